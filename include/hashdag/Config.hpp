@@ -45,14 +45,15 @@ template <std::unsigned_integral Word> struct Config {
 	inline Word GetTotalPages() const { return GetTotalBuckets() << page_bits_per_bucket; }
 	inline Word GetTotalWords() const { return GetTotalBuckets() << (word_bits_per_page + page_bits_per_bucket); }
 
-	inline static bool Validate(const Config &config) {
+	// reserved_pointer_bits: the top bits of a node pointer that are not part of the address (3 for MirrorNodePool)
+	inline static bool Validate(const Config &config, Word reserved_pointer_bits = 0) {
 		if (config.word_bits_per_page < kMinWordBitsPerPage)
 			return false;
 		uint64_t bucket_count = 0;
 		for (Word c : config.bucket_bits_each_level)
 			bucket_count += 1ULL << c;
 		uint64_t total_words = bucket_count * config.GetWordsPerBucket();
-		return total_words - 1 <= uint64_t(Word(-2));
+		return total_words - 1 <= uint64_t(Word(Word(-1) >> reserved_pointer_bits) - Word(1));
 	}
 };
 
@@ -0,0 +1,42 @@
+//
+// Created by adamyuan on 6/9/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_ITERATOR_HPP
+#define VKHASHDAG_ITERATOR_HPP
+
+#include "Config.hpp"
+#include "NodeCoord.hpp"
+#include "NodePointer.hpp"
+#include <concepts>
+#include <cstdint>
+#include <span>
+
+namespace hashdag {
+
+enum class IterateType { kStop, kProceed };
+
+// Read-only visitor of every (non-null) node occurrence under a root
+// IterateLeaf() gets the 64 voxel bits of a leaf, bit i is the voxel at coord.GetLeafCoord(i)
+template <typename T, typename Word>
+concept Iterator = requires(T e) {
+	{ e.IterateNode(Config<Word>{}, NodeCoord<Word>{}, NodePointer<Word>{}) } -> std::convertible_to<IterateType>;
+	e.IterateLeaf(Config<Word>{}, NodeCoord<Word>{}, uint64_t{});
+} && std::unsigned_integral<Word>;
+
+// Visitor whose result only depends on the subtree, so that each shared node is visited once
+// IterateNode() gets the results of the 8 children, the results of null children (not in child_mask) are Result{}
+template <typename T, typename Word>
+concept MemoIterator = requires(const T ce) {
+	typename T::Result;
+	{ ce.IterateLeaf(Config<Word>{}, uint64_t{}) } -> std::convertible_to<typename T::Result>;
+	{
+		ce.IterateNode(Config<Word>{}, Word{} /* level */, Word{} /* child_mask */,
+		               std::declval<std::span<const typename T::Result, 8>>())
+	} -> std::convertible_to<typename T::Result>;
+} && std::default_initializable<typename T::Result> && std::unsigned_integral<Word>;
+
+} // namespace hashdag
+
+#endif // VKHASHDAG_ITERATOR_HPP
@@ -11,6 +11,7 @@
 #include "NodeCoord.hpp"
 #include "NodePointer.hpp"
 
+#include <algorithm>
 #include <array>
 #include <bit>
 #include <concepts>
@@ -37,6 +38,15 @@ concept ThreadedNodePool = NodePool<T, Word> && requires(T e, const T ce) {
 template <typename T, typename Word>
 concept GCNodePool = NodePool<T, Word> && requires(T e) { e.FreePage(Word{} /* Page Index */); };
 
+// A RebucketNodePool can grow its bucket and page storage to a larger Config, existing pages must keep their indices
+template <typename T, typename Word>
+concept RebucketNodePool = GCNodePool<T, Word> && requires(T e) { e.ResizeBuckets(Config<Word>{}); };
+
+// Nodes of a MirrorNodePool are canonicalized under the 8 axis mirrors, the top 3 bits of a node pointer hold the
+// mirror to apply to the stored node
+template <typename T, typename Word>
+concept MirrorNodePool = NodePool<T, Word> && requires { requires bool(T::kMirrorNodes); };
+
 template <typename Derived, std::unsigned_integral Word> class NodePoolBase {
 #ifndef HASHDAG_TEST
 private:
@@ -46,6 +56,11 @@ public:
 
 	template <typename, std::unsigned_integral> friend class NodePoolTraversal;
 	template <typename, std::unsigned_integral> friend class NodePoolThreadedEdit;
+	template <typename, std::unsigned_integral> friend class NodePoolThreadedMesh;
+	template <typename, std::unsigned_integral> friend class NodePoolIterate;
+	template <std::unsigned_integral> friend class StaticDAG;
+	template <typename, std::unsigned_integral, template <typename, typename> typename>
+	friend class NodePoolVoxelCount;
 	template <typename, std::unsigned_integral, template <typename, typename> typename, template <typename> typename>
 	friend class NodePoolThreadedGC;
 
@@ -72,7 +87,88 @@ public:
 		return static_cast<Derived *>(this)->GetBucketRefWords(bucket_id);
 	}
 
+	// Mirror helpers, no-ops if Derived is not a MirrorNodePool
+	inline static constexpr Word kMirrorBits = 3, kMirrorShift = sizeof(Word) * 8 - kMirrorBits,
+	                             kAddressMask = (Word(1) << kMirrorShift) - Word(1);
+	inline static constexpr bool is_mirror_pool() { return MirrorNodePool<Derived, Word>; }
+	inline static constexpr Word get_node_address(Word node) {
+		if constexpr (is_mirror_pool())
+			return node & kAddressMask;
+		else
+			return node;
+	}
+	inline static constexpr Word get_node_mirror(Word node) {
+		if constexpr (is_mirror_pool())
+			return node >> kMirrorShift;
+		else
+			return 0;
+	}
+	inline static constexpr Word apply_node_mirror(Word node, Word mirror) {
+		if constexpr (is_mirror_pool())
+			return NodePointer<Word>{node} ? node ^ (mirror << kMirrorShift) : node;
+		else
+			return node;
+	}
+	// Permute 8 child bits so that bit i moves to bit (i ^ mirror)
+	inline static constexpr Word mirror_child_bits(Word bits, Word mirror) {
+		if (mirror & 1u)
+			bits = ((bits & 0x55u) << 1u) | ((bits >> 1u) & 0x55u);
+		if (mirror & 2u)
+			bits = ((bits & 0x33u) << 2u) | ((bits >> 2u) & 0x33u);
+		if (mirror & 4u)
+			bits = ((bits & 0x0Fu) << 4u) | ((bits >> 4u) & 0x0Fu);
+		return bits;
+	}
+	// Leaf voxel i = (hi << 3) | lo, a mirror flips the same axis bits in both octants
+	inline static constexpr uint64_t mirror_leaf_bits(uint64_t bits, Word mirror) {
+		constexpr uint64_t kMasks[6] = {0x5555555555555555ULL, 0x3333333333333333ULL, 0x0F0F0F0F0F0F0F0FULL,
+		                                0x00FF00FF00FF00FFULL, 0x0000FFFF0000FFFFULL, 0x00000000FFFFFFFFULL};
+		for (Word k = 0; k < 6; ++k)
+			if ((mirror >> (k % 3u)) & 1u)
+				bits = ((bits & kMasks[k]) << (1u << k)) | ((bits >> (1u << k)) & kMasks[k]);
+		return bits;
+	}
+	inline static std::array<Word, 9> mirror_unpacked_node(const std::array<Word, 9> &unpacked_node, Word mirror) {
+		std::array<Word, 9> mirrored_node;
+		mirrored_node[0] = mirror_child_bits(unpacked_node[0], mirror);
+		for (Word i = 0; i < 8; ++i)
+			mirrored_node[1 + (i ^ mirror)] = apply_node_mirror(unpacked_node[1 + i], mirror);
+		return mirrored_node;
+	}
+	// Mirror the node into its canonical form (the lexicographically smallest packed node), return the mirror applied
+	inline static Word make_canonical_unpacked_node(std::span<Word, 9> unpacked_node) {
+		std::array<Word, 9> src_node, best_node, best_packed_node;
+		std::copy(unpacked_node.begin(), unpacked_node.end(), src_node.begin());
+		std::span<const Word> best_span;
+		Word best_mirror = 0;
+		for (Word mirror = 0; mirror < 8; ++mirror) {
+			std::array<Word, 9> node = mirror_unpacked_node(src_node, mirror), packed_node = node;
+			std::span<const Word> span = get_packed_node_inplace(packed_node);
+			if (mirror == 0 || std::ranges::lexicographical_compare(span, best_span)) {
+				best_node = node;
+				best_packed_node = packed_node;
+				best_span = {best_packed_node.data(), span.size()};
+				best_mirror = mirror;
+			}
+		}
+		std::copy(best_node.begin(), best_node.end(), unpacked_node.begin());
+		return best_mirror;
+	}
+	inline static uint64_t get_leaf_bits(std::span<const Word, Config<Word>::kWordsPerLeaf> leaf_span) {
+		uint64_t bits = 0;
+		for (Word i = 0; i < Config<Word>::kWordsPerLeaf; ++i)
+			bits |= uint64_t(leaf_span[i]) << (i * sizeof(Word) * 8u);
+		return bits;
+	}
+	inline static std::array<Word, Config<Word>::kWordsPerLeaf> get_leaf_words(uint64_t bits) {
+		std::array<Word, Config<Word>::kWordsPerLeaf> leaf;
+		for (Word i = 0; i < Config<Word>::kWordsPerLeaf; ++i)
+			leaf[i] = Word(bits >> (i * sizeof(Word) * 8u));
+		return leaf;
+	}
+
 	inline const Word *read_node(Word node) const {
+		node = get_node_address(node);
 		return read_page(node >> m_config.word_bits_per_page) + (node & (m_config.GetWordsPerPage() - 1u));
 	}
 
@@ -228,13 +324,32 @@ public:
 	template <bool ThreadSafe>
 	inline NodePointer<Word> upsert_inner_node(Word level, std::span<const Word> node_span,
 	                                           NodePointer<Word> fallback_ptr) {
-		return upsert_node<ThreadSafe>(get_inner_node_words, level, node_span, fallback_ptr);
+		if constexpr (is_mirror_pool()) {
+			std::array<Word, 9> unpacked_node = get_unpacked_node_array(node_span);
+			Word mirror = make_canonical_unpacked_node(unpacked_node);
+			NodePointer<Word> node_ptr = upsert_node<ThreadSafe>(
+			    get_inner_node_words, level, get_packed_node_inplace(unpacked_node), NodePointer<Word>::Null());
+			return node_ptr ? NodePointer<Word>{apply_node_mirror(*node_ptr, mirror)} : fallback_ptr;
+		} else
+			return upsert_node<ThreadSafe>(get_inner_node_words, level, node_span, fallback_ptr);
 	}
 	template <bool ThreadSafe>
 	inline NodePointer<Word> upsert_leaf(Word level, std::span<const Word, Config<Word>::kWordsPerLeaf> leaf_span,
 	                                     NodePointer<Word> fallback_ptr) {
 		const auto get_node_words = [](auto) { return Config<Word>::kWordsPerLeaf; };
-		return upsert_node<ThreadSafe>(get_node_words, level, leaf_span, fallback_ptr);
+		if constexpr (is_mirror_pool()) {
+			uint64_t bits = get_leaf_bits(leaf_span), best_bits = bits;
+			Word best_mirror = 0;
+			for (Word mirror = 1; mirror < 8; ++mirror)
+				if (uint64_t mirrored_bits = mirror_leaf_bits(bits, mirror); mirrored_bits < best_bits)
+					best_bits = mirrored_bits, best_mirror = mirror;
+			auto leaf = get_leaf_words(best_bits);
+			NodePointer<Word> leaf_ptr = upsert_node<ThreadSafe>(
+			    get_node_words, level, std::span<const Word, Config<Word>::kWordsPerLeaf>{leaf},
+			    NodePointer<Word>::Null());
+			return leaf_ptr ? NodePointer<Word>{apply_node_mirror(*leaf_ptr, best_mirror)} : fallback_ptr;
+		} else
+			return upsert_node<ThreadSafe>(get_node_words, level, leaf_span, fallback_ptr);
 	}
 
 	inline void make_filled_node_pointers() {
@@ -253,7 +368,8 @@ public:
 		if (m_config.GetNodeLevels() == 1)
 			return;
 
-		for (Word l = m_config.GetNodeLevels() - 2u; ~l; --l) {
+		// Stop at a saturated bucket, otherwise Null children would be stored
+		for (Word l = m_config.GetNodeLevels() - 2u; ~l && m_filled_node_pointers[l + 1]; --l) {
 			Word prev_node = *m_filled_node_pointers[l + 1];
 			std::array<Word, 9> node = {0xFFu,     prev_node, prev_node, prev_node, prev_node,
 			                            prev_node, prev_node, prev_node, prev_node};
@@ -288,8 +404,16 @@ public:
 			        *NodePointer<Word>::Null()};
 
 		const Word *p_node = read_node(*node_ptr);
-		Word child_mask = *p_node;
-		const Word *p_next_child = p_node + 1;
+		std::array<Word, 9> unpacked_node =
+		    get_unpacked_node_array(std::span<const Word>{p_node, get_inner_node_words(p_node)});
+		if constexpr (is_mirror_pool())
+			return mirror_unpacked_node(unpacked_node, get_node_mirror(*node_ptr));
+		else
+			return unpacked_node;
+	}
+	inline static std::array<Word, 9> get_unpacked_node_array(std::span<const Word> node_span) {
+		Word child_mask = node_span.front();
+		const Word *p_next_child = node_span.data() + 1;
 
 		std::array<Word, 9> unpacked_node = {
 		    child_mask,
@@ -313,7 +437,10 @@ public:
 		const Word *p_leaf = read_node(*leaf_ptr);
 		std::array<Word, Config<Word>::kWordsPerLeaf> leaf;
 		std::copy(p_leaf, p_leaf + Config<Word>::kWordsPerLeaf, leaf.data());
-		return leaf;
+		if constexpr (is_mirror_pool())
+			return get_leaf_words(mirror_leaf_bits(get_leaf_bits(leaf), get_node_mirror(*leaf_ptr)));
+		else
+			return leaf;
 	}
 
 	template <bool ThreadSafe>
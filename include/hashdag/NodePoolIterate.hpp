@@ -0,0 +1,184 @@
+//
+// Created by adamyuan on 6/9/24.
+//
+
+// NodePool Iterate, serial or with libfork
+
+#pragma once
+#ifndef VKHASHDAG_NODEPOOLITERATE_HPP
+#define VKHASHDAG_NODEPOOLITERATE_HPP
+
+#include "Iterator.hpp"
+#include "NodePool.hpp"
+
+#include <algorithm>
+#include <libfork/schedule/busy_pool.hpp>
+#include <libfork/task.hpp>
+#include <vector>
+
+namespace hashdag {
+
+template <typename Derived, std::unsigned_integral Word> class NodePoolIterate {
+private:
+	inline static constexpr std::size_t kTaskNodes = 64;
+
+	inline const auto &get_node_pool() const {
+		return *static_cast<const NodePoolBase<Derived, Word> *>(static_cast<const Derived *>(this));
+	}
+	inline const Config<Word> &get_config() const { return get_node_pool().m_config; }
+	inline bool is_leaf_level(Word level) const { return level == get_config().GetNodeLevels() - 1; }
+	inline uint64_t get_leaf_bits(NodePointer<Word> leaf_ptr) const {
+		return NodePoolBase<Derived, Word>::get_leaf_bits(get_node_pool().get_leaf_array(leaf_ptr));
+	}
+
+	template <Iterator<Word> Iterator_T>
+	inline void iterate_node(Iterator_T *p_iterator, NodePointer<Word> node_ptr, const NodeCoord<Word> &coord) const {
+		if (!node_ptr || p_iterator->IterateNode(get_config(), coord, node_ptr) == IterateType::kStop)
+			return;
+		if (is_leaf_level(coord.level)) {
+			p_iterator->IterateLeaf(get_config(), coord, get_leaf_bits(node_ptr));
+			return;
+		}
+		auto unpacked_node = get_node_pool().get_unpacked_node_array(node_ptr);
+		for (Word i = 0; i < 8; ++i)
+			iterate_node(p_iterator, NodePointer<Word>{unpacked_node[1 + i]}, coord.GetChildCoord(i));
+	}
+
+	template <lf::context Context, Iterator<Word> Iterator_T>
+	inline lf::basic_task<void, Context> lf_iterate_node(Iterator_T *p_iterator, NodePointer<Word> node_ptr,
+	                                                     NodeCoord<Word> coord, Word max_task_level) const {
+		if (coord.level >= max_task_level || is_leaf_level(coord.level)) {
+			iterate_node(p_iterator, node_ptr, coord);
+			co_return;
+		}
+		if (p_iterator->IterateNode(get_config(), coord, node_ptr) == IterateType::kStop)
+			co_return;
+
+		auto unpacked_node = get_node_pool().get_unpacked_node_array(node_ptr);
+		Word fork_count = 0;
+		std::array<Word, 8> fork_indices;
+		for (Word i = 0; i < 8; ++i)
+			if (NodePointer<Word>{unpacked_node[1 + i]})
+				fork_indices[fork_count++] = i;
+		for (Word f = 0; f < fork_count; ++f) {
+			Word i = fork_indices[f];
+			if (f + 1 == fork_count)
+				co_await lf_iterate_node<Context>(p_iterator, NodePointer<Word>{unpacked_node[1 + i]},
+				                                  coord.GetChildCoord(i), max_task_level);
+			else
+				co_await lf_iterate_node<Context>(p_iterator, NodePointer<Word>{unpacked_node[1 + i]},
+				                                  coord.GetChildCoord(i), max_task_level)
+				    .fork();
+		}
+		co_await lf::join();
+	}
+
+	// Unique (mirrored) node pointers at each level, sorted so that children are found by binary search
+	inline std::vector<std::vector<Word>> get_level_nodes(NodePointer<Word> root_ptr) const {
+		std::vector<std::vector<Word>> level_nodes(get_config().GetNodeLevels());
+		level_nodes[0].push_back(*root_ptr);
+		for (Word level = 0; level + 1 < get_config().GetNodeLevels(); ++level) {
+			auto &child_nodes = level_nodes[level + 1];
+			for (Word node : level_nodes[level]) {
+				auto unpacked_node = get_node_pool().get_unpacked_node_array(NodePointer<Word>{node});
+				for (Word i = 0; i < 8; ++i)
+					if (NodePointer<Word>{unpacked_node[1 + i]})
+						child_nodes.push_back(unpacked_node[1 + i]);
+			}
+			std::sort(child_nodes.begin(), child_nodes.end());
+			child_nodes.erase(std::unique(child_nodes.begin(), child_nodes.end()), child_nodes.end());
+		}
+		return level_nodes;
+	}
+	template <MemoIterator<Word> Iterator_T>
+	inline typename Iterator_T::Result memo_iterate_node(const Iterator_T &iterator, Word level, Word node,
+	                                                     std::span<const Word> child_nodes,
+	                                                     std::span<const typename Iterator_T::Result> child_results) const {
+		if (is_leaf_level(level))
+			return iterator.IterateLeaf(get_config(), get_leaf_bits(NodePointer<Word>{node}));
+		auto unpacked_node = get_node_pool().get_unpacked_node_array(NodePointer<Word>{node});
+		std::array<typename Iterator_T::Result, 8> results{};
+		Word child_mask = 0;
+		for (Word i = 0; i < 8; ++i) {
+			if (!NodePointer<Word>{unpacked_node[1 + i]})
+				continue;
+			child_mask |= 1u << i;
+			results[i] = child_results[std::lower_bound(child_nodes.begin(), child_nodes.end(), unpacked_node[1 + i]) -
+			                           child_nodes.begin()];
+		}
+		return iterator.IterateNode(get_config(), level, child_mask, std::span<const typename Iterator_T::Result, 8>{results});
+	}
+	template <lf::context Context, MemoIterator<Word> Iterator_T>
+	inline lf::basic_task<void, Context>
+	lf_memo_iterate_nodes(const Iterator_T *p_iterator, Word level, std::span<const Word> nodes,
+	                      std::span<typename Iterator_T::Result> results, std::span<const Word> child_nodes,
+	                      std::span<const typename Iterator_T::Result> child_results) const {
+		if (nodes.size() <= kTaskNodes) {
+			for (std::size_t i = 0; i < nodes.size(); ++i)
+				results[i] = memo_iterate_node(*p_iterator, level, nodes[i], child_nodes, child_results);
+			co_return;
+		}
+		std::size_t half = nodes.size() >> 1u;
+		co_await lf_memo_iterate_nodes<Context>(p_iterator, level, nodes.first(half), results.first(half), child_nodes,
+		                                        child_results)
+		    .fork();
+		co_await lf_memo_iterate_nodes<Context>(p_iterator, level, nodes.subspan(half), results.subspan(half),
+		                                        child_nodes, child_results);
+		co_await lf::join();
+	}
+	template <MemoIterator<Word> Iterator_T>
+	inline typename Iterator_T::Result memo_iterate(lf::busy_pool *p_lf_pool, NodePointer<Word> root_ptr,
+	                                                const Iterator_T &iterator) const {
+		using Result = typename Iterator_T::Result;
+		if (!root_ptr)
+			return Result{};
+
+		auto level_nodes = get_level_nodes(root_ptr);
+		std::vector<Result> results, child_results;
+		for (Word level = get_config().GetNodeLevels() - 1; ~level; --level) {
+			const auto &nodes = level_nodes[level];
+			std::span<const Word> child_nodes =
+			    is_leaf_level(level) ? std::span<const Word>{} : std::span<const Word>{level_nodes[level + 1]};
+			results.resize(nodes.size());
+			if (p_lf_pool)
+				p_lf_pool->schedule(lf_memo_iterate_nodes<lf::busy_pool::context>(&iterator, level, nodes, results,
+				                                                                  child_nodes, child_results));
+			else
+				for (std::size_t i = 0; i < nodes.size(); ++i)
+					results[i] = memo_iterate_node(iterator, level, nodes[i], child_nodes, child_results);
+			std::swap(results, child_results);
+		}
+		return child_results[0];
+	}
+
+public:
+	inline NodePoolIterate() { static_assert(std::is_base_of_v<NodePoolBase<Derived, Word>, Derived>); }
+
+	// Visit the nodes under root_ptr depth-first in child index order
+	template <Iterator<Word> Iterator_T> inline void Iterate(NodePointer<Word> root_ptr, Iterator_T *p_iterator) const {
+		iterate_node(p_iterator, root_ptr, {});
+	}
+	// Iterate() with subtrees above max_task_level forked, the iterator is called concurrently
+	template <Iterator<Word> Iterator_T>
+	inline void ThreadedIterate(lf::busy_pool *p_lf_pool, NodePointer<Word> root_ptr, Iterator_T *p_iterator,
+	                            Word max_task_level = -1) const {
+		if (root_ptr)
+			p_lf_pool->schedule(lf_iterate_node<lf::busy_pool::context>(p_iterator, root_ptr, {}, max_task_level));
+	}
+
+	// The result of root_ptr, each unique (mirrored) node is visited once, Result{} for a null root
+	template <MemoIterator<Word> Iterator_T>
+	inline typename Iterator_T::Result MemoIterate(NodePointer<Word> root_ptr, const Iterator_T &iterator) const {
+		return memo_iterate(nullptr, root_ptr, iterator);
+	}
+	// MemoIterate() with the nodes of a level visited in parallel, the iterator is called concurrently
+	template <MemoIterator<Word> Iterator_T>
+	inline typename Iterator_T::Result ThreadedMemoIterate(lf::busy_pool *p_lf_pool, NodePointer<Word> root_ptr,
+	                                                       const Iterator_T &iterator) const {
+		return memo_iterate(p_lf_pool, root_ptr, iterator);
+	}
+};
+
+} // namespace hashdag
+
+#endif // VKHASHDAG_NODEPOOLITERATE_HPP
@@ -9,8 +9,11 @@
 #include "NodePool.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <libfork/schedule/busy_pool.hpp>
 #include <libfork/task.hpp>
+#include <optional>
 #include <vector>
 
 namespace hashdag {
@@ -47,7 +50,7 @@ private:
 					const Word *p_next_child = p_node + 1;
 
 					for (; child_mask; child_mask &= (child_mask - 1)) {
-						Word child = *(p_next_child++);
+						Word child = get_node_pool().get_node_address(*(p_next_child++));
 						if (worker_node_set.count(child))
 							continue;
 						worker_node_set.insert(child);
@@ -62,12 +65,13 @@ private:
 		co_return;
 	}
 
-	inline std::pair<Word, Word> get_level_loop_bits(Word level) const {
-		Word bucket_bits = get_config().bucket_bits_each_level[level];
+	inline std::pair<Word, Word> get_level_loop_bits(const Config<Word> &config, Word level) const {
+		Word bucket_bits = config.bucket_bits_each_level[level];
 		Word loop_bits = std::min(m_parallel_bits, bucket_bits);
 		Word block_bits = bucket_bits - loop_bits;
 		return {loop_bits, block_bits};
 	}
+	inline std::pair<Word, Word> get_level_loop_bits(Word level) const { return get_level_loop_bits(get_config(), level); }
 
 	template <lf::context Context>
 	inline lf::basic_task<void, Context> lf_gc_forward_pass(std::vector<Word> root_nodes) {
@@ -83,7 +87,6 @@ private:
 		for (Word level = 0; level < get_config().GetNodeLevels(); ++level) {
 			auto [loop_bits, block_bits] = get_level_loop_bits(level);
 			Word bucket_base = get_bucket_base(level);
-			bool leaf = level == get_config().GetNodeLevels() - 1;
 
 			for (HashSet<Word> &node_set : worker_node_sets)
 				node_set.clear();
@@ -102,15 +105,17 @@ private:
 		co_return;
 	}
 
+	// Re-hash nodes into the destination bucket caches, leaves are only re-hashed when their level is relocated
 	template <lf::context Context>
 	inline lf::basic_task<void, Context>
-	lf_gc_shrink_inner_bucket(Word level, std::span<std::vector<Word>> bucket_nodes,
-	                          std::span<const HashMap<Word, Word>> child_node_tables,
-	                          HashMap<Word, Word> *p_node_table) {
+	lf_gc_rehash_bucket(Word level, std::span<std::vector<Word>> bucket_nodes,
+	                    std::span<const HashMap<Word, Word>> child_node_tables, HashMap<Word, Word> *p_node_table) {
 		const Config<Word> &config = get_node_pool().m_config;
 
-		Word bucket_base = get_bucket_base(level), child_bucket_base = get_bucket_base(level + 1);
-		auto [_, child_block_bits] = get_level_loop_bits(level + 1);
+		bool leaf = level == config.GetNodeLevels() - 1;
+		Word bucket_base = m_dst_bucket_level_bases[level];
+		Word child_bucket_base = leaf ? 0 : get_bucket_base(level + 1);
+		Word child_block_bits = leaf ? 0 : get_level_loop_bits(level + 1).second;
 
 		std::array<Word, 9> node_cache;
 
@@ -133,23 +138,38 @@ private:
 
 					Word node_page_offset = node & (config.GetWordsPerPage() - 1u);
 					const Word *p_node = page + node_page_offset;
-					Word node_words = get_node_pool().get_inner_node_words(p_node);
+					Word node_words = leaf ? Config<Word>::kWordsPerLeaf : get_node_pool().get_inner_node_words(p_node);
 					std::copy(p_node, p_node + node_words, node_cache.data());
 					node_span = {node_cache.data(), node_words};
 				}
 
 				// Alter child pointer and Re-Hash
-				for (Word i = 1; i < node_span.size(); ++i) {
-					Word child_bucket_slot = (node_span[i] >> config.GetWordBitsPerBucket()) - child_bucket_base;
-					node_span[i] = child_node_tables[child_bucket_slot >> child_block_bits].at(node_span[i]);
+				for (Word i = 1; !leaf && i < node_span.size(); ++i) {
+					Word child = get_node_pool().get_node_address(node_span[i]);
+					Word child_bucket_slot = (child >> config.GetWordBitsPerBucket()) - child_bucket_base;
+					node_span[i] = get_node_pool().apply_node_mirror(
+					    child_node_tables[child_bucket_slot >> child_block_bits].at(child),
+					    get_node_pool().get_node_mirror(node_span[i]));
 				}
 
-				const Word new_bucket = bucket_base + (typename Derived::WordSpanHasher{}(node_span) &
-				                                       (config.GetBucketsAtLevel(level) - 1));
+				// Mirrored children might alter the canonical form
+				Word mirror = 0;
+				if (NodePoolBase<Derived, Word>::is_mirror_pool() && !leaf) {
+					std::array<Word, 9> unpacked_node = get_node_pool().get_unpacked_node_array(node_span);
+					mirror = get_node_pool().make_canonical_unpacked_node(unpacked_node);
+					std::span<const Word> packed_span = get_node_pool().get_packed_node_inplace(unpacked_node);
+					std::copy(packed_span.begin(), packed_span.end(), node_span.begin());
+				}
+
+				const Word hash = typename Derived::WordSpanHasher{}(node_span);
 
 				// Write to bucket cache
-				Word new_node;
-				{
+				// Re-hashed nodes might overflow a bucket, then following buckets are probed (such nodes can't be
+				// found by later upserts, which only loses some sharing)
+				Word new_node = -1;
+				for (Word probe = 0; probe < m_dst_config.GetBucketsAtLevel(level); ++probe) {
+					const Word new_bucket = bucket_base + ((hash + probe) & (m_dst_config.GetBucketsAtLevel(level) - 1));
+
 					std::unique_lock lock{get_node_pool().get_bucket_ref_mutex(new_bucket)};
 
 					std::vector<Word> &bucket_cache = m_bucket_caches[new_bucket - bucket_base];
@@ -158,20 +178,29 @@ private:
 					Word page_slot = bucket_cache_offset >> config.word_bits_per_page; // PageID in bucket
 					Word page_offset = bucket_cache_offset & (config.GetWordsPerPage() - 1);
 
-					if (page_offset + node_span.size() > config.GetWordsPerPage()) {
+					if (page_offset + node_span.size() > config.GetWordsPerPage())
 						bucket_cache_offset = (page_slot + 1) << config.word_bits_per_page;
-						bucket_cache.resize(bucket_cache_offset + node_span.size());
-						std::copy(node_span.begin(), node_span.end(), bucket_cache.begin() + bucket_cache_offset);
-					} else
-						bucket_cache.insert(bucket_cache.end(), node_span.begin(), node_span.end());
+					if (bucket_cache_offset + node_span.size() > config.GetWordsPerBucket())
+						continue;
+
+					bucket_cache.resize(bucket_cache_offset);
+					bucket_cache.insert(bucket_cache.end(), node_span.begin(), node_span.end());
 
 					lock.unlock();
 
 					new_node = (new_bucket << config.GetWordBitsPerBucket()) | bucket_cache_offset;
+					break;
+				}
+
+				// Every bucket of the level is full, the node is lost
+				if (new_node == Word(-1)) {
+					m_rehash_overflow.store(true, std::memory_order_relaxed);
+					(*p_node_table)[node] = new_node;
+					continue;
 				}
 
 				// Update Node Map
-				(*p_node_table)[node] = new_node;
+				(*p_node_table)[node] = get_node_pool().apply_node_mirror(new_node, mirror);
 			}
 
 			nodes.clear();
@@ -185,7 +214,7 @@ private:
 		const Config<Word> &config = get_node_pool().m_config;
 
 		const auto get_upper_page_slot = [&config](Word words) {
-			return (words >> config.word_bits_per_page) + (words & (config.GetWordsPerPage() - 1)) ? 1u : 0u;
+			return (words >> config.word_bits_per_page) + ((words & (config.GetWordsPerPage() - 1)) ? 1u : 0u);
 		};
 
 		Word base_page_index = bucket << config.page_bits_per_bucket;
@@ -286,9 +315,11 @@ private:
 
 			auto [loop_bits, block_bits] = get_level_loop_bits(level);
 			Word bucket_base = get_bucket_base(level);
+			bool relocate = bucket_base != m_dst_bucket_level_bases[level] ||
+			                config.bucket_bits_each_level[level] != m_dst_config.bucket_bits_each_level[level];
 
-			// Leaf
-			if (level == config.GetNodeLevels() - 1) {
+			// Leaf (in-place if not relocated)
+			if (level == config.GetNodeLevels() - 1 && !relocate) {
 				for (Word i = 0; i < (1u << loop_bits); ++i) {
 					Word first_bucket = bucket_base + (i << block_bits);
 					std::span<std::vector<Word>> src_bucket_nodes = {m_bucket_nodes.data() + first_bucket,
@@ -314,21 +345,24 @@ private:
 					                                                 (1u << block_bits)};
 
 					if (i + 1 == (1u << loop_bits))
-						co_await lf_gc_shrink_inner_bucket<Context>(level, src_bucket_nodes, child_node_tables,
-						                                            cur_node_tables.data() + i);
+						co_await lf_gc_rehash_bucket<Context>(level, src_bucket_nodes, child_node_tables,
+						                                      cur_node_tables.data() + i);
 					else
-						co_await lf_gc_shrink_inner_bucket<Context>(level, src_bucket_nodes, child_node_tables,
-						                                            cur_node_tables.data() + i)
+						co_await lf_gc_rehash_bucket<Context>(level, src_bucket_nodes, child_node_tables,
+						                                      cur_node_tables.data() + i)
 						    .fork();
 				}
 				co_await lf::join();
 
-				for (Word i = 0; i < (1u << loop_bits); ++i) {
-					Word first_bucket = bucket_base + (i << block_bits);
-					std::span<std::vector<Word>> bucket_caches = {m_bucket_caches.data() + (i << block_bits),
-					                                              (1u << block_bits)};
+				// All nodes of the level are read before flushing, so a relocated level can overwrite the pages of
+				// its source and child levels
+				auto [dst_loop_bits, dst_block_bits] = get_level_loop_bits(m_dst_config, level);
+				for (Word i = 0; i < (1u << dst_loop_bits); ++i) {
+					Word first_bucket = m_dst_bucket_level_bases[level] + (i << dst_block_bits);
+					std::span<std::vector<Word>> bucket_caches = {m_bucket_caches.data() + (i << dst_block_bits),
+					                                              (1u << dst_block_bits)};
 
-					if (i + 1 == (1u << loop_bits))
+					if (i + 1 == (1u << dst_loop_bits))
 						co_await lf_gc_flush_inner_bucket<Context>(first_bucket, bucket_caches);
 					else
 						co_await lf_gc_flush_inner_bucket<Context>(first_bucket, bucket_caches).fork();
@@ -338,19 +372,22 @@ private:
 
 			if (level == 0) {
 				for (auto &root_ptr : root_ptrs)
-					if (root_ptr)
-						root_ptr = NodePointer<Word>(
-						    cur_node_tables[*root_ptr >> (config.GetWordBitsPerBucket() + block_bits)].at(*root_ptr));
+					if (root_ptr) {
+						Word root = get_node_pool().get_node_address(*root_ptr);
+						root_ptr = NodePointer<Word>(get_node_pool().apply_node_mirror(
+						    cur_node_tables[root >> (config.GetWordBitsPerBucket() + block_bits)].at(root),
+						    get_node_pool().get_node_mirror(*root_ptr)));
+					}
 			}
 		}
 
 		co_return;
 	}
 
-	inline Word get_max_level_buckets() const {
+	inline static Word get_max_level_buckets(const Config<Word> &config) {
 		Word max_level_buckets = 0;
-		for (Word level = 0; level < get_node_pool().m_config.GetNodeLevels(); ++level)
-			max_level_buckets = std::max(max_level_buckets, get_node_pool().m_config.GetBucketsAtLevel(level));
+		for (Word level = 0; level < config.GetNodeLevels(); ++level)
+			max_level_buckets = std::max(max_level_buckets, config.GetBucketsAtLevel(level));
 		return max_level_buckets;
 	}
 
@@ -359,48 +396,99 @@ private:
 		roots.reserve(root_ptrs.size() + 1);
 		// Preserve root for filled nodes
 		if (!get_node_pool().m_filled_node_pointers.empty() && get_node_pool().m_filled_node_pointers.front())
-			roots.push_back(*get_node_pool().m_filled_node_pointers.front());
+			roots.push_back(get_node_pool().get_node_address(*get_node_pool().m_filled_node_pointers.front()));
 
 		// Push Non-Null roots
 		for (NodePointer<Word> root_ptr : root_ptrs)
 			if (root_ptr)
-				roots.push_back(*root_ptr);
+				roots.push_back(get_node_pool().get_node_address(*root_ptr));
 
 		return roots;
 	}
 
-	inline void gc_threaded(lf::busy_pool *p_lf_pool, std::span<NodePointer<Word>> root_ptrs) {
+	// Returns false if a level overflowed while re-hashing, the pool is then left invalid
+	inline bool gc_threaded(lf::busy_pool *p_lf_pool, std::span<NodePointer<Word>> root_ptrs) {
 		m_parallel_bits = std::bit_width(p_lf_pool->get_worker_count()) << 1u;
+		m_rehash_overflow.store(false, std::memory_order_relaxed);
 
 		p_lf_pool->schedule(lf_gc_forward_pass<lf::busy_pool::context>(gc_make_root_nodes(root_ptrs)));
 		p_lf_pool->schedule(lf_gc_backward_pass<lf::busy_pool::context>(root_ptrs));
+		// Switch to the destination layout if rebucketed
+		if (m_dst_config.bucket_bits_each_level != get_config().bucket_bits_each_level) {
+			get_node_pool().m_config = m_dst_config;
+			get_node_pool().m_bucket_level_bases = m_dst_bucket_level_bases;
+			m_bucket_nodes.resize(m_dst_config.GetTotalBuckets());
+		}
 		// Re-initialize filled node pointers if altered
 		if (!get_node_pool().m_filled_node_pointers.empty()) {
 			get_node_pool().m_filled_node_pointers.clear();
 			get_node_pool().make_filled_node_pointers();
 		}
+		return !m_rehash_overflow.load(std::memory_order_relaxed);
 	}
 
 	Word m_parallel_bits = -1;
 	std::vector<std::vector<Word>> m_bucket_nodes, m_bucket_caches;
+	// Bucket layout written by the backward pass, differs from the pool's layout only during a rebucket
+	Config<Word> m_dst_config;
+	std::vector<Word> m_dst_bucket_level_bases;
+	std::atomic_bool m_rehash_overflow{false};
 
 public:
 	inline NodePoolThreadedGC() {
 		static_assert(std::is_base_of_v<NodePoolBase<Derived, Word>, Derived>);
 		m_bucket_nodes.resize(get_config().GetTotalBuckets());
-		m_bucket_caches.resize(get_max_level_buckets());
+		m_bucket_caches.resize(get_max_level_buckets(get_config()));
+		m_dst_config = get_config();
+		m_dst_bucket_level_bases = get_node_pool().m_bucket_level_bases;
 	}
 
+	// The nodes only shrink in the same layout, so no level can overflow
 	inline NodePointer<Word> ThreadedGC(lf::busy_pool *p_lf_pool, NodePointer<Word> root_ptr) {
-		gc_threaded(p_lf_pool, std::span<NodePointer<Word>>{&root_ptr, 1});
+		[[maybe_unused]] bool ok = gc_threaded(p_lf_pool, std::span<NodePointer<Word>>{&root_ptr, 1});
+		assert(ok);
 		return root_ptr;
 	}
 
 	inline std::vector<NodePointer<Word>> ThreadedGC(lf::busy_pool *p_lf_pool,
 	                                                 std::vector<NodePointer<Word>> root_ptrs) {
-		gc_threaded(p_lf_pool, root_ptrs);
+		[[maybe_unused]] bool ok = gc_threaded(p_lf_pool, root_ptrs);
+		assert(ok);
 		return std::move(root_ptrs);
 	}
+
+	// Double the bucket count of a saturated level, all nodes are re-hashed into the new layout like in ThreadedGC
+	// (garbage is collected as well); returns std::nullopt if the new layout exceeds the node pointer range, or if a
+	// level overflows while re-hashing, in which case the pool is invalid
+	inline std::optional<std::vector<NodePointer<Word>>>
+	ThreadedRebucket(lf::busy_pool *p_lf_pool, Word level, std::vector<NodePointer<Word>> root_ptrs)
+	    requires RebucketNodePool<Derived, Word>
+	{
+		Config<Word> dst_config = get_config();
+		if (level >= dst_config.GetNodeLevels())
+			return std::nullopt;
+		++dst_config.bucket_bits_each_level[level];
+		if (!Config<Word>::Validate(dst_config,
+		                            NodePoolBase<Derived, Word>::is_mirror_pool() ? NodePoolBase<Derived, Word>::kMirrorBits
+		                                                                          : 0))
+			return std::nullopt;
+
+		static_cast<Derived *>(this)->ResizeBuckets(dst_config);
+		m_bucket_caches.resize(get_max_level_buckets(dst_config));
+		m_dst_bucket_level_bases = dst_config.GetLevelBaseBucketIndices();
+		m_dst_config = std::move(dst_config);
+
+		if (!gc_threaded(p_lf_pool, root_ptrs))
+			return std::nullopt;
+		return root_ptrs;
+	}
+	inline std::optional<NodePointer<Word>> ThreadedRebucket(lf::busy_pool *p_lf_pool, Word level,
+	                                                         NodePointer<Word> root_ptr)
+	    requires RebucketNodePool<Derived, Word>
+	{
+		auto opt_root_ptrs = ThreadedRebucket(p_lf_pool, level, std::vector<NodePointer<Word>>{root_ptr});
+		return opt_root_ptrs ? std::optional{opt_root_ptrs->front()} : std::nullopt;
+	}
 };
 
 } // namespace hashdag
@@ -0,0 +1,325 @@
+//
+// Created by adamyuan on 6/8/24.
+//
+
+// Greedy surface meshing of DAG regions with libfork
+
+#pragma once
+#ifndef VKHASHDAG_NODEPOOLTHREADEDMESH_HPP
+#define VKHASHDAG_NODEPOOLTHREADEDMESH_HPP
+
+#include "NodePool.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <glm/glm.hpp>
+#include <libfork/schedule/busy_pool.hpp>
+#include <libfork/task.hpp>
+#include <vector>
+
+namespace hashdag {
+
+// Indexed triangle mesh of a chunk, positions are voxel corners in the whole volume
+template <std::unsigned_integral Word> struct SurfaceMesh {
+	std::vector<glm::vec<3, Word>> positions;
+	std::vector<glm::i8vec3> normals;
+	std::vector<uint32_t> colors; // Per vertex, empty if meshed without colors
+	std::vector<uint32_t> indices;
+
+	inline bool Empty() const { return indices.empty(); }
+};
+
+template <typename Derived, std::unsigned_integral Word> class NodePoolThreadedMesh {
+private:
+	// A merged rectangle of faces in chunk coordinates, facing +axis or -axis
+	struct Quad {
+		Word axis, positive, depth, u, v, width, height;
+		uint32_t color;
+	};
+	// Voxels of a chunk with a border of 1 voxel, so that faces on the chunk boundary can be culled
+	struct Grid {
+		Word size, padded_size;
+		glm::vec<3, Word> chunk_lower;
+		std::vector<uint8_t> voxels;
+
+		inline std::size_t get_index(Word x, Word y, Word z) const {
+			return (std::size_t(x) * padded_size + y) * padded_size + z;
+		}
+		// Chunk coordinates in [-1, size]
+		inline bool Get(Word x, Word y, Word z) const { return voxels[get_index(x + 1u, y + 1u, z + 1u)]; }
+		inline bool GetFace(Word axis, Word depth, Word u, Word v, bool positive) const {
+			glm::vec<3, Word> p, q;
+			p[axis] = depth;
+			p[(axis + 1u) % 3u] = u;
+			p[(axis + 2u) % 3u] = v;
+			q = p;
+			q[axis] += positive ? Word(1) : Word(-1);
+			return Get(p.x, p.y, p.z) && !Get(q.x, q.y, q.z);
+		}
+	};
+
+	inline const auto &get_node_pool() const {
+		return *static_cast<const NodePoolBase<Derived, Word> *>(static_cast<const Derived *>(this));
+	}
+	inline const Config<Word> &get_config() const { return get_node_pool().m_config; }
+
+	inline bool is_filled_node(Word level, NodePointer<Word> node_ptr) const {
+		const auto &filled_node_pointers = get_node_pool().m_filled_node_pointers;
+		return level < filled_node_pointers.size() && filled_node_pointers[level] &&
+		       get_node_pool().get_node_address(*filled_node_pointers[level]) ==
+		           get_node_pool().get_node_address(*node_ptr);
+	}
+
+	// Mark the voxels of node_ptr inside [lower, upper)
+	inline void fill_grid(Word level, NodePointer<Word> node_ptr, const glm::vec<3, Word> &node_lower,
+	                      const glm::vec<3, Word> &lower, const glm::vec<3, Word> &upper, Grid *p_grid) const {
+		if (!node_ptr)
+			return;
+		Word voxel_bits = get_config().GetVoxelLevel() - level;
+		glm::vec<3, Word> node_upper = node_lower + (Word(1) << voxel_bits);
+		if (glm::any(glm::lessThanEqual(node_upper, lower)) || glm::any(glm::greaterThanEqual(node_lower, upper)))
+			return;
+
+		const auto set_voxel = [p_grid](const glm::vec<3, Word> &p) {
+			glm::vec<3, Word> g = p + Word(1) - p_grid->chunk_lower;
+			p_grid->voxels[p_grid->get_index(g.x, g.y, g.z)] = 1;
+		};
+
+		// Shared fully-filled subtrees are written without descending
+		if (is_filled_node(level, node_ptr)) {
+			glm::vec<3, Word> l = glm::max(node_lower, lower), u = glm::min(node_upper, upper);
+			for (Word x = l.x; x < u.x; ++x)
+				for (Word y = l.y; y < u.y; ++y)
+					for (Word z = l.z; z < u.z; ++z)
+						set_voxel({x, y, z});
+			return;
+		}
+		if (level == get_config().GetNodeLevels() - 1) {
+			uint64_t bits = NodePoolBase<Derived, Word>::get_leaf_bits(get_node_pool().get_leaf_array(node_ptr));
+			for (; bits; bits &= bits - 1u) {
+				glm::vec<3, Word> p =
+				    node_lower + NodeCoord<Word>{.level = 0, .pos = {}}.GetLeafCoord(std::countr_zero(bits)).pos;
+				if (glm::all(glm::greaterThanEqual(p, lower)) && glm::all(glm::lessThan(p, upper)))
+					set_voxel(p);
+			}
+			return;
+		}
+		auto unpacked_node = get_node_pool().get_unpacked_node_array(node_ptr);
+		for (Word i = 0; i < 8; ++i)
+			fill_grid(level + 1, NodePointer<Word>{unpacked_node[1 + i]},
+			          node_lower + (NodeCoord<Word>{.level = 0, .pos = {}}.GetChildCoord(i).pos << (voxel_bits - 1u)),
+			          lower, upper, p_grid);
+	}
+
+	inline Grid make_grid(Word chunk_level, const glm::vec<3, Word> &chunk_lower) const {
+		Word size = Word(1) << (get_config().GetVoxelLevel() - chunk_level);
+		return {.size = size,
+		        .padded_size = size + 2u,
+		        .chunk_lower = chunk_lower,
+		        .voxels = std::vector<uint8_t>(std::size_t(size + 2u) * (size + 2u) * (size + 2u))};
+	}
+
+	// Greedy merge the faces of a slice, faces only merge if they have the same color
+	template <bool Color, typename ColorFunc>
+	inline static void mesh_slice(const Grid &grid, Word axis, bool positive, Word depth, const ColorFunc &color_func,
+	                              std::vector<uint32_t> *p_mask, std::vector<Quad> *p_quads) {
+		Word size = grid.size;
+		auto &mask = *p_mask; // 0 for no face, otherwise color + 1 (or 1 without colors)
+		mask.assign(std::size_t(size) * size, 0);
+		bool any_face = false;
+		for (Word u = 0; u < size; ++u)
+			for (Word v = 0; v < size; ++v) {
+				if (!grid.GetFace(axis, depth, u, v, positive))
+					continue;
+				if constexpr (Color) {
+					glm::vec<3, Word> p;
+					p[axis] = depth;
+					p[(axis + 1u) % 3u] = u;
+					p[(axis + 2u) % 3u] = v;
+					mask[u * size + v] = uint32_t(color_func(grid.chunk_lower + p)) + 1u;
+				} else
+					mask[u * size + v] = 1u;
+				any_face = true;
+			}
+		if (!any_face)
+			return;
+
+		for (Word u = 0; u < size; ++u)
+			for (Word v = 0; v < size;) {
+				uint32_t key = mask[u * size + v];
+				if (!key) {
+					++v;
+					continue;
+				}
+				Word height = 1;
+				while (v + height < size && mask[u * size + v + height] == key)
+					++height;
+				Word width = 1;
+				for (; u + width < size; ++width) {
+					const uint32_t *p_row = mask.data() + (u + width) * size + v;
+					if (!std::all_of(p_row, p_row + height, [key](uint32_t k) { return k == key; }))
+						break;
+				}
+				for (Word w = 0; w < width; ++w)
+					std::fill_n(mask.data() + (u + w) * size + v, height, 0u);
+				p_quads->push_back({.axis = axis,
+				                    .positive = positive,
+				                    .depth = depth,
+				                    .u = u,
+				                    .v = v,
+				                    .width = width,
+				                    .height = height,
+				                    .color = key - 1u});
+				v += height;
+			}
+	}
+	// Interior slices only depend on the chunk itself, boundary slices also depend on the neighbours
+	template <bool Color, typename ColorFunc>
+	inline static void mesh_slices(const Grid &grid, bool interior, bool boundary, const ColorFunc &color_func,
+	                               std::vector<Quad> *p_quads) {
+		std::vector<uint32_t> mask;
+		for (Word axis = 0; axis < 3; ++axis)
+			for (bool positive : {false, true}) {
+				Word boundary_depth = positive ? grid.size - 1u : 0u;
+				for (Word depth = 0; depth < grid.size; ++depth)
+					if (depth == boundary_depth ? boundary : interior)
+						mesh_slice<Color>(grid, axis, positive, depth, color_func, &mask, p_quads);
+			}
+	}
+
+	inline static void append_quads(std::span<const Quad> quads, const glm::vec<3, Word> &chunk_lower, bool color,
+	                                SurfaceMesh<Word> *p_mesh) {
+		for (const Quad &quad : quads) {
+			Word u_axis = (quad.axis + 1u) % 3u, v_axis = (quad.axis + 2u) % 3u;
+			glm::vec<3, Word> p = chunk_lower, du{0}, dv{0};
+			p[quad.axis] += quad.depth + quad.positive;
+			p[u_axis] += quad.u;
+			p[v_axis] += quad.v;
+			du[u_axis] = quad.width;
+			dv[v_axis] = quad.height;
+			glm::i8vec3 normal{0};
+			normal[quad.axis] = quad.positive ? 1 : -1;
+
+			auto base = uint32_t(p_mesh->positions.size());
+			p_mesh->positions.insert(p_mesh->positions.end(), {p, p + du, p + du + dv, p + dv});
+			p_mesh->normals.insert(p_mesh->normals.end(), 4, normal);
+			if (color)
+				p_mesh->colors.insert(p_mesh->colors.end(), 4, quad.color);
+			// (u, v, axis) is right-handed, so (0, 1, 2) is counter-clockwise seen from +axis
+			if (quad.positive)
+				p_mesh->indices.insert(p_mesh->indices.end(), {base, base + 1, base + 2, base, base + 2, base + 3});
+			else
+				p_mesh->indices.insert(p_mesh->indices.end(), {base, base + 2, base + 1, base, base + 3, base + 2});
+		}
+	}
+
+	inline NodePointer<Word> get_chunk_node(NodePointer<Word> root_ptr, Word chunk_level,
+	                                        const glm::vec<3, Word> &chunk_pos) const {
+		NodePointer<Word> node_ptr = root_ptr;
+		for (Word level = 0; level < chunk_level && node_ptr; ++level) {
+			glm::vec<3, Word> p = (chunk_pos >> (chunk_level - 1u - level)) & Word(1);
+			node_ptr = get_node_pool().get_unpacked_node_array(node_ptr)[1 + (p.x | (p.y << 1u) | (p.z << 2u))];
+		}
+		return node_ptr;
+	}
+
+	template <lf::context Context, typename Func>
+	inline static lf::basic_task<void, Context> lf_for_each(std::size_t first, std::size_t count, const Func *p_func) {
+		if (count == 1) {
+			(*p_func)(first);
+			co_return;
+		}
+		std::size_t half = count >> 1u;
+		co_await lf_for_each<Context>(first, half, p_func).fork();
+		co_await lf_for_each<Context>(first + half, count - half, p_func);
+		co_await lf::join();
+	}
+	template <typename Func> inline static void parallel_for(lf::busy_pool *p_lf_pool, std::size_t count, Func &&func) {
+		if (count)
+			p_lf_pool->schedule(lf_for_each<lf::busy_pool::context>(0, count, &func));
+	}
+
+	template <bool Color, typename ColorFunc>
+	inline std::vector<SurfaceMesh<Word>> threaded_mesh(lf::busy_pool *p_lf_pool, NodePointer<Word> root_ptr,
+	                                                    Word chunk_level, const glm::vec<3, Word> &chunk_min,
+	                                                    const glm::vec<3, Word> &chunk_max,
+	                                                    const ColorFunc &color_func) const {
+		glm::vec<3, Word> chunk_extent = chunk_max - chunk_min;
+		std::size_t chunk_count = std::size_t(chunk_extent.x) * chunk_extent.y * chunk_extent.z;
+		const auto get_chunk_pos = [&](std::size_t i) {
+			return chunk_min + glm::vec<3, Word>(i / (std::size_t(chunk_extent.y) * chunk_extent.z),
+			                                     (i / chunk_extent.z) % chunk_extent.y, i % chunk_extent.z);
+		};
+		Word chunk_bits = get_config().GetVoxelLevel() - chunk_level;
+		Word resolution = get_config().GetResolution();
+
+		std::vector<NodePointer<Word>> chunk_nodes(chunk_count);
+		for (std::size_t i = 0; i < chunk_count; ++i)
+			chunk_nodes[i] = get_chunk_node(root_ptr, chunk_level, get_chunk_pos(i));
+
+		// Interior quads are memoized per (mirrored) chunk node, the colors depend on the position though
+		std::vector<Word> unique_nodes;
+		std::vector<std::vector<Quad>> unique_interiors;
+		if constexpr (!Color) {
+			for (NodePointer<Word> node_ptr : chunk_nodes)
+				if (node_ptr && !is_filled_node(chunk_level, node_ptr))
+					unique_nodes.push_back(*node_ptr);
+			std::sort(unique_nodes.begin(), unique_nodes.end());
+			unique_nodes.erase(std::unique(unique_nodes.begin(), unique_nodes.end()), unique_nodes.end());
+			unique_interiors.resize(unique_nodes.size());
+			parallel_for(p_lf_pool, unique_nodes.size(), [&](std::size_t i) {
+				Grid grid = make_grid(chunk_level, {});
+				fill_grid(chunk_level, NodePointer<Word>{unique_nodes[i]}, {}, {}, glm::vec<3, Word>(grid.size),
+				          &grid);
+				mesh_slices<false>(grid, true, false, color_func, &unique_interiors[i]);
+			});
+		}
+
+		std::vector<SurfaceMesh<Word>> meshes(chunk_count);
+		parallel_for(p_lf_pool, chunk_count, [&](std::size_t i) {
+			NodePointer<Word> node_ptr = chunk_nodes[i];
+			if (!node_ptr)
+				return;
+			glm::vec<3, Word> chunk_lower = get_chunk_pos(i) << chunk_bits;
+			Grid grid = make_grid(chunk_level, chunk_lower);
+			glm::vec<3, Word> lower = glm::max(chunk_lower, Word(1)) - Word(1),
+			                  upper = glm::min(chunk_lower + grid.size + Word(1), glm::vec<3, Word>(resolution));
+			fill_grid(0, root_ptr, {}, lower, upper, &grid);
+
+			std::vector<Quad> quads;
+			if constexpr (Color)
+				mesh_slices<true>(grid, true, true, color_func, &quads);
+			else {
+				mesh_slices<false>(grid, false, true, color_func, &quads);
+				auto it = std::lower_bound(unique_nodes.begin(), unique_nodes.end(), *node_ptr);
+				if (it != unique_nodes.end() && *it == *node_ptr)
+					append_quads(unique_interiors[it - unique_nodes.begin()], chunk_lower, false, &meshes[i]);
+			}
+			append_quads(quads, chunk_lower, Color, &meshes[i]);
+		});
+		return meshes;
+	}
+
+public:
+	inline NodePoolThreadedMesh() { static_assert(std::is_base_of_v<NodePoolBase<Derived, Word>, Derived>); }
+
+	// Mesh the chunks (nodes at chunk_level) in [chunk_min, chunk_max), one mesh per chunk in x-major order
+	// Faces between voxels of neighbouring chunks are culled, including neighbours outside the region
+	inline std::vector<SurfaceMesh<Word>> ThreadedMesh(lf::busy_pool *p_lf_pool, NodePointer<Word> root_ptr,
+	                                                   Word chunk_level, const glm::vec<3, Word> &chunk_min,
+	                                                   const glm::vec<3, Word> &chunk_max) const {
+		return threaded_mesh<false>(p_lf_pool, root_ptr, chunk_level, chunk_min, chunk_max, [](auto &&) { return 0u; });
+	}
+	// Same as above with per-face colors from color_func(voxel_pos) (called concurrently), e.g. from a DAGColorPool
+	template <std::invocable<glm::vec<3, Word>> ColorFunc>
+	inline std::vector<SurfaceMesh<Word>> ThreadedMesh(lf::busy_pool *p_lf_pool, NodePointer<Word> root_ptr,
+	                                                   Word chunk_level, const glm::vec<3, Word> &chunk_min,
+	                                                   const glm::vec<3, Word> &chunk_max,
+	                                                   const ColorFunc &color_func) const {
+		return threaded_mesh<true>(p_lf_pool, root_ptr, chunk_level, chunk_min, chunk_max, color_func);
+	}
+};
+
+} // namespace hashdag
+
+#endif // VKHASHDAG_NODEPOOLTHREADEDMESH_HPP
@@ -0,0 +1,79 @@
+//
+// Created by adamyuan on 6/5/24.
+//
+
+// Batched NodePool Traversal with libfork
+
+#pragma once
+#ifndef VKHASHDAG_NODEPOOLTHREADEDTRAVERSAL_HPP
+#define VKHASHDAG_NODEPOOLTHREADEDTRAVERSAL_HPP
+
+#include "NodePoolTraversal.hpp"
+
+#include <libfork/schedule/busy_pool.hpp>
+#include <libfork/task.hpp>
+
+namespace hashdag {
+
+// Rays and outputs of a batched traversal
+// Ray i hits if bit (i % word bits) of hit_masks[i / word bits] is set, positions are only written for hits
+// iterations[i] is the march iterations of ray i, hit or not
+template <std::unsigned_integral Word, std::floating_point F, glm::qualifier Q = glm::defaultp> struct TraversalBatch {
+	std::span<const glm::vec<3, F, Q>> origins, dirs;
+	std::span<Word> hit_masks;
+	std::span<glm::vec<3, F, Q>> positions;
+	std::span<Word> iterations;
+};
+
+template <typename Derived, std::unsigned_integral Word> class NodePoolThreadedTraversal {
+private:
+	inline static constexpr Word kBlockRays = sizeof(Word) * 8; // Rays of a hit mask word
+	inline static constexpr Word kTaskBlocks = 4;
+
+	template <std::floating_point F, glm::qualifier Q>
+	inline void traversal_block(NodePointer<Word> root_ptr, const TraversalBatch<Word, F, Q> &batch, Word block) const {
+		Word first_ray = block * kBlockRays, ray_count = std::min<Word>(batch.origins.size() - first_ray, kBlockRays);
+		Word hit_mask = 0u;
+		for (Word r = 0; r < ray_count; ++r) {
+			Word ray = first_ray + r;
+			auto hit = static_cast<const Derived *>(this)->template Traversal<F, Q>(
+			    root_ptr, batch.origins[ray], batch.dirs[ray], &batch.iterations[ray]);
+			if (hit) {
+				hit_mask |= Word{1} << r;
+				batch.positions[ray] = *hit;
+			}
+		}
+		batch.hit_masks[block] = hit_mask;
+	}
+
+	template <lf::context Context, std::floating_point F, glm::qualifier Q>
+	inline lf::basic_task<void, Context> lf_traversal(NodePointer<Word> root_ptr,
+	                                                  const TraversalBatch<Word, F, Q> *p_batch, Word first_block,
+	                                                  Word block_count) const {
+		if (block_count <= kTaskBlocks) {
+			for (Word b = 0; b < block_count; ++b)
+				traversal_block(root_ptr, *p_batch, first_block + b);
+			co_return;
+		}
+		Word half_blocks = block_count >> 1u;
+		co_await lf_traversal<Context>(root_ptr, p_batch, first_block, half_blocks).fork();
+		co_await lf_traversal<Context>(root_ptr, p_batch, first_block + half_blocks, block_count - half_blocks);
+		co_await lf::join();
+	}
+
+public:
+	inline NodePoolThreadedTraversal() { static_assert(std::is_base_of_v<NodePoolTraversal<Derived, Word>, Derived>); }
+
+	// Scalar traversals of the rays, blocks of rays are distributed with libfork
+	template <std::floating_point F, glm::qualifier Q>
+	inline void ThreadedTraversal(lf::busy_pool *p_lf_pool, NodePointer<Word> root_ptr,
+	                              const TraversalBatch<Word, F, Q> &batch) const {
+		Word block_count = (batch.origins.size() + kBlockRays - 1) / kBlockRays;
+		if (block_count)
+			p_lf_pool->schedule(lf_traversal<lf::busy_pool::context, F, Q>(root_ptr, &batch, 0, block_count));
+	}
+};
+
+} // namespace hashdag
+
+#endif // VKHASHDAG_NODEPOOLTHREADEDTRAVERSAL_HPP
@@ -8,51 +8,95 @@
 
 #include "NodePool.hpp"
 
+#include <algorithm>
 #include <bit>
 #include <concepts>
 #include <glm/glm.hpp>
 #include <numeric>
 #include <optional>
+#include <span>
+#include <vector>
 
 namespace hashdag {
 
+// Read-only node storage (e.g. StaticDAG) that is not a NodePoolBase, nodes are addressed by word offsets
+template <typename T, typename Word>
+concept NodeReader = requires(const T ce) {
+	{ ce.ReadNode(Word{} /* Node */) } -> std::convertible_to<const Word *>;
+	{ ce.GetNodeLevels() } -> std::convertible_to<Word>;
+};
+
+// Hit record of LODTraversal()
+template <std::unsigned_integral Word, std::floating_point F, glm::qualifier Q = glm::defaultp> struct TraversalHit {
+	glm::vec<3, F, Q> position, normal; // position is in [0, 1]^3, normal faces the ray
+	glm::vec<3, Word, Q> voxel_pos;     // Lower corner of the hit cell in voxels
+	Word voxel_size;                    // Edge of the hit cell in voxels, larger than 1 for a coarse node
+	Word level;                         // Level of the hit cell, the voxel level if it is a voxel
+	F t;                                // o + t * d is the entry point of the hit cell
+	Word iterations;
+};
+
+// Shapes of Overlap() and SweepAABB(), in the same [0, 1]^3 space as Traversal()
+template <std::floating_point F, glm::qualifier Q = glm::defaultp> struct TraversalAABB {
+	glm::vec<3, F, Q> lower, upper;
+};
+template <std::floating_point F, glm::qualifier Q = glm::defaultp> struct TraversalSphere {
+	glm::vec<3, F, Q> center;
+	F radius;
+};
+
 template <typename Derived, std::unsigned_integral Word> class NodePoolTraversal {
 private:
-	inline const auto &get_node_pool() const {
-		return *static_cast<const NodePoolBase<Derived, Word> *>(static_cast<const Derived *>(this));
+	inline static constexpr bool is_node_pool() { return std::is_base_of_v<NodePoolBase<Derived, Word>, Derived>; }
+
+	inline const Word *read_node(Word node) const {
+		if constexpr (is_node_pool())
+			return static_cast<const NodePoolBase<Derived, Word> *>(static_cast<const Derived *>(this))->read_node(node);
+		else
+			return static_cast<const Derived *>(this)->ReadNode(node);
+	}
+	inline Word get_node_levels() const {
+		if constexpr (is_node_pool())
+			return static_cast<const Derived *>(this)->GetConfig().GetNodeLevels();
+		else
+			return static_cast<const Derived *>(this)->GetNodeLevels();
 	}
-	inline auto &get_node_pool() { return *static_cast<NodePoolBase<Derived, Word> *>(static_cast<Derived *>(this)); }
 
-	template <std::floating_point F> inline static Word float_bits_to_word(F f) {
-		static_assert(sizeof(F) == sizeof(Word));
+	// Unsigned integer with the bits of F (uint64_t for double), so that deep traversals can march in double
+	template <std::floating_point F>
+	using FloatBits = std::conditional_t<sizeof(F) == sizeof(uint32_t), uint32_t, uint64_t>;
+
+	template <std::floating_point F> inline static FloatBits<F> float_bits_to_word(F f) {
+		static_assert(sizeof(F) == sizeof(FloatBits<F>));
 		union {
 			F f_;
-			Word w_;
+			FloatBits<F> w_;
 		} u;
-		static_assert(sizeof(u) == sizeof(Word));
+		static_assert(sizeof(u) == sizeof(FloatBits<F>));
 		u.f_ = f;
 		return u.w_;
 	}
 
-	template <std::floating_point F> inline static F word_bits_to_float(Word w) {
-		static_assert(sizeof(F) == sizeof(Word));
+	template <std::floating_point F> inline static F word_bits_to_float(FloatBits<F> w) {
+		static_assert(sizeof(F) == sizeof(FloatBits<F>));
 		union {
 			F f_;
-			Word w_;
+			FloatBits<F> w_;
 		} u;
-		static_assert(sizeof(u) == sizeof(Word));
+		static_assert(sizeof(u) == sizeof(FloatBits<F>));
 		u.w_ = w;
 		return u.f_;
 	}
 
+	// w can be negative (wrapped)
 	template <std::floating_point F> inline static F fast_exp2(Word w) {
 		static constexpr Word kFractionBits = std::numeric_limits<F>::digits - 1;
 		static constexpr Word kExponentBias = std::numeric_limits<F>::max_exponent - 1;
-		return word_bits_to_float<F>((kExponentBias + w) << kFractionBits);
+		return word_bits_to_float<F>(FloatBits<F>(Word(kExponentBias + w)) << kFractionBits);
 	}
 
 	inline Word DAG_GetLeafFirstChildBits(Word node) const {
-		const Word *p = get_node_pool().read_node(node);
+		const Word *p = read_node(node);
 		Word l0 = p[0], l1 = p[1];
 		return ((l0 & 0x000000FFu) == 0u ? 0u : 0x01u) | ((l0 & 0x0000FF00u) == 0u ? 0u : 0x02u) |
 		       ((l0 & 0x00FF0000u) == 0u ? 0u : 0x04u) | ((l0 & 0xFF000000u) == 0u ? 0u : 0x08u) |
@@ -60,8 +104,43 @@ private:
 		       ((l1 & 0x00FF0000u) == 0u ? 0u : 0x40u) | ((l1 & 0xFF000000u) == 0u ? 0u : 0x80u);
 	}
 
-public:
-	inline NodePoolTraversal() { static_assert(std::is_base_of_v<NodePoolBase<Derived, Word>, Derived>); }
+	// Child bits of "parent" in the mirrored (actual) space
+	// Above the leaf scale "parent" is a node pointer, below it "parent" is already the child bits of a leaf octant
+	inline Word DAG_GetChildBits(Word parent, Word scale, Word leaf_scale) const {
+		using Base = NodePoolBase<Derived, Word>;
+		if (scale < leaf_scale)
+			return parent;
+		Word bits = scale > leaf_scale ? *read_node(parent) & 0xFFu : DAG_GetLeafFirstChildBits(parent);
+		return Base::mirror_child_bits(bits, Base::get_node_mirror(parent));
+	}
+
+	inline Word DAG_GetChild(Word parent, Word child_bits, Word child_shift, Word scale, Word leaf_scale) const {
+		using Base = NodePoolBase<Derived, Word>;
+		Word mirror = Base::get_node_mirror(parent);
+		child_shift ^= mirror; // child slot of the stored node
+		if (scale > leaf_scale) {
+			child_bits = Base::mirror_child_bits(child_bits, mirror);
+			return Base::apply_node_mirror(
+			    *read_node(parent + 1u + std::popcount(child_bits & ((1u << child_shift) - 1u))),
+			    mirror);
+		}
+		return Base::mirror_child_bits(
+		    0xffu & (*read_node(parent + (child_shift >> 2u)) >> ((child_shift & 3u) << 3u)), mirror);
+	}
+
+	template <std::floating_point F>
+	inline static constexpr Word kMarchStackSize = std::numeric_limits<F>::digits - 1; // Fraction bits
+
+	// Whether the voxels are finer than the fraction bits of F, march() is then redone in double
+	template <std::floating_point F> inline bool is_deeper_than_march() const {
+		return get_node_levels() + 1u > kMarchStackSize<F>;
+	}
+
+	template <std::floating_point F, glm::qualifier Q> struct MarchState {
+		glm::vec<3, F, Q> o, d, t_coef, t_bias, pos;
+		F t_min, t_max, scale_exp2;
+		Word scale, octant_mask, iterations;
+	};
 
 	/*
 	 *  Copyright (c) 2009-2011, NVIDIA Corporation
@@ -90,20 +169,20 @@ public:
 	 *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 	 */
 
-	template <std::floating_point F, glm::qualifier Q = glm::defaultp>
-	inline std::optional<glm::vec<3, F, Q>> Traversal(NodePointer<Word> root_ptr, glm::vec<3, F, Q> o,
-	                                                  glm::vec<3, F, Q> d) const {
+	// Marches a ray from o in the mirrored [1, 2] space, stops at the first non-empty cell that is a voxel or (LOD) small
+	// enough to be projected under a pixel
+	template <bool LOD, std::floating_point F, glm::qualifier Q>
+	inline MarchState<F, Q> march(NodePointer<Word> root_ptr, glm::vec<3, F, Q> o, glm::vec<3, F, Q> d, F proj_factor,
+	                              F proj_bias) const {
 		static_assert(std::numeric_limits<F>::is_iec559);
 
 		using Vec3 = glm::vec<3, F, Q>;
 
-		if (!root_ptr)
-			return std::nullopt;
-
 		static constexpr F kEpsilon = std::numeric_limits<F>::epsilon();
-		static constexpr std::size_t kStackSize = std::numeric_limits<F>::digits - 1; // Fraction bits
+		static constexpr Word kStackSize = kMarchStackSize<F>;
 
 		std::array<Word, kStackSize> stack;
+		Word iterations = 0;
 
 		o += F{1};
 
@@ -146,12 +225,13 @@ public:
 		Word scale = kStackSize - 1;
 		F scale_exp2 = 0.5; // exp2( scale - STACK_SIZE )
 
-		const Word kLeafScale = kStackSize - get_node_pool().m_config.GetNodeLevels();
+		const Word kLeafScale = kStackSize - get_node_levels();
 
 		for (;;) {
+			++iterations;
+
 			if (child_bits == 0u)
-				child_bits = scale > kLeafScale ? *get_node_pool().read_node(parent)
-				                                : (scale == kLeafScale ? DAG_GetLeafFirstChildBits(parent) : parent);
+				child_bits = DAG_GetChildBits(parent, scale, kLeafScale);
 			// Determine maximum t-value of the cube by evaluating
 			// tx(), ty(), and tz() at its corner.
 
@@ -168,16 +248,17 @@ public:
 
 				if (scale < kLeafScale || scale == -1) // leaf node
 					break;
+				if constexpr (LOD) {
+					if (scale_exp2 * proj_factor < tc_max + proj_bias)
+						break;
+				}
 
 				// PUSH
 				if (tc_max < h)
 					stack[scale] = parent;
 				h = tc_max;
 
-				parent = scale > kLeafScale
-				             ? *get_node_pool().read_node(parent + 1u + std::popcount(child_bits & (child_mask - 1)))
-				             : 0xffu & (*get_node_pool().read_node(parent + (child_shift >> 2u)) >>
-				                        ((child_shift & 3u) << 3u));
+				parent = DAG_GetChild(parent, child_bits, child_shift, scale, kLeafScale);
 
 				idx = 0u;
 				--scale;
@@ -211,14 +292,14 @@ public:
 			if (idx & step_mask) {
 				// POP
 				// Find the highest differing bit between the two positions.
-				Word differing_bits = 0;
+				FloatBits<F> differing_bits = 0;
 				if (step_mask & 1u)
 					differing_bits |= float_bits_to_word<F>(pos.x) ^ float_bits_to_word<F>(pos.x + scale_exp2);
 				if (step_mask & 2u)
 					differing_bits |= float_bits_to_word<F>(pos.y) ^ float_bits_to_word<F>(pos.y + scale_exp2);
 				if (step_mask & 4u)
 					differing_bits |= float_bits_to_word<F>(pos.z) ^ float_bits_to_word<F>(pos.z + scale_exp2);
-				scale = glm::findMSB(differing_bits);
+				scale = Word(std::bit_width(differing_bits)) - 1u; // Word(-1) if no bit differs
 				if (scale >= kStackSize)
 					break;
 				scale_exp2 = fast_exp2<F>(scale - kStackSize);
@@ -227,13 +308,13 @@ public:
 				parent = stack[scale];
 
 				// Round cube position and extract child slot index.
-				Word shx = float_bits_to_word<F>(pos.x) >> scale;
-				Word shy = float_bits_to_word<F>(pos.y) >> scale;
-				Word shz = float_bits_to_word<F>(pos.z) >> scale;
+				FloatBits<F> shx = float_bits_to_word<F>(pos.x) >> scale;
+				FloatBits<F> shy = float_bits_to_word<F>(pos.y) >> scale;
+				FloatBits<F> shz = float_bits_to_word<F>(pos.z) >> scale;
 				pos.x = word_bits_to_float<F>(shx << scale);
 				pos.y = word_bits_to_float<F>(shy << scale);
 				pos.z = word_bits_to_float<F>(shz << scale);
-				idx = (shx & 1u) | ((shy & 1u) << 1u) | ((shz & 1u) << 2u);
+				idx = Word(shx & 1u) | Word((shy & 1u) << 1u) | Word((shz & 1u) << 2u);
 
 				// Prevent same parent from being stored again and invalidate cached
 				// child descriptor.
@@ -242,6 +323,181 @@ public:
 			}
 		}
 
+		return {.o = o,
+		        .d = d,
+		        .t_coef = t_coef,
+		        .t_bias = t_bias,
+		        .pos = pos,
+		        .t_min = t_min,
+		        .t_max = t_max,
+		        .scale_exp2 = scale_exp2,
+		        .scale = scale,
+		        .octant_mask = octant_mask,
+		        .iterations = iterations};
+	}
+
+	// Hierarchical queries descend with the DAG_* helpers, the scale of a node is its height above the voxels so that
+	// the leaf is at scale 1 and the octants of a leaf are at scale 0
+	inline static constexpr Word kQueryLeafScale = 1;
+
+	template <std::floating_point F, glm::qualifier Q>
+	inline static glm::vec<3, F, Q> get_child_lower(const glm::vec<3, F, Q> &lower, F child_size, Word child_idx) {
+		return lower + glm::vec<3, F, Q>(child_idx & 1u, (child_idx >> 1u) & 1u, (child_idx >> 2u) & 1u) * child_size;
+	}
+
+	// A voxel only collides with a shape on a non-zero overlap, so that touching faces do not collide
+	template <std::floating_point F, glm::qualifier Q>
+	inline static bool intersects(const TraversalAABB<F, Q> &box, const glm::vec<3, F, Q> &lower, F size) {
+		return glm::all(glm::lessThan(lower, box.upper)) && glm::all(glm::greaterThan(lower + size, box.lower));
+	}
+	template <std::floating_point F, glm::qualifier Q>
+	inline static bool contains(const TraversalAABB<F, Q> &box, const glm::vec<3, F, Q> &lower, F size) {
+		return glm::all(glm::lessThanEqual(box.lower, lower)) && glm::all(glm::lessThanEqual(lower + size, box.upper));
+	}
+	template <std::floating_point F, glm::qualifier Q>
+	inline static bool intersects(const TraversalSphere<F, Q> &sphere, const glm::vec<3, F, Q> &lower, F size) {
+		glm::vec<3, F, Q> v = glm::clamp(sphere.center, lower, lower + size) - sphere.center;
+		return glm::dot(v, v) < sphere.radius * sphere.radius;
+	}
+	template <std::floating_point F, glm::qualifier Q>
+	inline static bool contains(const TraversalSphere<F, Q> &sphere, const glm::vec<3, F, Q> &lower, F size) {
+		glm::vec<3, F, Q> v = glm::max(glm::abs(lower - sphere.center), glm::abs(lower + size - sphere.center));
+		return glm::dot(v, v) <= sphere.radius * sphere.radius;
+	}
+
+	template <typename Shape, std::floating_point F, glm::qualifier Q>
+	inline bool overlap(Word parent, Word scale, const glm::vec<3, F, Q> &lower, F size, const Shape &shape) const {
+		Word child_bits = DAG_GetChildBits(parent, scale, kQueryLeafScale);
+		F child_size = size * F{0.5};
+		for (Word bits = child_bits; bits; bits &= bits - 1u) {
+			Word child_idx = std::countr_zero(bits);
+			glm::vec<3, F, Q> child_lower = get_child_lower(lower, child_size, child_idx);
+			if (!intersects(shape, child_lower, child_size))
+				continue;
+			if (scale == 0 || contains(shape, child_lower, child_size) ||
+			    overlap(DAG_GetChild(parent, child_bits, child_idx, scale, kQueryLeafScale), scale - 1u, child_lower,
+			            child_size, shape))
+				return true;
+		}
+		return false;
+	}
+	// Shapes (indices [first, first + count) of *p_indices) that reach a node descend together
+	template <typename Shape, std::floating_point F, glm::qualifier Q>
+	inline void overlap_batch(Word parent, Word scale, const glm::vec<3, F, Q> &lower, F size,
+	                          std::span<const Shape> shapes, std::vector<Word> *p_indices, std::size_t first,
+	                          std::size_t count, std::span<Word> hit_masks) const {
+		static constexpr Word kWordBits = sizeof(Word) * 8;
+		Word child_bits = DAG_GetChildBits(parent, scale, kQueryLeafScale);
+		F child_size = size * F{0.5};
+		for (Word bits = child_bits; bits; bits &= bits - 1u) {
+			Word child_idx = std::countr_zero(bits);
+			glm::vec<3, F, Q> child_lower = get_child_lower(lower, child_size, child_idx);
+			std::size_t child_first = p_indices->size();
+			for (std::size_t k = first; k < first + count; ++k) {
+				Word s = (*p_indices)[k];
+				if (((hit_masks[s / kWordBits] >> (s % kWordBits)) & 1u) || !intersects(shapes[s], child_lower, child_size))
+					continue;
+				if (scale == 0 || contains(shapes[s], child_lower, child_size))
+					hit_masks[s / kWordBits] |= Word(1) << (s % kWordBits);
+				else
+					p_indices->push_back(s);
+			}
+			if (std::size_t child_count = p_indices->size() - child_first)
+				overlap_batch(DAG_GetChild(parent, child_bits, child_idx, scale, kQueryLeafScale), scale - 1u,
+				              child_lower, child_size, shapes, p_indices, child_first, child_count, hit_masks);
+			p_indices->resize(child_first);
+		}
+	}
+	template <template <typename, glm::qualifier> typename Shape, std::floating_point F, glm::qualifier Q>
+	inline void overlap_batch(NodePointer<Word> root_ptr, std::span<const Shape<F, Q>> shapes,
+	                          std::span<Word> hit_masks) const {
+		static constexpr Word kWordBits = sizeof(Word) * 8;
+		std::fill(hit_masks.begin(), hit_masks.begin() + (shapes.size() + kWordBits - 1) / kWordBits, Word{0});
+		if (!root_ptr || shapes.empty())
+			return;
+		std::vector<Word> indices(shapes.size());
+		std::iota(indices.begin(), indices.end(), Word{0});
+		overlap_batch(*root_ptr, get_node_levels(), glm::vec<3, F, Q>(0), F{1}, shapes, &indices, 0, shapes.size(),
+		              hit_masks);
+	}
+
+	// The t span in [0, 1] of box + t * delta overlapping the cell, empty if t_enter >= t_exit
+	template <std::floating_point F, glm::qualifier Q>
+	inline static std::pair<F, F> sweep_span(const TraversalAABB<F, Q> &box, const glm::vec<3, F, Q> &delta,
+	                                         const glm::vec<3, F, Q> &lower, F size) {
+		F t_enter = F{0}, t_exit = F{1};
+		for (Word a = 0; a < 3; ++a) {
+			F cell_lower = lower[a], cell_upper = lower[a] + size;
+			if (delta[a] == F{0}) {
+				if (box.lower[a] >= cell_upper || box.upper[a] <= cell_lower)
+					return {F{1}, F{0}};
+				continue;
+			}
+			F t0 = (cell_lower - box.upper[a]) / delta[a], t1 = (cell_upper - box.lower[a]) / delta[a];
+			if (delta[a] < F{0})
+				std::swap(t0, t1);
+			t_enter = glm::max(t_enter, t0);
+			t_exit = glm::min(t_exit, t1);
+		}
+		return {t_enter, t_exit};
+	}
+	// Children are visited from the earliest entry so that the search stops once no child can improve the TOI
+	template <std::floating_point F, glm::qualifier Q>
+	inline void sweep(Word parent, Word scale, const glm::vec<3, F, Q> &lower, F size, const TraversalAABB<F, Q> &box,
+	                  const glm::vec<3, F, Q> &delta, F *p_toi) const {
+		Word child_bits = DAG_GetChildBits(parent, scale, kQueryLeafScale);
+		F child_size = size * F{0.5};
+		std::array<std::pair<F, Word>, 8> children;
+		Word child_count = 0;
+		for (Word bits = child_bits; bits; bits &= bits - 1u) {
+			Word child_idx = std::countr_zero(bits);
+			auto [t_enter, t_exit] = sweep_span(box, delta, get_child_lower(lower, child_size, child_idx), child_size);
+			if (t_enter < t_exit && t_enter < *p_toi) {
+				// Insertion sort of at most 8 children
+				Word c = child_count++;
+				for (; c > 0 && std::pair{t_enter, child_idx} < children[c - 1]; --c)
+					children[c] = children[c - 1];
+				children[c] = {t_enter, child_idx};
+			}
+		}
+		for (Word c = 0; c < child_count; ++c) {
+			auto [t_enter, child_idx] = children[c];
+			if (t_enter >= *p_toi)
+				break;
+			if (scale == 0)
+				*p_toi = t_enter;
+			else
+				sweep(DAG_GetChild(parent, child_bits, child_idx, scale, kQueryLeafScale), scale - 1u,
+				      get_child_lower(lower, child_size, child_idx), child_size, box, delta, p_toi);
+		}
+	}
+
+public:
+	inline NodePoolTraversal() { static_assert(is_node_pool() || NodeReader<Derived, Word>); }
+
+	// Pools deeper than the fraction bits of F allow (22 node levels for float) are marched in double
+	// *p_iterations (if not null) is set to the march iterations of the ray, for hits and misses
+	template <std::floating_point F, glm::qualifier Q = glm::defaultp>
+	inline std::optional<glm::vec<3, F, Q>> Traversal(NodePointer<Word> root_ptr, glm::vec<3, F, Q> o,
+	                                                  glm::vec<3, F, Q> d, Word *p_iterations = nullptr) const {
+		if (p_iterations)
+			*p_iterations = 0;
+		if (!root_ptr)
+			return std::nullopt;
+
+		if constexpr (!std::is_same_v<F, double>) {
+			if (is_deeper_than_march<F>()) {
+				auto hit = Traversal<double, Q>(root_ptr, glm::vec<3, double, Q>(o), glm::vec<3, double, Q>(d),
+				                                p_iterations);
+				return hit ? std::optional<glm::vec<3, F, Q>>{glm::vec<3, F, Q>(*hit)} : std::nullopt;
+			}
+		}
+
+		auto [o1, d1, t_coef, t_bias, pos, t_min, t_max, scale_exp2, scale, octant_mask, iterations] =
+		    march<false, F, Q>(root_ptr, o, d, F{0}, F{0});
+		if (p_iterations)
+			*p_iterations = iterations;
+
 		// Undo mirroring of the coordinate system.
 		if (octant_mask & 1u)
 			pos.x = F{3} - scale_exp2 - pos.x;
@@ -250,10 +506,118 @@ public:
 		if (octant_mask & 4u)
 			pos.z = F{3} - scale_exp2 - pos.z;
 
-		return scale < kStackSize && t_min <= t_max
-		           ? std::optional<Vec3>{glm::clamp(o + t_min * d, pos, pos + scale_exp2) - F{1}}
+		return scale < kMarchStackSize<F> && t_min <= t_max
+		           ? std::optional<glm::vec<3, F, Q>>{glm::clamp(o1 + t_min * d1, pos, pos + scale_exp2) - F{1}}
 		           : std::nullopt;
 	}
+
+	// Traversal() that stops at a coarse node once it projects to less than a pixel, like DAG_RayMarch() in trace.frag
+	// A node of size s (the root is 1) at ray distance t is taken when s * proj_factor < t, d should be normalized
+	// The ray starts at o + t_start * d (e.g. from a beam), t_start still counts in the projected distance
+	template <std::floating_point F, glm::qualifier Q = glm::defaultp>
+	inline std::optional<TraversalHit<Word, F, Q>> LODTraversal(NodePointer<Word> root_ptr, glm::vec<3, F, Q> o,
+	                                                            glm::vec<3, F, Q> d, F proj_factor,
+	                                                            F t_start = F{0}) const {
+		using Vec3 = glm::vec<3, F, Q>;
+
+		if (!root_ptr)
+			return std::nullopt;
+
+		if constexpr (!std::is_same_v<F, double>) {
+			if (is_deeper_than_march<F>()) {
+				auto hit = LODTraversal<double, Q>(root_ptr, glm::vec<3, double, Q>(o), glm::vec<3, double, Q>(d),
+				                                   double(proj_factor), double(t_start));
+				if (!hit)
+					return std::nullopt;
+				return TraversalHit<Word, F, Q>{.position = glm::vec<3, F, Q>(hit->position),
+				                                .normal = glm::vec<3, F, Q>(hit->normal),
+				                                .voxel_pos = hit->voxel_pos,
+				                                .voxel_size = hit->voxel_size,
+				                                .level = hit->level,
+				                                .t = F(hit->t),
+				                                .iterations = hit->iterations};
+			}
+		}
+
+		auto [o1, d1, t_coef, t_bias, pos, t_min, t_max, scale_exp2, scale, octant_mask, iterations] =
+		    march<true, F, Q>(root_ptr, o + t_start * d, d, proj_factor, t_start);
+		if (scale >= kMarchStackSize<F> || t_min > t_max)
+			return std::nullopt;
+
+		// The entered face has the largest t at the cell's far corner (in the mirrored space)
+		Vec3 t_corner = t_coef * (pos + scale_exp2) - t_bias;
+		Vec3 normal = (t_corner.x > t_corner.y && t_corner.x > t_corner.z)
+		                  ? Vec3(-1, 0, 0)
+		                  : (t_corner.y > t_corner.z ? Vec3(0, -1, 0) : Vec3(0, 0, -1));
+		if ((octant_mask & 1u) == 0u)
+			normal.x = -normal.x;
+		if ((octant_mask & 2u) == 0u)
+			normal.y = -normal.y;
+		if ((octant_mask & 4u) == 0u)
+			normal.z = -normal.z;
+
+		// Undo mirroring of the coordinate system.
+		if (octant_mask & 1u)
+			pos.x = F{3} - scale_exp2 - pos.x;
+		if (octant_mask & 2u)
+			pos.y = F{3} - scale_exp2 - pos.y;
+		if (octant_mask & 4u)
+			pos.z = F{3} - scale_exp2 - pos.z;
+
+		constexpr FloatBits<F> kFractionMask = (FloatBits<F>{1} << kMarchStackSize<F>) - 1u;
+		const Word voxel_level = get_node_levels() + 1u, voxel_scale = kMarchStackSize<F> - voxel_level;
+		const auto get_voxel_coord = [&](F x) { return Word((float_bits_to_word<F>(x) & kFractionMask) >> voxel_scale); };
+		return TraversalHit<Word, F, Q>{
+		    .position = glm::clamp(o1 + t_min * d1, pos, pos + scale_exp2) - F{1},
+		    .normal = normal,
+		    .voxel_pos = {get_voxel_coord(pos.x), get_voxel_coord(pos.y), get_voxel_coord(pos.z)},
+		    .voxel_size = Word{1} << (scale - voxel_scale),
+		    .level = kMarchStackSize<F> - scale,
+		    .t = t_start + t_min,
+		    .iterations = iterations,
+		};
+	}
+
+	// Whether any voxel overlaps the box or the sphere (by a non-zero volume)
+	template <std::floating_point F, glm::qualifier Q = glm::defaultp>
+	inline bool Overlap(NodePointer<Word> root_ptr, const TraversalAABB<F, Q> &box) const {
+		return root_ptr && overlap(*root_ptr, get_node_levels(), glm::vec<3, F, Q>(0), F{1}, box);
+	}
+	template <std::floating_point F, glm::qualifier Q = glm::defaultp>
+	inline bool Overlap(NodePointer<Word> root_ptr, const TraversalSphere<F, Q> &sphere) const {
+		return root_ptr && overlap(*root_ptr, get_node_levels(), glm::vec<3, F, Q>(0), F{1}, sphere);
+	}
+	// Batched Overlap(), shapes that reach the same node share the descent
+	// Shape i overlaps if bit (i % word bits) of hit_masks[i / word bits] is set
+	template <std::floating_point F, glm::qualifier Q = glm::defaultp>
+	inline void Overlap(NodePointer<Word> root_ptr, std::span<const TraversalAABB<F, Q>> boxes,
+	                    std::span<Word> hit_masks) const {
+		overlap_batch(root_ptr, boxes, hit_masks);
+	}
+	template <std::floating_point F, glm::qualifier Q = glm::defaultp>
+	inline void Overlap(NodePointer<Word> root_ptr, std::span<const TraversalSphere<F, Q>> spheres,
+	                    std::span<Word> hit_masks) const {
+		overlap_batch(root_ptr, spheres, hit_masks);
+	}
+
+	// Time of impact t in [0, 1] of the box moving by t * delta, std::nullopt if it stays free
+	// Returns 0 if the box already overlaps a voxel
+	template <std::floating_point F, glm::qualifier Q = glm::defaultp>
+	inline std::optional<F> SweepAABB(NodePointer<Word> root_ptr, const TraversalAABB<F, Q> &box,
+	                                  const glm::vec<3, F, Q> &delta) const {
+		F toi = std::numeric_limits<F>::infinity();
+		if (root_ptr)
+			sweep(*root_ptr, get_node_levels(), glm::vec<3, F, Q>(0), F{1}, box, delta, &toi);
+		return toi <= F{1} ? std::optional<F>{toi} : std::nullopt;
+	}
+	// Batched SweepAABB(), a box that stays free gets an infinite TOI
+	template <std::floating_point F, glm::qualifier Q = glm::defaultp>
+	inline void SweepAABB(NodePointer<Word> root_ptr, std::span<const TraversalAABB<F, Q>> boxes,
+	                      std::span<const std::type_identity_t<glm::vec<3, F, Q>>> deltas,
+	                      std::span<std::type_identity_t<F>> tois) const {
+		for (std::size_t i = 0; i < boxes.size(); ++i)
+			tois[i] = SweepAABB(root_ptr, boxes[i], deltas[i]).value_or(std::numeric_limits<F>::infinity());
+	}
 };
 
 } // namespace hashdag
@@ -0,0 +1,242 @@
+//
+// Created by adamyuan on 6/7/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_NODEPOOLVOXELCOUNT_HPP
+#define VKHASHDAG_NODEPOOLVOXELCOUNT_HPP
+
+#include "NodePool.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <libfork/schedule/busy_pool.hpp>
+#include <libfork/task.hpp>
+#include <optional>
+#include <vector>
+
+namespace hashdag {
+
+// Voxel count and tight bounds of a node, bounds are in voxels relative to the node's lower corner
+template <std::unsigned_integral Word> struct NodeVoxelStats {
+	uint64_t count;
+	glm::vec<3, Word> lower, upper; // Inclusive
+};
+
+// Memoized per-node voxel statistics, keyed by node address at each level
+// Nodes are never modified after creation so edits need no invalidation, only ThreadedGC() (which moves and frees
+// nodes) requires ClearVoxelStats()
+template <typename Derived, std::unsigned_integral Word, template <typename, typename> typename HashMap>
+class NodePoolVoxelCount {
+private:
+	inline static constexpr Word kTaskNodes = 64;
+
+	std::vector<HashMap<Word, NodeVoxelStats<Word>>> m_level_stats;
+
+	inline const auto &get_node_pool() const {
+		return *static_cast<const NodePoolBase<Derived, Word> *>(static_cast<const Derived *>(this));
+	}
+	inline const Config<Word> &get_config() const { return get_node_pool().m_config; }
+	inline bool is_leaf_level(Word level) const { return level == get_config().GetNodeLevels() - 1; }
+	inline Word get_node_voxel_bits(Word level) const { return get_config().GetVoxelLevel() - level; }
+
+	// Stats of a mirrored occurrence of a node
+	inline static NodeVoxelStats<Word> mirror_stats(NodeVoxelStats<Word> stats, Word mirror, Word voxel_bits) {
+		Word max_coord = (Word(1) << voxel_bits) - 1u;
+		for (Word a = 0; a < 3; ++a)
+			if ((mirror >> a) & 1u)
+				std::tie(stats.lower[a], stats.upper[a]) = std::pair{max_coord - stats.upper[a], max_coord - stats.lower[a]};
+		return stats;
+	}
+
+	inline NodeVoxelStats<Word> make_leaf_stats(Word address) const {
+		auto leaf = get_node_pool().get_leaf_array(NodePointer<Word>{address});
+		uint64_t bits = NodePoolBase<Derived, Word>::get_leaf_bits(leaf);
+		NodeVoxelStats<Word> stats = {.count = uint64_t(std::popcount(bits)), .lower = glm::vec<3, Word>(3), .upper = {}};
+		for (uint64_t b = bits; b; b &= b - 1u) {
+			glm::vec<3, Word> p = NodeCoord<Word>{.level = 0, .pos = {}}.GetLeafCoord(std::countr_zero(b)).pos;
+			stats.lower = glm::min(stats.lower, p);
+			stats.upper = glm::max(stats.upper, p);
+		}
+		return stats;
+	}
+	// Children stats must be cached
+	inline NodeVoxelStats<Word> make_inner_stats(Word level, Word address) const {
+		auto unpacked_node = get_node_pool().get_unpacked_node_array(NodePointer<Word>{address});
+		Word child_bits = get_node_voxel_bits(level + 1);
+		NodeVoxelStats<Word> stats = {.count = 0, .lower = glm::vec<3, Word>(Word(-1)), .upper = {}};
+		for (Word i = 0; i < 8; ++i) {
+			Word child = unpacked_node[1 + i];
+			if (!NodePointer<Word>{child})
+				continue;
+			const auto &level_stats = m_level_stats[level + 1];
+			auto child_stats = mirror_stats(level_stats.find(get_node_pool().get_node_address(child))->second,
+			                                get_node_pool().get_node_mirror(child), child_bits);
+			glm::vec<3, Word> offset = NodeCoord<Word>{.level = 0, .pos = {}}.GetChildCoord(i).pos << child_bits;
+			stats.count += child_stats.count;
+			stats.lower = glm::min(stats.lower, child_stats.lower + offset);
+			stats.upper = glm::max(stats.upper, child_stats.upper + offset);
+		}
+		return stats;
+	}
+	inline NodeVoxelStats<Word> make_stats(Word level, Word address) const {
+		return is_leaf_level(level) ? make_leaf_stats(address) : make_inner_stats(level, address);
+	}
+
+	// Serial lazy fill
+	inline NodeVoxelStats<Word> get_stats(Word level, NodePointer<Word> node_ptr) {
+		Word address = get_node_pool().get_node_address(*node_ptr);
+		auto &level_stats = m_level_stats[level];
+		auto it = level_stats.find(address);
+		if (it == level_stats.end()) {
+			if (!is_leaf_level(level)) {
+				auto unpacked_node = get_node_pool().get_unpacked_node_array(NodePointer<Word>{address});
+				for (Word i = 0; i < 8; ++i)
+					if (NodePointer<Word> child{unpacked_node[1 + i]})
+						get_stats(level + 1, child);
+			}
+			it = level_stats.emplace(address, make_stats(level, address)).first;
+		}
+		return mirror_stats(it->second, get_node_pool().get_node_mirror(*node_ptr), get_node_voxel_bits(level));
+	}
+
+	template <lf::context Context>
+	inline lf::basic_task<void, Context> lf_make_stats(Word level, std::span<const Word> addresses,
+	                                                   std::span<NodeVoxelStats<Word>> stats) const {
+		if (addresses.size() <= kTaskNodes) {
+			for (std::size_t i = 0; i < addresses.size(); ++i)
+				stats[i] = make_stats(level, addresses[i]);
+			co_return;
+		}
+		std::size_t half = addresses.size() >> 1u;
+		co_await lf_make_stats<Context>(level, addresses.first(half), stats.first(half)).fork();
+		co_await lf_make_stats<Context>(level, addresses.subspan(half), stats.subspan(half));
+		co_await lf::join();
+	}
+
+	inline uint64_t count_voxels(Word level, NodePointer<Word> node_ptr, glm::vec<3, Word> node_lower,
+	                             const glm::vec<3, Word> &aabb_min, const glm::vec<3, Word> &aabb_max) {
+		if (!node_ptr)
+			return 0;
+		Word voxel_bits = get_node_voxel_bits(level);
+		glm::vec<3, Word> node_upper = node_lower + (Word(1) << voxel_bits);
+		if (glm::any(glm::lessThanEqual(node_upper, aabb_min)) || glm::any(glm::greaterThanEqual(node_lower, aabb_max)))
+			return 0;
+		auto stats = get_stats(level, node_ptr);
+		// Fully covered by the box, including the case that the tight bounds are covered
+		if (glm::all(glm::greaterThanEqual(node_lower + stats.lower, aabb_min)) &&
+		    glm::all(glm::lessThan(node_lower + stats.upper, aabb_max)))
+			return stats.count;
+
+		if (is_leaf_level(level)) {
+			uint64_t bits = NodePoolBase<Derived, Word>::get_leaf_bits(get_node_pool().get_leaf_array(node_ptr)), count = 0;
+			for (; bits; bits &= bits - 1u) {
+				glm::vec<3, Word> p =
+				    node_lower + NodeCoord<Word>{.level = 0, .pos = {}}.GetLeafCoord(std::countr_zero(bits)).pos;
+				count += glm::all(glm::greaterThanEqual(p, aabb_min)) && glm::all(glm::lessThan(p, aabb_max));
+			}
+			return count;
+		}
+		auto unpacked_node = get_node_pool().get_unpacked_node_array(node_ptr);
+		uint64_t count = 0;
+		for (Word i = 0; i < 8; ++i)
+			count += count_voxels(level + 1, NodePointer<Word>{unpacked_node[1 + i]},
+			                      node_lower + (NodeCoord<Word>{.level = 0, .pos = {}}.GetChildCoord(i).pos
+			                                    << (voxel_bits - 1u)),
+			                      aabb_min, aabb_max);
+		return count;
+	}
+
+public:
+	inline NodePoolVoxelCount() { static_assert(std::is_base_of_v<NodePoolBase<Derived, Word>, Derived>); }
+
+	inline void ClearVoxelStats() { m_level_stats.clear(); }
+
+	// Fill the stats of all nodes under root_ptr, level by level with libfork
+	inline void ThreadedFillVoxelStats(lf::busy_pool *p_lf_pool, NodePointer<Word> root_ptr) {
+		m_level_stats.resize(get_config().GetNodeLevels());
+		if (!root_ptr)
+			return;
+
+		// Uncached node addresses at each level
+		std::vector<std::vector<Word>> level_addresses(get_config().GetNodeLevels());
+		Word root = get_node_pool().get_node_address(*root_ptr);
+		if (!m_level_stats[0].count(root))
+			level_addresses[0].push_back(root);
+		for (Word level = 0; level + 1 < get_config().GetNodeLevels(); ++level) {
+			auto &child_addresses = level_addresses[level + 1];
+			for (Word address : level_addresses[level]) {
+				auto unpacked_node = get_node_pool().get_unpacked_node_array(NodePointer<Word>{address});
+				for (Word i = 0; i < 8; ++i) {
+					NodePointer<Word> child{unpacked_node[1 + i]};
+					Word child_address = get_node_pool().get_node_address(*child);
+					if (child && !m_level_stats[level + 1].count(child_address))
+						child_addresses.push_back(child_address);
+				}
+			}
+			std::sort(child_addresses.begin(), child_addresses.end());
+			child_addresses.erase(std::unique(child_addresses.begin(), child_addresses.end()), child_addresses.end());
+		}
+
+		// Bottom-up, a level only reads the stats of the level below
+		std::vector<NodeVoxelStats<Word>> stats;
+		for (Word level = get_config().GetNodeLevels() - 1; ~level; --level) {
+			const auto &addresses = level_addresses[level];
+			if (addresses.empty())
+				continue;
+			stats.resize(addresses.size());
+			p_lf_pool->schedule(lf_make_stats<lf::busy_pool::context>(level, addresses, stats));
+			for (std::size_t i = 0; i < addresses.size(); ++i)
+				m_level_stats[level].emplace(addresses[i], stats[i]);
+		}
+	}
+
+	inline NodeVoxelStats<Word> GetVoxelStats(NodePointer<Word> root_ptr) {
+		m_level_stats.resize(get_config().GetNodeLevels());
+		return root_ptr ? get_stats(0, root_ptr) : NodeVoxelStats<Word>{};
+	}
+	inline uint64_t CountVoxels(NodePointer<Word> root_ptr) { return GetVoxelStats(root_ptr).count; }
+	// Voxels in [aabb_min, aabb_max)
+	inline uint64_t CountVoxels(NodePointer<Word> root_ptr, const glm::vec<3, Word> &aabb_min,
+	                            const glm::vec<3, Word> &aabb_max) {
+		m_level_stats.resize(get_config().GetNodeLevels());
+		return count_voxels(0, root_ptr, {}, aabb_min, aabb_max);
+	}
+	// Inclusive voxel bounds, std::nullopt if empty
+	inline std::optional<std::pair<glm::vec<3, Word>, glm::vec<3, Word>>> BoundingBox(NodePointer<Word> root_ptr) {
+		if (!root_ptr)
+			return std::nullopt;
+		auto stats = GetVoxelStats(root_ptr);
+		return std::pair{stats.lower, stats.upper};
+	}
+	// The k-th voxel (from 0) in the order of child indices at each level, std::nullopt if k >= voxel count
+	inline std::optional<glm::vec<3, Word>> GetKthVoxel(NodePointer<Word> root_ptr, uint64_t k) {
+		if (k >= CountVoxels(root_ptr))
+			return std::nullopt;
+		NodeCoord<Word> coord = {.level = 0, .pos = {}};
+		NodePointer<Word> node_ptr = root_ptr;
+		while (!is_leaf_level(coord.level)) {
+			auto unpacked_node = get_node_pool().get_unpacked_node_array(node_ptr);
+			for (Word i = 0; i < 8; ++i) {
+				NodePointer<Word> child{unpacked_node[1 + i]};
+				if (!child)
+					continue;
+				uint64_t child_count = get_stats(coord.level + 1, child).count;
+				if (k < child_count) {
+					node_ptr = child;
+					coord = coord.GetChildCoord(i);
+					break;
+				}
+				k -= child_count;
+			}
+		}
+		uint64_t bits = NodePoolBase<Derived, Word>::get_leaf_bits(get_node_pool().get_leaf_array(node_ptr));
+		for (; k; --k)
+			bits &= bits - 1u;
+		return coord.GetLeafCoord(std::countr_zero(bits)).pos;
+	}
+};
+
+} // namespace hashdag
+
+#endif // VKHASHDAG_NODEPOOLVOXELCOUNT_HPP
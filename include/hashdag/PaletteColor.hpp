@@ -0,0 +1,140 @@
+//
+// Created by adamyuan on 6/9/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_PALETTECOLOR_HPP
+#define VKHASHDAG_PALETTECOLOR_HPP
+
+#include "VBRColor.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <optional>
+
+namespace hashdag {
+
+struct PaletteInfo {
+	static constexpr uint32_t kMaxBitsPerIndex = 4u;
+	static constexpr uint32_t kMaxColorCount = 1u << kMaxBitsPerIndex;
+};
+
+// A leaf of at most 16 RGB8 colors, with a packed palette index for each voxel in Morton order
+// Like the last block of a VBRChunk, the last index extends to the end of the macro blocks
+template <std::unsigned_integral Word, template <typename> typename Container> class PaletteChunk {
+private:
+	static constexpr uint32_t kVoxelBitsPerMacroBlock = VBRInfo::kVoxelBitsPerMacroBlock;
+
+	uint32_t m_macro_block_count{}, m_index_count{};
+	Container<uint32_t> m_colors{};
+	VBRBitset<Word, Container> m_index_bits;
+
+	static_assert(VBRContainer<Container<uint32_t>, uint32_t>);
+
+	template <std::unsigned_integral, template <typename> typename> friend class PaletteChunk;
+
+public:
+	inline PaletteChunk() = default;
+	template <template <typename> typename SrcContainer>
+	inline explicit PaletteChunk(const PaletteChunk<Word, SrcContainer> &src)
+	    : m_macro_block_count{src.m_macro_block_count}, m_index_count{src.m_index_count}, m_colors{src.m_colors},
+	      m_index_bits{src.m_index_bits} {}
+
+	inline PaletteChunk(uint32_t macro_block_count, uint32_t index_count, Container<uint32_t> colors,
+	                    VBRBitset<Word, Container> index_bits)
+	    : m_macro_block_count{macro_block_count}, m_index_count{index_count}, m_colors{std::move(colors)},
+	      m_index_bits{std::move(index_bits)} {}
+
+	inline static uint32_t GetBitsPerIndex(uint32_t color_count) {
+		return color_count > 1u ? std::bit_width(color_count - 1u) : 0u;
+	}
+
+	inline bool Empty() const { return m_index_count == 0; }
+	inline uint32_t GetMacroBlockCount() const { return m_macro_block_count; }
+	inline uint32_t GetIndexCount() const { return m_index_count; }
+	inline uint32_t GetBitsPerIndex() const { return GetBitsPerIndex(m_colors.size()); }
+	inline const auto &GetColors() const { return m_colors; }
+	inline const auto &GetIndexBits() const { return m_index_bits; }
+
+	// Same as VBRChunk::GetColor() of the chunk it is encoded from
+	inline VBRColor GetColor(uint32_t voxel_index) const {
+		if (Empty() || (voxel_index >> kVoxelBitsPerMacroBlock) >= m_macro_block_count)
+			return {};
+		uint32_t bits_per_index = GetBitsPerIndex();
+		uint32_t index =
+		    bits_per_index ? m_index_bits.Get(std::min(voxel_index, m_index_count - 1u) * bits_per_index, bits_per_index)
+		                   : 0u;
+		return RGB8Color{m_colors[index]};
+	}
+	// Runs of the indices as a VBRChunk, for editing
+	inline VBRChunk<Word, VBRWriterContainer> ToVBR() const {
+		VBRChunkWriter<Word, VBRWriterContainer> writer;
+		if (Empty())
+			return writer.Flush();
+		uint32_t bits_per_index = GetBitsPerIndex(), voxel_count = m_macro_block_count << kVoxelBitsPerMacroBlock;
+		const auto get_index = [&](uint32_t i) {
+			return bits_per_index ? uint32_t(m_index_bits.Get(i * bits_per_index, bits_per_index)) : 0u;
+		};
+		for (uint32_t i = 0, run; i < m_index_count; i += run) {
+			uint32_t index = get_index(i);
+			for (run = 1; i + run < m_index_count && get_index(i + run) == index; ++run)
+				;
+			writer.Push(RGB8Color{m_colors[index]}, i + run == m_index_count ? voxel_count - i : run);
+		}
+		return writer.Flush();
+	}
+};
+
+// Encodes a VBRChunk of only RGB8 blocks with at most 16 colors as a PaletteChunk, if it takes fewer bits
+template <std::unsigned_integral Word, template <typename> typename Container>
+inline std::optional<PaletteChunk<Word, VBRWriterContainer>> EncodePaletteChunk(const VBRChunk<Word, Container> &chunk) {
+	const auto &macro_blocks = chunk.GetMacroBlocks();
+	const auto &block_headers = chunk.GetBlockHeaders();
+	if (block_headers.empty())
+		return std::nullopt;
+
+	VBRWriterContainer<uint32_t> colors;
+	for (std::size_t b = 0; b < block_headers.size(); ++b) {
+		if (block_headers[b].GetBitsPerWeight())
+			return std::nullopt;
+		uint32_t color = RGB8Color{block_headers[b].colors}.GetData();
+		if (std::ranges::find(colors, color) == colors.end()) {
+			if (colors.size() == PaletteInfo::kMaxColorCount)
+				return std::nullopt;
+			colors.push_back(color);
+		}
+	}
+
+	// Indices up to the first voxel of the last block
+	uint32_t last_macro_id = macro_blocks.size() - 1u;
+	uint32_t index_count = (last_macro_id << VBRInfo::kVoxelBitsPerMacroBlock) +
+	                       block_headers.back().GetVoxelIndexOffset() + 1u,
+	         bits_per_index = PaletteChunk<Word, VBRWriterContainer>::GetBitsPerIndex(colors.size());
+	std::size_t palette_bits = colors.size() * 32u + std::size_t(index_count) * bits_per_index,
+	            vbr_bits = (macro_blocks.size() * sizeof(VBRMacroBlock) + block_headers.size() * sizeof(VBRBlockHeader) +
+	                        chunk.GetWeightBits().GetWords().size() * sizeof(Word)) *
+	                       8u;
+	if (palette_bits >= vbr_bits)
+		return std::nullopt;
+
+	VBRBitsetWriter<Word> index_bits;
+	for (uint32_t macro_id = 0; macro_id < macro_blocks.size(); ++macro_id) {
+		uint32_t first_block = macro_blocks[macro_id].first_block,
+		         last_block = macro_id == last_macro_id ? block_headers.size() : macro_blocks[macro_id + 1].first_block;
+		for (uint32_t b = first_block; b < last_block; ++b) {
+			uint32_t offset = block_headers[b].GetVoxelIndexOffset(),
+			         next_offset = b + 1 == last_block ? VBRInfo::kVoxelsPerMacroBlock
+			                                           : block_headers[b + 1].GetVoxelIndexOffset();
+			if (b + 1 == block_headers.size())
+				next_offset = offset + 1u;
+			uint32_t index = std::ranges::find(colors, RGB8Color{block_headers[b].colors}.GetData()) - colors.begin();
+			index_bits.Push(index, bits_per_index, next_offset - offset);
+		}
+	}
+	return PaletteChunk<Word, VBRWriterContainer>{uint32_t(macro_blocks.size()), index_count, std::move(colors),
+	                                              index_bits.Flush()};
+}
+
+} // namespace hashdag
+
+#endif // VKHASHDAG_PALETTECOLOR_HPP
@@ -0,0 +1,121 @@
+//
+// Created by adamyuan on 6/3/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_STATICDAG_HPP
+#define VKHASHDAG_STATICDAG_HPP
+
+#include "NodePool.hpp"
+#include "NodePoolTraversal.hpp"
+
+#include <algorithm>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace hashdag {
+
+// A read-only DAG packed level by level without buckets or page padding
+// Nodes use the encoding of NodePoolBase (mirrors baked out), so the words can be uploaded for the trace shader as is
+template <std::unsigned_integral Word> class StaticDAG : public NodePoolTraversal<StaticDAG<Word>, Word> {
+private:
+	Word m_node_levels{};
+	std::vector<Word> m_level_bases, m_words;
+
+	// Unique node words of a level, children are offsets into the next level
+	struct LevelBuilder {
+		std::vector<Word> words;
+		std::unordered_multimap<Word, Word> hash_offsets;
+
+		inline Word Insert(std::span<const Word> node_span) {
+			Word hash = MurmurHasher32{}(node_span);
+			auto [it, end] = hash_offsets.equal_range(hash);
+			for (; it != end; ++it)
+				if (std::equal(node_span.begin(), node_span.end(), words.begin() + it->second))
+					return it->second;
+			Word offset = words.size();
+			words.insert(words.end(), node_span.begin(), node_span.end());
+			hash_offsets.emplace(hash, offset);
+			return offset;
+		}
+	};
+
+public:
+	inline StaticDAG() = default;
+	inline StaticDAG(Word node_levels, std::vector<Word> level_bases, std::vector<Word> words)
+	    : m_node_levels{node_levels}, m_level_bases{std::move(level_bases)}, m_words{std::move(words)} {}
+
+	template <typename Derived>
+	inline static StaticDAG Export(const NodePoolBase<Derived, Word> &node_pool, NodePointer<Word> root_ptr) {
+		static_assert(sizeof(Word) == sizeof(uint32_t));
+		Word node_levels = node_pool.GetConfig().GetNodeLevels();
+		if (!root_ptr)
+			return StaticDAG{node_levels, std::vector<Word>(node_levels, 0), {}};
+
+		// Collect the (mirrored) node pointers of each level
+		std::vector<std::vector<Word>> level_nodes(node_levels);
+		level_nodes[0].push_back(*root_ptr);
+		for (Word level = 0; level + 1 < node_levels; ++level) {
+			std::vector<Word> &child_nodes = level_nodes[level + 1];
+			for (Word node : level_nodes[level]) {
+				std::array<Word, 9> unpacked_node = node_pool.get_unpacked_node_array(node);
+				for (Word i = 1; i < 9; ++i)
+					if (NodePointer<Word>{unpacked_node[i]})
+						child_nodes.push_back(unpacked_node[i]);
+			}
+			std::sort(child_nodes.begin(), child_nodes.end());
+			child_nodes.erase(std::unique(child_nodes.begin(), child_nodes.end()), child_nodes.end());
+		}
+
+		// Pack from bottom to top, so that nodes with identical content after renumbering are merged
+		std::vector<LevelBuilder> builders(node_levels);
+		std::vector<Word> child_offsets, offsets;
+		for (Word level = node_levels - 1; ~level; --level) {
+			const std::vector<Word> &nodes = level_nodes[level];
+			offsets.resize(nodes.size());
+			if (level == node_levels - 1) {
+				for (std::size_t i = 0; i < nodes.size(); ++i)
+					offsets[i] = builders[level].Insert(node_pool.get_leaf_array(nodes[i]));
+			} else {
+				const std::vector<Word> &child_nodes = level_nodes[level + 1];
+				for (std::size_t i = 0; i < nodes.size(); ++i) {
+					std::array<Word, 9> unpacked_node = node_pool.get_unpacked_node_array(nodes[i]);
+					for (Word c = 1; c < 9; ++c)
+						if (NodePointer<Word>{unpacked_node[c]})
+							unpacked_node[c] = child_offsets[std::lower_bound(child_nodes.begin(), child_nodes.end(),
+							                                                  unpacked_node[c]) -
+							                                 child_nodes.begin()];
+					offsets[i] = builders[level].Insert(NodePoolBase<Derived, Word>::get_packed_node_inplace(unpacked_node));
+				}
+			}
+			std::swap(offsets, child_offsets);
+		}
+
+		// Concatenate levels and turn child offsets into absolute word offsets
+		std::vector<Word> level_bases(node_levels), words;
+		for (Word level = 0; level < node_levels; ++level) {
+			level_bases[level] = words.size();
+			words.insert(words.end(), builders[level].words.begin(), builders[level].words.end());
+		}
+		for (Word level = 0; level + 1 < node_levels; ++level) {
+			for (Word node = level_bases[level]; node < level_bases[level + 1];) {
+				Word node_words = NodePoolBase<Derived, Word>::get_inner_node_words(words.data() + node);
+				for (Word i = 1; i < node_words; ++i)
+					words[node + i] += level_bases[level + 1];
+				node += node_words;
+			}
+		}
+		return StaticDAG{node_levels, std::move(level_bases), std::move(words)};
+	}
+
+	inline Word GetNodeLevels() const { return m_node_levels; }
+	inline const Word *ReadNode(Word node) const { return m_words.data() + node; }
+	inline NodePointer<Word> GetRoot() const { return m_words.empty() ? NodePointer<Word>::Null() : NodePointer<Word>{0}; }
+	inline const std::vector<Word> &GetWords() const { return m_words; }
+	inline const std::vector<Word> &GetLevelBases() const { return m_level_bases; }
+};
+
+} // namespace hashdag
+
+#endif // VKHASHDAG_STATICDAG_HPP
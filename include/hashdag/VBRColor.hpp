@@ -9,9 +9,13 @@
 #include "Color.hpp"
 
 #include <algorithm>
+#include <array>
 #include <bit>
+#include <cassert>
 #include <concepts>
 #include <iostream>
+#include <span>
+#include <tuple>
 #include <vector>
 
 namespace hashdag {
@@ -91,6 +95,29 @@ public:
 		Word w1 = m_bits[(index >> kWordMaskBits) + 1] & ((Word(1) << (bits + offset - kWordBits)) - Word(1));
 		return w0 | (w1 << (kWordBits - offset));
 	}
+	// Sum of count values of 1 to 3 bits from bit index, by a popcount for each bit of the values per word
+	inline std::size_t GetSum(std::size_t index, Word bits, std::size_t count) const {
+		assert(bits >= 1 && bits <= 3);
+		// masks[t] has the bits i of a word with i % bits == t
+		std::array<Word, 3> masks{};
+		for (Word i = 0; i < kWordBits; ++i)
+			masks[i % bits] |= Word(1) << i;
+
+		std::size_t end = index + count * bits, sum = 0;
+		for (std::size_t word_id = index >> kWordMaskBits; (word_id << kWordMaskBits) < end; ++word_id) {
+			std::size_t word_begin = word_id << kWordMaskBits;
+			Word word = m_bits[word_id];
+			if (word_begin < index)
+				word &= ~Word(0) << (index - word_begin);
+			if (end - word_begin < kWordBits)
+				word &= (Word(1) << (end - word_begin)) - Word(1);
+			// Bit i of the word is bit (i + phase) % bits of a value
+			Word phase = (word_begin % bits + bits - index % bits) % bits;
+			for (Word j = 0; j < bits; ++j)
+				sum += std::size_t(std::popcount(Word(word & masks[(j + bits - phase) % bits]))) << j;
+		}
+		return sum;
+	}
 };
 
 template <std::unsigned_integral Word> class VBRBitsetWriter {
@@ -101,13 +128,76 @@ private:
 	VBRWriterContainer<Word> m_bits;
 	std::size_t m_bit_count = 0;
 
+	// bits in [0, kWordBits]
+	inline static Word get_low_bits(Word word, Word bits) {
+		return bits < kWordBits ? Word(word & ((Word(1) << bits) - Word(1))) : word;
+	}
+	// bits in [1, kWordBits], only reads the words covering the bits
+	inline static Word get_bits(const auto &src_words, std::size_t index, Word bits) {
+		Word offset = index & kWordMask;
+		Word w0 = Word(src_words[index >> kWordMaskBits] >> offset);
+		if (offset + bits <= kWordBits)
+			return get_low_bits(w0, bits);
+		Word w1 = src_words[(index >> kWordMaskBits) + 1];
+		return get_low_bits(Word(w0 | Word(w1 << (kWordBits - offset))), bits);
+	}
+	// Appends src_bits bits of src_words from src_begin
+	inline void copy_words(const auto &src_words, std::size_t src_begin, std::size_t src_bits) {
+		if (src_bits == 0)
+			return;
+
+		Word bit_offset = m_bit_count & kWordMask;
+		m_bit_count += src_bits;
+		if (bit_offset) {
+			Word head_bits = std::min<std::size_t>(kWordBits - bit_offset, src_bits);
+			m_bits.back() |= Word(get_bits(src_words, src_begin, head_bits) << bit_offset);
+			src_begin += head_bits;
+			if ((src_bits -= head_bits) == 0)
+				return;
+		}
+
+		// Destination is word-aligned from here, each full word is a funnel shift of 2 source words
+		std::size_t word_idx = m_bits.size(), full_count = src_bits >> kWordMaskBits;
+		Word tail_bits = src_bits & kWordMask;
+		m_bits.resize(word_idx + full_count + (tail_bits ? 1 : 0));
+		Word *p_words = m_bits.data() + word_idx;
+
+		std::size_t src_word_idx = src_begin >> kWordMaskBits;
+		Word shr = src_begin & kWordMask;
+		if (shr == 0) {
+			for (std::size_t i = 0; i < full_count; ++i)
+				p_words[i] = src_words[src_word_idx + i];
+		} else if constexpr (kWordBits < 64) {
+			for (std::size_t i = 0; i < full_count; ++i)
+				p_words[i] = Word(((uint64_t(src_words[src_word_idx + i + 1]) << kWordBits) |
+				                   uint64_t(src_words[src_word_idx + i])) >>
+				                  shr);
+		} else {
+			Word shl = kWordBits - shr;
+			for (std::size_t i = 0; i < full_count; ++i)
+				p_words[i] = (src_words[src_word_idx + i] >> shr) | (src_words[src_word_idx + i + 1] << shl);
+		}
+		if (tail_bits)
+			p_words[full_count] = get_bits(src_words, src_begin + (full_count << kWordMaskBits), tail_bits);
+	}
+
 public:
 	inline std::size_t GetBitCount() const { return m_bit_count; }
 	inline VBRBitset<Word, VBRWriterContainer> Flush() {
 		return VBRBitset<Word, VBRWriterContainer>{std::move(m_bits)};
 	}
+	// Starts over, the words keep their capacity
+	inline void Clear() {
+		m_bits.clear();
+		m_bit_count = 0;
+	}
+	// Takes back the words of a flushed bitset, so that their capacity is reused
+	inline void Recycle(VBRBitset<Word, VBRWriterContainer> &&flushed) {
+		m_bits = std::move(flushed.m_bits);
+		Clear();
+	}
 
-	// unit bits = 0, 1, 2, 3 is guaranteed for VBR
+	// unit bits = 0, 1, 2, 3 is guaranteed for VBR, palette indices also take 4
 	inline void Push(Word word, Word bits) {
 		if (bits == 0)
 			return;
@@ -123,10 +213,6 @@ public:
 		if (count == 0 || bits == 0)
 			return;
 
-		Word bit_offset = m_bit_count & kWordMask;
-		if (bit_offset == 0)
-			m_bits.emplace_back();
-
 		Word full_word = word | (word << bits);
 		for (Word i = 1; (bits << i) < kWordBits; ++i)
 			full_word |= full_word << Word(bits << i);
@@ -135,95 +221,49 @@ public:
 			return r ? (Word(full_word >> r) | Word(full_word << (Word(kWordBits / bits) * bits - r))) : full_word;
 		};
 
-		std::size_t remain_bits = bits * count, last_bits;
-		m_bits.back() |= full_word << bit_offset;
-		if (remain_bits + bit_offset <= kWordBits)
-			last_bits = remain_bits + bit_offset;
-		else {
-			remain_bits -= kWordBits - bit_offset;
-			last_bits = remain_bits;
-
-			std::size_t word_count = (remain_bits >> kWordMaskBits) + ((remain_bits & kWordMask) ? 1 : 0);
-			Word r_rot = (kWordBits - bit_offset) % bits;
-			if (bits == 3) {
-				Word rotr_full_words[3] = {
-				    get_rotr_full_word(0),
-				    get_rotr_full_word(1),
-				    get_rotr_full_word(2),
-				};
-				for (uint32_t i = 0; i < word_count; ++i) {
-					m_bits.push_back(rotr_full_words[r_rot]);
-					static_assert(kWordBits % 3 != 0);
-					r_rot = (r_rot + (kWordBits % 3)) % 3;
-				}
-			} else {
-				// bits == 1 or 2, so that kWordBits % bits == 0 and all bits are same across words
-				m_bits.resize(m_bits.size() + word_count, get_rotr_full_word(r_rot));
-			}
-		}
-		// Mask out exceeded bits
-		if ((last_bits &= kWordMask))
-			m_bits.back() &= (Word(1) << last_bits) - Word(1);
-
-		m_bit_count += bits * count;
-	}
-
-	template <template <typename> typename SrcContainer>
-	inline void Copy(const VBRBitset<Word, SrcContainer> &src, std::size_t src_begin, std::size_t src_bits) {
-		if (src_bits == 0)
-			return;
-
-		Word bit_offset = m_bit_count & kWordMask, src_bit_offset = src_begin & kWordMask;
-		if (bit_offset == 0)
-			m_bits.emplace_back();
-
-		std::size_t word_count = 0, last_bits; // Additional words
-
-		if (bit_offset + src_bits <= kWordBits)
-			last_bits = src_bits + bit_offset;
-		else {
-			std::size_t remain_bits = src_bits - (kWordBits - bit_offset);
-			last_bits = remain_bits;
-			word_count = std::size_t(remain_bits >> kWordMaskBits) + std::size_t((remain_bits & kWordMask) ? 1 : 0);
-			// printf("SB = %zu, RB = %zu, WC = %zu\n", src_bits, remain_bits, word_count);
+		std::size_t remain_bits = bits * count;
+		Word bit_offset = m_bit_count & kWordMask;
+		m_bit_count += remain_bits;
+		if (bit_offset) {
+			Word head_bits = std::min<std::size_t>(kWordBits - bit_offset, remain_bits);
+			m_bits.back() |= Word(get_low_bits(full_word, head_bits) << bit_offset);
+			if ((remain_bits -= head_bits) == 0)
+				return;
 		}
 
-		std::size_t word_idx = m_bits.size() - 1;
-		m_bits.resize(m_bits.size() + word_count);
-
-		std::size_t src_word_idx = src_begin >> kWordMaskBits;
-		if (bit_offset == src_bit_offset) {
-			m_bits[word_idx++] |= Word(src.m_bits[src_word_idx++] >> bit_offset) << bit_offset;
-			for (std::size_t i = 0; i < word_count; ++i)
-				m_bits[word_idx++] = src.m_bits[src_word_idx++];
-		} else if (src_bit_offset < bit_offset) {
-			Word prev_word = src.m_bits[src_word_idx++];
-			m_bits[word_idx++] |= (prev_word >> src_bit_offset) << bit_offset;
-			Word shl = bit_offset - src_bit_offset, prev_shr = kWordBits - shl;
-			for (std::size_t i = 0; i < word_count; ++i) {
-				Word word = src_word_idx == src.m_bits.size() ? Word(0) : src.m_bits[src_word_idx++];
-				m_bits[word_idx++] = (prev_word >> prev_shr) | (word << shl);
-				prev_word = word;
+		// The first new word starts at phase r_rot of the pattern
+		Word r_rot = (kWordBits - bit_offset) % kWordBits % bits;
+		std::size_t word_idx = m_bits.size(), word_count = (remain_bits + kWordMask) >> kWordMaskBits;
+		if (bits == 3) {
+			// Phases repeat every 3 words
+			static_assert(kWordBits % 3 != 0);
+			Word rotr_full_words[3];
+			for (Word i = 0; i < 3; ++i, r_rot = (r_rot + (kWordBits % 3)) % 3)
+				rotr_full_words[i] = get_rotr_full_word(r_rot);
+			m_bits.resize(word_idx + word_count);
+			Word *p_words = m_bits.data() + word_idx;
+			std::size_t i = 0;
+			for (; i + 3 <= word_count; i += 3) {
+				p_words[i] = rotr_full_words[0];
+				p_words[i + 1] = rotr_full_words[1];
+				p_words[i + 2] = rotr_full_words[2];
 			}
+			for (Word j = 0; i < word_count; ++i, ++j)
+				p_words[i] = rotr_full_words[j];
 		} else {
-			// src_bit_offset > bit_offset
-			Word word = src.m_bits[src_word_idx++];
-			Word next_word = src_word_idx == src.m_bits.size() ? Word(0) : src.m_bits[src_word_idx++];
-			Word shr = src_bit_offset - bit_offset, next_shl = kWordBits - shr;
-			m_bits[word_idx++] |= ((word >> src_bit_offset) << bit_offset) | (next_word << next_shl);
-			for (std::size_t i = 0; i < word_count; ++i) {
-				word = next_word;
-				next_word = src_word_idx == src.m_bits.size() ? Word(0) : src.m_bits[src_word_idx++];
-				m_bits[word_idx++] = (word >> shr) | (next_word << next_shl);
-			}
+			// bits == 1, 2 or 4 (palette indices), so that kWordBits % bits == 0 and all bits are same across words
+			m_bits.resize(word_idx + word_count, get_rotr_full_word(r_rot));
 		}
-
 		// Mask out exceeded bits
-		if ((last_bits &= kWordMask))
-			m_bits.back() &= (Word(1) << last_bits) - Word(1);
+		m_bits.back() = get_low_bits(m_bits.back(), ((remain_bits - 1u) & kWordMask) + 1u);
+	}
 
-		m_bit_count += src_bits;
+	template <template <typename> typename SrcContainer>
+	inline void Copy(const VBRBitset<Word, SrcContainer> &src, std::size_t src_begin, std::size_t src_bits) {
+		copy_words(src.m_bits, src_begin, src_bits);
 	}
+	// Appends the bits written by another writer
+	inline void Append(const VBRBitsetWriter &src) { copy_words(src.m_bits, 0, src.m_bit_count); }
 };
 
 // Variable Bitrate Block Encoding
@@ -268,6 +308,37 @@ private:
 	template <std::unsigned_integral, template <typename> typename> friend class VBRChunkWriter;
 	template <std::unsigned_integral, template <typename> typename> friend class VBRChunkIterator;
 
+	static constexpr uint32_t kVoxelBitsPerMacroBlock = VBRInfo::kVoxelBitsPerMacroBlock;
+	static constexpr uint32_t kVoxelsPerMacroBlock = VBRInfo::kVoxelsPerMacroBlock;
+
+	inline std::pair<uint32_t, uint32_t> get_macro_block_range(uint32_t macro_id) const {
+		return {m_macro_blocks[macro_id].first_block, macro_id + 1u < m_macro_blocks.size()
+		                                                  ? m_macro_blocks[macro_id + 1u].first_block
+		                                                  : uint32_t(m_block_headers.size())};
+	}
+	// The last block in [first_block, last_block) starting at or before voxel_offset, first_block must start at or
+	// before it
+	inline uint32_t find_block(uint32_t first_block, uint32_t last_block, uint32_t voxel_offset) const {
+		for (uint32_t count = last_block - first_block - 1u; count;) {
+			uint32_t step = (count + 1u) >> 1u;
+			if (m_block_headers[first_block + step].GetVoxelIndexOffset() <= voxel_offset)
+				first_block += step, count -= step;
+			else
+				count = step - 1u;
+		}
+		return first_block;
+	}
+	inline VBRColor get_color(uint32_t macro_id, uint32_t block_id, uint32_t voxel_offset) const {
+		const VBRBlockHeader &block = m_block_headers[block_id];
+		uint32_t weight_bits = block.GetBitsPerWeight();
+		if (weight_bits == 0)
+			return {RGB8Color(block.colors)};
+		uint32_t weight_index = m_macro_blocks[macro_id].weight_start + block.GetWeightOffset() +
+		                        (voxel_offset - block.GetVoxelIndexOffset()) * weight_bits;
+		return VBRColor{R5G6B5Color(block.colors), R5G6B5Color(block.colors >> 16u),
+		                (uint8_t)m_weight_bits.Get(weight_index, weight_bits), (uint8_t)weight_bits};
+	}
+
 public:
 	inline VBRChunk() = default;
 	template <template <typename> typename SrcContainer>
@@ -287,6 +358,68 @@ public:
 	inline const auto &GetMacroBlocks() const { return m_macro_blocks; }
 	inline const auto &GetBlockHeaders() const { return m_block_headers; }
 	inline const auto &GetWeightBits() const { return m_weight_bits; }
+
+	// Random access in O(log n) like Color_GetLeafColor() of trace.frag, an empty VBRColor if voxel_index is out of the
+	// macro blocks
+	inline VBRColor GetColor(uint32_t voxel_index) const {
+		uint32_t macro_id = voxel_index >> kVoxelBitsPerMacroBlock;
+		if (macro_id >= m_macro_blocks.size())
+			return {};
+		uint32_t voxel_offset = voxel_index & (kVoxelsPerMacroBlock - 1u);
+		auto [first_block, last_block] = get_macro_block_range(macro_id);
+		return get_color(macro_id, find_block(first_block, last_block, voxel_offset), voxel_offset);
+	}
+	// Colors of ascending voxel indices, galloping from the previous block instead of a full binary search
+	inline void GetColors(std::span<const uint32_t> sorted_voxel_indices, std::span<VBRColor> colors) const {
+		uint32_t macro_id = -1, block_id = 0, last_block = 0;
+		for (std::size_t i = 0; i < sorted_voxel_indices.size(); ++i) {
+			uint32_t voxel_index = sorted_voxel_indices[i], voxel_macro_id = voxel_index >> kVoxelBitsPerMacroBlock;
+			if (voxel_macro_id >= m_macro_blocks.size()) {
+				std::fill(colors.begin() + i, colors.end(), VBRColor{});
+				return;
+			}
+			if (voxel_macro_id != macro_id) {
+				macro_id = voxel_macro_id;
+				std::tie(block_id, last_block) = get_macro_block_range(macro_id);
+			}
+			uint32_t voxel_offset = voxel_index & (kVoxelsPerMacroBlock - 1u), step = 1;
+			while (block_id + step < last_block && m_block_headers[block_id + step].GetVoxelIndexOffset() <= voxel_offset)
+				step <<= 1u;
+			block_id = find_block(block_id + (step >> 1u), std::min(block_id + step, last_block), voxel_offset);
+			colors[i] = get_color(macro_id, block_id, voxel_offset);
+		}
+	}
+	// Sum of the colors of a macro block in a chunk of voxel_count voxels, the last block of the chunk ends at
+	// voxel_count
+	inline glm::dvec3 GetMacroBlockColorSum(uint32_t macro_id, uint32_t voxel_count) const {
+		auto [first_block, last_block] = get_macro_block_range(macro_id);
+		uint32_t macro_begin = macro_id << kVoxelBitsPerMacroBlock,
+		         macro_end = macro_id + 1u < m_macro_blocks.size() ? macro_begin + kVoxelsPerMacroBlock : voxel_count;
+		glm::dvec3 sum{0};
+		for (uint32_t block_id = first_block; block_id < last_block; ++block_id) {
+			const VBRBlockHeader &block = m_block_headers[block_id];
+			uint32_t begin = macro_begin + block.GetVoxelIndexOffset(),
+			         end = block_id + 1u < last_block ? macro_begin + m_block_headers[block_id + 1u].GetVoxelIndexOffset()
+			                                          : macro_end;
+			uint32_t count = end - begin, weight_bits = block.GetBitsPerWeight();
+			if (weight_bits == 0) {
+				sum += glm::dvec3{RGB8Color(block.colors).Get()} * double(count);
+				continue;
+			}
+			std::size_t weight_sum = m_weight_bits.GetSum(
+			    m_macro_blocks[macro_id].weight_start + block.GetWeightOffset(), weight_bits, count);
+			glm::dvec3 left{R5G6B5Color(block.colors).Get()}, right{R5G6B5Color(block.colors >> 16u).Get()};
+			sum += left * double(count) + (right - left) * (double(weight_sum) / double((1u << weight_bits) - 1u));
+		}
+		return sum;
+	}
+	// Sum of the colors of a chunk of voxel_count voxels, in a pass over its headers and weight words
+	inline glm::dvec3 GetColorSum(uint32_t voxel_count) const {
+		glm::dvec3 sum{0};
+		for (uint32_t macro_id = 0; macro_id < m_macro_blocks.size(); ++macro_id)
+			sum += GetMacroBlockColorSum(macro_id, voxel_count);
+		return sum;
+	}
 };
 
 template <std::unsigned_integral Word, template <typename> typename Container> class VBRChunkIterator {
@@ -346,6 +479,14 @@ public:
 			next_block();
 		return ret;
 	}
+	// Moves to voxel_index directly, by a binary search in its macro block
+	inline void Seek(uint32_t voxel_index) {
+		m_macro_id = std::min(voxel_index >> kVoxelBitsPerMacroBlock, uint32_t(m_chunk.m_macro_blocks.size()) - 1u);
+		uint32_t voxel_offset = voxel_index - (m_macro_id << kVoxelBitsPerMacroBlock);
+		auto [first_block, last_block] = m_chunk.get_macro_block_range(m_macro_id);
+		m_block_id = m_chunk.find_block(first_block, last_block, voxel_offset);
+		m_block_offset = voxel_offset - GetBlockHeader().GetVoxelIndexOffset();
+	}
 	inline void Jump(uint32_t count) {
 		Jump(count, [](auto &&, auto &&) {});
 	}
@@ -381,6 +522,18 @@ private:
 	VBRChunkIterator<Word, Container> m_src_iterator;
 	uint32_t m_voxel_count = 0;
 
+	// Macro blocks of the source that may be changed, in increasing order
+	VBRWriterContainer<uint32_t> m_dirty_macro_blocks;
+	uint32_t m_src_voxel_begin = 0;
+
+	inline void mark_dirty(uint32_t voxel_count) {
+		uint32_t src_voxel_index = m_src_voxel_begin + m_voxel_count;
+		for (uint32_t macro_id = src_voxel_index >> kVoxelBitsPerMacroBlock;
+		     macro_id <= (src_voxel_index + voxel_count - 1u) >> kVoxelBitsPerMacroBlock; ++macro_id)
+			if (m_dirty_macro_blocks.empty() || m_dirty_macro_blocks.back() < macro_id)
+				m_dirty_macro_blocks.push_back(macro_id);
+	}
+
 	inline void append(uint32_t colors, uint32_t bits_per_weight, uint32_t voxel_count, uint32_t &weight_start) {
 		for (uint32_t i = 0; i < voxel_count;) {
 			uint32_t voxel_index = m_voxel_count + i;
@@ -442,6 +595,9 @@ private:
 		m_weight_bits.Copy(m_src_iterator.GetChunk().m_weight_bits, src_weight_start, weight_start - prev_weight_start);
 	}
 	inline void push(VBRColor color, uint32_t count) {
+		if (count == 0)
+			return;
+		mark_dirty(count);
 		uint32_t weight_start = m_weight_bits.GetBitCount();
 		append(color.GetColors(), color.GetBitsPerWeight(), count, weight_start);
 		m_weight_bits.Push(color.GetWeight(), color.GetBitsPerWeight(), count);
@@ -458,10 +614,37 @@ public:
 	inline explicit VBRChunkWriter(VBRChunk<Word, Container> &&chunk) : m_src_iterator(std::move(chunk)) {}
 
 	inline uint32_t GetVoxelCount() const { return m_voxel_count; }
+	// Bits of the written chunk, like GetVBRChunkBits() of the flushed one but without padding the weights to words
+	inline std::size_t GetBitCount() const {
+		return (m_macro_blocks.size() * sizeof(VBRMacroBlock) + m_block_headers.size() * sizeof(VBRBlockHeader)) * 8u +
+		       m_weight_bits.GetBitCount();
+	}
+	// Macro blocks of the source that may be changed, in increasing order
+	// If the flushed chunk has the same macro blocks as the source, the others are identical
+	inline const auto &GetDirtyMacroBlocks() const { return m_dirty_macro_blocks; }
 	inline VBRChunk<Word, VBRWriterContainer> Flush() {
 		return VBRChunk<Word, VBRWriterContainer>{std::move(m_macro_blocks), std::move(m_block_headers),
 		                                          m_weight_bits.Flush()};
 	}
+	// Starts over on chunk from src_voxel_index, the containers keep their capacity
+	inline void Reset(VBRChunk<Word, Container> chunk, uint32_t src_voxel_index = 0) {
+		m_macro_blocks.clear();
+		m_block_headers.clear();
+		m_weight_bits.Clear();
+		m_src_iterator = VBRChunkIterator<Word, Container>{std::move(chunk)};
+		if (src_voxel_index && !m_src_iterator.Empty())
+			m_src_iterator.Seek(src_voxel_index);
+		m_voxel_count = 0;
+		m_dirty_macro_blocks.clear();
+		m_src_voxel_begin = src_voxel_index;
+	}
+	// Takes back the containers of a flushed chunk, so that their capacity is reused
+	inline void Recycle(VBRChunk<Word, VBRWriterContainer> &&flushed) {
+		m_macro_blocks = std::move(flushed.m_macro_blocks);
+		m_block_headers = std::move(flushed.m_block_headers);
+		m_weight_bits.Recycle(std::move(flushed.m_weight_bits));
+		Reset({});
+	}
 	inline void Copy(uint32_t voxel_count, VBRColor empty_color) {
 		if (m_src_iterator.Empty()) {
 			push(empty_color, voxel_count);
@@ -474,13 +657,42 @@ public:
 		if (!m_src_iterator.Empty())
 			m_src_iterator.Jump(voxel_count);
 	}
+	// Appends the voxels written by segment, which started on the source where this writer is now
+	// Segments of disjoint voxel ranges can be written in parallel, then appended in order
+	inline void Append(const VBRChunkWriter &segment) {
+		uint32_t weight_start = m_weight_bits.GetBitCount();
+		for (uint32_t macro_id = 0; macro_id < segment.m_macro_blocks.size(); ++macro_id) {
+			uint32_t first_block = segment.m_macro_blocks[macro_id].first_block,
+			         last_block = macro_id + 1u < segment.m_macro_blocks.size()
+			                          ? segment.m_macro_blocks[macro_id + 1u].first_block
+			                          : uint32_t(segment.m_block_headers.size()),
+			         macro_voxel_count =
+			             std::min(kVoxelsPerMacroBlock, segment.m_voxel_count - (macro_id << kVoxelBitsPerMacroBlock));
+			for (uint32_t block_id = first_block; block_id < last_block; ++block_id) {
+				const VBRBlockHeader &block = segment.m_block_headers[block_id];
+				uint32_t block_end = block_id + 1u < last_block
+				                         ? segment.m_block_headers[block_id + 1u].GetVoxelIndexOffset()
+				                         : macro_voxel_count;
+				append(block.colors, block.GetBitsPerWeight(), block_end - block.GetVoxelIndexOffset(), weight_start);
+			}
+		}
+		m_weight_bits.Append(segment.m_weight_bits);
+		if (!m_src_iterator.Empty())
+			m_src_iterator.Jump(segment.m_voxel_count);
+		for (uint32_t macro_id : segment.m_dirty_macro_blocks)
+			if (m_dirty_macro_blocks.empty() || m_dirty_macro_blocks.back() < macro_id)
+				m_dirty_macro_blocks.push_back(macro_id);
+	}
 	inline auto Edit(std::invocable<VBRColor &> auto &&editor, VBRColor empty_color) {
 		VBRColor color = m_src_iterator.Empty()
 		                     ? empty_color
 		                     : m_src_iterator.Next([](const VBRChunkIterator<Word, Container> &iterator) {
 			                       return iterator.GetColor();
 		                       });
+		VBRColor src_color = color;
 		auto ret = editor(color);
+		if (m_src_iterator.Empty() || color != src_color)
+			mark_dirty(1);
 		push_one(color);
 		return ret;
 	}
@@ -10,9 +10,39 @@
 #include "VBROctree.hpp"
 
 #include <memory>
+#include <vector>
 
 namespace hashdag {
 
+// Thread-local free list of leaf writers
+// A released writer keeps the containers of the chunk it flushed, so that editing a leaf allocates nothing once the
+// pool is warm. A writer may be released on another thread than the one it was acquired on
+template <typename Writer_T> class VBRWriterPool {
+private:
+	std::vector<std::unique_ptr<Writer_T>> m_writers;
+
+	inline static VBRWriterPool &get_thread_pool() {
+		thread_local VBRWriterPool pool;
+		return pool;
+	}
+
+public:
+	template <typename Chunk_T> inline static Writer_T *Acquire(Chunk_T &&chunk, uint32_t src_voxel_index = 0) {
+		auto &writers = get_thread_pool().m_writers;
+		Writer_T *p_writer;
+		if (writers.empty())
+			p_writer = new Writer_T;
+		else {
+			p_writer = writers.back().release();
+			writers.pop_back();
+		}
+		p_writer->Reset(std::forward<Chunk_T>(chunk), src_voxel_index);
+		return p_writer;
+	}
+	inline static void Release(Writer_T *p_writer) { get_thread_pool().m_writers.emplace_back(p_writer); }
+	inline static std::size_t GetFreeCount() { return get_thread_pool().m_writers.size(); }
+};
+
 template <typename T, typename Word>
 concept VBREditor = requires(const T ce) {
 	{
@@ -23,48 +53,68 @@ concept VBREditor = requires(const T ce) {
 	} -> std::convertible_to<bool>;
 } && std::unsigned_integral<Word>;
 
+// Below the octree leaf level, each node proceeding in a leaf writes its voxels into a segment of its own, which is
+// appended to the parent on JoinNode(). So ThreadedEdit() can fork below the leaf level as well
 template <std::unsigned_integral Word, VBREditor<Word> Editor_T, VBROctree<Word> Octree_T> struct VBREditorWrapper {
 	struct NodeState {
 		VBROctreeLeafWriter<Octree_T> *p_writer{nullptr};
 		VBROctreePointer<Octree_T> octree_node{};
+		VBRColor final_color{}; // Below the leaf level, the color of a final node
+		uint32_t voxel_offset{}; // Below the leaf level, the offset of the node in the voxels of its leaf
 		bool is_final{false};
 	};
+	using WriterPool = VBRWriterPool<VBROctreeLeafWriter<Octree_T>>;
 
 	Editor_T editor;
 	Octree_T *p_octree;
 	VBROctreePointer<Octree_T> octree_root;
 
+	inline void flush_writer(NodeState &state) const {
+		auto chunk = state.p_writer->Flush();
+		// An octree can patch only the dirty macro blocks of the leaf
+		if constexpr (requires {
+			              p_octree->SetLeaf(state.octree_node, std::move(chunk), state.p_writer->GetDirtyMacroBlocks());
+		              })
+			state.octree_node =
+			    p_octree->SetLeaf(state.octree_node, std::move(chunk), state.p_writer->GetDirtyMacroBlocks());
+		else
+			state.octree_node = p_octree->SetLeaf(state.octree_node, std::move(chunk));
+		// SetLeaf() copies the chunk into the octree, its containers go back to the writer
+		state.p_writer->Recycle(std::move(chunk));
+		WriterPool::Release(state.p_writer);
+	}
+
 	inline EditType EditNode(const Config<Word> &config, const NodeCoord<Word> &coord, NodePointer<Word> node_ptr,
 	                         NodeState &state, const NodeState &parent_state) const {
+		bool in_leaf = coord.level > p_octree->GetLeafLevel();
 		state.octree_node =
-		    coord.level <= p_octree->GetLeafLevel()
-		        ? (coord.level == 0 ? octree_root : p_octree->GetChild(parent_state.octree_node, coord.GetChildIndex()))
-		        : parent_state.octree_node;
-		state.p_writer = parent_state.p_writer;
+		    in_leaf ? parent_state.octree_node
+		            : (coord.level == 0 ? octree_root : p_octree->GetChild(parent_state.octree_node, coord.GetChildIndex()));
+		state.p_writer = nullptr;
 		state.is_final = parent_state.is_final;
+		state.voxel_offset =
+		    in_leaf ? parent_state.voxel_offset + (coord.GetChildIndex() << ((config.GetVoxelLevel() - coord.level) * 3u))
+		            : 0;
 
 		VBRColor fill_color = p_octree->GetFill(state.octree_node), color = fill_color;
 		EditType edit_type = editor.EditNode(config, coord, node_ptr, color);
 
 		if (!state.is_final) {
-			if (coord.level <= p_octree->GetLeafLevel()) {
+			if (!in_leaf) {
 				if (color) {
 					state.octree_node = p_octree->FillNode(state.octree_node, color);
 					state.is_final = true;
 				} else if (edit_type == EditType::kClear)
 					state.octree_node = p_octree->ClearNode(state.octree_node);
 				else if (edit_type == EditType::kProceed && coord.level == p_octree->GetLeafLevel())
-					state.p_writer = new VBROctreeLeafWriter<Octree_T>(p_octree->GetLeaf(state.octree_node));
-			} else {
-				if (state.p_writer) {
-					uint32_t voxel_count = 1u << ((config.GetVoxelLevel() - coord.level) * 3u);
-					if (color) {
-						state.p_writer->Push(color, voxel_count);
-						state.is_final = true;
-					} else if (edit_type != EditType::kProceed)
-						state.p_writer->Copy(voxel_count, fill_color);
-				}
-			}
+					state.p_writer = WriterPool::Acquire(p_octree->GetLeaf(state.octree_node));
+			} else if (color) {
+				// Pushed by the parent
+				state.final_color = color;
+				state.is_final = true;
+			} else if (edit_type == EditType::kProceed)
+				state.p_writer = WriterPool::Acquire(p_octree->GetLeaf(state.octree_node), state.voxel_offset);
+			// Otherwise copied from the source by the parent
 		}
 
 		return edit_type;
@@ -79,29 +129,36 @@ template <std::unsigned_integral Word, VBREditor<Word> Editor_T, VBROctree<Word>
 		                            p_octree->GetFill(state.octree_node));
 	}
 
-	inline void JoinNode(const Config<Word> &, const NodeCoord<Word> &coord, NodeState &state,
+	inline void JoinNode(const Config<Word> &config, const NodeCoord<Word> &coord, NodeState &state,
 	                     std::span<const NodeState, 8> child_states) const {
-		if (coord.level == p_octree->GetLeafLevel()) {
+		if (coord.level >= p_octree->GetLeafLevel()) {
 			if (state.p_writer) {
-				state.octree_node = p_octree->SetLeaf(state.octree_node, state.p_writer->Flush());
-				delete state.p_writer;
-			}
-		} else if (coord.level < p_octree->GetLeafLevel()) {
-			if (!state.is_final) {
-				std::array<typename Octree_T::Pointer, 8> octree_children = {
-				    child_states[0].octree_node, child_states[1].octree_node, child_states[2].octree_node,
-				    child_states[3].octree_node, child_states[4].octree_node, child_states[5].octree_node,
-				    child_states[6].octree_node, child_states[7].octree_node};
-				state.octree_node = p_octree->SetNode(state.octree_node, octree_children);
+				uint32_t child_voxel_count = 1u << ((config.GetVoxelLevel() - coord.level - 1u) * 3u);
+				for (const NodeState &child_state : child_states) {
+					if (child_state.p_writer) {
+						state.p_writer->Append(*child_state.p_writer);
+						WriterPool::Release(child_state.p_writer);
+					} else if (child_state.is_final)
+						state.p_writer->Push(child_state.final_color, child_voxel_count);
+					else
+						state.p_writer->Copy(child_voxel_count, p_octree->GetFill(child_state.octree_node));
+				}
+				if (coord.level == p_octree->GetLeafLevel())
+					flush_writer(state);
 			}
+		} else if (!state.is_final) {
+			std::array<typename Octree_T::Pointer, 8> octree_children = {
+			    child_states[0].octree_node, child_states[1].octree_node, child_states[2].octree_node,
+			    child_states[3].octree_node, child_states[4].octree_node, child_states[5].octree_node,
+			    child_states[6].octree_node, child_states[7].octree_node};
+			state.octree_node = p_octree->SetNode(state.octree_node, octree_children);
 		}
 	}
 	inline void JoinLeaf(const Config<Word> &, const NodeCoord<Word> &coord, NodeState &state) const {
+		// Below the leaf level, the segment is appended by the parent
 		if (coord.level == p_octree->GetLeafLevel()) {
-			if (state.p_writer) {
-				state.octree_node = p_octree->SetLeaf(state.octree_node, state.p_writer->Flush());
-				delete state.p_writer;
-			}
+			if (state.p_writer)
+				flush_writer(state);
 		}
 	}
 };
@@ -0,0 +1,302 @@
+//
+// Created by adamyuan on 6/9/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_VBRENCODER_HPP
+#define VKHASHDAG_VBRENCODER_HPP
+
+#include "VBRColor.hpp"
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <libfork/schedule/busy_pool.hpp>
+#include <libfork/task.hpp>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace hashdag {
+
+// Lossy VBR encoding of Morton-ordered voxel colors
+// Every decoded channel is within max_error of the input, except that a single voxel is always encodable as its
+// rounded RGB8 color. Blocks are chosen greedily: from the current voxel, the longest run that fits under max_error is
+// found for 0 to 3 bits-per-weight, and the one with the fewest bits per voxel (including its header) is taken
+template <std::unsigned_integral Word> class VBREncoder {
+private:
+	inline static constexpr uint32_t kHeaderBits = sizeof(VBRBlockHeader) * 8u;
+
+	float m_max_error;
+
+	struct Block {
+		VBRColor colors; // Weight is not used
+		uint32_t count;
+	};
+
+	inline static float max_diff(const RGBColor &l, const RGBColor &r) {
+		RGBColor d = glm::abs(l - r);
+		return glm::max(glm::max(d.r, d.g), d.b);
+	}
+	inline static RGB8Color round_rgb8(const RGBColor &c) {
+		return RGB8Color{glm::u8vec3(glm::round(glm::clamp(c, 0.0f, 1.0f) * 255.0f))};
+	}
+	inline static R5G6B5Color round_r5g6b5(const RGBColor &c) {
+		glm::u32vec3 q = glm::round(glm::clamp(c, 0.0f, 1.0f) * RGBColor(31, 63, 31));
+		return R5G6B5Color{uint16_t(q.r | (q.g << 5u) | (q.b << 11u))};
+	}
+
+	// The weight with the least error, or std::nullopt if even it exceeds max_error
+	inline std::optional<uint8_t> find_weight(std::span<const RGBColor> palette, const RGBColor &c) const {
+		uint8_t best_w = 0;
+		float best_error = max_diff(palette[0], c);
+		for (uint8_t w = 1; w < palette.size(); ++w)
+			if (float error = max_diff(palette[w], c); error < best_error)
+				best_error = error, best_w = w;
+		return best_error <= m_max_error ? std::optional{best_w} : std::nullopt;
+	}
+
+	// Endpoints along the principal axis of the colors
+	inline static std::pair<RGBColor, RGBColor> fit_endpoints(std::span<const RGBColor> colors) {
+		RGBColor mean{0}, lower{1}, upper{0};
+		for (const auto &c : colors)
+			mean += c, lower = glm::min(lower, c), upper = glm::max(upper, c);
+		mean /= float(colors.size());
+		glm::mat3 cov{0};
+		for (const auto &c : colors)
+			cov += glm::outerProduct(c - mean, c - mean);
+		RGBColor axis = upper - lower;
+		for (uint32_t i = 0; i < 8; ++i) {
+			RGBColor next = cov * axis;
+			float len = glm::length(next);
+			if (len == 0.0f)
+				break;
+			axis = next / len;
+		}
+		if (glm::dot(axis, axis) == 0.0f)
+			return {mean, mean};
+		axis = glm::normalize(axis);
+		float t_min = 0.0f, t_max = 0.0f;
+		for (const auto &c : colors) {
+			float t = glm::dot(c - mean, axis);
+			t_min = glm::min(t_min, t), t_max = glm::max(t_max, t);
+		}
+		return {mean + t_min * axis, mean + t_max * axis};
+	}
+	// Fit colors into one block with bits_per_weight, weights are written to p_weights if not nullptr
+	inline std::optional<VBRColor> fit(std::span<const RGBColor> colors, uint32_t bits_per_weight,
+	                                   uint8_t *p_weights) const {
+		if (bits_per_weight == 0) {
+			RGBColor lower{1}, upper{0};
+			for (const auto &c : colors)
+				lower = glm::min(lower, c), upper = glm::max(upper, c);
+			RGB8Color rgb8 = round_rgb8((lower + upper) * 0.5f);
+			if (colors.size() > 1 && glm::max(max_diff(rgb8.Get(), lower), max_diff(rgb8.Get(), upper)) > m_max_error)
+				return std::nullopt;
+			return VBRColor{rgb8};
+		}
+		auto [c0, c1] = fit_endpoints(colors);
+		R5G6B5Color q0 = round_r5g6b5(c0), q1 = round_r5g6b5(c1);
+		std::array<RGBColor, 8> palette;
+		uint32_t weight_count = 1u << bits_per_weight;
+		for (uint32_t w = 0; w < weight_count; ++w)
+			palette[w] = VBRColor{q0, q1, uint8_t(w), uint8_t(bits_per_weight)}.Get();
+		for (std::size_t i = 0; i < colors.size(); ++i) {
+			auto w = find_weight(std::span{palette.data(), weight_count}, colors[i]);
+			if (!w)
+				return std::nullopt;
+			if (p_weights)
+				p_weights[i] = *w;
+		}
+		return VBRColor{q0, q1, 0, uint8_t(bits_per_weight)};
+	}
+
+	// Longest run from the front of colors that fits with bits_per_weight, galloping then binary search
+	inline Block find_longest_block(std::span<const RGBColor> colors, uint32_t bits_per_weight) const {
+		uint32_t good = 0, bad = colors.size() + 1u;
+		VBRColor good_colors{};
+		for (uint32_t count = 1; count < bad; count = std::min(count << 1u, bad - 1u)) {
+			if (auto block_colors = fit(colors.first(count), bits_per_weight, nullptr)) {
+				good = count, good_colors = *block_colors;
+				if (count == colors.size())
+					break;
+			} else {
+				bad = count;
+				break;
+			}
+		}
+		while (good + 1u < bad) {
+			uint32_t mid = (good + bad) >> 1u;
+			if (auto block_colors = fit(colors.first(mid), bits_per_weight, nullptr))
+				good = mid, good_colors = *block_colors;
+			else
+				bad = mid;
+		}
+		return {.colors = good_colors, .count = good};
+	}
+
+	inline void encode_block(std::span<const RGBColor> colors, auto &writer, std::vector<uint8_t> &weights) const {
+		Block best = {.colors = VBRColor{round_rgb8(colors[0])}, .count = 1};
+		float best_bits = float(kHeaderBits);
+		for (uint32_t bits_per_weight = 0; bits_per_weight <= 3; ++bits_per_weight) {
+			Block block = find_longest_block(colors, bits_per_weight);
+			if (block.count == 0)
+				continue;
+			float bits = float(kHeaderBits) / float(block.count) + float(bits_per_weight);
+			if (bits < best_bits)
+				best = block, best_bits = bits;
+		}
+
+		uint32_t bits_per_weight = best.colors.GetBitsPerWeight();
+		if (bits_per_weight == 0) {
+			writer.Push(best.colors, best.count);
+			return;
+		}
+		weights.resize(best.count);
+		fit(colors.first(best.count), bits_per_weight, weights.data());
+		R5G6B5Color q0{uint16_t(best.colors.GetColors())}, q1{uint16_t(best.colors.GetColors() >> 16u)};
+		for (uint32_t i = 0, run; i < best.count; i += run) {
+			for (run = 1; i + run < best.count && weights[i + run] == weights[i]; ++run)
+				;
+			writer.Push(VBRColor{q0, q1, weights[i], uint8_t(bits_per_weight)}, run);
+		}
+	}
+
+	inline void encode(std::span<const RGBColor> colors, auto &writer, std::vector<uint8_t> &weights) const {
+		for (std::size_t i = 0; i < colors.size();) {
+			// Blocks are split at macro block boundaries anyway
+			std::size_t macro_end = ((i >> VBRInfo::kVoxelBitsPerMacroBlock) + 1u) << VBRInfo::kVoxelBitsPerMacroBlock;
+			std::size_t begin = writer.GetVoxelCount();
+			encode_block(colors.subspan(i, std::min(colors.size(), macro_end) - i), writer, weights);
+			i += writer.GetVoxelCount() - begin;
+		}
+	}
+
+	// Whether both endpoints of block l are within max_error of a color of block r
+	inline bool is_covered(const VBRBlockHeader &l, const VBRBlockHeader &r) const {
+		const auto get_colors = [](const VBRBlockHeader &block, uint8_t weight) {
+			uint32_t bits_per_weight = block.GetBitsPerWeight();
+			return bits_per_weight ? VBRColor{R5G6B5Color(block.colors), R5G6B5Color(block.colors >> 16u), weight,
+			                                  uint8_t(bits_per_weight)}
+			                             .Get()
+			                       : RGB8Color{block.colors}.Get();
+		};
+		std::array<RGBColor, 8> palette;
+		uint32_t weight_count = 1u << r.GetBitsPerWeight(), l_max_weight = (1u << l.GetBitsPerWeight()) - 1u;
+		for (uint32_t w = 0; w < weight_count; ++w)
+			palette[w] = get_colors(r, w);
+		return find_weight(std::span{palette.data(), weight_count}, get_colors(l, 0)) &&
+		       find_weight(std::span{palette.data(), weight_count}, get_colors(l, l_max_weight));
+	}
+
+	template <lf::context Context>
+	inline lf::basic_task<void, Context> lf_encode(std::span<const std::span<const RGBColor>> leaf_colors,
+	                                               std::span<VBRChunk<Word, VBRWriterContainer>> chunks) const {
+		if (leaf_colors.size() == 1) {
+			chunks[0] = Encode(leaf_colors[0]);
+			co_return;
+		}
+		std::size_t half = leaf_colors.size() >> 1u;
+		co_await lf_encode<Context>(leaf_colors.first(half), chunks.first(half)).fork();
+		co_await lf_encode<Context>(leaf_colors.subspan(half), chunks.subspan(half));
+		co_await lf::join();
+	}
+
+public:
+	inline explicit VBREncoder(float max_error) : m_max_error{max_error} {}
+
+	inline VBRChunk<Word, VBRWriterContainer> Encode(std::span<const RGBColor> colors) const {
+		VBRChunkWriter<Word, VBRWriterContainer> writer;
+		std::vector<uint8_t> weights;
+		encode(colors, writer, weights);
+		return writer.Flush();
+	}
+	// Rewrites the voxel_count voxels of chunk into writer, re-encoding the macro blocks with adjacent blocks that could
+	// be merged under max_error (written into segment first) when it takes fewer bits, and copying the others
+	// Returns the number of re-encoded macro blocks, which are the dirty ones of writer. Colors of the source are
+	// re-encoded as they are decoded, so recompressing a chunk again may move them by max_error again
+	template <template <typename> typename Container>
+	inline uint32_t Recompress(const VBRChunk<Word, Container> &chunk, uint32_t voxel_count,
+	                           VBRChunkWriter<Word, Container> &writer, VBRChunkWriter<Word, Container> &segment) const {
+		uint32_t next_macro_id;
+		return Recompress(chunk, voxel_count, writer, segment, 0, &next_macro_id, [] { return false; });
+	}
+	// Recompress() of the macro blocks from first_macro_id, until stop() returns true after one is re-encoded
+	// The other macro blocks are copied, *p_next_macro_id is the one to go on from (the macro block count if all done)
+	template <template <typename> typename Container>
+	inline uint32_t Recompress(const VBRChunk<Word, Container> &chunk, uint32_t voxel_count,
+	                           VBRChunkWriter<Word, Container> &writer, VBRChunkWriter<Word, Container> &segment,
+	                           uint32_t first_macro_id, uint32_t *p_next_macro_id,
+	                           std::predicate auto &&stop) const {
+		writer.Reset(chunk);
+		const auto &macro_blocks = chunk.GetMacroBlocks();
+		const auto &block_headers = chunk.GetBlockHeaders();
+		std::vector<RGBColor> colors;
+		std::vector<uint8_t> weights;
+		uint32_t recompressed_count = 0;
+		if (first_macro_id)
+			writer.Copy(std::min(first_macro_id << VBRInfo::kVoxelBitsPerMacroBlock, voxel_count), {});
+		*p_next_macro_id = macro_blocks.size();
+		for (uint32_t macro_id = first_macro_id; macro_id < macro_blocks.size(); ++macro_id) {
+			uint32_t macro_begin = macro_id << VBRInfo::kVoxelBitsPerMacroBlock,
+			         macro_voxel_count = std::min(VBRInfo::kVoxelsPerMacroBlock, voxel_count - macro_begin),
+			         first_block = macro_blocks[macro_id].first_block,
+			         last_block =
+			             macro_id + 1u < macro_blocks.size() ? macro_blocks[macro_id + 1u].first_block : block_headers.size();
+			bool fragmented = false;
+			for (uint32_t b = first_block; b + 1u < last_block && !fragmented; ++b)
+				fragmented = is_covered(block_headers[b], block_headers[b + 1u]) ||
+				             is_covered(block_headers[b + 1u], block_headers[b]);
+			if (!fragmented) {
+				writer.Copy(macro_voxel_count, {});
+				continue;
+			}
+
+			std::size_t src_bits = sizeof(VBRMacroBlock) * 8u;
+			for (uint32_t b = first_block; b < last_block; ++b) {
+				uint32_t block_end =
+				    b + 1u < last_block ? block_headers[b + 1u].GetVoxelIndexOffset() : macro_voxel_count;
+				src_bits += sizeof(VBRBlockHeader) * 8u +
+				            (block_end - block_headers[b].GetVoxelIndexOffset()) * block_headers[b].GetBitsPerWeight();
+			}
+			VBRChunkIterator<Word, Container> iterator{chunk};
+			iterator.Seek(macro_begin);
+			colors.resize(macro_voxel_count);
+			for (auto &color : colors)
+				color = iterator.Next([](const auto &iterator) { return iterator.GetColor().Get(); });
+			segment.Reset({}, macro_begin);
+			encode(colors, segment, weights);
+			if (segment.GetBitCount() < src_bits) {
+				writer.Append(segment);
+				++recompressed_count;
+			} else
+				writer.Copy(macro_voxel_count, {});
+			if (macro_id + 1u < macro_blocks.size() && stop()) {
+				writer.Copy(voxel_count - writer.GetVoxelCount(), {});
+				*p_next_macro_id = macro_id + 1u;
+				break;
+			}
+		}
+		return recompressed_count;
+	}
+	// Encode the colors of each leaf into chunks in parallel
+	inline void ThreadedEncode(lf::busy_pool *p_lf_pool, std::span<const std::span<const RGBColor>> leaf_colors,
+	                           std::span<VBRChunk<Word, VBRWriterContainer>> chunks) const {
+		if (leaf_colors.empty())
+			return;
+		p_lf_pool->schedule(lf_encode<lf::busy_pool::context>(leaf_colors, chunks));
+	}
+};
+
+// Bits of a chunk, including macro blocks and block headers
+template <std::unsigned_integral Word, template <typename> typename Container>
+inline std::size_t GetVBRChunkBits(const VBRChunk<Word, Container> &chunk) {
+	return (chunk.GetMacroBlocks().size() * sizeof(VBRMacroBlock) +
+	        chunk.GetBlockHeaders().size() * sizeof(VBRBlockHeader) +
+	        chunk.GetWeightBits().GetWords().size() * sizeof(Word)) *
+	       8u;
+}
+
+} // namespace hashdag
+
+#endif // VKHASHDAG_VBRENCODER_HPP
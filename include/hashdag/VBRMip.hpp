@@ -0,0 +1,43 @@
+//
+// Created by adamyuan on 6/9/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_VBRMIP_HPP
+#define VKHASHDAG_VBRMIP_HPP
+
+#include "Color.hpp"
+
+#include <glm/glm.hpp>
+
+namespace hashdag {
+
+// Mean color of the non-null children of an octree node, the mip of the node for LOD fetches
+// Children are added in full precision, so that the mips of upper nodes are not averaged from quantized ones
+class VBRMip {
+private:
+	glm::dvec3 m_sum{0};
+	uint32_t m_count{0};
+
+public:
+	inline void AddMean(const glm::dvec3 &mean) {
+		m_sum += mean;
+		++m_count;
+	}
+	inline void AddColor(const RGBColor &color) { AddMean(glm::dvec3{color}); }
+	// A leaf of voxel_count voxels of the color sum
+	inline void AddColorSum(const glm::dvec3 &color_sum, uint32_t voxel_count) {
+		AddMean(color_sum / double(voxel_count));
+	}
+
+	inline uint32_t GetCount() const { return m_count; }
+	inline glm::dvec3 GetMean() const { return m_count ? m_sum / double(m_count) : glm::dvec3{0}; }
+	// Rounded to the nearest, R5G6B5Color(RGBColor) truncates
+	inline R5G6B5Color GetR5G6B5() const {
+		return R5G6B5Color{RGBColor(GetMean() + 0.5 / glm::dvec3{31, 63, 31})};
+	}
+};
+
+} // namespace hashdag
+
+#endif // VKHASHDAG_VBRMIP_HPP
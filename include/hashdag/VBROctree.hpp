@@ -31,6 +31,20 @@ concept VBROctree = requires(T e, const T ce, VBROctreePointer<T> pointer, VBROc
 	{ ce.GetLeafLevel() } -> std::convertible_to<Word>;
 };
 
+// Morton index of a cell, x in the lowest bit like the children of a node, coordinates take up to 21 bits
+inline uint64_t GetMortonIndex(glm::u32vec3 pos) {
+	const auto spread = [](uint64_t x) {
+		x &= 0x1FFFFFu;
+		x = (x | x << 32u) & 0x1F00000000FFFFu;
+		x = (x | x << 16u) & 0x1F0000FF0000FFu;
+		x = (x | x << 8u) & 0x100F00F00F00F00Fu;
+		x = (x | x << 4u) & 0x10C30C30C30C30C3u;
+		x = (x | x << 2u) & 0x1249249249249249u;
+		return x;
+	};
+	return spread(pos.x) | spread(pos.y) << 1u | spread(pos.z) << 2u;
+}
+
 } // namespace hashdag
 
 #endif
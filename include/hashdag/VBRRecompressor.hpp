@@ -0,0 +1,176 @@
+//
+// Created by adamyuan on 6/9/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_VBRRECOMPRESSOR_HPP
+#define VKHASHDAG_VBRRECOMPRESSOR_HPP
+
+#include "VBREncoder.hpp"
+#include "VBROctree.hpp"
+
+#include <array>
+#include <bit>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <concepts>
+
+namespace hashdag {
+
+struct VBRRecompressStats {
+	std::size_t leaf_count{}, recompressed_leaf_count{}, recompressed_macro_block_count{};
+	// Of the recompressed leaves, before and after
+	std::size_t src_header_count{}, header_count{}, src_bytes{}, bytes{};
+
+	inline std::size_t GetSavedHeaderCount() const { return src_header_count - header_count; }
+	inline std::size_t GetSavedBytes() const { return src_bytes - bytes; }
+};
+
+// Recompresses the leaves of a color octree in Morton order, merging the small adjacent blocks that repeated edits
+// leave behind with VBREncoder::Recompress()
+// Step() runs in time slices and continues from the macro block it stopped at, so edits of the octree can be done
+// between steps on the same thread
+template <std::unsigned_integral Word, VBROctree<Word> Octree_T> class VBRRecompressor {
+private:
+	using Pointer = VBROctreePointer<Octree_T>;
+	using LeafWriter = VBROctreeLeafWriter<Octree_T>;
+	inline static constexpr uint32_t kMaxLeafLevel = 21; // Morton indices of leaves fit in 63 bits
+
+	Octree_T *m_p_octree;
+	uint32_t m_voxel_level, m_leaf_voxel_count;
+	VBREncoder<Word> m_encoder;
+	LeafWriter m_writer, m_segment;
+
+	// The pass covers the leaves of Morton indices [m_leaf_index, m_end_leaf_index), from macro block m_macro_id
+	uint64_t m_leaf_index{0}, m_end_leaf_index;
+	uint32_t m_macro_id{0};
+	bool m_done{false}, m_leaf_recompressed{false};
+	VBRRecompressStats m_stats{};
+
+	// Fills path from the root to the first leaf at or after m_leaf_index and moves m_leaf_index to it, returns false
+	// if there is none
+	inline bool find_leaf(std::span<Pointer> path) {
+		uint32_t leaf_level = m_p_octree->GetLeafLevel();
+		for (uint32_t level = 0;;) {
+			Pointer ptr = path[level];
+			// A pointer that is its own child is a fill or null, with no leaves below
+			bool skip = level == leaf_level ? m_p_octree->GetLeaf(ptr).Empty() : m_p_octree->GetChild(ptr, 0) == ptr;
+			if (level == leaf_level && !skip)
+				return true;
+			if (!skip) {
+				path[level + 1] = m_p_octree->GetChild(ptr, (m_leaf_index >> (3u * (leaf_level - level - 1u))) & 7u);
+				++level;
+				continue;
+			}
+			// Skip the subtree, then go back to the deepest node that contains the next one
+			uint32_t shift = 3u * (leaf_level - level);
+			uint64_t next_leaf_index = ((m_leaf_index >> shift) + 1u) << shift;
+			if (next_leaf_index >> (3u * leaf_level))
+				return false;
+			level = leaf_level - (std::bit_width(m_leaf_index ^ next_leaf_index) + 2u) / 3u;
+			m_leaf_index = next_leaf_index;
+			m_macro_id = 0;
+		}
+	}
+
+	// Recompresses the leaf from m_macro_id until stop(), moves m_macro_id to where it goes on (0 if the leaf is done)
+	inline Pointer recompress_leaf(Pointer ptr, std::predicate auto &&stop) {
+		auto chunk = m_p_octree->GetLeaf(ptr);
+		if (m_macro_id == 0) {
+			++m_stats.leaf_count;
+			m_leaf_recompressed = false;
+		}
+		uint32_t macro_block_count = m_encoder.Recompress(chunk, m_leaf_voxel_count, m_writer, m_segment, m_macro_id,
+		                                                  &m_macro_id, stop);
+		if (m_macro_id == chunk.GetMacroBlocks().size())
+			m_macro_id = 0;
+		if (macro_block_count == 0)
+			return ptr;
+
+		auto recompressed = m_writer.Flush();
+		std::size_t src_header_count = chunk.GetBlockHeaders().size(), src_bytes = GetVBRChunkBits(chunk) / 8u;
+		// A leaf recompressed in several steps counts once, from before its first step
+		if (!m_leaf_recompressed) {
+			m_leaf_recompressed = true;
+			++m_stats.recompressed_leaf_count;
+			m_stats.src_header_count += src_header_count;
+			m_stats.header_count += src_header_count;
+			m_stats.src_bytes += src_bytes;
+			m_stats.bytes += src_bytes;
+		}
+		m_stats.recompressed_macro_block_count += macro_block_count;
+		m_stats.header_count = m_stats.header_count + recompressed.GetBlockHeaders().size() - src_header_count;
+		m_stats.bytes = m_stats.bytes + GetVBRChunkBits(recompressed) / 8u - src_bytes;
+		if constexpr (requires { m_p_octree->SetLeaf(ptr, std::move(recompressed), m_writer.GetDirtyMacroBlocks()); })
+			ptr = m_p_octree->SetLeaf(ptr, std::move(recompressed), m_writer.GetDirtyMacroBlocks());
+		else
+			ptr = m_p_octree->SetLeaf(ptr, std::move(recompressed));
+		m_writer.Recycle(std::move(recompressed));
+		return ptr;
+	}
+
+public:
+	inline VBRRecompressor(Octree_T *p_octree, uint32_t voxel_level, float max_error)
+	    : m_p_octree{p_octree}, m_voxel_level{voxel_level},
+	      m_leaf_voxel_count{1u << (3u * (voxel_level - p_octree->GetLeafLevel()))}, m_encoder{max_error},
+	      m_end_leaf_index{uint64_t{1} << (3u * p_octree->GetLeafLevel())} {
+		assert(p_octree->GetLeafLevel() <= kMaxLeafLevel);
+	}
+
+	inline bool IsDone() const { return m_done; }
+	// Starts a new pass from the first leaf, the stats keep counting
+	inline void Restart() {
+		m_leaf_index = 0, m_end_leaf_index = uint64_t{1} << (3u * m_p_octree->GetLeafLevel());
+		m_macro_id = 0, m_done = false;
+	}
+	// Adds the leaves of the voxels in [voxel_min, voxel_max] to the pass, for the region of an edit
+	// Their Morton indices are in a range, the pass is widened to cover it and goes back to its first leaf if needed
+	inline void Restart(glm::u32vec3 voxel_min, glm::u32vec3 voxel_max) {
+		uint32_t shift = m_voxel_level - m_p_octree->GetLeafLevel();
+		uint64_t first_leaf_index = GetMortonIndex(voxel_min >> shift),
+		         end_leaf_index = GetMortonIndex(voxel_max >> shift) + 1u;
+		if (m_done || first_leaf_index <= m_leaf_index)
+			m_leaf_index = first_leaf_index, m_macro_id = 0;
+		m_end_leaf_index = m_done ? end_leaf_index : std::max(m_end_leaf_index, end_leaf_index);
+		m_done = false;
+	}
+	inline const VBRRecompressStats &GetStats() const { return m_stats; }
+
+	// Recompresses leaves until time_budget is used up (at least one macro block), returns the root with the new leaves
+	// A large leaf is split across steps at its macro blocks
+	template <typename Rep, typename Period>
+	inline Pointer Step(Pointer root, std::chrono::duration<Rep, Period> time_budget) {
+		auto begin = std::chrono::steady_clock::now();
+		const auto is_timeout = [&] { return std::chrono::steady_clock::now() - begin >= time_budget; };
+		uint32_t leaf_level = m_p_octree->GetLeafLevel();
+		std::array<Pointer, kMaxLeafLevel + 1> path;
+		path[0] = root;
+		while (!m_done) {
+			if (!find_leaf(path) || m_leaf_index >= m_end_leaf_index) {
+				m_done = true;
+				break;
+			}
+			Pointer leaf_ptr = recompress_leaf(path[leaf_level], is_timeout);
+			if (!(leaf_ptr == path[leaf_level])) {
+				path[leaf_level] = leaf_ptr;
+				for (uint32_t level = leaf_level; level-- > 0;) {
+					std::array<Pointer, 8> children;
+					for (uint32_t i = 0; i < 8; ++i)
+						children[i] = m_p_octree->GetChild(path[level], i);
+					children[(m_leaf_index >> (3u * (leaf_level - level - 1u))) & 7u] = path[level + 1];
+					path[level] = m_p_octree->SetNode(path[level], children);
+				}
+			}
+			if (m_macro_id == 0)
+				m_done = ++m_leaf_index >= m_end_leaf_index;
+			if (is_timeout())
+				break;
+		}
+		return path[0];
+	}
+};
+
+} // namespace hashdag
+
+#endif // VKHASHDAG_VBRRECOMPRESSOR_HPP
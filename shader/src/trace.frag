@@ -245,9 +245,9 @@ bool DAG_RayMarch(in const uint root,
 	if ((octant_mask & 4u) != 0u)
 		vox_pos.z = (1u << voxel_level) - vox_size - vox_pos.z;
 
-	// float voxel bounds & hit position
-	vec3 vox_min = uintBitsToFloat(vox_pos << voxel_scale | 127u << 23u),
-	     vox_max = uintBitsToFloat((vox_pos + vox_size) << voxel_scale | 127u << 23u);
+	// float voxel bounds & hit position (add to the bits of 1.0 so that the upper bound can carry to 2.0)
+	vec3 vox_min = uintBitsToFloat((vox_pos << voxel_scale) + (127u << 23u)),
+	     vox_max = uintBitsToFloat(((vox_pos + vox_size) << voxel_scale) + (127u << 23u));
 	vec3 hit_pos = clamp(o + t_min * d, vox_min, vox_max);
 	if (norm.x != 0)
 		hit_pos.x = norm.x > 0 ? vox_max.x + epsilon * 2 : vox_min.x - epsilon;
@@ -301,8 +301,28 @@ vec3 Color_UnpackRGB565(in const uint c) {
 	return vec3(c3) / vec3(0x1Fu, 0x3Fu, 0x1Fu);
 }
 
+vec3 Color_GetPaletteLeafColor(in const uint idx, in const uvec3 vox_pos) {
+	uint macro_cnt = uColorLeaves[idx + 1u] & 0x7FFFFFFFu, palette = uColorLeaves[idx + 2u],
+	     index_cnt = uColorLeaves[idx + 4u];
+	uint color_offset = idx + 5u;
+	uint index_offset = color_offset + (palette & 0xFFFFu);
+
+	uint vox_id = Color_Morton32(vox_pos);
+	if ((vox_id >> 14u) >= macro_cnt || index_cnt == 0u)
+		return vec3(0);
+
+	// The last index extends to the end of the macro blocks
+	uint bits_per_index = palette >> 16u;
+	uint index = bits_per_index == 0u
+	                 ? 0u
+	                 : Color_GetWeight(index_offset, min(vox_id, index_cnt - 1u) * bits_per_index, bits_per_index);
+	return unpackUnorm4x8(uColorLeaves[color_offset + index]).rgb;
+}
+
 vec3 Color_GetLeafColor(in const uint idx, in const uvec3 vox_pos) {
 	uint macro_cnt = uColorLeaves[idx + 1u], block_cnt = uColorLeaves[idx + 2u];
+	if ((macro_cnt & 0x80000000u) != 0u)
+		return Color_GetPaletteLeafColor(idx, vox_pos);
 	uint macro_offset = idx + 4u;
 	uint block_offset = macro_offset + (macro_cnt << 1u);
 	uint weight_offset = block_offset + (block_cnt << 1u);
@@ -348,15 +368,22 @@ vec3 Color_GetLeafColor(in const uint idx, in const uvec3 vox_pos) {
 	return mix(Color_UnpackRGB565(block.x), Color_UnpackRGB565(block.x >> 16u), alpha);
 }
 
-vec3 Color_Fetch(in const uint root, in const uint voxel_level, in const uint leaf_level, in const uvec3 vox_pos) {
-	uint ptr = root;
-	vec3 rgb = vec3(0);
+// A voxel of vox_size (coarser than the leaves) takes the mip of the node that covers it
+vec3 Color_Fetch(in const uint root, in const uint voxel_level, in const uint leaf_level, in const uvec3 vox_pos,
+                 in const uint vox_size) {
+	uint ptr = root, lod_level = voxel_level - findMSB(vox_size);
 	[[unroll]] for (uint l = 0; l < leaf_level; ++l) {
 		uint tag = ptr >> 30u, data = ptr & 0x3FFFFFFFu;
 		if (tag != 0)
 			return unpackUnorm4x8(data).rgb;
+		// [child mask | fill bit << 8 | mip << 16][fill][children]
+		uint header = uColorNodes[ptr];
+		if (l >= lod_level)
+			return Color_UnpackRGB565(header >> 16u);
 		uvec3 o = (vox_pos >> (voxel_level - 1u - l)) & 1u;
-		ptr = uColorNodes[(ptr << 3u) | o.x | (o.y << 1u) | (o.z << 2u)];
+		uint child_mask = 1u << (o.x | (o.y << 1u) | (o.z << 2u)), fill_words = (header >> 8u) & 1u;
+		ptr = (header & child_mask) != 0u ? uColorNodes[ptr + 1u + fill_words + bitCount(header & (child_mask - 1u))]
+		                                  : (fill_words != 0u ? uColorNodes[ptr + 1u] : 3u << 30u);
 	}
 	uint tag = ptr >> 30u, data = ptr & 0x3FFFFFFFu;
 	return tag == 2u ? Color_GetLeafColor(data, vox_pos & ((1u << (voxel_level - leaf_level)) - 1u))
@@ -394,7 +421,9 @@ void main() {
 
 	if (uType == 0) {
 		float diffuse = max(dot(norm, normalize(vec3(4, 5, 3))), 0.0) * .5 + .5;
-		oColor = vec4(hit ? diffuse * Color_Fetch(uColorRoot, uVoxelLevel, uColorLeafLevel, vox_pos) : vec3(0), 1.0);
+		oColor = vec4(hit ? diffuse * Color_Fetch(uColorRoot, uVoxelLevel, uColorLeafLevel, vox_pos, vox_size)
+		                   : vec3(0),
+		              1.0);
 	} else if (uType == 1)
 		oColor = hit ? vec4(norm * .5 + .5, 1.0) : vec4(0, 0, 0, 1);
 	else
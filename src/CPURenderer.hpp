@@ -0,0 +1,351 @@
+//
+// Created by adamyuan on 6/6/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_CPURENDERER_HPP
+#define VKHASHDAG_CPURENDERER_HPP
+
+#include "ColorFetcher.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstdio>
+#include <span>
+
+#include <glm/glm.hpp>
+#include <hashdag/VBROctree.hpp>
+#include <libfork/schedule/busy_pool.hpp>
+#include <libfork/task.hpp>
+
+// CPU reference of trace.frag (without BEAM_OPTIMIZATION), for machines without a Vulkan GPU
+template <WordBufferReader DAGNodes, WordBufferReader ColorNodes, WordBufferReader ColorLeaves> class CPURenderer {
+public:
+	// Same as the push constants of trace.frag
+	struct Params {
+		glm::vec3 pos, look, side, up;
+		uint32_t width, height;
+		uint32_t voxel_level;
+		uint32_t dag_root, dag_leaf_level;
+		uint32_t color_root, color_leaf_level;
+		float proj_factor;
+		uint32_t type;
+	};
+	// Outputs of DAG_RayMarch(), only iter is valid if !hit
+	struct Hit {
+		bool hit;
+		glm::vec3 hit_pos, norm;
+		glm::u32vec3 vox_pos;
+		uint32_t vox_size;
+		glm::vec3 vox_min, vox_max;
+		uint32_t iter;
+	};
+
+private:
+	// STACK_SIZE equals to the fraction bits of float
+	inline static constexpr uint32_t kStackSize = 23;
+	inline static constexpr uint32_t kTileSize = 16;
+
+	DAGNodes m_dag_nodes;
+	ColorFetcher<ColorNodes, ColorLeaves> m_color_fetcher;
+
+	inline static uint32_t float_bits(float f) { return std::bit_cast<uint32_t>(f); }
+	inline static float bits_float(uint32_t u) { return std::bit_cast<float>(u); }
+
+	inline uint32_t dag_get_leaf_first_child_bits(uint32_t node) const {
+		uint32_t l0 = m_dag_nodes(node), l1 = m_dag_nodes(node + 1);
+		return ((l0 & 0x000000FFu) == 0u ? 0u : 0x01u) | ((l0 & 0x0000FF00u) == 0u ? 0u : 0x02u) |
+		       ((l0 & 0x00FF0000u) == 0u ? 0u : 0x04u) | ((l0 & 0xFF000000u) == 0u ? 0u : 0x08u) |
+		       ((l1 & 0x000000FFu) == 0u ? 0u : 0x10u) | ((l1 & 0x0000FF00u) == 0u ? 0u : 0x20u) |
+		       ((l1 & 0x00FF0000u) == 0u ? 0u : 0x40u) | ((l1 & 0xFF000000u) == 0u ? 0u : 0x80u);
+	}
+
+	inline static glm::u8vec3 to_unorm8(glm::vec3 c) {
+		return glm::u8vec3(glm::round(glm::clamp(c, glm::vec3{0}, glm::vec3{1}) * 255.0f));
+	}
+
+	inline void render_tile(const Params &params, std::span<glm::u8vec3> image, uint32_t tile) const {
+		uint32_t tiles_x = (params.width + kTileSize - 1) / kTileSize;
+		uint32_t x0 = (tile % tiles_x) * kTileSize, y0 = (tile / tiles_x) * kTileSize;
+		uint32_t x1 = std::min(x0 + kTileSize, params.width), y1 = std::min(y0 + kTileSize, params.height);
+		for (uint32_t y = y0; y < y1; ++y)
+			for (uint32_t x = x0; x < x1; ++x)
+				image[y * params.width + x] = to_unorm8(Shade(params, glm::vec2{x, y} + 0.5f));
+	}
+
+	template <lf::context Context>
+	inline lf::basic_task<void, Context> lf_render(const Params *p_params, std::span<glm::u8vec3> image,
+	                                               uint32_t first_tile, uint32_t tile_count) const {
+		if (tile_count == 1) {
+			render_tile(*p_params, image, first_tile);
+			co_return;
+		}
+		uint32_t half_tiles = tile_count >> 1u;
+		co_await lf_render<Context>(p_params, image, first_tile, half_tiles).fork();
+		co_await lf_render<Context>(p_params, image, first_tile + half_tiles, tile_count - half_tiles);
+		co_await lf::join();
+	}
+
+public:
+	inline CPURenderer(DAGNodes dag_nodes, ColorNodes color_nodes, ColorLeaves color_leaves)
+	    : m_dag_nodes{std::move(dag_nodes)}, m_color_fetcher{std::move(color_nodes), std::move(color_leaves)} {}
+
+	// DAG_RayMarch(), the octree resides at [0, 1]
+	inline Hit RayMarch(uint32_t root, uint32_t leaf_level, float proj_factor, float proj_bias, glm::vec3 o,
+	                    glm::vec3 d) const {
+		if (root == uint32_t(-1))
+			return Hit{};
+
+		uint32_t stack[kStackSize];
+		uint32_t iter = 0;
+
+		o += 1.0f;
+		const float epsilon = bits_float((127u - kStackSize) << 23u); // exp2f(-STACK_SIZE)
+		d.x = glm::abs(d.x) > epsilon ? d.x : (d.x >= 0 ? epsilon : -epsilon);
+		d.y = glm::abs(d.y) > epsilon ? d.y : (d.y >= 0 ? epsilon : -epsilon);
+		d.z = glm::abs(d.z) > epsilon ? d.z : (d.z >= 0 ? epsilon : -epsilon);
+
+		// Precompute the coefficients of tx(x), ty(y), and tz(z).
+		// The octree is assumed to reside at coordinates [1, 2].
+		glm::vec3 t_coef = 1.0f / -glm::abs(d);
+		glm::vec3 t_bias = t_coef * o;
+
+		uint32_t octant_mask = 0u;
+		if (d.x > 0.0f)
+			octant_mask ^= 1u, t_bias.x = 3.0f * t_coef.x - t_bias.x;
+		if (d.y > 0.0f)
+			octant_mask ^= 2u, t_bias.y = 3.0f * t_coef.y - t_bias.y;
+		if (d.z > 0.0f)
+			octant_mask ^= 4u, t_bias.z = 3.0f * t_coef.z - t_bias.z;
+
+		// Initialize the active span of t-values.
+		float t_min = glm::max(glm::max(2.0f * t_coef.x - t_bias.x, 2.0f * t_coef.y - t_bias.y),
+		                       2.0f * t_coef.z - t_bias.z);
+		float t_max = glm::min(glm::min(t_coef.x - t_bias.x, t_coef.y - t_bias.y), t_coef.z - t_bias.z);
+		float h = t_max;
+		t_min = glm::max(t_min, 0.0f);
+		t_max = glm::min(t_max, 1.0f);
+
+		uint32_t parent = root, child_bits = 0u;
+		glm::vec3 pos{1.0f};
+		uint32_t idx = 0u;
+		if (1.5f * t_coef.x - t_bias.x > t_min)
+			idx ^= 1u, pos.x = 1.5f;
+		if (1.5f * t_coef.y - t_bias.y > t_min)
+			idx ^= 2u, pos.y = 1.5f;
+		if (1.5f * t_coef.z - t_bias.z > t_min)
+			idx ^= 4u, pos.z = 1.5f;
+
+		uint32_t scale = kStackSize - 1;
+		float scale_exp2 = 0.5f; // exp2( scale - STACK_SIZE )
+
+		const uint32_t leaf_scale = kStackSize - leaf_level;
+
+		for (;;) {
+			++iter;
+
+			if (child_bits == 0u)
+				child_bits = scale > leaf_scale
+				                 ? m_dag_nodes(parent)
+				                 : (scale == leaf_scale ? dag_get_leaf_first_child_bits(parent) : parent);
+			// Determine maximum t-value of the cube by evaluating
+			// tx(), ty(), and tz() at its corner.
+
+			glm::vec3 t_corner = pos * t_coef - t_bias;
+			float tc_max = glm::min(glm::min(t_corner.x, t_corner.y), t_corner.z);
+
+			uint32_t child_shift = idx ^ octant_mask; // permute child slots based on the mirroring
+			uint32_t child_mask = 1u << child_shift;
+
+			if ((child_bits & child_mask) != 0 && t_min <= t_max) {
+				// INTERSECT
+				float half_scale_exp2 = scale_exp2 * 0.5f;
+				glm::vec3 t_center = half_scale_exp2 * t_coef + t_corner;
+
+				if (scale < leaf_scale || scale_exp2 * proj_factor < tc_max + proj_bias)
+					break;
+
+				// PUSH
+				if (tc_max < h)
+					stack[scale] = parent;
+				h = tc_max;
+
+				parent = scale > leaf_scale
+				             ? m_dag_nodes(parent + 1 + std::popcount(child_bits & (child_mask - 1)))
+				             : (m_dag_nodes(parent + (child_shift >> 2u)) >> ((child_shift & 3u) << 3u)) & 0xFFu;
+
+				idx = 0u;
+				--scale;
+				scale_exp2 = half_scale_exp2;
+				if (t_center.x > t_min)
+					idx ^= 1u, pos.x += scale_exp2;
+				if (t_center.y > t_min)
+					idx ^= 2u, pos.y += scale_exp2;
+				if (t_center.z > t_min)
+					idx ^= 4u, pos.z += scale_exp2;
+
+				child_bits = 0;
+
+				continue;
+			}
+
+			// ADVANCE
+			uint32_t step_mask = 0u;
+			if (t_corner.x <= tc_max)
+				step_mask ^= 1u, pos.x -= scale_exp2;
+			if (t_corner.y <= tc_max)
+				step_mask ^= 2u, pos.y -= scale_exp2;
+			if (t_corner.z <= tc_max)
+				step_mask ^= 4u, pos.z -= scale_exp2;
+
+			// Update active t-span and flip bits of the child slot index.
+			t_min = tc_max;
+			idx ^= step_mask;
+
+			// Proceed with pop if the bit flips disagree with the ray direction.
+			if ((idx & step_mask) != 0) {
+				// POP
+				// Find the highest differing bit between the two positions.
+				uint32_t differing_bits = 0;
+				if ((step_mask & 1u) != 0)
+					differing_bits |= float_bits(pos.x) ^ float_bits(pos.x + scale_exp2);
+				if ((step_mask & 2u) != 0)
+					differing_bits |= float_bits(pos.y) ^ float_bits(pos.y + scale_exp2);
+				if ((step_mask & 4u) != 0)
+					differing_bits |= float_bits(pos.z) ^ float_bits(pos.z + scale_exp2);
+				scale = std::bit_width(differing_bits) - 1u; // findMSB(0) == -1
+				if (scale >= kStackSize)
+					break;
+				scale_exp2 = bits_float((scale - kStackSize + 127u) << 23u); // exp2f(scale - s_max)
+
+				// Restore parent voxel from the stack.
+				parent = stack[scale];
+
+				// Round cube position and extract child slot index.
+				uint32_t shx = float_bits(pos.x) >> scale;
+				uint32_t shy = float_bits(pos.y) >> scale;
+				uint32_t shz = float_bits(pos.z) >> scale;
+				pos.x = bits_float(shx << scale);
+				pos.y = bits_float(shy << scale);
+				pos.z = bits_float(shz << scale);
+				idx = (shx & 1u) | ((shy & 1u) << 1u) | ((shz & 1u) << 2u);
+
+				// Prevent same parent from being stored again and invalidate cached
+				// child descriptor.
+				h = 0.0f;
+				child_bits = 0;
+			}
+		}
+
+		// The outputs of a ray leaving the octree are undefined in trace.frag and shifts below would overflow
+		if (scale >= kStackSize) {
+			Hit miss{};
+			miss.iter = iter;
+			return miss;
+		}
+
+		glm::vec3 t_corner = t_coef * (pos + scale_exp2) - t_bias;
+
+		// normal
+		glm::vec3 norm = (t_corner.x > t_corner.y && t_corner.x > t_corner.z)
+		                     ? glm::vec3(-1, 0, 0)
+		                     : (t_corner.y > t_corner.z ? glm::vec3(0, -1, 0) : glm::vec3(0, 0, -1));
+		if ((octant_mask & 1u) == 0u)
+			norm.x = -norm.x;
+		if ((octant_mask & 2u) == 0u)
+			norm.y = -norm.y;
+		if ((octant_mask & 4u) == 0u)
+			norm.z = -norm.z;
+
+		const uint32_t voxel_level = leaf_level + 1u, voxel_scale = kStackSize - voxel_level;
+
+		// voxel size & position
+		uint32_t vox_size = 1u << (scale - voxel_scale);
+		glm::u32vec3 vox_pos =
+		    (glm::u32vec3{float_bits(pos.x), float_bits(pos.y), float_bits(pos.z)} & 0x7FFFFFu) >> voxel_scale;
+		if ((octant_mask & 1u) != 0u)
+			vox_pos.x = (1u << voxel_level) - vox_size - vox_pos.x;
+		if ((octant_mask & 2u) != 0u)
+			vox_pos.y = (1u << voxel_level) - vox_size - vox_pos.y;
+		if ((octant_mask & 4u) != 0u)
+			vox_pos.z = (1u << voxel_level) - vox_size - vox_pos.z;
+
+		// float voxel bounds & hit position (add to the bits of 1.0 so that the upper bound can carry to 2.0)
+		const auto to_float = [](glm::u32vec3 u) {
+			return glm::vec3{bits_float(u.x), bits_float(u.y), bits_float(u.z)};
+		};
+		glm::vec3 vox_min = to_float((vox_pos << voxel_scale) + (127u << 23u)),
+		          vox_max = to_float(((vox_pos + vox_size) << voxel_scale) + (127u << 23u));
+		glm::vec3 hit_pos = glm::clamp(o + t_min * d, vox_min, vox_max);
+		if (norm.x != 0)
+			hit_pos.x = norm.x > 0 ? vox_max.x + epsilon * 2 : vox_min.x - epsilon;
+		if (norm.y != 0)
+			hit_pos.y = norm.y > 0 ? vox_max.y + epsilon * 2 : vox_min.y - epsilon;
+		if (norm.z != 0)
+			hit_pos.z = norm.z > 0 ? vox_max.z + epsilon * 2 : vox_min.z - epsilon;
+		hit_pos -= 1.0f, vox_min -= 1.0f, vox_max -= 1.0f;
+
+		return {
+		    .hit = t_min <= t_max,
+		    .hit_pos = hit_pos,
+		    .norm = norm,
+		    .vox_pos = vox_pos,
+		    .vox_size = vox_size,
+		    .vox_min = vox_min,
+		    .vox_max = vox_max,
+		    .iter = iter,
+		};
+	}
+
+	// Color_Fetch(), vox_pos is walked by its Morton index
+	inline glm::vec3 ColorFetch(uint32_t root, uint32_t voxel_level, uint32_t leaf_level, glm::u32vec3 vox_pos,
+	                            uint32_t vox_size = 1u) const {
+		return m_color_fetcher.Fetch(root, voxel_level, leaf_level, hashdag::GetMortonIndex(vox_pos), vox_size);
+	}
+
+	// main() of trace.frag, frag_coord is the pixel center
+	inline glm::vec3 Shade(const Params &params, glm::vec2 frag_coord) const {
+		glm::vec2 coord = frag_coord / glm::vec2(params.width, params.height);
+		coord = coord * 2.0f - 1.0f;
+		glm::vec3 o = params.pos, d = glm::normalize(params.look - params.side * coord.x - params.up * coord.y);
+
+		Hit hit = RayMarch(params.dag_root, params.dag_leaf_level, params.proj_factor, 0, o, d);
+
+		if (params.type == 0) {
+			float diffuse = glm::max(glm::dot(hit.norm, glm::normalize(glm::vec3(4, 5, 3))), 0.0f) * .5f + .5f;
+			return hit.hit ? diffuse * ColorFetch(params.color_root, params.voxel_level, params.color_leaf_level,
+			                                      hit.vox_pos, hit.vox_size)
+			               : glm::vec3{0};
+		} else if (params.type == 1)
+			return hit.hit ? hit.norm * .5f + .5f : glm::vec3{0};
+		float heat = glm::clamp(float(hit.iter) / 128.0f, 0.0f, 1.0f);
+		return glm::sin(heat * 3.0f - glm::vec3(1, 2, 3)) * 0.5f + 0.5f;
+	}
+
+	// Render a width x height RGB8 frame, row 0 is the top
+	inline void Render(const Params &params, std::span<glm::u8vec3> image) const {
+		uint32_t tile_count = ((params.width + kTileSize - 1) / kTileSize) * ((params.height + kTileSize - 1) / kTileSize);
+		for (uint32_t t = 0; t < tile_count; ++t)
+			render_tile(params, image, t);
+	}
+	// Render() with kTileSize^2 tiles distributed by libfork
+	inline void ThreadedRender(lf::busy_pool *p_lf_pool, const Params &params, std::span<glm::u8vec3> image) const {
+		uint32_t tile_count = ((params.width + kTileSize - 1) / kTileSize) * ((params.height + kTileSize - 1) / kTileSize);
+		if (tile_count)
+			p_lf_pool->schedule(lf_render<lf::busy_pool::context>(&params, image, 0, tile_count));
+	}
+};
+
+// Binary PPM (P6)
+inline bool WritePPM(const char *filename, uint32_t width, uint32_t height, std::span<const glm::u8vec3> image) {
+	FILE *file = fopen(filename, "wb");
+	if (!file)
+		return false;
+	fprintf(file, "P6\n%u %u\n255\n", width, height);
+	static_assert(sizeof(glm::u8vec3) == 3);
+	bool ok = fwrite(image.data(), sizeof(glm::u8vec3), image.size(), file) == image.size();
+	return fclose(file) == 0 && ok;
+}
+
+#endif // VKHASHDAG_CPURENDERER_HPP
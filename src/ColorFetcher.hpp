@@ -0,0 +1,158 @@
+//
+// Created by adamyuan on 6/9/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_COLORFETCHER_HPP
+#define VKHASHDAG_COLORFETCHER_HPP
+
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <utility>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+// Reads a word of uDAGNodes, uColorNodes or uColorLeaves
+template <typename T>
+concept WordBufferReader = std::copy_constructible<T> && requires(const T e, uint32_t idx) {
+	{ e(idx) } -> std::convertible_to<uint32_t>;
+};
+
+// Color_Fetch() of trace.frag over the words of uColorNodes and uColorLeaves, for CPURenderer and ColorOctree
+// Voxels are addressed by Morton index, x in the lowest bit like the children of a node
+template <WordBufferReader ColorNodes, WordBufferReader ColorLeaves> class ColorFetcher {
+public:
+	// A pointer of the color octree and its level
+	struct Cell {
+		uint32_t ptr, level;
+	};
+
+private:
+	ColorNodes m_color_nodes;
+	ColorLeaves m_color_leaves;
+
+	inline static glm::vec3 unpack_unorm_rgb(uint32_t c) { return glm::vec3{glm::unpackUnorm4x8(c)}; }
+
+	inline glm::u32vec2 color_get_u2(uint32_t ofst, uint32_t idx) const {
+		uint32_t p = ofst + (idx << 1u);
+		return {m_color_leaves(p), m_color_leaves(p | 1u)};
+	}
+	inline uint32_t color_get_u2_x(uint32_t ofst, uint32_t idx) const { return m_color_leaves(ofst + (idx << 1u)); }
+	inline uint32_t color_get_u2_y(uint32_t ofst, uint32_t idx) const {
+		return m_color_leaves((ofst + (idx << 1u)) | 1u);
+	}
+	inline uint32_t color_get_weight(uint32_t ofst, uint32_t bit_idx, uint32_t bits_per_weight) const {
+		uint32_t bit_ofst = bit_idx & 31u;
+		bool single = bit_ofst + bits_per_weight <= 32;
+		uint32_t w0 = m_color_leaves(ofst + (bit_idx >> 5u)) >> bit_ofst;
+		if (single)
+			return w0 & ((1u << bits_per_weight) - 1u);
+		uint32_t w1 = m_color_leaves(ofst + (bit_idx >> 5u) + 1u);
+		w1 &= (1u << (bit_ofst + bits_per_weight - 32u)) - 1u;
+		return w0 | (w1 << (32u - bit_ofst));
+	}
+	inline static glm::vec3 color_unpack_rgb565(uint32_t c) {
+		glm::u32vec3 c3 = (glm::u32vec3(c) >> glm::u32vec3(0u, 5u, 11u)) & glm::u32vec3(0x1Fu, 0x3Fu, 0x1Fu);
+		return glm::vec3(c3) / glm::vec3(0x1Fu, 0x3Fu, 0x1Fu);
+	}
+	inline glm::vec3 color_get_palette_leaf_color(uint32_t idx, uint32_t vox_id) const {
+		uint32_t macro_cnt = m_color_leaves(idx + 1u) & 0x7FFFFFFFu, palette = m_color_leaves(idx + 2u),
+		         index_cnt = m_color_leaves(idx + 4u);
+		uint32_t color_offset = idx + 5u;
+		uint32_t index_offset = color_offset + (palette & 0xFFFFu);
+
+		if ((vox_id >> 14u) >= macro_cnt || index_cnt == 0u)
+			return glm::vec3{0};
+
+		// The last index extends to the end of the macro blocks
+		uint32_t bits_per_index = palette >> 16u;
+		uint32_t index =
+		    bits_per_index == 0u
+		        ? 0u
+		        : color_get_weight(index_offset, glm::min(vox_id, index_cnt - 1u) * bits_per_index, bits_per_index);
+		return unpack_unorm_rgb(m_color_leaves(color_offset + index));
+	}
+	inline glm::vec3 color_get_leaf_color(uint32_t idx, uint32_t vox_id) const {
+		uint32_t macro_cnt = m_color_leaves(idx + 1u), block_cnt = m_color_leaves(idx + 2u);
+		if ((macro_cnt & 0x80000000u) != 0u)
+			return color_get_palette_leaf_color(idx, vox_id);
+		uint32_t macro_offset = idx + 4u;
+		uint32_t block_offset = macro_offset + (macro_cnt << 1u);
+		uint32_t weight_offset = block_offset + (block_cnt << 1u);
+
+		uint32_t macro_id = vox_id >> 14u;
+		if (macro_id >= macro_cnt)
+			return glm::vec3{0};
+		glm::u32vec2 macro = color_get_u2(macro_offset, macro_id);
+
+		// Refine Block Range and Vox ID
+		block_offset += macro.x << 1u;
+		block_cnt =
+		    macro_id + 1u < macro_cnt ? color_get_u2_x(macro_offset, macro_id + 1u) - macro.x : block_cnt - macro.x;
+		vox_id &= 0x3FFFu;
+
+		// Binary Search for Block, Find the first block with vox_idx_offset > vox_id
+		if (block_cnt == 0u)
+			return glm::vec3{0};
+		for (uint32_t _ = 0; _ <= 14u && block_cnt != 0u; ++_) {
+			uint32_t step = block_cnt >> 1u;
+			if ((color_get_u2_y(block_offset, step) >> 18u) <= vox_id) {
+				block_cnt -= (step + 1u);
+				block_offset += (step + 1u) << 1u;
+			} else
+				block_cnt = step;
+		}
+		block_offset -= 2u;
+
+		// Read Color
+		glm::u32vec2 block = color_get_u2(block_offset, 0);
+		uint32_t bits_per_weight = (block.y >> 16u) & 0x3u;
+		if (bits_per_weight == 0u)
+			return unpack_unorm_rgb(block.x);
+
+		// In-block Vox ID & Global Bit ID
+		vox_id -= (block.y >> 18u);
+		uint32_t bit_id = macro.y + (block.y & 0xFFFFu) + vox_id * bits_per_weight;
+
+		// Read Weight Bits and Decode VBR Color
+		uint32_t weight = color_get_weight(weight_offset, bit_id, bits_per_weight);
+		float alpha = float(weight) / float((1u << bits_per_weight) - 1u);
+		return glm::mix(color_unpack_rgb565(block.x), color_unpack_rgb565(block.x >> 16u), alpha);
+	}
+
+public:
+	inline ColorFetcher(ColorNodes color_nodes, ColorLeaves color_leaves)
+	    : m_color_nodes{std::move(color_nodes)}, m_color_leaves{std::move(color_leaves)} {}
+
+	// Walks from root to the cell of the voxel until a pointer that is not a node, leaf_level, or the level of the LOD
+	// of vox_size
+	inline Cell FindCell(uint32_t root, uint32_t voxel_level, uint32_t leaf_level, uint64_t vox_id,
+	                     uint32_t vox_size = 1u) const {
+		uint32_t ptr = root, lod_level = voxel_level - (std::bit_width(vox_size) - 1u), l = 0;
+		for (; l < leaf_level && l < lod_level && (ptr >> 30u) == 0u; ++l) {
+			uint32_t header = m_color_nodes(ptr), fill_words = (header >> 8u) & 1u,
+			         child_mask = 1u << uint32_t((vox_id >> (3u * (voxel_level - 1u - l))) & 7u);
+			ptr = (header & child_mask) != 0u
+			          ? m_color_nodes(ptr + 1u + fill_words + std::popcount(header & (child_mask - 1u)))
+			          : (fill_words != 0u ? m_color_nodes(ptr + 1u) : 3u << 30u);
+		}
+		return {ptr, l};
+	}
+	// Color of a cell: the mip of a node, a fill color, black if null, or the color of the voxel leaf_vox_id of a leaf
+	inline glm::vec3 GetCellColor(uint32_t ptr, uint32_t leaf_vox_id) const {
+		uint32_t tag = ptr >> 30u, data = ptr & 0x3FFFFFFFu;
+		if (tag == 0u)
+			return color_unpack_rgb565(m_color_nodes(data) >> 16u);
+		return tag == 2u ? color_get_leaf_color(data, leaf_vox_id) : unpack_unorm_rgb(data);
+	}
+	inline glm::vec3 Fetch(uint32_t root, uint32_t voxel_level, uint32_t leaf_level, uint64_t vox_id,
+	                       uint32_t vox_size = 1u) const {
+		uint64_t leaf_vox_mask = (uint64_t(1) << (3u * (voxel_level - leaf_level))) - 1u;
+		return GetCellColor(FindCell(root, voxel_level, leaf_level, vox_id, vox_size).ptr,
+		                    uint32_t(vox_id & leaf_vox_mask));
+	}
+};
+
+#endif
@@ -0,0 +1,757 @@
+//
+// Created by adamyuan on 6/9/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_COLOROCTREE_HPP
+#define VKHASHDAG_COLOROCTREE_HPP
+
+#include <hashdag/Hasher.hpp>
+#include <hashdag/PaletteColor.hpp>
+#include <hashdag/VBRColor.hpp>
+#include <hashdag/VBRMip.hpp>
+#include <hashdag/VBROctree.hpp>
+
+#include "ColorFetcher.hpp"
+#include "FreeBlockList.hpp"
+#include "PagedVector.hpp"
+#include "Range.hpp"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <parallel_hashmap/phmap.h>
+#include <span>
+#include <vector>
+
+// Color octree of DAGColorPool without the Vulkan buffers, written words are tracked for FlushWrites()
+class ColorOctree {
+public:
+	template <typename T> using SafeLeafSpan = PagedSpan<SafePagedVector<uint32_t>, T>;
+	struct Pointer {
+		static constexpr uint32_t kDataBits = 30u;
+		enum class Tag { kNode = 0, kColor, kLeaf, kNull };
+		uint32_t pointer;
+		inline Pointer() : Pointer(Tag::kNull, 0u) {}
+		inline Pointer(Tag tag, uint32_t data) : pointer{(static_cast<uint32_t>(tag) << kDataBits) | data} {}
+		inline Tag GetTag() const { return static_cast<Tag>(pointer >> kDataBits); }
+		inline uint32_t GetData() const { return pointer & ((1u << kDataBits) - 1u); }
+
+		inline bool operator==(const Pointer &r) const { return pointer == r.pointer; }
+	};
+	static_assert(sizeof(Pointer) == sizeof(uint32_t));
+
+	struct Config {
+		uint32_t voxel_level, leaf_level;
+		uint32_t word_bits_per_node_page, word_bits_per_leaf_page;
+		bool keep_history;
+		// Share identical nodes and leaves by their content hash, leaves are then never rewritten in place
+		bool dedup{false};
+	};
+
+	// Nodes and leaves that were shared instead of appended
+	struct DedupStats {
+		std::size_t node_count, node_word_count, leaf_count, leaf_word_count;
+		inline std::size_t GetSavedBytes() const { return (node_word_count + leaf_word_count) * sizeof(uint32_t); }
+	};
+
+private:
+	// A node is [child mask | kNodeFillBit | mip << 16][fill][child pointers...], like the inner nodes of the DAG,
+	// children not in the mask are the fill pointer if kNodeFillBit is set, or null
+	// The mip is the R5G6B5 mean color of the non-null children, for fetches that stop at the node, rounded from the
+	// full-precision mean in m_node_means
+	static constexpr uint32_t kNodeFillBit = 1u << 8u, kNodeMipShift = 16u, kMaxNodeWords = 9;
+	static constexpr std::size_t kVBRStructWords = 2;
+	static_assert(kVBRStructWords == sizeof(hashdag::VBRMacroBlock) / sizeof(uint32_t));
+	static_assert(kVBRStructWords == sizeof(hashdag::VBRBlockHeader) / sizeof(uint32_t));
+	// A palette leaf is [block size][kPaletteLeafBit | macro cnt][color cnt | bits per index << 16][index word cnt]
+	// [index cnt][colors][index words], a VBR leaf is [block size][macro cnt][block cnt][weight word cnt][...]
+	static constexpr uint32_t kPaletteLeafBit = 1u << 31u;
+	// Smallest VBR leaf: the block size, the sizes, a macro block and a block header
+	static constexpr uint32_t kMinLeafBlockSize = 8;
+
+	SafePagedVector<uint32_t> m_nodes;
+	SafePagedVector<uint32_t> m_leaves;
+	// Blocks of leaves that moved or were removed, when leaves are rewritten in place, split down to the leaves
+	FreeBlockList<uint32_t> m_free_leaf_blocks{kMinLeafBlockSize};
+
+	Config m_config{};
+	Pointer m_root = {};
+
+	// Flush related Stuff
+	uint32_t m_flushed_node_word_count{0};
+	using PageWriteRanges =
+	    phmap::parallel_flat_hash_map<uint32_t, Range<uint32_t>, std::hash<uint32_t>, std::equal_to<>,
+	                                  std::allocator<std::pair<uint32_t, Range<uint32_t>>>, 6, std::mutex>;
+	// Node headers whose mip is updated in place, and leaves
+	PageWriteRanges m_node_page_write_ranges, m_leaf_page_write_ranges;
+
+	// Color sums of the leaves and mean colors of the nodes, for the mips of their parents
+	using ColorMap = phmap::parallel_flat_hash_map<uint32_t, glm::dvec3, std::hash<uint32_t>, std::equal_to<>,
+	                                               std::allocator<std::pair<uint32_t, glm::dvec3>>, 6, std::mutex>;
+	ColorMap m_leaf_color_sums, m_node_means;
+
+	// Content hash to the index of a node or leaf, only the first of colliding contents is shared
+	using DedupMap = phmap::parallel_flat_hash_map<uint32_t, uint32_t, std::hash<uint32_t>, std::equal_to<>,
+	                                               std::allocator<std::pair<uint32_t, uint32_t>>, 6, std::mutex>;
+	DedupMap m_node_dedup_map, m_leaf_dedup_map;
+	std::atomic_size_t m_dedup_node_count{0}, m_dedup_node_word_count{0}, m_dedup_leaf_count{0},
+	    m_dedup_leaf_word_count{0};
+
+	// VBR chunks decoded from palette leaves for editing, kept until Flush()
+	mutable SafePagedVector<uint32_t> m_decoded_leaves;
+	mutable phmap::parallel_flat_hash_map<uint32_t, uint32_t, std::hash<uint32_t>, std::equal_to<>,
+	                                      std::allocator<std::pair<uint32_t, uint32_t>>, 6, std::mutex>
+	    m_decoded_leaf_indices;
+
+	inline static void write_leaf_chunk(SafePagedVector<uint32_t> &leaves, std::size_t idx,
+	                                    const hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer> &chunk) {
+		// Write Sizes
+		leaves.Write(idx++, [&](uint32_t &x) { x = chunk.GetMacroBlocks().size(); });
+		leaves.Write(idx++, [&](uint32_t &x) { x = chunk.GetBlockHeaders().size(); });
+		leaves.Write(idx++, [&](uint32_t &x) { x = chunk.GetWeightBits().GetWords().size(); });
+		// Write MacroBlocks
+		leaves.Write(idx, chunk.GetMacroBlocks().size() * kVBRStructWords,
+		               [&](std::size_t offset, std::size_t, std::size_t, std::span<uint32_t> span) {
+			               assert(idx % kVBRStructWords == 0 && offset % kVBRStructWords == 0);
+			               std::ranges::copy(std::span{chunk.GetMacroBlocks().data() + offset / kVBRStructWords,
+			                                           span.size() / kVBRStructWords},
+			                                 (hashdag::VBRMacroBlock *)span.data());
+		               });
+		idx += chunk.GetMacroBlocks().size() * kVBRStructWords;
+		// Write BlockHeaders
+		leaves.Write(idx, chunk.GetBlockHeaders().size() * kVBRStructWords,
+		               [&](std::size_t offset, std::size_t, std::size_t, std::span<uint32_t> span) {
+			               assert(idx % kVBRStructWords == 0 && offset % kVBRStructWords == 0);
+			               std::ranges::copy(std::span{chunk.GetBlockHeaders().data() + offset / kVBRStructWords,
+			                                           span.size() / kVBRStructWords},
+			                                 (hashdag::VBRBlockHeader *)span.data());
+		               });
+		idx += chunk.GetBlockHeaders().size() * kVBRStructWords;
+		// Write WeightBits
+		leaves.Write(idx, chunk.GetWeightBits().GetWords().size(),
+		               [&](std::size_t offset, std::size_t, std::size_t, std::span<uint32_t> span) {
+			               std::ranges::copy(std::span{chunk.GetWeightBits().GetWords().data() + offset, span.size()},
+			                                 span.data());
+		               });
+	}
+
+	// Words of a leaf, including the "block size" indicator
+	inline static std::size_t get_leaf_data_size(const hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer> &chunk) {
+		return chunk.GetMacroBlocks().size() * kVBRStructWords + chunk.GetBlockHeaders().size() * kVBRStructWords +
+		       chunk.GetWeightBits().GetWords().size() + 4;
+	}
+	// Words of a palette leaf, including the "block size" indicator
+	inline static std::size_t
+	get_palette_data_size(const hashdag::PaletteChunk<uint32_t, hashdag::VBRWriterContainer> &chunk) {
+		return chunk.GetColors().size() + chunk.GetIndexBits().GetWords().size() + 5;
+	}
+	inline void write_leaf_words(std::size_t idx, std::span<const uint32_t> words) {
+		mark_leaf(idx, words.size());
+		m_leaves.Write(idx, words.size(), [&](std::size_t offset, std::size_t, std::size_t, std::span<uint32_t> span) {
+			std::ranges::copy(words.subspan(offset, span.size()), span.data());
+		});
+	}
+	// Rewrites the leaf at idx in place, only writing the words that may differ from the source of chunk
+	// Words before the first dirty macro block never move, words after it move if the dirty ones change in size
+	inline void patch_leaf_chunk(std::size_t idx, const hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer> &chunk,
+	                             std::span<const uint32_t> dirty_macro_blocks) {
+		const auto &macro_blocks = chunk.GetMacroBlocks();
+		const auto &block_headers = chunk.GetBlockHeaders();
+		const auto &weight_words = chunk.GetWeightBits().GetWords();
+		std::array<uint32_t, 3> sizes = {(uint32_t)macro_blocks.size(), (uint32_t)block_headers.size(),
+		                                 (uint32_t)weight_words.size()},
+		                        src_sizes = {m_leaves.Read(idx, std::identity{}), m_leaves.Read(idx + 1, std::identity{}),
+		                                     m_leaves.Read(idx + 2, std::identity{})};
+		if (dirty_macro_blocks.empty() && sizes == src_sizes)
+			return;
+		if (dirty_macro_blocks.empty() || sizes[0] != src_sizes[0]) {
+			mark_leaf(idx, 3 + (sizes[0] + sizes[1]) * kVBRStructWords + sizes[2]);
+			write_leaf_chunk(m_leaves, idx, chunk);
+			return;
+		}
+		// Write Sizes
+		if (sizes != src_sizes)
+			write_leaf_words(idx, sizes);
+		idx += 3;
+		// Write MacroBlocks after the first dirty one
+		const hashdag::VBRMacroBlock &first_dirty = macro_blocks[dirty_macro_blocks.front()];
+		bool same_macro_blocks = true;
+		m_leaves.Read(idx, macro_blocks.size() * kVBRStructWords,
+		              [&](std::size_t offset, std::size_t, std::size_t, std::span<const uint32_t> span) {
+			              same_macro_blocks &= std::ranges::equal(
+			                  std::span{macro_blocks.data() + offset / kVBRStructWords, span.size() / kVBRStructWords},
+			                  std::span{(const hashdag::VBRMacroBlock *)span.data(), span.size() / kVBRStructWords});
+		              });
+		if (!same_macro_blocks) {
+			std::size_t first = dirty_macro_blocks.front() + 1;
+			write_leaf_words(idx + first * kVBRStructWords,
+			                 std::span{(const uint32_t *)(macro_blocks.data() + first),
+			                           (macro_blocks.size() - first) * kVBRStructWords});
+		}
+		idx += macro_blocks.size() * kVBRStructWords;
+
+		const auto write_block_headers = [&](std::size_t first, std::size_t last) {
+			write_leaf_words(idx + first * kVBRStructWords, std::span{(const uint32_t *)(block_headers.data() + first),
+			                                                          (last - first) * kVBRStructWords});
+		};
+		const auto write_weight_words = [&](std::size_t weight_idx, std::size_t first, std::size_t last) {
+			write_leaf_words(weight_idx + first, std::span{weight_words.data() + first, last - first});
+		};
+		std::size_t weight_idx = idx + block_headers.size() * kVBRStructWords;
+		if (same_macro_blocks) {
+			// Only the dirty macro blocks changed, words shared with their neighbours are written as well
+			for (uint32_t macro_id : dirty_macro_blocks) {
+				if (macro_id >= macro_blocks.size())
+					break;
+				bool is_last = macro_id + 1 == macro_blocks.size();
+				write_block_headers(macro_blocks[macro_id].first_block,
+				                    is_last ? block_headers.size() : macro_blocks[macro_id + 1].first_block);
+				if (sizes[1] == src_sizes[1])
+					write_weight_words(weight_idx, macro_blocks[macro_id].weight_start / 32u,
+					                   is_last ? weight_words.size()
+					                           : (macro_blocks[macro_id + 1].weight_start + 31u) / 32u);
+			}
+		} else {
+			write_block_headers(first_dirty.first_block, block_headers.size());
+			if (sizes[1] == src_sizes[1])
+				write_weight_words(weight_idx, first_dirty.weight_start / 32u, weight_words.size());
+		}
+		// WeightBits move with the count of BlockHeaders
+		if (sizes[1] != src_sizes[1])
+			write_weight_words(weight_idx, 0, weight_words.size());
+	}
+
+	inline static hashdag::VBRChunk<uint32_t, SafeLeafSpan> fetch_leaf_chunk(const SafePagedVector<uint32_t> &leaves,
+	                                                                          std::size_t idx) {
+		// Read Sizes
+		std::size_t macro_block_count = leaves.Read(idx++, std::identity{});
+		std::size_t block_header_count = leaves.Read(idx++, std::identity{});
+		std::size_t bit_word_count = leaves.Read(idx++, std::identity{});
+		// Span for MacroBlocks
+		SafeLeafSpan<hashdag::VBRMacroBlock> macro_block_span{leaves, idx, macro_block_count * kVBRStructWords};
+		idx += macro_block_count * kVBRStructWords;
+		// Span for BlockHeaders
+		SafeLeafSpan<hashdag::VBRBlockHeader> block_header_span{leaves, idx, block_header_count * kVBRStructWords};
+		idx += block_header_count * kVBRStructWords;
+		// Span for WeightBits
+		SafeLeafSpan<uint32_t> bit_span{leaves, idx, bit_word_count};
+		return hashdag::VBRChunk<uint32_t, SafeLeafSpan>{macro_block_span, block_header_span,
+		                                                 hashdag::VBRBitset<uint32_t, SafeLeafSpan>{bit_span}};
+	}
+
+	inline void write_palette_chunk(std::size_t idx,
+	                                const hashdag::PaletteChunk<uint32_t, hashdag::VBRWriterContainer> &chunk) {
+		const auto &colors = chunk.GetColors();
+		const auto &index_words = chunk.GetIndexBits().GetWords();
+		// Write Header
+		m_leaves.Write(idx++, [&](uint32_t &x) { x = kPaletteLeafBit | chunk.GetMacroBlockCount(); });
+		m_leaves.Write(idx++, [&](uint32_t &x) { x = colors.size() | (chunk.GetBitsPerIndex() << 16u); });
+		m_leaves.Write(idx++, [&](uint32_t &x) { x = index_words.size(); });
+		m_leaves.Write(idx++, [&](uint32_t &x) { x = chunk.GetIndexCount(); });
+		// Write Colors
+		m_leaves.Write(idx, colors.size(), [&](std::size_t offset, std::size_t, std::size_t, std::span<uint32_t> span) {
+			std::ranges::copy(std::span{colors.data() + offset, span.size()}, span.data());
+		});
+		idx += colors.size();
+		// Write IndexBits
+		m_leaves.Write(idx, index_words.size(),
+		               [&](std::size_t offset, std::size_t, std::size_t, std::span<uint32_t> span) {
+			               std::ranges::copy(std::span{index_words.data() + offset, span.size()}, span.data());
+		               });
+	}
+	inline hashdag::PaletteChunk<uint32_t, SafeLeafSpan> fetch_palette_chunk(std::size_t idx) const {
+		// Read Header
+		uint32_t macro_block_count = m_leaves.Read(idx++, std::identity{}) & ~kPaletteLeafBit;
+		std::size_t color_count = m_leaves.Read(idx++, std::identity{}) & 0xFFFFu;
+		std::size_t index_word_count = m_leaves.Read(idx++, std::identity{});
+		uint32_t index_count = m_leaves.Read(idx++, std::identity{});
+		// Span for Colors and IndexBits
+		SafeLeafSpan<uint32_t> color_span{m_leaves, idx, color_count};
+		SafeLeafSpan<uint32_t> index_span{m_leaves, idx + color_count, index_word_count};
+		return hashdag::PaletteChunk<uint32_t, SafeLeafSpan>{macro_block_count, index_count, color_span,
+		                                                     hashdag::VBRBitset<uint32_t, SafeLeafSpan>{index_span}};
+	}
+	inline bool is_palette_leaf(std::size_t idx) const { return m_leaves.Read(idx, std::identity{}) & kPaletteLeafBit; }
+	// Colors of ascending voxel indices of the leaf at idx, read in place like Color_GetLeafColor() of trace.frag
+	inline void get_leaf_colors(std::size_t idx, std::span<const uint32_t> sorted_voxel_indices,
+	                            std::span<hashdag::VBRColor> colors) const {
+		if (!is_palette_leaf(idx)) {
+			fetch_leaf_chunk(m_leaves, idx).GetColors(sorted_voxel_indices, colors);
+			return;
+		}
+		auto chunk = fetch_palette_chunk(idx);
+		std::ranges::transform(sorted_voxel_indices, colors.begin(),
+		                       [&](uint32_t voxel_index) { return chunk.GetColor(voxel_index); });
+	}
+
+	inline static bool equal_elements(const auto &l, const auto &r) {
+		if (l.size() != r.size())
+			return false;
+		for (std::size_t i = 0; i < l.size(); ++i)
+			if (!(l[i] == r[i]))
+				return false;
+		return true;
+	}
+	inline static uint32_t hash_words(const auto &container) {
+		using T = std::decay_t<decltype(container[0])>;
+		return hashdag::MurmurHasher32{}(
+		    std::span{(const uint32_t *)container.data(), container.size() * (sizeof(T) / sizeof(uint32_t))});
+	}
+	inline static uint32_t hash_leaf(const hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer> &chunk) {
+		std::array<uint32_t, 3> hashes = {hash_words(chunk.GetMacroBlocks()), hash_words(chunk.GetBlockHeaders()),
+		                                  hash_words(chunk.GetWeightBits().GetWords())};
+		return hashdag::MurmurHasher32{}(hashes);
+	}
+	inline static uint32_t hash_leaf(const hashdag::PaletteChunk<uint32_t, hashdag::VBRWriterContainer> &chunk) {
+		std::array<uint32_t, 4> hashes = {kPaletteLeafBit | chunk.GetMacroBlockCount(), chunk.GetIndexCount(),
+		                                  hash_words(chunk.GetColors()), hash_words(chunk.GetIndexBits().GetWords())};
+		return hashdag::MurmurHasher32{}(hashes);
+	}
+	inline bool leaf_equals(std::size_t idx,
+	                        const hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer> &chunk) const {
+		if (is_palette_leaf(idx))
+			return false;
+		auto leaf = fetch_leaf_chunk(m_leaves, idx);
+		return equal_elements(leaf.GetMacroBlocks(), chunk.GetMacroBlocks()) &&
+		       equal_elements(leaf.GetBlockHeaders(), chunk.GetBlockHeaders()) &&
+		       equal_elements(leaf.GetWeightBits().GetWords(), chunk.GetWeightBits().GetWords());
+	}
+	inline bool leaf_equals(std::size_t idx,
+	                        const hashdag::PaletteChunk<uint32_t, hashdag::VBRWriterContainer> &chunk) const {
+		if (!is_palette_leaf(idx))
+			return false;
+		auto leaf = fetch_palette_chunk(idx);
+		return leaf.GetMacroBlockCount() == chunk.GetMacroBlockCount() &&
+		       leaf.GetIndexCount() == chunk.GetIndexCount() && equal_elements(leaf.GetColors(), chunk.GetColors()) &&
+		       equal_elements(leaf.GetIndexBits().GetWords(), chunk.GetIndexBits().GetWords());
+	}
+	// Packs child pointers and the mip into node words, returns the word count
+	// The most frequent child becomes the fill if it is a color shared by more children than null
+	inline static uint32_t pack_node(std::span<const Pointer, 8> child_ptrs, uint32_t mip,
+	                                 std::span<uint32_t, kMaxNodeWords> words) {
+		Pointer fill{};
+		uint32_t fill_count = std::ranges::count(child_ptrs, Pointer{});
+		for (Pointer p : child_ptrs)
+			if (uint32_t c = std::ranges::count(child_ptrs, p); p.GetTag() == Pointer::Tag::kColor && c >= 2u &&
+			                                                     c > fill_count)
+				fill = p, fill_count = c;
+
+		uint32_t count = 1, header = mip << kNodeMipShift;
+		if (fill.GetTag() != Pointer::Tag::kNull) {
+			header |= kNodeFillBit;
+			words[count++] = fill.pointer;
+		}
+		for (uint32_t i = 0; i < 8; ++i)
+			if (!(child_ptrs[i] == fill)) {
+				header |= 1u << i;
+				words[count++] = child_ptrs[i].pointer;
+			}
+		words[0] = header;
+		return count;
+	}
+	inline uint32_t get_leaf_voxel_count() const { return 1u << (3u * (m_config.voxel_level - m_config.leaf_level)); }
+	inline hashdag::RGBColor get_node_mip(Pointer ptr) const {
+		return hashdag::R5G6B5Color(uint16_t(ReadNodeWord(ptr.GetData()) >> kNodeMipShift)).Get();
+	}
+	inline glm::dvec3 get_node_mean(Pointer ptr) const {
+		std::optional<glm::dvec3> opt_mean;
+		m_node_means.if_contains(ptr.GetData(), [&](const auto &it) { opt_mean = it.second; });
+		return opt_mean ? *opt_mean : glm::dvec3{get_node_mip(ptr)};
+	}
+	// Mip of the non-null children, leaves average all of their voxels
+	inline hashdag::VBRMip get_mip(std::span<const Pointer, 8> child_ptrs) const {
+		hashdag::VBRMip mip;
+		for (Pointer p : child_ptrs) {
+			switch (p.GetTag()) {
+			case Pointer::Tag::kNode:
+				mip.AddMean(get_node_mean(p));
+				break;
+			case Pointer::Tag::kColor:
+				mip.AddColor(hashdag::RGB8Color{p.GetData()}.Get());
+				break;
+			case Pointer::Tag::kLeaf: {
+				std::optional<glm::dvec3> opt_sum;
+				m_leaf_color_sums.if_contains(p.GetData(), [&](const auto &it) { opt_sum = it.second; });
+				if (!opt_sum)
+					opt_sum = GetLeaf(p).GetColorSum(get_leaf_voxel_count());
+				mip.AddColorSum(*opt_sum, get_leaf_voxel_count());
+				break;
+			}
+			case Pointer::Tag::kNull:
+				break;
+			}
+		}
+		return mip;
+	}
+	// Color sum of chunk replacing the leaf at ptr, only its dirty macro blocks are summed if they are all that changed
+	inline glm::dvec3 get_leaf_color_sum(Pointer ptr,
+	                                     const hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer> &chunk,
+	                                     std::span<const uint32_t> dirty_macro_blocks) const {
+		uint32_t voxel_count = get_leaf_voxel_count();
+		std::optional<glm::dvec3> opt_sum;
+		if (ptr.GetTag() == Pointer::Tag::kLeaf && !dirty_macro_blocks.empty())
+			m_leaf_color_sums.if_contains(ptr.GetData(), [&](const auto &it) { opt_sum = it.second; });
+		if (!opt_sum)
+			return chunk.GetColorSum(voxel_count);
+		auto src_chunk = GetLeaf(ptr);
+		if (src_chunk.GetMacroBlocks().size() != chunk.GetMacroBlocks().size())
+			return chunk.GetColorSum(voxel_count);
+		for (uint32_t macro_id : dirty_macro_blocks)
+			if (macro_id < chunk.GetMacroBlocks().size())
+				*opt_sum += chunk.GetMacroBlockColorSum(macro_id, voxel_count) -
+				            src_chunk.GetMacroBlockColorSum(macro_id, voxel_count);
+		return *opt_sum;
+	}
+	inline bool node_equals(std::size_t idx, std::span<const uint32_t> words) const {
+		for (uint32_t i = 0; i < words.size(); ++i)
+			if (m_nodes.Read(idx + i, std::identity{}) != words[i])
+				return false;
+		return true;
+	}
+
+	// Leaves and node mips are rewritten in place only if no history is kept and they are not shared
+	inline bool rewrites_leaves() const { return !m_config.keep_history && !m_config.dedup; }
+	inline void free_leaf_block(std::size_t idx) {
+		m_decoded_leaf_indices.erase(idx + 1);
+		m_leaf_color_sums.erase(idx);
+		m_free_leaf_blocks.Push({.idx = (uint32_t)idx, .size = m_leaves.Read(idx, std::identity{})});
+	}
+	// Frees the leaf blocks of a subtree that is replaced
+	inline void free_leaf_blocks(Pointer ptr) {
+		if (!rewrites_leaves())
+			return;
+		if (ptr.GetTag() == Pointer::Tag::kLeaf)
+			free_leaf_block(ptr.GetData());
+		else if (ptr.GetTag() == Pointer::Tag::kNode)
+			for (uint32_t i = 0; i < 8; ++i)
+				free_leaf_blocks(GetChild(ptr, i));
+	}
+
+	inline static void mark_words(const SafePagedVector<uint32_t> &vector, PageWriteRanges &page_write_ranges,
+	                              std::size_t idx, std::size_t count) {
+		vector.ForeachPage(idx, count, [&](std::size_t, uint32_t page_id, uint32_t page_offset, uint32_t inpage_count) {
+			Range<uint32_t> range{.begin = page_offset, .end = page_offset + inpage_count};
+			page_write_ranges.lazy_emplace_l(
+			    page_id, [&](auto &it) { it.second.Union(range); }, [&](const auto &ctor) { ctor(page_id, range); });
+		});
+	}
+	inline void mark_leaf(std::size_t idx, std::size_t count) {
+		mark_words(m_leaves, m_leaf_page_write_ranges, idx, count);
+	}
+	// Reads the node and leaf words like uColorNodes and uColorLeaves
+	inline auto get_fetcher() const {
+		return ColorFetcher{[this](uint32_t idx) { return ReadNodeWord(idx); },
+		                    [this](uint32_t idx) { return ReadLeafWord(idx); }};
+	}
+
+	// Writes data_size words of a leaf chunk (including the "block size" indicator) by writer(idx) in place or appended
+	// With Config::dedup, an equal leaf of the same hash is shared instead
+	inline Pointer set_leaf(Pointer ptr, const auto &chunk, std::size_t data_size, const glm::dvec3 &color_sum,
+	                        std::invocable<std::size_t> auto &&writer) {
+		static_assert(kVBRStructWords == 2);
+		std::size_t append_size = (data_size & 1) ? data_size + 1 : data_size;
+
+		uint32_t hash = 0;
+		if (m_config.dedup) {
+			hash = hash_leaf(chunk);
+			std::optional<uint32_t> opt_shared_idx;
+			m_leaf_dedup_map.if_contains(hash, [&](const auto &it) {
+				if (leaf_equals(it.second + 1, chunk))
+					opt_shared_idx = it.second;
+			});
+			if (opt_shared_idx) {
+				++m_dedup_leaf_count;
+				m_dedup_leaf_word_count += append_size;
+				return Pointer{Pointer::Tag::kLeaf, *opt_shared_idx};
+			}
+		}
+
+		bool moves_leaf = rewrites_leaves() && ptr.GetTag() == Pointer::Tag::kLeaf;
+		if (moves_leaf) {
+			std::size_t idx = ptr.GetData(), block_size = m_leaves.Read(idx, std::identity{});
+			assert(idx % kVBRStructWords == 0 && block_size % kVBRStructWords == 0);
+			// The decoded chunk of the overwritten leaf is outdated
+			m_decoded_leaf_indices.erase(idx + 1);
+			if (data_size <= block_size) {
+				// Space is enough, write and return
+				mark_leaf(idx + 1, data_size - 1); // not mark the first "block size" indicator
+				writer(idx + 1);
+				m_leaf_color_sums.insert_or_assign(idx, color_sum);
+				return ptr;
+			}
+			append_size = std::max(block_size << 1, append_size); // Double the space
+		}
+
+		assert(data_size <= append_size && append_size % kVBRStructWords == 0);
+
+		// Reuse a free block, or append
+		std::size_t idx, block_size = append_size;
+		if (auto opt_block = rewrites_leaves() ? m_free_leaf_blocks.Pop(append_size) : std::nullopt) {
+			idx = opt_block->idx, block_size = opt_block->size;
+		} else {
+			auto opt_idx = m_leaves.Append(append_size, [](auto &&...) {});
+			// TODO: Test out-of-memory
+			if (!opt_idx)
+				return ptr;
+			idx = *opt_idx;
+		}
+		mark_leaf(idx, data_size);
+		m_leaves.Write(idx, [&](uint32_t &x) { x = block_size; });
+		writer(idx + 1);
+		m_leaf_color_sums.insert_or_assign(idx, color_sum);
+		if (moves_leaf)
+			free_leaf_block(ptr.GetData());
+		if (m_config.dedup)
+			m_leaf_dedup_map.try_emplace_l(hash, [](auto &) {}, (uint32_t)idx);
+		return Pointer{Pointer::Tag::kLeaf, (uint32_t)idx};
+	}
+
+public:
+	inline ColorOctree(const Config &config, std::size_t node_page_total, std::size_t leaf_page_total)
+	    : m_config{config} {
+		m_nodes.Reset(node_page_total, config.word_bits_per_node_page);
+		m_leaves.Reset(leaf_page_total, config.word_bits_per_leaf_page);
+		m_decoded_leaves.Reset(leaf_page_total, config.word_bits_per_leaf_page);
+	}
+
+	inline const Config &GetConfig() const { return m_config; }
+
+	inline Pointer GetChild(Pointer ptr, auto idx) const {
+		if (ptr.GetTag() != Pointer::Tag::kNode)
+			return ptr.GetTag() == Pointer::Tag::kColor ? ptr : Pointer{};
+		uint32_t header = m_nodes.Read(ptr.GetData(), std::identity{}), child_mask = 1u << uint32_t(idx),
+		         fill_words = (header & kNodeFillBit) ? 1u : 0u;
+		if (!(header & child_mask) && !fill_words)
+			return Pointer{};
+		Pointer child;
+		child.pointer = m_nodes.Read(ptr.GetData() + 1u + ((header & child_mask)
+		                                                      ? fill_words + std::popcount(header & (child_mask - 1u))
+		                                                      : 0u),
+		                             std::identity{});
+		return child;
+	}
+	static inline hashdag::VBRColor GetFill(Pointer ptr) {
+		return ptr.GetTag() == Pointer::Tag::kColor ? hashdag::VBRColor{ptr.GetData()} : hashdag::VBRColor{};
+	}
+	inline Pointer SetNode(Pointer ptr, std::span<const Pointer, 8> child_ptrs) {
+		// Null
+		if (std::ranges::all_of(child_ptrs, [](Pointer p) { return p.GetTag() == Pointer::Tag::kNull; }))
+			return {};
+		// Color
+		if (Pointer c = child_ptrs[0]; c.GetTag() == Pointer::Tag::kColor &&
+		                               std::ranges::all_of(child_ptrs.subspan(1), [c](Pointer p) { return p == c; }))
+			return c;
+		hashdag::VBRMip mip = get_mip(child_ptrs);
+		std::array<uint32_t, kMaxNodeWords> node_words;
+		auto words = std::span{node_words}.first(pack_node(child_ptrs, mip.GetR5G6B5().GetData(), node_words));
+		// Node (not changed, or only its mip changed)
+		if (ptr.GetTag() == Pointer::Tag::kNode) {
+			uint32_t idx = ptr.GetData(), header = m_nodes.Read(idx, std::identity{});
+			constexpr uint32_t kLayoutMask = (1u << kNodeMipShift) - 1u;
+			if ((header & kLayoutMask) == (words[0] & kLayoutMask) && node_equals(idx + 1, words.subspan(1))) {
+				// The mean may change within the same R5G6B5 mip, if children were rewritten in place
+				if (header == words[0]) {
+					m_node_means.insert_or_assign(idx, mip.GetMean());
+					return ptr;
+				}
+				if (rewrites_leaves()) {
+					m_nodes.Write(idx, [&](uint32_t &x) { x = words[0]; });
+					mark_words(m_nodes, m_node_page_write_ranges, idx, 1);
+					m_node_means.insert_or_assign(idx, mip.GetMean());
+					return ptr;
+				}
+			}
+		}
+		// Share an equal node
+		uint32_t hash = 0;
+		if (m_config.dedup) {
+			hash = hashdag::MurmurHasher32{}(std::span<const uint32_t>{words});
+			std::optional<uint32_t> opt_shared_idx;
+			m_node_dedup_map.if_contains(hash, [&](const auto &it) {
+				if (node_equals(it.second, words))
+					opt_shared_idx = it.second;
+			});
+			if (opt_shared_idx) {
+				++m_dedup_node_count;
+				m_dedup_node_word_count += words.size();
+				return Pointer{Pointer::Tag::kNode, *opt_shared_idx};
+			}
+		}
+		// Need to create a new node
+		auto opt_idx = m_nodes.Append(words.size(), [&](std::size_t offset, std::size_t, std::size_t,
+		                                                std::span<uint32_t> span) {
+			std::ranges::copy(words.subspan(offset, span.size()), span.begin());
+		});
+		if (opt_idx)
+			m_node_means.insert_or_assign(*opt_idx, mip.GetMean());
+		if (opt_idx && m_config.dedup)
+			m_node_dedup_map.try_emplace_l(hash, [](auto &) {}, (uint32_t)*opt_idx);
+		return opt_idx ? Pointer{Pointer::Tag::kNode, (uint32_t)*opt_idx} : ptr;
+	}
+	inline Pointer ClearNode(Pointer ptr) {
+		free_leaf_blocks(ptr);
+		return Pointer{};
+	}
+	inline Pointer FillNode(Pointer ptr, hashdag::VBRColor color) {
+		free_leaf_blocks(ptr);
+		return Pointer{Pointer::Tag::kColor, hashdag::RGB8Color{color.Get()}.GetData()};
+	}
+
+	inline hashdag::VBRChunk<uint32_t, SafeLeafSpan> GetLeaf(Pointer ptr) const {
+		if (ptr.GetTag() != Pointer::Tag::kLeaf)
+			return {};
+		std::size_t idx = ptr.GetData() + 1;
+		if (!is_palette_leaf(idx))
+			return fetch_leaf_chunk(m_leaves, idx);
+		// Palette leaves are edited as VBR chunks, decoded once for all the writers of the leaf
+		uint32_t decoded_idx = -1;
+		m_decoded_leaf_indices.lazy_emplace_l(
+		    idx, [&](const auto &it) { decoded_idx = it.second; },
+		    [&](const auto &ctor) {
+			    auto chunk = fetch_palette_chunk(idx).ToVBR();
+			    // Same alignment as m_leaves
+			    std::size_t data_size = get_leaf_data_size(chunk);
+			    auto opt_decoded_idx = m_decoded_leaves.Append(data_size + (data_size & 1), [](auto &&...) {});
+			    // TODO: Test out-of-memory
+			    if (opt_decoded_idx) {
+				    decoded_idx = *opt_decoded_idx + 1;
+				    write_leaf_chunk(m_decoded_leaves, decoded_idx, chunk);
+			    }
+			    ctor(idx, decoded_idx);
+		    });
+		return decoded_idx == uint32_t(-1) ? hashdag::VBRChunk<uint32_t, SafeLeafSpan>{}
+		                                   : fetch_leaf_chunk(m_decoded_leaves, decoded_idx);
+	}
+	// Leaves of only a few flat colors are stored as palette leaves if they are smaller
+	inline Pointer SetLeaf(Pointer ptr, hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer> &&chunk) {
+		glm::dvec3 color_sum = chunk.GetColorSum(get_leaf_voxel_count());
+		if (auto opt_palette_chunk = hashdag::EncodePaletteChunk(chunk))
+			return set_leaf(ptr, *opt_palette_chunk, get_palette_data_size(*opt_palette_chunk), color_sum,
+			                [&](std::size_t idx) { write_palette_chunk(idx, *opt_palette_chunk); });
+		return set_leaf(ptr, chunk, get_leaf_data_size(chunk), color_sum,
+		                [&](std::size_t idx) { write_leaf_chunk(m_leaves, idx, chunk); });
+	}
+	// Rewrites only the dirty macro blocks (and what follows them if their sizes changed) when the leaf is kept in place
+	inline Pointer SetLeaf(Pointer ptr, hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer> &&chunk,
+	                       std::span<const uint32_t> dirty_macro_blocks) {
+		// Summed before the source leaf is overwritten
+		glm::dvec3 color_sum = get_leaf_color_sum(ptr, chunk, dirty_macro_blocks);
+		if (auto opt_palette_chunk = hashdag::EncodePaletteChunk(chunk))
+			return set_leaf(ptr, *opt_palette_chunk, get_palette_data_size(*opt_palette_chunk), color_sum,
+			                [&](std::size_t idx) { write_palette_chunk(idx, *opt_palette_chunk); });
+		if (rewrites_leaves() && ptr.GetTag() == Pointer::Tag::kLeaf) {
+			std::size_t idx = ptr.GetData();
+			if (get_leaf_data_size(chunk) <= m_leaves.Read(idx, std::identity{})) {
+				m_decoded_leaf_indices.erase(idx + 1);
+				patch_leaf_chunk(idx + 1, chunk, dirty_macro_blocks);
+				m_leaf_color_sums.insert_or_assign(idx, color_sum);
+				return ptr;
+			}
+		}
+		return set_leaf(ptr, chunk, get_leaf_data_size(chunk), color_sum,
+		                [&](std::size_t idx) { write_leaf_chunk(m_leaves, idx, chunk); });
+	}
+	inline uint32_t GetLeafLevel() const { return m_config.leaf_level; }
+
+	// Words of leaf blocks waiting to be reused
+	inline std::size_t GetFreeLeafWordCount() const { return m_free_leaf_blocks.GetFreeSize(); }
+	inline DedupStats GetDedupStats() const {
+		return {.node_count = m_dedup_node_count,
+		        .node_word_count = m_dedup_node_word_count,
+		        .leaf_count = m_dedup_leaf_count,
+		        .leaf_word_count = m_dedup_leaf_word_count};
+	}
+
+	// Color of a voxel under the root, Color_Fetch() of trace.frag over the node and leaf words
+	// A voxel_size coarser than the leaves takes the mip of the node that covers the voxel
+	inline hashdag::RGBColor Fetch(glm::u32vec3 voxel_pos, uint32_t voxel_size = 1u) const {
+		return get_fetcher().Fetch(m_root.pointer, m_config.voxel_level, m_config.leaf_level,
+		                           hashdag::GetMortonIndex(voxel_pos), voxel_size);
+	}
+	// Colors of voxels of ascending Morton indices, the same as Fetch() of each
+	// The octree is walked once for the voxels of a cell, and the blocks of a leaf are found by galloping from the
+	// previous voxel
+	inline void Fetch(std::span<const uint64_t> sorted_morton_indices, std::span<hashdag::RGBColor> colors,
+	                  uint32_t voxel_size = 1u) const {
+		assert(colors.size() >= sorted_morton_indices.size());
+		auto fetcher = get_fetcher();
+		std::vector<uint32_t> voxel_indices;
+		std::vector<hashdag::VBRColor> vbr_colors;
+		for (std::size_t i = 0, count; i < sorted_morton_indices.size(); i += count) {
+			auto cell = fetcher.FindCell(m_root.pointer, m_config.voxel_level, m_config.leaf_level,
+			                             sorted_morton_indices[i], voxel_size);
+			Pointer ptr;
+			ptr.pointer = cell.ptr;
+			// Voxels in the same cell
+			uint32_t shift = 3u * (m_config.voxel_level - cell.level);
+			for (count = 1; i + count < sorted_morton_indices.size() &&
+			                (sorted_morton_indices[i + count] >> shift) == (sorted_morton_indices[i] >> shift);
+			     ++count)
+				;
+			auto cell_colors = colors.subspan(i, count);
+			if (ptr.GetTag() != Pointer::Tag::kLeaf) {
+				std::ranges::fill(cell_colors, fetcher.GetCellColor(cell.ptr, 0));
+				continue;
+			}
+			voxel_indices.resize(count);
+			vbr_colors.resize(count);
+			uint32_t leaf_voxel_mask = get_leaf_voxel_count() - 1u;
+			std::ranges::transform(sorted_morton_indices.subspan(i, count), voxel_indices.begin(),
+			                       [&](uint64_t morton_index) { return uint32_t(morton_index) & leaf_voxel_mask; });
+			get_leaf_colors(ptr.GetData() + 1, voxel_indices, vbr_colors);
+			std::ranges::transform(vbr_colors, cell_colors.begin(), [](hashdag::VBRColor c) { return c.Get(); });
+		}
+	}
+
+	// Words of the node buffer (uColorNodes) and the leaf buffer (uColorLeaves)
+	inline uint32_t ReadNodeWord(uint32_t idx) const { return m_nodes.Read(idx, std::identity{}); }
+	inline uint32_t ReadLeafWord(uint32_t idx) const { return m_leaves.Read(idx, std::identity{}); }
+
+	// Pages of the node buffer and the leaf buffer in use
+	inline uint32_t GetNodePageCount() const { return m_nodes.GetPageCount(); }
+	inline uint32_t GetLeafPageCount() const { return m_leaves.GetPageCount(); }
+	// Words appended to the node buffer and the leaf buffer, free leaf blocks included
+	inline std::size_t GetNodeWordCount() const { return m_nodes.GetCount(); }
+	inline std::size_t GetLeafWordCount() const { return m_leaves.GetCount(); }
+	// Calls node_writer and leaf_writer (page_id, page_offset, words) with the words written since the last call
+	inline void FlushWrites(std::invocable<uint32_t, uint32_t, std::span<const uint32_t>> auto &&node_writer,
+	                        std::invocable<uint32_t, uint32_t, std::span<const uint32_t>> auto &&leaf_writer) {
+		{ // Flush Nodes
+			uint32_t node_word_count = m_nodes.GetCount();
+			uint32_t idx = m_flushed_node_word_count < node_word_count ? m_flushed_node_word_count : 0,
+			         count = node_word_count - idx;
+			m_nodes.Read(idx, count,
+			             [&](std::size_t, std::size_t page_id, std::size_t page_offset,
+			                 std::span<const uint32_t> span) { node_writer(page_id, page_offset, span); });
+			m_flushed_node_word_count = node_word_count;
+			// Headers of flushed nodes with updated mips
+			for (const auto &[page_id, range] : m_node_page_write_ranges) {
+				const uint32_t *p_page = m_nodes.GetPage(page_id);
+				node_writer(page_id, range.begin, std::span{p_page + range.begin, p_page + range.end});
+			}
+			m_node_page_write_ranges.clear();
+		}
+
+		{ // Flush Leaves
+			for (const auto &[page_id, range] : m_leaf_page_write_ranges) {
+				const uint32_t *p_page = m_leaves.GetPage(page_id);
+				leaf_writer(page_id, range.begin, std::span{p_page + range.begin, p_page + range.end});
+			}
+			m_leaf_page_write_ranges.clear();
+		}
+
+		// No writer refers to the decoded palette leaves after editing
+		if (m_decoded_leaves.GetCount()) {
+			m_decoded_leaf_indices.clear();
+			m_decoded_leaves.Reset(m_leaves.GetPageTotal(), m_config.word_bits_per_leaf_page);
+		}
+	}
+
+	inline Pointer GetRoot() const { return m_root; }
+	inline void SetRoot(Pointer root) { m_root = root; }
+};
+
+static_assert(hashdag::VBROctree<ColorOctree, uint32_t>);
+
+#endif // VKHASHDAG_COLOROCTREE_HPP
@@ -93,6 +93,11 @@ public:
 
 	void Flush(const myvk::Ptr<VkSparseBinder> &binder);
 
+	// Word at idx of the node buffer (uDAGNodes)
+	inline uint32_t ReadWord(uint32_t idx) const {
+		return ReadPage(idx >> GetConfig().word_bits_per_page)[idx & (GetConfig().GetWordsPerPage() - 1u)];
+	}
+
 	inline void SetRoot(hashdag::NodePointer<uint32_t> root) { m_root = root; }
 	inline auto GetRoot() const { return m_root; }
 
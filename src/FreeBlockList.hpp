@@ -0,0 +1,83 @@
+//
+// Created by adamyuan on 6/9/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_FREEBLOCKLIST_HPP
+#define VKHASHDAG_FREEBLOCKLIST_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+
+// Thread-safe list of free blocks (of a PagedVector), a block taken by Pop() is the best fit
+// Blocks are split if the rest is at least the minimum split size, adjacent free blocks are merged
+template <std::unsigned_integral T> class FreeBlockList {
+public:
+	struct Block {
+		T idx, size;
+	};
+
+private:
+	std::mutex m_mutex;
+	// Free blocks by index for merging, and by size for the best fit
+	std::map<T, T> m_blocks;
+	std::set<std::pair<T, T>> m_size_blocks;
+	std::atomic<std::size_t> m_free_size{0};
+	T m_min_split_size;
+
+	inline void insert(Block block) {
+		m_blocks.emplace(block.idx, block.size);
+		m_size_blocks.emplace(block.size, block.idx);
+	}
+	inline void erase(typename std::map<T, T>::iterator it) {
+		m_size_blocks.erase({it->second, it->first});
+		m_blocks.erase(it);
+	}
+
+public:
+	// Sizes and the minimum split size are multiples of the alignment of blocks, so are the split blocks
+	inline explicit FreeBlockList(T min_split_size = 1) : m_min_split_size{std::max(min_split_size, T(1))} {}
+
+	inline void Push(Block block) {
+		std::scoped_lock lock{m_mutex};
+		m_free_size.fetch_add(block.size, std::memory_order_relaxed);
+		auto next = m_blocks.lower_bound(block.idx);
+		if (next != m_blocks.end() && next->first == block.idx + block.size) {
+			block.size += next->second;
+			erase(next++);
+		}
+		if (next != m_blocks.begin()) {
+			auto prev = std::prev(next);
+			if (prev->first + prev->second == block.idx) {
+				block = {.idx = prev->first, .size = T(prev->second + block.size)};
+				erase(prev);
+			}
+		}
+		insert(block);
+	}
+	// The smallest free block of at least size, split to size if the rest is large enough
+	inline std::optional<Block> Pop(T size) {
+		std::scoped_lock lock{m_mutex};
+		auto it = m_size_blocks.lower_bound({size, T(0)});
+		if (it == m_size_blocks.end())
+			return std::nullopt;
+		Block block{.idx = it->second, .size = it->first};
+		erase(m_blocks.find(block.idx));
+		// The rest is not adjacent to another free block, or they would have been merged
+		if (block.size - size >= m_min_split_size) {
+			insert({.idx = T(block.idx + size), .size = T(block.size - size)});
+			block.size = size;
+		}
+		m_free_size.fetch_sub(block.size, std::memory_order_relaxed);
+		return block;
+	}
+	inline std::size_t GetFreeSize() const { return m_free_size.load(std::memory_order_relaxed); }
+};
+
+#endif
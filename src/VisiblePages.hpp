@@ -0,0 +1,265 @@
+//
+// Created by adamyuan on 6/9/24.
+//
+
+#pragma once
+#ifndef VKHASHDAG_VISIBLEPAGES_HPP
+#define VKHASHDAG_VISIBLEPAGES_HPP
+
+#include "CPURenderer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <libfork/schedule/busy_pool.hpp>
+#include <libfork/task.hpp>
+
+// A page and the distance from the camera to its nearest visible cell
+struct VisiblePage {
+	uint32_t page;
+	float distance;
+};
+
+// log2 of the page sizes of uDAGNodes, uColorNodes and uColorLeaves, in words
+struct VisiblePageBits {
+	uint32_t dag_words, color_node_words, color_leaf_words;
+};
+
+// Pages of uDAGNodes, uColorNodes and uColorLeaves that trace.frag may read in a frame, nearest first
+struct VisiblePageSet {
+	std::vector<VisiblePage> dag_node_pages, color_node_pages, color_leaf_pages;
+};
+
+// Finds the page set of a view on the CPU by walking the DAG and the color octree together, culling cells outside
+// the frustum and stopping at the same LOD cut as DAG_RayMarch(), so that the pages can be uploaded nearest first
+// The set is conservative: a cell is kept if its nearest point passes the LOD test, where the ray uses its exit point
+template <WordBufferReader DAGNodes, WordBufferReader ColorNodes, WordBufferReader ColorLeaves>
+class VisiblePageFinder {
+public:
+	using Params = typename CPURenderer<DAGNodes, ColorNodes, ColorLeaves>::Params;
+
+private:
+	inline static constexpr uint32_t kTaskLevels = 3;
+
+	DAGNodes m_dag_nodes;
+	ColorNodes m_color_nodes;
+	ColorLeaves m_color_leaves;
+
+	struct Frustum {
+		glm::vec3 pos;
+		std::array<glm::vec3, 4> normals; // Inward
+	};
+	struct Context {
+		const Params *p_params;
+		VisiblePageBits page_bits;
+		Frustum frustum;
+	};
+	struct Record {
+		uint32_t type, page; // 0: DAG node, 1: color node, 2: color leaf
+		float distance;
+	};
+
+	inline static Frustum make_frustum(const Params &params) {
+		Frustum frustum = {.pos = params.pos + 1.0f};
+		// Ray directions span look -+ side -+ up, see Shade()
+		const std::array<std::pair<glm::vec3, glm::vec3>, 4> edges = {
+		    std::pair{params.look - params.side, params.up}, std::pair{params.look + params.side, params.up},
+		    std::pair{params.look - params.up, params.side}, std::pair{params.look + params.up, params.side}};
+		for (uint32_t i = 0; i < 4; ++i) {
+			glm::vec3 n = glm::cross(edges[i].first, edges[i].second);
+			frustum.normals[i] = glm::dot(n, params.look) < 0.0f ? -n : n;
+		}
+		return frustum;
+	}
+	// Cells are in the [1, 2] space of DAG_RayMarch()
+	inline static bool cull(const Frustum &frustum, glm::vec3 lower, float size) {
+		for (const auto &n : frustum.normals) {
+			glm::vec3 p_vertex = lower + glm::vec3{glm::greaterThanEqual(n, glm::vec3{0})} * size;
+			if (glm::dot(n, p_vertex - frustum.pos) < 0.0f)
+				return true;
+		}
+		return false;
+	}
+	inline static float distance(const Frustum &frustum, glm::vec3 lower, float size) {
+		return glm::length(frustum.pos - glm::clamp(frustum.pos, lower, lower + size));
+	}
+
+	inline static void record_words(std::vector<Record> &records, uint32_t type, uint32_t first, uint32_t count,
+	                                uint32_t bits, float dist) {
+		for (uint32_t p = first >> bits, last = (first + count - 1u) >> bits; p <= last; ++p)
+			records.push_back({.type = type, .page = p, .distance = dist});
+	}
+	inline void record_color_leaf(const Context &ctx, std::vector<Record> &records, uint32_t data, float dist) const {
+		uint32_t header = m_color_leaves(data + 1u);
+		uint32_t words = (header & 0x80000000u) != 0u
+		                     ? 5u + (m_color_leaves(data + 2u) & 0xFFFFu) + m_color_leaves(data + 3u)
+		                     : 4u + ((header + m_color_leaves(data + 2u)) << 1u) + m_color_leaves(data + 3u);
+		record_words(records, 2, data, words, ctx.page_bits.color_leaf_words, dist);
+	}
+	// Color_Fetch() of the cells under color pointer ptr at level, all children if all_children else only child 0
+	inline void record_color_subtree(const Context &ctx, std::vector<Record> &records, uint32_t ptr, uint32_t level,
+	                                 bool all_children, float dist) const {
+		uint32_t tag = ptr >> 30u, data = ptr & 0x3FFFFFFFu;
+		if (tag == 2u)
+			record_color_leaf(ctx, records, data, dist);
+		if (tag != 0u || level >= ctx.p_params->color_leaf_level)
+			return;
+		for (uint32_t i = 0; i < (all_children ? 8u : 1u); ++i)
+			record_color_subtree(ctx, records, get_color_child(ctx, records, ptr, level, i, dist), level + 1u,
+			                     all_children, dist);
+	}
+	inline uint32_t get_color_child(const Context &ctx, std::vector<Record> &records, uint32_t ptr, uint32_t level,
+	                                uint32_t child, float dist) const {
+		if ((ptr >> 30u) != 0u || level >= ctx.p_params->color_leaf_level)
+			return ptr;
+		records.push_back({.type = 1, .page = ptr >> ctx.page_bits.color_node_words, .distance = dist});
+		uint32_t child_mask = 1u << child, header = m_color_nodes(ptr), fill_words = (header >> 8u) & 1u;
+		if ((header & child_mask) == 0u && fill_words == 0u)
+			return 3u << 30u;
+		ptr += 1u + ((header & child_mask) != 0u ? fill_words + std::popcount(header & (child_mask - 1u)) : 0u);
+		records.push_back({.type = 1, .page = ptr >> ctx.page_bits.color_node_words, .distance = dist});
+		return m_color_nodes(ptr);
+	}
+
+	inline bool is_dag_leaf_level(const Context &ctx, uint32_t level) const {
+		return level + 1u == ctx.p_params->dag_leaf_level;
+	}
+	inline uint32_t get_dag_child_bits(uint32_t node, bool leaf) const {
+		if (!leaf)
+			return m_dag_nodes(node) & 0xFFu;
+		uint32_t l0 = m_dag_nodes(node), l1 = m_dag_nodes(node + 1), bits = 0;
+		for (uint32_t i = 0; i < 4; ++i)
+			bits |= (((l0 >> (i << 3u)) & 0xFFu) ? 1u : 0u) << i | (((l1 >> (i << 3u)) & 0xFFu) ? 1u : 0u) << (i + 4u);
+		return bits;
+	}
+
+	// Visit the children of a DAG node at level (its cell is [lower, lower + 2 * half])
+	template <typename Visit>
+	inline void visit_children(const Context &ctx, std::vector<Record> &records, uint32_t node, uint32_t color,
+	                           uint32_t level, glm::vec3 lower, float half, Visit &&visit) const {
+		bool leaf = is_dag_leaf_level(ctx, level);
+		uint32_t child_bits = get_dag_child_bits(node, leaf);
+		float node_dist = distance(ctx.frustum, lower, half * 2.0f);
+		record_words(records, 0, node, leaf ? 2u : 1u + std::popcount(child_bits), ctx.page_bits.dag_words,
+		             node_dist);
+		for (uint32_t i = 0; i < 8; ++i) {
+			if (!((child_bits >> i) & 1u))
+				continue;
+			glm::vec3 child_lower = lower + glm::vec3{i & 1u, (i >> 1u) & 1u, (i >> 2u) & 1u} * half;
+			if (cull(ctx.frustum, child_lower, half))
+				continue;
+			float child_dist = distance(ctx.frustum, child_lower, half);
+			uint32_t child_color = get_color_child(ctx, records, color, level, i, child_dist);
+			if (leaf) {
+				// Any voxel of the leaf can be hit
+				record_color_subtree(ctx, records, child_color, level + 1u, true, child_dist);
+			} else if (half * ctx.p_params->proj_factor < child_dist) {
+				// LOD cut, Color_Fetch() stops at the mip of a color node above the leaves, or goes down at the lower
+				// corner of the cell
+				if ((child_color >> 30u) == 0u && level + 1u < ctx.p_params->color_leaf_level)
+					records.push_back(
+					    {.type = 1, .page = child_color >> ctx.page_bits.color_node_words, .distance = child_dist});
+				else
+					record_color_subtree(ctx, records, child_color, level + 1u, false, child_dist);
+			} else {
+				uint32_t child = m_dag_nodes(node + 1u + std::popcount(child_bits & ((1u << i) - 1u)));
+				visit(child, child_color, level + 1u, child_lower, half * 0.5f);
+			}
+		}
+	}
+
+	inline void find(const Context &ctx, std::vector<Record> &records, uint32_t node, uint32_t color, uint32_t level,
+	                 glm::vec3 lower, float half) const {
+		visit_children(ctx, records, node, color, level, lower, half,
+		               [&](uint32_t child, uint32_t child_color, uint32_t child_level, glm::vec3 child_lower,
+		                   float child_half) { find(ctx, records, child, child_color, child_level, child_lower, child_half); });
+	}
+
+	template <lf::context LFContext>
+	inline lf::basic_task<void, LFContext> lf_find(const Context *p_ctx, std::vector<std::vector<Record>> *p_records,
+	                                               uint32_t node, uint32_t color, uint32_t level, glm::vec3 lower,
+	                                               float half) const {
+		auto lf_ctx = co_await lf::get_context();
+		auto &records = (*p_records)[lf_ctx->get_worker_id()];
+		if (level >= kTaskLevels) {
+			find(*p_ctx, records, node, color, level, lower, half);
+			co_return;
+		}
+		struct Task {
+			uint32_t node, color;
+			glm::vec3 lower;
+		};
+		std::array<Task, 8> tasks;
+		uint32_t task_count = 0;
+		visit_children(*p_ctx, records, node, color, level, lower, half,
+		               [&](uint32_t child, uint32_t child_color, uint32_t, glm::vec3 child_lower, float) {
+			               tasks[task_count++] = {child, child_color, child_lower};
+		               });
+		for (uint32_t t = 0; t < task_count; ++t)
+			co_await lf_find<LFContext>(p_ctx, p_records, tasks[t].node, tasks[t].color, level + 1u, tasks[t].lower,
+			                            half * 0.5f)
+			    .fork();
+		co_await lf::join();
+	}
+
+	template <lf::context LFContext>
+	inline lf::basic_task<void, LFContext> lf_threaded_find(const Context *p_ctx, VisiblePageSet *p_page_set) const {
+		auto lf_ctx = co_await lf::get_context();
+		std::vector<std::vector<Record>> worker_records(lf_ctx->get_worker_count());
+		co_await lf_find<LFContext>(p_ctx, &worker_records, p_ctx->p_params->dag_root, p_ctx->p_params->color_root, 0,
+		                            glm::vec3{1.0f}, 0.5f);
+		*p_page_set = make_page_set(worker_records);
+	}
+
+	// Deduplicate pages with their nearest distance, then sort nearest first
+	inline static VisiblePageSet make_page_set(std::span<const std::vector<Record>> worker_records) {
+		std::vector<Record> records;
+		for (const auto &r : worker_records)
+			records.insert(records.end(), r.begin(), r.end());
+		std::sort(records.begin(), records.end(), [](const Record &l, const Record &r) {
+			return l.type != r.type ? l.type < r.type : (l.page != r.page ? l.page < r.page : l.distance < r.distance);
+		});
+		VisiblePageSet page_set;
+		std::array<std::vector<VisiblePage> *, 3> pages = {&page_set.dag_node_pages, &page_set.color_node_pages,
+		                                                   &page_set.color_leaf_pages};
+		for (std::size_t i = 0; i < records.size(); ++i)
+			if (i == 0 || records[i].type != records[i - 1].type || records[i].page != records[i - 1].page)
+				pages[records[i].type]->push_back({.page = records[i].page, .distance = records[i].distance});
+		for (auto *p : pages)
+			std::stable_sort(p->begin(), p->end(),
+			                 [](const VisiblePage &l, const VisiblePage &r) { return l.distance < r.distance; });
+		return page_set;
+	}
+
+	inline Context make_context(const Params &params, const VisiblePageBits &page_bits) const {
+		return {.p_params = &params, .page_bits = page_bits, .frustum = make_frustum(params)};
+	}
+
+public:
+	inline VisiblePageFinder(DAGNodes dag_nodes, ColorNodes color_nodes, ColorLeaves color_leaves)
+	    : m_dag_nodes{std::move(dag_nodes)}, m_color_nodes{std::move(color_nodes)},
+	      m_color_leaves{std::move(color_leaves)} {}
+
+	inline VisiblePageSet Find(const Params &params, const VisiblePageBits &page_bits) const {
+		if (params.dag_root == -1)
+			return {};
+		Context ctx = make_context(params, page_bits);
+		std::vector<Record> records;
+		find(ctx, records, params.dag_root, params.color_root, 0, glm::vec3{1.0f}, 0.5f);
+		return make_page_set(std::span{&records, 1});
+	}
+	inline VisiblePageSet ThreadedFind(lf::busy_pool *p_lf_pool, const Params &params,
+	                                   const VisiblePageBits &page_bits) const {
+		if (params.dag_root == -1)
+			return {};
+		Context ctx = make_context(params, page_bits);
+		VisiblePageSet page_set;
+		p_lf_pool->schedule(lf_threaded_find<lf::busy_pool::context>(&ctx, &page_set));
+		return page_set;
+	}
+};
+
+#endif // VKHASHDAG_VISIBLEPAGES_HPP
@@ -5,7 +5,9 @@
 #include <myvk/Queue.hpp>
 
 #include <hashdag/VBREditor.hpp>
+#include <hashdag/VBRRecompressor.hpp>
 
+#include "CPURenderer.hpp"
 #include "Camera.hpp"
 #include "DAGColorPool.hpp"
 #include "DAGNodePool.hpp"
@@ -14,6 +16,7 @@
 
 #include <ThreadPool.h>
 #include <chrono>
+#include <cmath>
 #include <glm/gtc/type_ptr.hpp>
 #include <libfork/schedule/busy_pool.hpp>
 
@@ -158,9 +161,12 @@ template <typename Func> inline long ns(Func &&func) {
 
 lf::busy_pool busy_pool(12);
 
+// Roots to set after a job of the edit thread, a root that the job does not change is left empty
 struct EditResult {
-	hashdag::NodePointer<uint32_t> node_ptr;
+	std::optional<hashdag::NodePointer<uint32_t>> opt_node_ptr;
 	std::optional<DAGColorPool::Pointer> opt_color_ptr;
+	// Copied on the edit thread, where VBRRecompressor::Step() updates them
+	std::optional<hashdag::VBRRecompressStats> opt_recompress_stats;
 };
 
 progschj::ThreadPool edit_pool(1);
@@ -203,17 +209,18 @@ int main() {
 	    {generic_queue, sparse_queue});
 	auto dag_color_pool = DAGColorPool::Create(
 	    DAGColorPool::Config{
+	        .voxel_level = dag_node_pool->GetConfig().GetVoxelLevel(),
 	        .leaf_level = 10,
-	        .node_bits_per_node_page = 18,
+	        .word_bits_per_node_page = 21,
 	        .word_bits_per_leaf_page = 24,
 	        .keep_history = false,
+	        .dedup = false,
 	    },
 	    {generic_queue, sparse_queue});
 	auto sparse_binder = myvk::MakePtr<VkSparseBinder>(sparse_queue);
 
 	const auto edit = [&]<hashdag::Editor<uint32_t> Editor_T>(Editor_T &&editor) -> EditResult {
-		return dag_node_pool->ThreadedEdit(&busy_pool, dag_node_pool->GetRoot(), std::forward<Editor_T>(editor),
-		                                   dag_color_pool->GetLeafLevel(),
+		return dag_node_pool->ThreadedEdit(&busy_pool, dag_node_pool->GetRoot(), std::forward<Editor_T>(editor), -1,
 		                                   [&](hashdag::NodePointer<uint32_t> root_ptr, auto &&state) -> EditResult {
 			                                   if constexpr (requires { state.octree_node; })
 				                                   return {root_ptr, state.octree_node};
@@ -233,11 +240,12 @@ int main() {
 		    .editor = std::forward<StatelessEditor_T>(editor)});
 	};
 	const auto gc = [&]() -> EditResult {
-		return {.node_ptr = dag_node_pool->ThreadedGC(&busy_pool, dag_node_pool->GetRoot()),
+		return {.opt_node_ptr = dag_node_pool->ThreadedGC(&busy_pool, dag_node_pool->GetRoot()),
 		        .opt_color_ptr = std::nullopt};
 	};
 	const auto set_root = [&](const EditResult &edit_result) {
-		dag_node_pool->SetRoot(edit_result.node_ptr);
+		if (edit_result.opt_node_ptr)
+			dag_node_pool->SetRoot(*edit_result.opt_node_ptr);
 		if (edit_result.opt_color_ptr)
 			dag_color_pool->SetRoot(*edit_result.opt_color_ptr);
 	};
@@ -278,15 +286,50 @@ int main() {
 		printf("flush cost %lf ms\n", (double)flush_ns / 1000000.0);
 	}
 
+	// Merges the small blocks that paint edits leave in color leaves, in slices on the edit thread between edits
+	hashdag::VBRRecompressor<uint32_t, DAGColorPool> recompressor(
+	    dag_color_pool.get(), dag_node_pool->GetConfig().GetVoxelLevel(), 1.0f / 255.0f);
+	hashdag::VBRRecompressStats recompress_stats{};
+	const auto push_recompress = [&]() {
+		if (edit_future.valid() || recompressor.IsDone())
+			return;
+		edit_future = edit_pool.enqueue([&]() -> EditResult {
+			std::size_t recompressed_leaf_count = recompressor.GetStats().recompressed_leaf_count;
+			// Leaves the DAG root to a GC that runs meanwhile on the UI thread
+			EditResult result = {
+			    .opt_node_ptr = std::nullopt,
+			    .opt_color_ptr = recompressor.Step(dag_color_pool->GetRoot(), std::chrono::milliseconds(2)),
+			    .opt_recompress_stats = recompressor.GetStats(),
+			};
+			if (recompressor.GetStats().recompressed_leaf_count != recompressed_leaf_count)
+				flush();
+			return result;
+		});
+	};
+
 	const auto pop_edit_result = [&]() {
-		if (edit_future.valid() && edit_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
-			set_root(edit_future.get());
+		if (edit_future.valid() && edit_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+			EditResult result = edit_future.get();
+			if (result.opt_recompress_stats)
+				recompress_stats = *result.opt_recompress_stats;
+			set_root(result);
+		}
+	};
+	// The leaves in the bounding box of a sphere edit are added to the recompression pass, which goes on from there
+	const auto restart_recompress = [&]<typename Editor_T>(const Editor_T &editor) {
+		if constexpr (requires { editor.center; editor.r2; }) {
+			glm::u32vec3 radius{uint32_t(std::ceil(std::sqrt(double(editor.r2))))};
+			glm::u32vec3 max_pos{dag_node_pool->GetConfig().GetResolution() - 1u};
+			recompressor.Restart(glm::max(editor.center, radius) - radius, glm::min(editor.center + radius, max_pos));
+		} else
+			recompressor.Restart();
 	};
 	const auto push_edit = [&]<typename... Args>(auto &&edit_func, Args &&...args) {
 		if (edit_future.valid())
 			return;
 		edit_future = edit_pool.enqueue([&]() {
 			EditResult result;
+			(restart_recompress(args), ...);
 			auto edit_ns = ns([&]() { result = edit_func(std::forward<Args>(args)...); });
 			printf("edit cost %lf ms\n", (double)edit_ns / 1000000.0);
 			auto flush_ns = ns([&]() { flush(); });
@@ -361,6 +404,8 @@ int main() {
 			}
 		}
 
+		push_recompress();
+
 		myvk::ImGuiNewFrame();
 		ImGui::Begin("Test");
 		ImGui::Text("FPS %f", ImGui::GetIO().Framerate);
@@ -376,6 +421,34 @@ int main() {
 			auto flush_ns = ns([&]() { flush(); });
 			printf("flush cost %lf ms\n", (double)flush_ns / 1000000.0);
 		}
+		if (ImGui::Button("CPU Frame")) {
+			// Same frame as TracePass, rendered on CPU for comparison
+			auto extent = frame_manager->GetExtent();
+			auto look_side_up = camera->GetLookSideUp(float(extent.width) / float(extent.height));
+			float inv_2tan_half_fov = 1.0f / (2.0f * glm::tan(0.5f * camera->m_fov));
+			CPURenderer cpu_renderer{[&](uint32_t i) { return dag_node_pool->ReadWord(i); },
+			                         [&](uint32_t i) { return dag_color_pool->ReadNodeWord(i); },
+			                         [&](uint32_t i) { return dag_color_pool->ReadLeafWord(i); }};
+			decltype(cpu_renderer)::Params params = {
+			    .pos = camera->m_position,
+			    .look = look_side_up.look,
+			    .side = look_side_up.side,
+			    .up = look_side_up.up,
+			    .width = extent.width,
+			    .height = extent.height,
+			    .voxel_level = dag_node_pool->GetConfig().GetVoxelLevel(),
+			    .dag_root = *dag_node_pool->GetRoot(),
+			    .dag_leaf_level = dag_node_pool->GetConfig().GetLeafLevel(),
+			    .color_root = dag_color_pool->GetRoot().pointer,
+			    .color_leaf_level = dag_color_pool->GetLeafLevel(),
+			    .proj_factor = inv_2tan_half_fov * float(extent.height),
+			    .type = uint32_t(render_type),
+			};
+			std::vector<glm::u8vec3> image(extent.width * extent.height);
+			auto render_ns = ns([&]() { cpu_renderer.ThreadedRender(&busy_pool, params, image); });
+			printf("CPU frame cost %lf ms\n", (double)render_ns / 1000000.0);
+			WritePPM("frame.ppm", extent.width, extent.height, image);
+		}
 		const auto imgui_paged_buffer_info = [](const char *name, const myvk::Ptr<VkPagedBuffer> &buffer) {
 			ImGui::Text("%s: %u / %u Page, %.2lf MiB", name, buffer->GetExistPageTotal(), buffer->GetPageTotal(),
 			            double(buffer->GetExistPageTotal() * buffer->GetPageSize()) / 1024.0 / 1024.0);
@@ -383,6 +456,16 @@ int main() {
 		imgui_paged_buffer_info("Node", dag_node_pool->GetBuffer());
 		imgui_paged_buffer_info("Color Node", dag_color_pool->GetNodeBuffer());
 		imgui_paged_buffer_info("Color Leaf", dag_color_pool->GetLeafBuffer());
+		if (dag_color_pool->GetConfig().dedup) {
+			auto stats = dag_color_pool->GetDedupStats();
+			ImGui::Text("Shared %zu Color Node, %zu Color Leaf, %.2lf MiB Saved", stats.node_count, stats.leaf_count,
+			            double(stats.GetSavedBytes()) / 1024.0 / 1024.0);
+		} else if (!dag_color_pool->GetConfig().keep_history)
+			ImGui::Text("Free Color Leaf: %.2lf MiB",
+			            double(dag_color_pool->GetFreeLeafWordCount() * sizeof(uint32_t)) / 1024.0 / 1024.0);
+		ImGui::Text("Recompressed %zu Leaf, %zu -> %zu Header, %.2lf KiB Saved",
+		            recompress_stats.recompressed_leaf_count, recompress_stats.src_header_count,
+		            recompress_stats.header_count, double(recompress_stats.GetSavedBytes()) / 1024.0);
 		ImGui::End();
 		ImGui::Render();
 
@@ -2,8 +2,33 @@
 #include "doctest.h"
 
 #include <hashdag/NodePool.hpp>
+#include <hashdag/NodePoolIterate.hpp>
 #include <hashdag/NodePoolThreadedEdit.hpp>
+#include <hashdag/NodePoolThreadedGC.hpp>
+#include <hashdag/NodePoolThreadedMesh.hpp>
+#include <hashdag/NodePoolThreadedTraversal.hpp>
+#include <hashdag/NodePoolTraversal.hpp>
+#include <hashdag/NodePoolVoxelCount.hpp>
+#include <hashdag/PaletteColor.hpp>
+#include <hashdag/StaticDAG.hpp>
+#include <hashdag/VBRColor.hpp>
+#include <hashdag/VBREditor.hpp>
+#include <hashdag/VBRRecompressor.hpp>
 
+#include <CPURenderer.hpp>
+#include <ColorOctree.hpp>
+#include <FreeBlockList.hpp>
+#include <VisiblePages.hpp>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <set>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -14,103 +39,287 @@ struct ZeroHasher {
 struct AABBEditor {
 	uint32_t level;
 	glm::u32vec3 aabb_min, aabb_max;
-	inline hashdag::EditType EditNode(const hashdag::Config<uint32_t > &config, const hashdag::NodeCoord<uint32_t> &coord, hashdag::NodePointer<uint32_t>) const {
+	inline hashdag::EditType EditNode(const hashdag::Config<uint32_t> &config,
+	                                  const hashdag::NodeCoord<uint32_t> &coord, hashdag::NodePointer<uint32_t>) const {
 		auto lb = coord.GetLowerBoundAtLevel(level), ub = coord.GetUpperBoundAtLevel(level);
-		/* printf("(%d %d %d), (%d, %d, %d) -> %d\n", lb.x, lb.y, lb.z, ub.x, ub.y, ub.z,
-		       !ub.Any(std::less_equal<uint32_t>{}, aabb_min) && !lb.Any(std::greater_equal<uint32_t>{}, aabb_max)); */
-		if (ub.Any(std::less_equal<uint32_t>{}, aabb_min) || lb.Any(std::greater_equal<uint32_t>{}, aabb_max))
+		if (glm::any(glm::lessThanEqual(ub, aabb_min)) || glm::any(glm::greaterThanEqual(lb, aabb_max)))
 			return hashdag::EditType::kNotAffected;
-		if (lb.All(std::greater_equal<uint32_t>{}, aabb_min) && ub.All(std::less_equal<uint32_t>{}, aabb_max))
+		if (glm::all(glm::greaterThanEqual(lb, aabb_min)) && glm::all(glm::lessThanEqual(ub, aabb_max)))
 			return hashdag::EditType::kFill;
 		return hashdag::EditType::kProceed;
 	}
-	inline bool EditVoxel(const hashdag::Config<uint32_t > &config,const hashdag::NodeCoord<uint32_t> &coord, bool voxel) const {
-		/*if (coord.pos.All(std::greater_equal<uint32_t>{}, aabb_min) && coord.pos.All(std::less<uint32_t>{}, aabb_max))
-		    printf("(%d %d %d)\n", coord.pos.x, coord.pos.y, coord.pos.z);
-		*/
-		return voxel || coord.pos.All(std::greater_equal<uint32_t>{}, aabb_min) &&
-		                    coord.pos.All(std::less<uint32_t>{}, aabb_max);
+	inline bool EditVoxel(const hashdag::Config<uint32_t> &config, const hashdag::NodeCoord<uint32_t> &coord,
+	                      bool voxel) const {
+		return voxel ||
+		       glm::all(glm::greaterThanEqual(coord.pos, aabb_min)) && glm::all(glm::lessThan(coord.pos, aabb_max));
 	}
 };
 
-struct SingleIterator {
-	uint32_t level;
-	glm::u32vec3 pos;
-	bool exist;
-	inline hashdag::IterateType IterateNode(const hashdag::NodeCoord<uint32_t> &coord,
-	                                        hashdag::NodePointer<uint32_t> node) const {
-		auto lb = coord.GetLowerBoundAtLevel(level), ub = coord.GetUpperBoundAtLevel(level);
-		if (node && !ub.Any(std::less_equal<uint32_t>{}, pos) && !lb.Any(std::greater<uint32_t>{}, pos))
-			return hashdag::IterateType::kProceed;
-		return hashdag::IterateType::kStop;
+inline auto Stateless(const AABBEditor &editor) {
+	return hashdag::StatelessEditorWrapper<uint32_t, AABBEditor>{.editor = editor};
+}
+
+// Marks the voxels inside [aabb_min, aabb_max), voxels are indexed as in TestNodePool::GetVoxels()
+struct AABBIterator {
+	uint32_t resolution;
+	glm::u32vec3 aabb_min, aabb_max;
+	std::vector<uint8_t> *p_voxels;
+	std::atomic_uint32_t node_count{0};
+	inline hashdag::IterateType IterateNode(const hashdag::Config<uint32_t> &config,
+	                                        const hashdag::NodeCoord<uint32_t> &coord, hashdag::NodePointer<uint32_t>) {
+		++node_count;
+		auto lb = coord.GetLowerBoundAtLevel(config.GetVoxelLevel()), ub = coord.GetUpperBoundAtLevel(config.GetVoxelLevel());
+		if (glm::any(glm::lessThanEqual(ub, aabb_min)) || glm::any(glm::greaterThanEqual(lb, aabb_max)))
+			return hashdag::IterateType::kStop;
+		return hashdag::IterateType::kProceed;
+	}
+	inline void IterateLeaf(const hashdag::Config<uint32_t> &, const hashdag::NodeCoord<uint32_t> &coord,
+	                        uint64_t bits) {
+		for (; bits; bits &= bits - 1u) {
+			glm::u32vec3 p = coord.GetLeafCoord(std::countr_zero(bits)).pos;
+			if (glm::all(glm::greaterThanEqual(p, aabb_min)) && glm::all(glm::lessThan(p, aabb_max)))
+				(*p_voxels)[(p.x * resolution + p.y) * resolution + p.z] = 1;
+		}
 	}
-	inline void IterateVoxel(const hashdag::NodeCoord<uint32_t> &coord, bool voxel) {
-		CHECK_EQ(coord.level, level);
-		if (voxel && coord.pos == pos)
-			exist = true;
+};
+
+struct VoxelCountIterator {
+	using Result = uint64_t;
+	std::atomic_uint32_t *p_leaf_count;
+	inline uint64_t IterateLeaf(const hashdag::Config<uint32_t> &, uint64_t bits) const {
+		++*p_leaf_count;
+		return std::popcount(bits);
+	}
+	inline uint64_t IterateNode(const hashdag::Config<uint32_t> &, uint32_t, uint32_t,
+	                            std::span<const uint64_t, 8> children) const {
+		uint64_t count = 0;
+		for (uint64_t c : children)
+			count += c;
+		return count;
 	}
 };
 
-struct ZeroNodePool final : public hashdag::NodePoolBase<ZeroNodePool, uint32_t> {
-	using WordSpanHasher = ZeroHasher;
+template <typename K, typename V> using std_hash_map = std::unordered_map<K, V>;
+template <typename K> using std_hash_set = std::unordered_set<K>;
 
-	std::vector<uint32_t> memory;
-	std::unordered_map<uint32_t, uint32_t> bucket_words;
-	std::unordered_set<uint32_t> pages;
+template <typename Hasher, bool Mirror>
+struct TestNodePool final
+    : public hashdag::NodePoolBase<TestNodePool<Hasher, Mirror>, uint32_t>,
+      public hashdag::NodePoolThreadedEdit<TestNodePool<Hasher, Mirror>, uint32_t>,
+      public hashdag::NodePoolThreadedGC<TestNodePool<Hasher, Mirror>, uint32_t, std_hash_map, std_hash_set>,
+      public hashdag::NodePoolTraversal<TestNodePool<Hasher, Mirror>, uint32_t>,
+      public hashdag::NodePoolThreadedTraversal<TestNodePool<Hasher, Mirror>, uint32_t>,
+      public hashdag::NodePoolThreadedMesh<TestNodePool<Hasher, Mirror>, uint32_t>,
+      public hashdag::NodePoolIterate<TestNodePool<Hasher, Mirror>, uint32_t>,
+      public hashdag::NodePoolVoxelCount<TestNodePool<Hasher, Mirror>, uint32_t, std_hash_map> {
+	using WordSpanHasher = Hasher;
+	inline static constexpr bool kMirrorNodes = Mirror;
 
-	inline ~ZeroNodePool() final = default;
-	inline explicit ZeroNodePool(uint32_t level_count)
-	    : hashdag::NodePoolBase<ZeroNodePool, uint32_t>(hashdag::Config<uint32_t>::MakeDefault(level_count)) {
-		memory.resize(GetConfig().GetTotalBuckets() * GetConfig().GetWordsPerBucket());
-	}
+	std::vector<std::unique_ptr<uint32_t[]>> pages;
+	std::vector<uint32_t> bucket_words;
+	std::mutex edit_mutex{};
 
-	inline uint32_t GetBucketWords(uint32_t bucket_id) const {
-		auto it = bucket_words.find(bucket_id);
-		return it == bucket_words.end() ? 0 : it->second;
+	inline ~TestNodePool() final = default;
+	inline explicit TestNodePool(hashdag::Config<uint32_t> config)
+	    : hashdag::NodePoolBase<TestNodePool, uint32_t>(std::move(config)) {
+		pages.resize(this->GetConfig().GetTotalPages());
+		bucket_words.resize(this->GetConfig().GetTotalBuckets());
 	}
-	inline void SetBucketWords(uint32_t bucket_id, uint32_t words) { bucket_words[bucket_id] = words; }
+	inline explicit TestNodePool(uint32_t node_levels)
+	    : TestNodePool(hashdag::DefaultConfig<uint32_t>{.level_count = node_levels + 1}()) {}
+
+	inline std::mutex &GetBucketRefMutex(uint32_t) { return edit_mutex; }
+	inline uint32_t &GetBucketRefWords(uint32_t bucket_id) { return bucket_words[bucket_id]; }
 	inline const uint32_t *ReadPage(uint32_t page_id) const {
-		CHECK(pages.count(page_id));
-		return memory.data() + (page_id << GetConfig().word_bits_per_page);
+		REQUIRE(pages[page_id]);
+		return pages[page_id].get();
+	}
+	inline uint32_t *upsert_page(uint32_t page_id) {
+		if (!pages[page_id])
+			pages[page_id] = std::make_unique<uint32_t[]>(this->GetConfig().GetWordsPerPage());
+		return pages[page_id].get();
+	}
+	inline void ZeroPage(uint32_t page_id, uint32_t page_offset, uint32_t zero_words) {
+		std::fill(upsert_page(page_id) + page_offset, upsert_page(page_id) + page_offset + zero_words, 0);
 	}
-	inline void ZeroPage(uint32_t page_id, uint32_t page_offset, uint32_t zero_words) { pages.insert(page_id); }
 	inline void WritePage(uint32_t page_id, uint32_t page_offset, std::span<const uint32_t> word_span) {
-		pages.insert(page_id);
-		std::copy(word_span.begin(), word_span.end(),
-		          memory.data() + ((page_id << GetConfig().word_bits_per_page) | page_offset));
+		std::copy(word_span.begin(), word_span.end(), upsert_page(page_id) + page_offset);
+	}
+	inline void FreePage(uint32_t page_id) { pages[page_id] = nullptr; }
+	inline void ResizeBuckets(const hashdag::Config<uint32_t> &config) {
+		pages.resize(config.GetTotalPages());
+		bucket_words.resize(config.GetTotalBuckets());
+	}
+
+	inline uint32_t GetTotalBucketWords() const {
+		uint32_t words = 0;
+		for (uint32_t w : bucket_words)
+			words += w;
+		return words;
+	}
+	inline bool GetVoxel(hashdag::NodePointer<uint32_t> node_ptr, glm::u32vec3 pos) const {
+		const auto &config = this->GetConfig();
+		for (uint32_t level = 0; node_ptr; ++level) {
+			uint32_t shift = config.GetVoxelLevel() - 1 - level;
+			if (level + 1 == config.GetNodeLevels()) {
+				auto leaf = this->get_leaf_array(node_ptr);
+				glm::u32vec3 p = pos & 3u;
+				uint32_t i = (p.x & 1u) | ((p.y & 1u) << 1u) | ((p.z & 1u) << 2u) | ((p.x >> 1u) << 3u) |
+				             ((p.y >> 1u) << 4u) | ((p.z >> 1u) << 5u);
+				return (leaf[i >> 5u] >> (i & 31u)) & 1u;
+			}
+			glm::u32vec3 p = (pos >> shift) & 1u;
+			node_ptr = this->get_unpacked_node_array(node_ptr)[1 + (p.x | (p.y << 1u) | (p.z << 2u))];
+		}
+		return false;
+	}
+	inline std::vector<bool> GetVoxels(hashdag::NodePointer<uint32_t> node_ptr) const {
+		uint32_t res = this->GetConfig().GetResolution();
+		std::vector<bool> voxels(res * res * res);
+		for (uint32_t x = 0; x < res; ++x)
+			for (uint32_t y = 0; y < res; ++y)
+				for (uint32_t z = 0; z < res; ++z)
+					voxels[(x * res + y) * res + z] = GetVoxel(node_ptr, {x, y, z});
+		return voxels;
 	}
 };
-struct MurmurNodePool final : public hashdag::NodePoolBase<MurmurNodePool, uint32_t>,
-                              public hashdag::NodePoolThreadedEdit<MurmurNodePool, uint32_t> {
-	using WordSpanHasher = hashdag::MurmurHasher32;
+using ZeroNodePool = TestNodePool<ZeroHasher, false>;
+using MurmurNodePool = TestNodePool<hashdag::MurmurHasher32, false>;
+using MirrorNodePool = TestNodePool<hashdag::MurmurHasher32, true>;
+
+// A VBROctree in memory with the pointer tags of DAGColorPool
+// Nodes and leaves are appended into arrays of fixed capacity, so that ThreadedEdit() can use it without locks
+struct TestColorOctree {
+	enum Tag : uint32_t { kNode = 0, kColor, kLeaf, kNull };
+	struct Pointer {
+		uint32_t pointer = kNull << 30u;
+		inline Tag GetTag() const { return Tag(pointer >> 30u); }
+		inline uint32_t GetData() const { return pointer & ((1u << 30u) - 1u); }
+		inline bool operator==(const Pointer &) const = default;
+	};
+	template <typename T> using LeafSpan = std::span<const T>;
+	using Leaf = hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer>;
 
-	std::vector<uint32_t> memory;
-	std::unordered_map<uint32_t, uint32_t> bucket_words;
-	std::unordered_set<uint32_t> pages;
+	uint32_t leaf_level;
+	std::vector<std::array<Pointer, 8>> nodes;
+	// Leaves stored as palette chunks like DAGColorPool does, with their VBR chunks decoded for editing
+	std::vector<Leaf> leaves;
+	std::vector<std::optional<hashdag::PaletteChunk<uint32_t, hashdag::VBRWriterContainer>>> palette_leaves;
+	std::atomic_uint32_t node_count{0}, leaf_count{0}, palette_leaf_count{0}, partial_dirty_count{0};
 
-	hashdag::Mutex m_edit_mutex{};
+	inline TestColorOctree(uint32_t leaf_level, uint32_t capacity)
+	    : leaf_level{leaf_level}, nodes(capacity), leaves(capacity), palette_leaves(capacity) {}
 
-	inline ~MurmurNodePool() final = default;
-	inline explicit MurmurNodePool(uint32_t level_count)
-	    : hashdag::NodePoolBase<MurmurNodePool, uint32_t>(hashdag::Config<uint32_t>::MakeDefault(level_count)) {
-		memory.resize(GetConfig().GetTotalWords());
+	inline Pointer GetChild(Pointer ptr, auto idx) const {
+		return ptr.GetTag() == kNode ? nodes[ptr.GetData()][idx] : (ptr.GetTag() == kColor ? ptr : Pointer{});
+	}
+	inline static hashdag::VBRColor GetFill(Pointer ptr) {
+		return ptr.GetTag() == kColor ? hashdag::VBRColor{ptr.GetData()} : hashdag::VBRColor{};
+	}
+	inline Pointer SetNode(Pointer, std::span<const Pointer, 8> child_ptrs) {
+		uint32_t idx = node_count++;
+		REQUIRE(idx < nodes.size());
+		std::ranges::copy(child_ptrs, nodes[idx].begin());
+		return Pointer{(kNode << 30u) | idx};
 	}
+	inline static Pointer ClearNode(Pointer) { return Pointer{}; }
+	inline static Pointer FillNode(Pointer, hashdag::VBRColor color) {
+		return Pointer{(kColor << 30u) | hashdag::RGB8Color{color.Get()}.GetData()};
+	}
+	inline hashdag::VBRChunk<uint32_t, LeafSpan> GetLeaf(Pointer ptr) const {
+		if (ptr.GetTag() != kLeaf)
+			return {};
+		const Leaf &leaf = leaves[ptr.GetData()];
+		return {LeafSpan<hashdag::VBRMacroBlock>{leaf.GetMacroBlocks()},
+		        LeafSpan<hashdag::VBRBlockHeader>{leaf.GetBlockHeaders()},
+		        hashdag::VBRBitset<uint32_t, LeafSpan>{LeafSpan<uint32_t>{leaf.GetWeightBits().GetWords()}}};
+	}
+	inline Pointer SetLeaf(Pointer, Leaf &&chunk) {
+		uint32_t idx = leaf_count++;
+		REQUIRE(idx < leaves.size());
+		palette_leaves[idx] = hashdag::EncodePaletteChunk(chunk);
+		if (palette_leaves[idx]) {
+			++palette_leaf_count;
+			leaves[idx] = palette_leaves[idx]->ToVBR();
+		} else
+			leaves[idx] = static_cast<const Leaf &>(chunk);
+		return Pointer{(kLeaf << 30u) | idx};
+	}
+	// Checks that the macro blocks out of dirty_macro_blocks are unchanged, and that the ones before them do not move
+	inline Pointer SetLeaf(Pointer ptr, Leaf &&chunk, std::span<const uint32_t> dirty_macro_blocks) {
+		CHECK(std::ranges::is_sorted(dirty_macro_blocks));
+		const auto get_block_range = [](const Leaf &leaf, uint32_t macro_id) {
+			const auto &macro_blocks = leaf.GetMacroBlocks();
+			return std::span{leaf.GetBlockHeaders()}.subspan(
+			    macro_blocks[macro_id].first_block,
+			    (macro_id + 1 == macro_blocks.size() ? leaf.GetBlockHeaders().size()
+			                                         : macro_blocks[macro_id + 1].first_block) -
+			        macro_blocks[macro_id].first_block);
+		};
+		if (ptr.GetTag() == kLeaf && leaves[ptr.GetData()].GetMacroBlocks().size() == chunk.GetMacroBlocks().size()) {
+			const Leaf &src = leaves[ptr.GetData()];
+			uint32_t macro_count = chunk.GetMacroBlocks().size();
+			for (uint32_t macro_id = 0; macro_id < macro_count; ++macro_id) {
+				if (dirty_macro_blocks.empty() || macro_id <= dirty_macro_blocks.front())
+					CHECK(src.GetMacroBlocks()[macro_id] == chunk.GetMacroBlocks()[macro_id]);
+				if (std::ranges::binary_search(dirty_macro_blocks, macro_id))
+					continue;
+				auto src_blocks = get_block_range(src, macro_id), blocks = get_block_range(chunk, macro_id);
+				CHECK(std::ranges::equal(src_blocks, blocks, [](const auto &l, const auto &r) {
+					return l.colors == r.colors && l.packed_14_2_16 == r.packed_14_2_16;
+				}));
+				uint32_t voxel_begin = macro_id << hashdag::VBRInfo::kVoxelBitsPerMacroBlock;
+				for (uint32_t i = 0; i < 64; ++i)
+					CHECK_EQ(src.GetColor(voxel_begin + i * 257u), chunk.GetColor(voxel_begin + i * 257u));
+			}
+			partial_dirty_count += dirty_macro_blocks.size() < macro_count;
+		}
+		return SetLeaf(ptr, std::move(chunk));
+	}
+	inline uint32_t GetLeafLevel() const { return leaf_level; }
 
-	inline hashdag::Mutex &GetBucketEditMutex(uint32_t bucket_id) { return m_edit_mutex; }
-	inline uint32_t GetBucketWords(uint32_t bucket_id) const {
-		auto it = bucket_words.find(bucket_id);
-		return it == bucket_words.end() ? 0 : it->second;
+	inline hashdag::VBRColor GetColor(Pointer ptr, uint32_t voxel_level, glm::u32vec3 pos) const {
+		for (uint32_t level = 0; level < leaf_level && ptr.GetTag() == kNode; ++level) {
+			glm::u32vec3 p = (pos >> (voxel_level - 1 - level)) & 1u;
+			ptr = GetChild(ptr, p.x | (p.y << 1u) | (p.z << 2u));
+		}
+		if (ptr.GetTag() != kLeaf)
+			return GetFill(ptr);
+		uint32_t voxel_index = 0;
+		for (uint32_t b = 0; b < voxel_level - leaf_level; ++b)
+			voxel_index |= (((pos.x >> b) & 1u) | (((pos.y >> b) & 1u) << 1u) | (((pos.z >> b) & 1u) << 2u)) << (3u * b);
+		const auto &opt_palette_leaf = palette_leaves[ptr.GetData()];
+		return opt_palette_leaf ? opt_palette_leaf->GetColor(voxel_index) : GetLeaf(ptr).GetColor(voxel_index);
 	}
-	inline void SetBucketWords(uint32_t bucket_id, uint32_t words) { bucket_words[bucket_id] = words; }
-	inline const uint32_t *ReadPage(uint32_t page_id) const {
-		CHECK(pages.count(page_id));
-		return memory.data() + (page_id << GetConfig().word_bits_per_page);
+};
+static_assert(hashdag::VBROctree<TestColorOctree, uint32_t>);
+
+// Fills (or paints the existing voxels of) an AABB with a color
+struct ColorAABBEditor {
+	AABBEditor aabb;
+	hashdag::VBRColor color;
+	bool paint;
+	inline hashdag::EditType EditNode(const hashdag::Config<uint32_t> &config,
+	                                  const hashdag::NodeCoord<uint32_t> &coord, hashdag::NodePointer<uint32_t> ptr,
+	                                  hashdag::VBRColor &final_color) const {
+		auto edit_type = aabb.EditNode(config, coord, ptr);
+		if (edit_type == hashdag::EditType::kFill) {
+			final_color = color;
+			if (paint)
+				edit_type = hashdag::EditType::kNotAffected;
+		} else if (!ptr || final_color == color)
+			final_color = color;
+		else
+			final_color = {};
+		if (paint && !ptr)
+			edit_type = hashdag::EditType::kNotAffected;
+		return edit_type;
 	}
-	inline void ZeroPage(uint32_t page_id, uint32_t page_offset, uint32_t zero_words) { pages.insert(page_id); }
-	inline void WritePage(uint32_t page_id, uint32_t page_offset, std::span<const uint32_t> word_span) {
-		pages.insert(page_id);
-		std::copy(word_span.begin(), word_span.end(),
-		          memory.data() + ((page_id << GetConfig().word_bits_per_page) | page_offset));
+	inline bool EditVoxel(const hashdag::Config<uint32_t> &config, const hashdag::NodeCoord<uint32_t> &coord,
+	                      bool voxel, hashdag::VBRColor &voxel_color) const {
+		bool in_range = aabb.EditVoxel(config, coord, false);
+		voxel_color = in_range || !voxel ? color : voxel_color;
+		return paint ? voxel : voxel || in_range;
 	}
 };
 
@@ -158,44 +367,32 @@ TEST_SUITE("NodePool") {
 		}
 		CHECK_EQ(cnt, (pool.GetConfig().GetWordsPerPage() / 3) * pool.GetConfig().GetPagesPerBucket());
 	}
-	TEST_CASE("Test Edit() and Iterate()") {
+	TEST_CASE("Test Edit()") {
 		MurmurNodePool pool(4);
-		SingleIterator iter{};
 		auto root =
-		    pool.Edit({}, AABBEditor{.level = pool.GetConfig().GetVoxelLevel(), .aabb_min = {}, .aabb_max{4, 4, 4}});
+		    pool.Edit({}, Stateless(AABBEditor{.level = pool.GetConfig().GetVoxelLevel(), .aabb_min = {}, .aabb_max{4, 4, 4}}));
 		CHECK(root);
 
 		auto root2 =
-		    pool.Edit(root, AABBEditor{.level = pool.GetConfig().GetVoxelLevel(), .aabb_min = {}, .aabb_max{4, 4, 4}});
+		    pool.Edit(root, Stateless(AABBEditor{.level = pool.GetConfig().GetVoxelLevel(), .aabb_min = {}, .aabb_max{4, 4, 4}}));
 		CHECK(root2);
 		CHECK_EQ(root, root2);
 
-		iter = SingleIterator{.level = pool.GetConfig().GetVoxelLevel(), .pos = {3, 3, 3}, .exist = false};
-		pool.Iterate(root2, &iter);
-		CHECK(iter.exist);
-
-		iter = SingleIterator{.level = pool.GetConfig().GetVoxelLevel(), .pos = {4, 3, 3}, .exist = false};
-		pool.Iterate(root2, &iter);
-		CHECK(!iter.exist);
-
-		iter = SingleIterator{.level = pool.GetConfig().GetVoxelLevel(), .pos = {3, 3, 3}, .exist = false};
-		pool.Iterate({}, &iter);
-		CHECK(!iter.exist);
+		CHECK(pool.GetVoxel(root2, {3, 3, 3}));
+		CHECK(!pool.GetVoxel(root2, {4, 3, 3}));
+		CHECK(!pool.GetVoxel({}, {3, 3, 3}));
 
 		auto root3 = pool.Edit(
-		    root2, AABBEditor{.level = pool.GetConfig().GetVoxelLevel(), .aabb_min = {1, 1, 1}, .aabb_max{5, 5, 5}});
+		    root2, Stateless(AABBEditor{.level = pool.GetConfig().GetVoxelLevel(), .aabb_min = {1, 1, 1}, .aabb_max{5, 5, 5}}));
 		CHECK(root3);
 		CHECK_NE(root, root3);
 
 		auto root4 = pool.Edit(
-		    root3, AABBEditor{.level = pool.GetConfig().GetVoxelLevel(), .aabb_min = {1, 2, 3}, .aabb_max{3, 5, 5}});
+		    root3, Stateless(AABBEditor{.level = pool.GetConfig().GetVoxelLevel(), .aabb_min = {1, 2, 3}, .aabb_max{3, 5, 5}}));
 		CHECK(root4);
 		CHECK_EQ(root3, root4);
-		CHECK_GT(pool.pages.size(), 4);
 
-		iter = SingleIterator{.level = pool.GetConfig().GetVoxelLevel(), .pos = {4, 3, 3}, .exist = false};
-		pool.Iterate(root4, &iter);
-		CHECK(iter.exist);
+		CHECK(pool.GetVoxel(root4, {4, 3, 3}));
 	}
 	TEST_CASE("Test ThreadedEdit()") {
 		lf::busy_pool busy_pool(12);
@@ -203,7 +400,1899 @@ TEST_SUITE("NodePool") {
 		MurmurNodePool pool(6);
 		auto root = pool.ThreadedEdit(
 		    &busy_pool, {},
-		    AABBEditor{.level = pool.GetConfig().GetVoxelLevel(), .aabb_min = {}, .aabb_max{43, 21, 3}});
+		    Stateless(AABBEditor{.level = pool.GetConfig().GetVoxelLevel(), .aabb_min = {}, .aabb_max{43, 21, 3}}));
+		CHECK(root);
+		CHECK(pool.GetVoxel(root, {42, 20, 2}));
+		CHECK(!pool.GetVoxel(root, {43, 20, 2}));
+	}
+}
+
+TEST_SUITE("Mesh") {
+	TEST_CASE_TEMPLATE("Test ThreadedMesh()", Pool, MurmurNodePool, MirrorNodePool) {
+		lf::busy_pool busy_pool(4);
+
+		Pool pool(5);
+		uint32_t voxel_level = pool.GetConfig().GetVoxelLevel(), res = pool.GetConfig().GetResolution();
+		hashdag::NodePointer<uint32_t> root{};
+		std::mt19937 gen{5};
+		std::uniform_int_distribution<uint32_t> dis{0, 63};
+		for (uint32_t i = 0; i < 6; ++i) {
+			glm::u32vec3 a = {dis(gen), dis(gen), dis(gen)}, b = {dis(gen), dis(gen), dis(gen)};
+			root = pool.Edit(root, Stateless(AABBEditor{.level = voxel_level,
+			                                            .aabb_min = glm::min(a, b),
+			                                            .aabb_max = glm::max(a, b) + 1u}));
+		}
+		auto voxels = pool.GetVoxels(root);
+		const auto get_voxel = [&](glm::ivec3 p) {
+			return glm::all(glm::greaterThanEqual(p, glm::ivec3{0})) && glm::all(glm::lessThan(p, glm::ivec3(res))) &&
+			       voxels[(p.x * res + p.y) * res + p.z];
+		};
+		const auto get_color = [](glm::u32vec3 p) { return (p.x / 5u + p.y / 3u + p.z / 7u) % 3u; };
+
+		// Unit faces are identified by (voxel, axis, positive)
+		const auto check_meshes = [&](const auto &meshes, glm::u32vec3 region_min, glm::u32vec3 region_max,
+		                              bool color) {
+			std::unordered_set<uint32_t> faces;
+			for (const auto &mesh : meshes) {
+				REQUIRE_EQ(mesh.positions.size(), mesh.normals.size());
+				REQUIRE_EQ(mesh.indices.size() % 6, 0);
+				CHECK_EQ(mesh.colors.size(), color ? mesh.positions.size() : 0);
+				for (uint32_t q = 0; q < mesh.indices.size(); q += 6) {
+					uint32_t base = mesh.indices[q];
+					glm::u32vec3 p0 = mesh.positions[base], p2 = mesh.positions[base + 2];
+					glm::ivec3 n = mesh.normals[base];
+					uint32_t axis = n.x ? 0 : (n.y ? 1 : 2);
+					bool positive = n[axis] > 0;
+					glm::u32vec3 lo = glm::min(p0, p2), hi = glm::max(p0, p2);
+					CHECK_EQ(lo[axis], hi[axis]);
+					hi[axis] = lo[axis] + 1;
+					if (positive)
+						--lo[axis], --hi[axis];
+					// Triangles face the normal
+					glm::vec3 e0 = glm::vec3(mesh.positions[mesh.indices[q + 1]]) - glm::vec3(p0),
+					          e1 = glm::vec3(mesh.positions[mesh.indices[q + 2]]) - glm::vec3(p0);
+					CHECK_GT(glm::dot(glm::cross(e0, e1), glm::vec3(n)), 0.0f);
+					for (uint32_t x = lo.x; x < hi.x; ++x)
+						for (uint32_t y = lo.y; y < hi.y; ++y)
+							for (uint32_t z = lo.z; z < hi.z; ++z) {
+								glm::ivec3 p{x, y, z};
+								CHECK(get_voxel(p));
+								CHECK_FALSE(get_voxel(p + n));
+								if (color)
+									CHECK_EQ(mesh.colors[base], get_color(p));
+								uint32_t face = (((x * res + y) * res + z) * 3 + axis) * 2 + positive;
+								CHECK(faces.insert(face).second);
+							}
+				}
+			}
+			uint32_t face_count = 0;
+			for (uint32_t x = region_min.x; x < region_max.x; ++x)
+				for (uint32_t y = region_min.y; y < region_max.y; ++y)
+					for (uint32_t z = region_min.z; z < region_max.z; ++z)
+						for (uint32_t axis = 0; axis < 3; ++axis) {
+							glm::ivec3 p{x, y, z}, n{0};
+							n[axis] = 1;
+							face_count += get_voxel(p) && !get_voxel(p + n);
+							face_count += get_voxel(p) && !get_voxel(p - n);
+						}
+			CHECK_GT(face_count, 0);
+			CHECK_EQ(faces.size(), face_count);
+		};
+
+		auto meshes = pool.ThreadedMesh(&busy_pool, root, 3, {0, 0, 0}, {8, 8, 8});
+		CHECK_EQ(meshes.size(), 512);
+		check_meshes(meshes, {0, 0, 0}, {res, res, res}, false);
+
+		auto color_meshes = pool.ThreadedMesh(&busy_pool, root, 2, {1, 0, 1}, {3, 4, 4}, get_color);
+		CHECK_EQ(color_meshes.size(), 24);
+		check_meshes(color_meshes, {16, 0, 16}, {48, 64, 64}, true);
+
+		CHECK(pool.ThreadedMesh(&busy_pool, {}, 3, {0, 0, 0}, {2, 2, 2})[0].Empty());
+	}
+}
+
+TEST_SUITE("Iterate") {
+	const auto edit_boxes = [](auto &pool) {
+		uint32_t voxel_level = pool.GetConfig().GetVoxelLevel();
+		hashdag::NodePointer<uint32_t> root{};
+		std::mt19937 gen{17};
+		std::uniform_int_distribution<uint32_t> dis{0, 63};
+		for (uint32_t i = 0; i < 8; ++i) {
+			glm::u32vec3 a = {dis(gen), dis(gen), dis(gen)}, b = {dis(gen), dis(gen), dis(gen)};
+			root = pool.Edit(root, Stateless(AABBEditor{.level = voxel_level,
+			                                            .aabb_min = glm::min(a, b),
+			                                            .aabb_max = glm::max(a, b) + 1u}));
+		}
+		return root;
+	};
+
+	TEST_CASE_TEMPLATE("Test Iterate() and ThreadedIterate()", Pool, MurmurNodePool, MirrorNodePool) {
+		lf::busy_pool busy_pool(4);
+
+		Pool pool(5);
+		uint32_t res = pool.GetConfig().GetResolution();
+		auto root = edit_boxes(pool);
+		auto voxels = pool.GetVoxels(root);
+
+		for (auto [aabb_min, aabb_max] : {std::pair{glm::u32vec3{0}, glm::u32vec3{res}},
+		                                  std::pair{glm::u32vec3{5, 10, 3}, glm::u32vec3{40, 33, 60}}}) {
+			std::vector<uint8_t> expected(voxels.size());
+			for (uint32_t x = aabb_min.x; x < aabb_max.x; ++x)
+				for (uint32_t y = aabb_min.y; y < aabb_max.y; ++y)
+					for (uint32_t z = aabb_min.z; z < aabb_max.z; ++z) {
+						uint32_t i = (x * res + y) * res + z;
+						expected[i] = voxels[i];
+					}
+
+			std::vector<uint8_t> serial_voxels(voxels.size()), threaded_voxels(voxels.size());
+			AABBIterator serial{.resolution = res, .aabb_min = aabb_min, .aabb_max = aabb_max, .p_voxels = &serial_voxels};
+			pool.Iterate(root, &serial);
+			CHECK_EQ(serial_voxels, expected);
+
+			AABBIterator threaded{
+			    .resolution = res, .aabb_min = aabb_min, .aabb_max = aabb_max, .p_voxels = &threaded_voxels};
+			pool.ThreadedIterate(&busy_pool, root, &threaded, 3);
+			CHECK_EQ(threaded_voxels, expected);
+			CHECK_EQ(serial.node_count, threaded.node_count);
+		}
+
+		std::vector<uint8_t> empty_voxels(voxels.size());
+		AABBIterator empty{.resolution = res, .aabb_min = {}, .aabb_max = glm::u32vec3{res}, .p_voxels = &empty_voxels};
+		pool.Iterate({}, &empty);
+		pool.ThreadedIterate(&busy_pool, {}, &empty);
+		CHECK_EQ(empty.node_count, 0);
+	}
+	TEST_CASE_TEMPLATE("Test MemoIterate() and ThreadedMemoIterate()", Pool, MurmurNodePool, MirrorNodePool) {
+		lf::busy_pool busy_pool(4);
+
+		Pool pool(5);
+		uint32_t res = pool.GetConfig().GetResolution();
+		auto root = edit_boxes(pool);
+		auto voxels = pool.GetVoxels(root);
+		uint64_t voxel_count = std::ranges::count(voxels, true);
+
+		std::atomic_uint32_t leaf_count{0}, threaded_leaf_count{0};
+		CHECK_EQ(pool.MemoIterate(root, VoxelCountIterator{.p_leaf_count = &leaf_count}), voxel_count);
+		CHECK_EQ(pool.ThreadedMemoIterate(&busy_pool, root, VoxelCountIterator{.p_leaf_count = &threaded_leaf_count}),
+		         voxel_count);
+		CHECK_EQ(leaf_count, threaded_leaf_count);
+
+		// Shared leaves are only visited once
+		std::vector<uint8_t> iterated_voxels(voxels.size());
+		AABBIterator all{.resolution = res, .aabb_min = {}, .aabb_max = glm::u32vec3{res}, .p_voxels = &iterated_voxels};
+		pool.Iterate(root, &all);
+		CHECK_LT(leaf_count, all.node_count);
+
+		CHECK_EQ(pool.MemoIterate({}, VoxelCountIterator{.p_leaf_count = &leaf_count}), 0);
+	}
+}
+
+TEST_SUITE("VoxelCount") {
+	const auto edit_boxes = [](auto &pool, uint32_t seed) {
+		uint32_t voxel_level = pool.GetConfig().GetVoxelLevel();
+		hashdag::NodePointer<uint32_t> root{};
+		std::mt19937 gen{seed};
+		std::uniform_int_distribution<uint32_t> dis{0, 63};
+		for (uint32_t i = 0; i < 6; ++i) {
+			glm::u32vec3 a = {dis(gen), dis(gen), dis(gen)}, b = {dis(gen), dis(gen), dis(gen)};
+			root = pool.Edit(root, Stateless(AABBEditor{.level = voxel_level,
+			                                            .aabb_min = glm::min(a, b),
+			                                            .aabb_max = glm::max(a, b) + 1u}));
+		}
+		return root;
+	};
+
+	TEST_CASE_TEMPLATE("Test CountVoxels()", Pool, MurmurNodePool, MirrorNodePool) {
+		Pool pool(5);
+		uint32_t res = pool.GetConfig().GetResolution();
+		auto root = edit_boxes(pool, 1);
+		auto voxels = pool.GetVoxels(root);
+		const auto get_voxel = [&](glm::u32vec3 p) { return bool(voxels[(p.x * res + p.y) * res + p.z]); };
+
+		uint64_t count = 0;
+		glm::u32vec3 lower{res}, upper{0};
+		for (uint32_t x = 0; x < res; ++x)
+			for (uint32_t y = 0; y < res; ++y)
+				for (uint32_t z = 0; z < res; ++z)
+					if (get_voxel({x, y, z})) {
+						++count;
+						lower = glm::min(lower, glm::u32vec3{x, y, z});
+						upper = glm::max(upper, glm::u32vec3{x, y, z});
+					}
+		REQUIRE_GT(count, 0);
+		CHECK_EQ(pool.CountVoxels(root), count);
+		auto bbox = pool.BoundingBox(root);
+		REQUIRE(bbox);
+		CHECK_EQ(bbox->first, lower);
+		CHECK_EQ(bbox->second, upper);
+
+		std::mt19937 gen{7};
+		std::uniform_int_distribution<uint32_t> dis{0, res};
+		for (uint32_t i = 0; i < 32; ++i) {
+			glm::u32vec3 a = {dis(gen), dis(gen), dis(gen)}, b = {dis(gen), dis(gen), dis(gen)};
+			glm::u32vec3 aabb_min = glm::min(a, b), aabb_max = glm::max(a, b);
+			uint64_t box_count = 0;
+			for (uint32_t x = aabb_min.x; x < aabb_max.x; ++x)
+				for (uint32_t y = aabb_min.y; y < aabb_max.y; ++y)
+					for (uint32_t z = aabb_min.z; z < aabb_max.z; ++z)
+						box_count += get_voxel({x, y, z});
+			CHECK_EQ(pool.CountVoxels(root, aabb_min, aabb_max), box_count);
+		}
+
+		// Every voxel is visited exactly once by GetKthVoxel()
+		std::vector<bool> visited(voxels.size());
+		for (uint64_t k = 0; k < count; k += 37) {
+			auto p = pool.GetKthVoxel(root, k);
+			REQUIRE(p);
+			CHECK(get_voxel(*p));
+			uint32_t idx = (p->x * res + p->y) * res + p->z;
+			CHECK_FALSE(visited[idx]);
+			visited[idx] = true;
+		}
+		CHECK_FALSE(pool.GetKthVoxel(root, count));
+
+		CHECK_EQ(pool.CountVoxels({}), 0);
+		CHECK_FALSE(pool.BoundingBox({}));
+	}
+	TEST_CASE_TEMPLATE("Test ThreadedFillVoxelStats()", Pool, MurmurNodePool, MirrorNodePool) {
+		lf::busy_pool busy_pool(4);
+
+		Pool pool(5);
+		auto root = edit_boxes(pool, 2);
+		pool.ThreadedFillVoxelStats(&busy_pool, root);
+		auto stats = pool.GetVoxelStats(root);
+
+		Pool lazy_pool(5);
+		auto lazy_root = edit_boxes(lazy_pool, 2);
+		auto lazy_stats = lazy_pool.GetVoxelStats(lazy_root);
+		CHECK_EQ(stats.count, lazy_stats.count);
+		CHECK_EQ(stats.lower, lazy_stats.lower);
+		CHECK_EQ(stats.upper, lazy_stats.upper);
+
+		// Edits only add nodes, so stats of the old root stay valid
+		auto root2 = pool.Edit(root, Stateless(AABBEditor{.level = pool.GetConfig().GetVoxelLevel(),
+		                                                  .aabb_min = {0, 0, 0},
+		                                                  .aabb_max = {64, 1, 64}}));
+		pool.ThreadedFillVoxelStats(&busy_pool, root2);
+		CHECK_EQ(pool.CountVoxels(root), stats.count);
+		CHECK_EQ(pool.CountVoxels(root2), std::ranges::count(pool.GetVoxels(root2), true));
+
+		uint64_t count2 = pool.CountVoxels(root2);
+		root2 = pool.ThreadedGC(&busy_pool, root2);
+		pool.ClearVoxelStats();
+		CHECK_EQ(pool.CountVoxels(root2), count2);
+	}
+}
+
+TEST_SUITE("MirrorNodePool") {
+	// Boxes mirrored across the center of a [0, 64)^3 world
+	const auto edit_mirrored_boxes = [](auto &pool, auto root) {
+		uint32_t res = pool.GetConfig().GetResolution(), voxel_level = pool.GetConfig().GetVoxelLevel();
+		glm::u32vec3 box_min = {3, 5, 7}, box_max = {29, 17, 11};
+		for (uint32_t mirror = 0; mirror < 8; ++mirror) {
+			glm::u32vec3 mirror_min = box_min, mirror_max = box_max;
+			for (uint32_t a = 0; a < 3; ++a)
+				if ((mirror >> a) & 1u)
+					mirror_min[a] = res - box_max[a], mirror_max[a] = res - box_min[a];
+			root = pool.Edit(root, Stateless(AABBEditor{.level = voxel_level, .aabb_min = mirror_min, .aabb_max = mirror_max}));
+		}
+		return root;
+	};
+
+	TEST_CASE("Test mirror bit helpers") {
+		for (uint32_t mirror = 0; mirror < 8; ++mirror) {
+			for (uint32_t i = 0; i < 8; ++i)
+				CHECK_EQ(MirrorNodePool::mirror_child_bits(1u << i, mirror), 1u << (i ^ mirror));
+			for (uint32_t i = 0; i < 64; ++i)
+				CHECK_EQ(MirrorNodePool::mirror_leaf_bits(1ULL << i, mirror), 1ULL << (i ^ (mirror | (mirror << 3u))));
+		}
+		CHECK_EQ(MurmurNodePool::get_node_address(0xFFFFFFF0u), 0xFFFFFFF0u);
+		CHECK_EQ(MirrorNodePool::get_node_address(0xFFFFFFF0u), 0x1FFFFFF0u);
+		CHECK_EQ(MirrorNodePool::get_node_mirror(0xFFFFFFF0u), 7u);
+		CHECK(hashdag::Config<uint32_t>::Validate(hashdag::DefaultConfig<uint32_t>{.level_count = 6}(), 3));
+	}
+	TEST_CASE("Test mirrored nodes are shared") {
+		MurmurNodePool pool(5);
+		MirrorNodePool mirror_pool(5);
+		auto root = edit_mirrored_boxes(pool, hashdag::NodePointer<uint32_t>{});
+		auto mirror_root = edit_mirrored_boxes(mirror_pool, hashdag::NodePointer<uint32_t>{});
 		CHECK(root);
+		CHECK(mirror_root);
+		CHECK_LT(mirror_pool.GetTotalBucketWords(), pool.GetTotalBucketWords());
+
+		for (uint32_t x = 0; x < 64; ++x)
+			for (uint32_t y = 0; y < 64; ++y)
+				for (uint32_t z = 0; z < 64; ++z)
+					CHECK_EQ(pool.GetVoxel(root, {x, y, z}), mirror_pool.GetVoxel(mirror_root, {x, y, z}));
+	}
+	TEST_CASE("Test Traversal() on mirrored nodes") {
+		MurmurNodePool pool(5);
+		MirrorNodePool mirror_pool(5);
+		auto root = edit_mirrored_boxes(pool, hashdag::NodePointer<uint32_t>{});
+		auto mirror_root = edit_mirrored_boxes(mirror_pool, hashdag::NodePointer<uint32_t>{});
+
+		std::mt19937 gen{0};
+		std::uniform_real_distribution<float> dis{-1.0f, 1.0f};
+		for (uint32_t i = 0; i < 1000; ++i) {
+			glm::vec3 o = glm::vec3{dis(gen), dis(gen), dis(gen)} * 0.5f + 0.5f;
+			glm::vec3 d = glm::normalize(glm::vec3{dis(gen), dis(gen), dis(gen)});
+			auto hit = pool.Traversal(root, o, d), mirror_hit = mirror_pool.Traversal(mirror_root, o, d);
+			CHECK_EQ(hit.has_value(), mirror_hit.has_value());
+			if (hit && mirror_hit)
+				CHECK_EQ(*hit, *mirror_hit);
+		}
+	}
+	TEST_CASE("Test ThreadedEdit() and ThreadedGC() on mirrored nodes") {
+		lf::busy_pool busy_pool(4);
+
+		MurmurNodePool pool(5);
+		MirrorNodePool mirror_pool(5);
+		uint32_t voxel_level = pool.GetConfig().GetVoxelLevel();
+		auto root = edit_mirrored_boxes(pool, hashdag::NodePointer<uint32_t>{});
+		auto mirror_root = edit_mirrored_boxes(mirror_pool, hashdag::NodePointer<uint32_t>{});
+		// Leave garbage behind
+		auto garbage_root = mirror_pool.ThreadedEdit(
+		    &busy_pool, mirror_root, Stateless(AABBEditor{.level = voxel_level, .aabb_min = {1, 1, 1}, .aabb_max{9, 3, 60}}));
+		CHECK_NE(garbage_root, mirror_root);
+
+		root = pool.ThreadedEdit(&busy_pool, root,
+		                         Stateless(AABBEditor{.level = voxel_level, .aabb_min = {33, 2, 40}, .aabb_max{50, 61, 41}}));
+		mirror_root = mirror_pool.ThreadedEdit(
+		    &busy_pool, mirror_root, Stateless(AABBEditor{.level = voxel_level, .aabb_min = {33, 2, 40}, .aabb_max{50, 61, 41}}));
+
+		uint32_t words_before_gc = mirror_pool.GetTotalBucketWords();
+		mirror_root = mirror_pool.ThreadedGC(&busy_pool, mirror_root);
+		CHECK_LT(mirror_pool.GetTotalBucketWords(), words_before_gc);
+
+		for (uint32_t x = 0; x < 64; ++x)
+			for (uint32_t y = 0; y < 64; ++y)
+				for (uint32_t z = 0; z < 64; ++z)
+					CHECK_EQ(pool.GetVoxel(root, {x, y, z}), mirror_pool.GetVoxel(mirror_root, {x, y, z}));
+	}
+}
+
+TEST_SUITE("Rebucket") {
+	// One 64-word bucket per level, saturates quickly
+	const auto make_tiny_config = [] {
+		return hashdag::DefaultConfig<uint32_t>{.level_count = 6,
+		                                        .top_level_count = 6,
+		                                        .word_bits_per_page = 5,
+		                                        .page_bits_per_bucket = 1,
+		                                        .bucket_bits_per_top_level = 0}();
+	};
+	const auto edit_random_boxes = [](auto &pool, auto root, lf::busy_pool *p_busy_pool) {
+		uint32_t voxel_level = pool.GetConfig().GetVoxelLevel();
+		std::mt19937 gen{1};
+		std::uniform_int_distribution<uint32_t> dis{0, 63};
+		for (uint32_t i = 0; i < 16; ++i) {
+			glm::u32vec3 a = {dis(gen), dis(gen), dis(gen)}, b = {dis(gen), dis(gen), dis(gen)};
+			root = pool.ThreadedEdit(p_busy_pool, root,
+			                         Stateless(AABBEditor{.level = voxel_level, .aabb_min = glm::min(a, b),
+			                                              .aabb_max = glm::max(a, b) + 1u}));
+		}
+		return root;
+	};
+
+	TEST_CASE_TEMPLATE("Test ThreadedRebucket()", Pool, MurmurNodePool, MirrorNodePool) {
+		lf::busy_pool busy_pool(4);
+
+		Pool ref_pool(5);
+		auto ref_root = edit_random_boxes(ref_pool, hashdag::NodePointer<uint32_t>{}, &busy_pool);
+		auto ref_voxels = ref_pool.GetVoxels(ref_root);
+
+		Pool pool(make_tiny_config());
+		auto root = edit_random_boxes(pool, hashdag::NodePointer<uint32_t>{}, &busy_pool);
+		CHECK(pool.GetVoxels(root) != ref_voxels); // Saturated
+
+		for (uint32_t bucket_bits = 1; bucket_bits <= 8; ++bucket_bits)
+			for (uint32_t level = 0; level < pool.GetConfig().GetNodeLevels(); ++level) {
+				auto voxels = pool.GetVoxels(root);
+				auto opt_root = pool.ThreadedRebucket(&busy_pool, level, root);
+				REQUIRE(opt_root);
+				root = *opt_root;
+				CHECK_EQ(pool.GetConfig().bucket_bits_each_level[level], bucket_bits);
+				CHECK_EQ(pool.GetConfig().GetTotalBuckets(), pool.bucket_words.size());
+				CHECK(pool.GetVoxels(root) == voxels);
+			}
+
+		root = pool.ThreadedGC(&busy_pool, root);
+		root = edit_random_boxes(pool, root, &busy_pool);
+		CHECK(pool.GetVoxels(root) == ref_voxels);
+
+		auto new_root = edit_random_boxes(pool, hashdag::NodePointer<uint32_t>{}, &busy_pool);
+		CHECK(pool.GetVoxels(new_root) == ref_voxels);
+	}
+	TEST_CASE("Test ThreadedRebucket() out of pointer range") {
+		lf::busy_pool busy_pool(2);
+
+		MurmurNodePool pool(hashdag::Config<uint32_t>{
+		    .word_bits_per_page = 16, .page_bits_per_bucket = 0, .bucket_bits_each_level = {15, 1, 1}});
+		auto root = pool.Edit({}, Stateless(AABBEditor{.level = pool.GetConfig().GetVoxelLevel(),
+		                                               .aabb_min = {1, 2, 3},
+		                                               .aabb_max = {7, 8, 9}}));
+		CHECK_FALSE(pool.ThreadedRebucket(&busy_pool, 0, root));
+		CHECK_EQ(pool.GetConfig().bucket_bits_each_level[0], 15);
+		auto opt_root = pool.ThreadedRebucket(&busy_pool, 2, root);
+		REQUIRE(opt_root);
+		CHECK(pool.GetVoxel(*opt_root, {6, 7, 8}));
+		CHECK_FALSE(pool.GetVoxel(*opt_root, {7, 7, 8}));
+	}
+}
+
+TEST_SUITE("StaticDAG") {
+	const auto edit_boxes = [](auto &pool) {
+		uint32_t voxel_level = pool.GetConfig().GetVoxelLevel();
+		hashdag::NodePointer<uint32_t> root{};
+		std::mt19937 gen{2};
+		std::uniform_int_distribution<uint32_t> dis{0, 63};
+		for (uint32_t i = 0; i < 8; ++i) {
+			glm::u32vec3 a = {dis(gen), dis(gen), dis(gen)}, b = {dis(gen), dis(gen), dis(gen)};
+			root = pool.Edit(root, Stateless(AABBEditor{.level = voxel_level,
+			                                            .aabb_min = glm::min(a, b),
+			                                            .aabb_max = glm::max(a, b) + 1u}));
+		}
+		return root;
+	};
+	const auto check_traversal = [](const auto &pool, auto root, const hashdag::StaticDAG<uint32_t> &dag) {
+		std::mt19937 gen{0};
+		std::uniform_real_distribution<float> dis{-1.0f, 1.0f};
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < 1000; ++i) {
+			glm::vec3 o = glm::vec3{dis(gen), dis(gen), dis(gen)} * 0.5f + 0.5f;
+			glm::vec3 d = glm::normalize(glm::vec3{dis(gen), dis(gen), dis(gen)});
+			auto hit = pool.Traversal(root, o, d), dag_hit = dag.Traversal(dag.GetRoot(), o, d);
+			CHECK_EQ(hit.has_value(), dag_hit.has_value());
+			if (hit && dag_hit) {
+				CHECK_EQ(*hit, *dag_hit);
+				++hits;
+			}
+		}
+		CHECK_GT(hits, 0);
+	};
+
+	TEST_CASE("Test Export()") {
+		MurmurNodePool pool(5);
+		auto root = edit_boxes(pool);
+		auto dag = hashdag::StaticDAG<uint32_t>::Export(pool, root);
+
+		CHECK_EQ(dag.GetNodeLevels(), pool.GetConfig().GetNodeLevels());
+		CHECK_EQ(dag.GetLevelBases().front(), 0);
+		CHECK(std::is_sorted(dag.GetLevelBases().begin(), dag.GetLevelBases().end()));
+		// Leaves are packed at the end
+		CHECK_EQ((dag.GetWords().size() - dag.GetLevelBases().back()) % 2, 0);
+		// No garbage, no bucket slack
+		CHECK_LE(dag.GetWords().size(), pool.GetTotalBucketWords());
+		check_traversal(pool, root, dag);
+
+		auto empty_dag = hashdag::StaticDAG<uint32_t>::Export(pool, hashdag::NodePointer<uint32_t>{});
+		CHECK_FALSE(empty_dag.GetRoot());
+		CHECK_FALSE(empty_dag.Traversal(empty_dag.GetRoot(), glm::vec3{0.5f}, glm::vec3{1.0f, 0.0f, 0.0f}));
+	}
+	TEST_CASE("Test Export() from mirrored nodes") {
+		MurmurNodePool pool(5);
+		MirrorNodePool mirror_pool(5);
+		auto root = edit_boxes(pool);
+		auto mirror_root = edit_boxes(mirror_pool);
+		auto dag = hashdag::StaticDAG<uint32_t>::Export(pool, root);
+		auto mirror_dag = hashdag::StaticDAG<uint32_t>::Export(mirror_pool, mirror_root);
+
+		// Mirrors are baked out, so both give the same minimal DAG
+		CHECK_EQ(mirror_dag.GetWords().size(), dag.GetWords().size());
+		CHECK(mirror_dag.GetLevelBases() == dag.GetLevelBases());
+		check_traversal(mirror_pool, mirror_root, mirror_dag);
+	}
+}
+
+TEST_SUITE("Traversal") {
+	const auto edit_boxes = [](auto &pool) {
+		uint32_t voxel_level = pool.GetConfig().GetVoxelLevel();
+		hashdag::NodePointer<uint32_t> root{};
+		std::mt19937 gen{3};
+		std::uniform_int_distribution<uint32_t> dis{0, 63};
+		for (uint32_t i = 0; i < 8; ++i) {
+			glm::u32vec3 a = {dis(gen), dis(gen), dis(gen)}, b = {dis(gen), dis(gen), dis(gen)};
+			root = pool.Edit(root, Stateless(AABBEditor{.level = voxel_level,
+			                                            .aabb_min = glm::min(a, b),
+			                                            .aabb_max = glm::max(a, b) + 1u}));
+		}
+		return root;
+	};
+	const auto make_rays = [](uint32_t count) {
+		std::mt19937 gen{0};
+		std::uniform_real_distribution<float> dis{-1.0f, 1.0f};
+		std::vector<glm::vec3> origins(count), dirs(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			origins[i] = glm::vec3{dis(gen), dis(gen), dis(gen)} * 0.75f + 0.5f;
+			dirs[i] = glm::normalize(glm::vec3{dis(gen), dis(gen), dis(gen)});
+		}
+		return std::pair{std::move(origins), std::move(dirs)};
+	};
+
+	TEST_CASE_TEMPLATE("Test LODTraversal()", Pool, MurmurNodePool, MirrorNodePool) {
+		Pool pool(5);
+		auto root = edit_boxes(pool);
+		auto [origins, dirs] = make_rays(1001);
+		const float kInf = std::numeric_limits<float>::infinity();
+		uint32_t voxel_level = pool.GetConfig().GetVoxelLevel();
+
+		uint32_t coarse_hits = 0;
+		for (uint32_t i = 0; i < origins.size(); ++i) {
+			glm::vec3 o = origins[i], d = dirs[i];
+			auto hit = pool.Traversal(root, o, d);
+			auto full = pool.LODTraversal(root, o, d, kInf);
+			CHECK_EQ(hit.has_value(), full.has_value());
+			if (!hit || !full)
+				continue;
+			CHECK_EQ(full->position, *hit);
+			CHECK_EQ(full->voxel_size, 1);
+			CHECK_EQ(full->level, voxel_level);
+			CHECK(pool.GetVoxel(root, full->voxel_pos));
+			CHECK_EQ(glm::dot(glm::abs(full->normal), glm::vec3{1}), 1.0f);
+			CHECK_LT(glm::dot(full->normal, d), 0.0f);
+			CHECK(glm::all(glm::epsilonEqual(o + full->t * d, full->position, 1e-5f)));
+
+			// Start from a t-bias
+			float t_start = full->t * 0.5f;
+			auto biased = pool.LODTraversal(root, o, d, kInf, t_start);
+			REQUIRE(biased);
+			CHECK_EQ(biased->voxel_pos, full->voxel_pos);
+			CHECK(glm::epsilonEqual(biased->t, full->t, 1e-5f));
+
+			// Coarse hits are non-empty cells that are not behind the voxel hit, and take fewer iterations
+			auto coarse = pool.LODTraversal(root, o, d, 4.0f);
+			REQUIRE(coarse);
+			CHECK_EQ(coarse->voxel_size, 1u << (voxel_level - coarse->level));
+			CHECK_LE(coarse->t, full->t + 1e-5f);
+			CHECK_LE(coarse->iterations, full->iterations);
+			CHECK_EQ(coarse->voxel_pos % coarse->voxel_size, glm::u32vec3{0});
+			bool non_empty = false;
+			for (uint32_t x = 0; x < coarse->voxel_size && !non_empty; ++x)
+				for (uint32_t y = 0; y < coarse->voxel_size && !non_empty; ++y)
+					for (uint32_t z = 0; z < coarse->voxel_size && !non_empty; ++z)
+						non_empty = pool.GetVoxel(root, coarse->voxel_pos + glm::u32vec3{x, y, z});
+			CHECK(non_empty);
+			coarse_hits += coarse->voxel_size > 1;
+		}
+		CHECK_GT(coarse_hits, 0);
+		CHECK_FALSE(pool.LODTraversal(hashdag::NodePointer<uint32_t>{}, origins[0], dirs[0], kInf));
+	}
+	TEST_CASE_TEMPLATE("Test Overlap() and SweepAABB()", Pool, MurmurNodePool, MirrorNodePool) {
+		Pool pool(5);
+		auto root = edit_boxes(pool);
+		uint32_t res = pool.GetConfig().GetResolution();
+		float voxel_size = 1.0f / float(res);
+
+		std::vector<glm::vec3> voxel_lowers;
+		auto voxels = pool.GetVoxels(root);
+		for (uint32_t i = 0; i < voxels.size(); ++i)
+			if (voxels[i])
+				voxel_lowers.push_back(glm::vec3{i / (res * res), (i / res) % res, i % res} * voxel_size);
+		REQUIRE_FALSE(voxel_lowers.empty());
+
+		std::mt19937 gen{11};
+		std::uniform_real_distribution<float> pos_dis{-0.1f, 1.1f}, size_dis{0.0f, 0.1f}, delta_dis{-0.5f, 0.5f};
+		std::vector<hashdag::TraversalAABB<float>> boxes(300);
+		std::vector<hashdag::TraversalSphere<float>> spheres(300);
+		std::vector<glm::vec3> deltas(300);
+		for (uint32_t i = 0; i < 300; ++i) {
+			glm::vec3 p = {pos_dis(gen), pos_dis(gen), pos_dis(gen)};
+			// Snap some boxes to the voxel grid to test touching faces
+			if (i % 3 == 0)
+				p = glm::floor(p * float(res)) * voxel_size;
+			boxes[i] = {.lower = p, .upper = p + glm::vec3{size_dis(gen), size_dis(gen), size_dis(gen)}};
+			spheres[i] = {.center = p, .radius = size_dis(gen)};
+			deltas[i] = {delta_dis(gen), delta_dis(gen), i % 5 == 0 ? 0.0f : delta_dis(gen)};
+		}
+
+		std::vector<uint32_t> box_masks(10), sphere_masks(10);
+		pool.Overlap(root, std::span<const hashdag::TraversalAABB<float>>{boxes}, box_masks);
+		pool.Overlap(root, std::span<const hashdag::TraversalSphere<float>>{spheres}, sphere_masks);
+		std::vector<float> tois(300);
+		pool.SweepAABB(root, std::span<const hashdag::TraversalAABB<float>>{boxes}, deltas, tois);
+
+		uint32_t box_hits = 0, sweep_hits = 0;
+		for (uint32_t i = 0; i < 300; ++i) {
+			const auto &box = boxes[i];
+			const auto &sphere = spheres[i];
+			bool box_overlap = false, sphere_overlap = false;
+			float toi = std::numeric_limits<float>::infinity();
+			for (const glm::vec3 &lower : voxel_lowers) {
+				glm::vec3 upper = lower + voxel_size;
+				box_overlap |= glm::all(glm::lessThan(lower, box.upper)) && glm::all(glm::greaterThan(upper, box.lower));
+				glm::vec3 v = glm::clamp(sphere.center, lower, upper) - sphere.center;
+				sphere_overlap |= glm::dot(v, v) < sphere.radius * sphere.radius;
+
+				float t_enter = 0.0f, t_exit = 1.0f;
+				for (uint32_t a = 0; a < 3; ++a) {
+					if (deltas[i][a] == 0.0f) {
+						if (box.lower[a] >= upper[a] || box.upper[a] <= lower[a])
+							t_enter = 1.0f, t_exit = 0.0f;
+						continue;
+					}
+					float t0 = (lower[a] - box.upper[a]) / deltas[i][a], t1 = (upper[a] - box.lower[a]) / deltas[i][a];
+					if (deltas[i][a] < 0.0f)
+						std::swap(t0, t1);
+					t_enter = glm::max(t_enter, t0);
+					t_exit = glm::min(t_exit, t1);
+				}
+				if (t_enter < t_exit)
+					toi = glm::min(toi, t_enter);
+			}
+			CHECK_EQ(pool.Overlap(root, box), box_overlap);
+			CHECK_EQ(pool.Overlap(root, sphere), sphere_overlap);
+			CHECK_EQ(bool((box_masks[i / 32] >> (i % 32)) & 1u), box_overlap);
+			CHECK_EQ(bool((sphere_masks[i / 32] >> (i % 32)) & 1u), sphere_overlap);
+			auto sweep = pool.SweepAABB(root, box, deltas[i]);
+			CHECK_EQ(sweep.has_value(), toi <= 1.0f);
+			if (sweep)
+				CHECK_EQ(*sweep, toi);
+			CHECK_EQ(tois[i], toi);
+			// A box touching a voxel and moving into it also gets TOI 0
+			if (box_overlap)
+				CHECK((sweep && *sweep == 0.0f));
+			box_hits += box_overlap;
+			sweep_hits += sweep && *sweep > 0.0f;
+		}
+		CHECK_GT(box_hits, 0);
+		CHECK_GT(sweep_hits, 0);
+		CHECK_FALSE(pool.Overlap(hashdag::NodePointer<uint32_t>{}, boxes[0]));
+		CHECK_FALSE(pool.SweepAABB(hashdag::NodePointer<uint32_t>{}, boxes[0], deltas[0]));
+	}
+	TEST_CASE_TEMPLATE("Test Traversal() beyond 23 levels", Pool, MurmurNodePool, MirrorNodePool) {
+		// 25 node levels, 2^26 voxels on each axis
+		Pool pool(hashdag::Config<uint32_t>{.word_bits_per_page = 6,
+		                                    .page_bits_per_bucket = 2,
+		                                    .bucket_bits_each_level = std::vector<uint32_t>(25, 6)});
+		uint32_t voxel_level = pool.GetConfig().GetVoxelLevel();
+		REQUIRE_EQ(voxel_level, 26);
+		double res = double(pool.GetConfig().GetResolution());
+
+		// Small boxes in a 64^3 neighbourhood deep inside the volume
+		const glm::u32vec3 base = {(1u << 25u) + 12345u, (1u << 24u) + 777u, (1u << 25u) - 999u};
+		std::vector<std::pair<glm::u32vec3, glm::u32vec3>> boxes;
+		hashdag::NodePointer<uint32_t> root{};
+		std::mt19937 gen{13};
+		std::uniform_int_distribution<uint32_t> pos_dis{0, 60}, size_dis{1, 4};
+		for (uint32_t i = 0; i < 16; ++i) {
+			glm::u32vec3 lo = base + glm::u32vec3{pos_dis(gen), pos_dis(gen), pos_dis(gen)},
+			             hi = lo + glm::u32vec3{size_dis(gen), size_dis(gen), size_dis(gen)};
+			boxes.emplace_back(lo, hi);
+			root = pool.Edit(root, Stateless(AABBEditor{.level = voxel_level, .aabb_min = lo, .aabb_max = hi}));
+		}
+
+		// Rays aimed at random points of the boxes
+		std::uniform_real_distribution<double> origin_dis{-16.0, 80.0}, target_dis{0.0, 1.0};
+		std::uniform_int_distribution<uint32_t> box_dis{0, 15};
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < 2000; ++i) {
+			const auto &[target_lo, target_hi] = boxes[box_dis(gen)];
+			glm::dvec3 target = glm::dvec3(target_lo) + glm::dvec3(target_hi - target_lo) *
+			                                                glm::dvec3{target_dis(gen), target_dis(gen), target_dis(gen)};
+			glm::dvec3 o = (glm::dvec3(base) + glm::dvec3{origin_dis(gen), origin_dis(gen), origin_dis(gen)}) / res,
+			           d = glm::normalize(target / res - o);
+
+			// Analytic first hit of the boxes
+			double t_hit = std::numeric_limits<double>::infinity();
+			bool inside = false;
+			for (const auto &[lo, hi] : boxes) {
+				glm::dvec3 t0 = (glm::dvec3(lo) / res - o) / d, t1 = (glm::dvec3(hi) / res - o) / d;
+				glm::dvec3 t_lo = glm::min(t0, t1), t_hi = glm::max(t0, t1);
+				double t_enter = glm::max(glm::max(t_lo.x, t_lo.y), t_lo.z),
+				       t_exit = glm::min(glm::min(t_hi.x, t_hi.y), t_hi.z);
+				inside |= t_enter < 0.0 && t_exit > 0.0;
+				if (t_enter >= 0.0 && t_enter <= t_exit)
+					t_hit = glm::min(t_hit, t_enter);
+			}
+			if (inside)
+				continue;
+
+			auto hit = pool.Traversal(root, o, d);
+			CHECK_EQ(hit.has_value(), t_hit != std::numeric_limits<double>::infinity());
+			if (!hit)
+				continue;
+			++hits;
+			CHECK_LT(glm::length(*hit - (o + t_hit * d)) * res, 1e-3);
+
+			// The float interface marches in double for deep pools
+			auto float_hit = pool.Traversal(root, glm::vec3(o), glm::vec3(d));
+			auto rounded_hit = pool.Traversal(root, glm::dvec3(glm::vec3(o)), glm::dvec3(glm::vec3(d)));
+			CHECK_EQ(float_hit.has_value(), rounded_hit.has_value());
+			if (float_hit && rounded_hit)
+				CHECK_EQ(*float_hit, glm::vec3(*rounded_hit));
+
+			auto lod_hit = pool.LODTraversal(root, o, d, std::numeric_limits<double>::infinity());
+			REQUIRE(lod_hit);
+			CHECK_EQ(lod_hit->level, voxel_level);
+			CHECK_EQ(lod_hit->voxel_size, 1);
+			CHECK(pool.GetVoxel(root, lod_hit->voxel_pos));
+			CHECK_LT(glm::length(glm::dvec3(lod_hit->voxel_pos) + 0.5 - *hit * res), 1.0);
+		}
+		CHECK_GT(hits, 1000);
+	}
+	TEST_CASE("Test ThreadedTraversal()") {
+		lf::busy_pool busy_pool(4);
+
+		MurmurNodePool pool(5);
+		auto root = edit_boxes(pool);
+		auto [origins, dirs] = make_rays(5000);
+
+		std::vector<uint32_t> hit_masks((origins.size() + 31) / 32);
+		std::vector<glm::vec3> positions(origins.size());
+		std::vector<uint32_t> iterations(origins.size());
+		pool.ThreadedTraversal(&busy_pool, root,
+		                       hashdag::TraversalBatch<uint32_t, float>{.origins = origins,
+		                                                                .dirs = dirs,
+		                                                                .hit_masks = hit_masks,
+		                                                                .positions = positions,
+		                                                                .iterations = iterations});
+		uint32_t hits = 0, misses = 0;
+		for (uint32_t i = 0; i < origins.size(); ++i) {
+			uint32_t ref_iterations;
+			auto hit = pool.Traversal(root, origins[i], dirs[i], &ref_iterations);
+			bool batch_hit = (hit_masks[i / 32] >> (i % 32)) & 1u;
+			CHECK_EQ(hit.has_value(), batch_hit);
+			CHECK_EQ(iterations[i], ref_iterations);
+			CHECK_GT(iterations[i], 0);
+			if (hit && batch_hit) {
+				CHECK_EQ(*hit, positions[i]);
+				// A hit takes the iterations of the LOD traversal down to the voxels
+				auto lod_hit = pool.LODTraversal(root, origins[i], dirs[i], std::numeric_limits<float>::infinity());
+				REQUIRE(lod_hit);
+				CHECK_EQ(iterations[i], lod_hit->iterations);
+				++hits;
+			} else
+				++misses;
+		}
+		CHECK_GT(hits, 0);
+		CHECK_GT(misses, 0);
+	}
+}
+
+TEST_SUITE("CPURenderer") {
+	const auto edit_boxes = [](auto &pool) {
+		uint32_t voxel_level = pool.GetConfig().GetVoxelLevel();
+		hashdag::NodePointer<uint32_t> root{};
+		std::mt19937 gen{5};
+		std::uniform_int_distribution<uint32_t> dis{0, 63};
+		for (uint32_t i = 0; i < 8; ++i) {
+			glm::u32vec3 a = {dis(gen), dis(gen), dis(gen)}, b = {dis(gen), dis(gen), dis(gen)};
+			root = pool.Edit(root, Stateless(AABBEditor{.level = voxel_level,
+			                                            .aabb_min = glm::min(a, b),
+			                                            .aabb_max = glm::max(a, b) + 1u}));
+		}
+		return root;
+	};
+	const auto make_renderer = [](const auto &pool, const std::vector<uint32_t> &color_nodes,
+	                              const std::vector<uint32_t> &color_leaves) {
+		return CPURenderer{[&pool](uint32_t i) {
+			                   return pool.ReadPage(i >> pool.GetConfig().word_bits_per_page)
+			                       [i & (pool.GetConfig().GetWordsPerPage() - 1u)];
+		                   },
+		                   [&color_nodes](uint32_t i) { return color_nodes.at(i); },
+		                   [&color_leaves](uint32_t i) { return color_leaves.at(i); }};
+	};
+	// Runs of voxels with RGB8 colors and 1 to 3 bits-per-weight VBR colors
+	const auto get_test_color = [](uint32_t voxel_index) -> hashdag::VBRColor {
+		uint32_t run = voxel_index / 1000u, bits_per_weight = run % 4u;
+		if (bits_per_weight == 0)
+			return hashdag::RGB8Color{run * 0x3F1D05u & 0xFFFFFFu};
+		return hashdag::VBRColor{hashdag::R5G6B5Color{uint16_t(run * 0x1234u)}, hashdag::R5G6B5Color{uint16_t(~run)},
+		                         uint8_t(run % (1u << bits_per_weight)), uint8_t(bits_per_weight)};
+	};
+	// Same layout as DAGColorPool::SetLeaf(), returns the leaf pointer
+	const auto append_test_leaf = [](std::vector<uint32_t> &leaves, uint32_t voxel_count, auto &&get_color) {
+		hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> writer;
+		for (uint32_t i = 0; i < voxel_count; i += 1000u)
+			writer.Push(get_color(i), std::min(voxel_count - i, 1000u));
+		auto chunk = writer.Flush();
+
+		uint32_t idx = leaves.size();
+		leaves.push_back(0);
+		leaves.push_back(chunk.GetMacroBlocks().size());
+		leaves.push_back(chunk.GetBlockHeaders().size());
+		leaves.push_back(chunk.GetWeightBits().GetWords().size());
+		for (const auto &macro_block : chunk.GetMacroBlocks())
+			leaves.insert(leaves.end(), {macro_block.first_block, macro_block.weight_start});
+		for (const auto &block_header : chunk.GetBlockHeaders())
+			leaves.insert(leaves.end(), {block_header.colors, block_header.packed_14_2_16});
+		leaves.insert(leaves.end(), chunk.GetWeightBits().GetWords().begin(), chunk.GetWeightBits().GetWords().end());
+		if (leaves.size() & 1u)
+			leaves.push_back(0);
+		leaves[idx] = leaves.size() - idx;
+		return (2u << 30u) | idx;
+	};
+	// Runs of 3 voxels with 5 RGB8 colors
+	const auto get_palette_test_color = [](uint32_t voxel_index) -> hashdag::VBRColor {
+		return hashdag::RGB8Color{(voxel_index / 3u * 7u % 5u) * 0x2F1B07u & 0xFFFFFFu};
+	};
+	// Same layout as a palette leaf of DAGColorPool::SetLeaf(), returns the leaf pointer
+	const auto append_test_palette_leaf = [](std::vector<uint32_t> &leaves, uint32_t voxel_count, auto &&get_color) {
+		hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> writer;
+		for (uint32_t i = 0; i < voxel_count; i += 3u)
+			writer.Push(get_color(i), std::min(voxel_count - i, 3u));
+		auto opt_chunk = hashdag::EncodePaletteChunk(writer.Flush());
+		REQUIRE(opt_chunk);
+
+		uint32_t idx = leaves.size();
+		leaves.push_back(0);
+		leaves.push_back((1u << 31u) | opt_chunk->GetMacroBlockCount());
+		leaves.push_back(opt_chunk->GetColors().size() | (opt_chunk->GetBitsPerIndex() << 16u));
+		leaves.push_back(opt_chunk->GetIndexBits().GetWords().size());
+		leaves.push_back(opt_chunk->GetIndexCount());
+		leaves.insert(leaves.end(), opt_chunk->GetColors().begin(), opt_chunk->GetColors().end());
+		leaves.insert(leaves.end(), opt_chunk->GetIndexBits().GetWords().begin(),
+		              opt_chunk->GetIndexBits().GetWords().end());
+		if (leaves.size() & 1u)
+			leaves.push_back(0);
+		leaves[idx] = leaves.size() - idx;
+		return (2u << 30u) | idx;
+	};
+	// Same layout as DAGColorPool::SetNode(), [child mask | fill bit | mip][fill][other children], returns the node
+	// pointer
+	const auto append_test_node = [](std::vector<uint32_t> &nodes, const std::array<uint32_t, 8> &children,
+	                                 uint32_t mip = 0) {
+		uint32_t fill = 3u << 30u, fill_count = std::ranges::count(children, fill);
+		for (uint32_t p : children)
+			if (uint32_t c = std::ranges::count(children, p); (p >> 30u) == 1u && c >= 2u && c > fill_count)
+				fill = p, fill_count = c;
+
+		uint32_t idx = nodes.size();
+		nodes.push_back(mip << 16u);
+		if ((fill >> 30u) != 3u) {
+			nodes[idx] |= 1u << 8u;
+			nodes.push_back(fill);
+		}
+		for (uint32_t i = 0; i < 8; ++i)
+			if (children[i] != fill) {
+				nodes[idx] |= 1u << i;
+				nodes.push_back(children[i]);
+			}
+		return idx;
+	};
+	const auto morton = [](glm::u32vec3 p, uint32_t bits) {
+		uint32_t m = 0;
+		for (uint32_t b = 0; b < bits; ++b)
+			m |= (((p.x >> b) & 1u) | (((p.y >> b) & 1u) << 1u) | (((p.z >> b) & 1u) << 2u)) << (3u * b);
+		return m;
+	};
+
+	TEST_CASE("Test RayMarch()") {
+		MurmurNodePool pool(5);
+		auto root = edit_boxes(pool);
+		std::vector<uint32_t> color_nodes, color_leaves;
+		auto renderer = make_renderer(pool, color_nodes, color_leaves);
+
+		std::mt19937 gen{0};
+		std::uniform_real_distribution<float> dis{-1.0f, 1.0f};
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < 5000; ++i) {
+			glm::vec3 o = glm::vec3{dis(gen), dis(gen), dis(gen)} * 0.75f + 0.5f,
+			          d = glm::normalize(glm::vec3{dis(gen), dis(gen), dis(gen)});
+			auto hit = renderer.RayMarch(*root, pool.GetConfig().GetLeafLevel(), std::numeric_limits<float>::infinity(),
+			                             0, o, d);
+			auto opt_pos = pool.Traversal(root, o, d);
+			CHECK_GT(hit.iter, 0);
+			CHECK_EQ(hit.hit, opt_pos.has_value());
+			if (!hit.hit || !opt_pos)
+				continue;
+			++hits;
+			CHECK_EQ(hit.vox_size, 1);
+			CHECK(pool.GetVoxel(root, hit.vox_pos));
+			CHECK(glm::all(glm::greaterThanEqual(*opt_pos, hit.vox_min - 1e-6f)));
+			CHECK(glm::all(glm::lessThanEqual(*opt_pos, hit.vox_max + 1e-6f)));
+			CHECK_EQ(glm::dot(glm::abs(hit.norm), glm::vec3{1}), 1.0f);
+			// hit_pos is pushed out of the voxel through the hit face
+			glm::vec3 outside = glm::max(hit.vox_min - hit.hit_pos, hit.hit_pos - hit.vox_max);
+			CHECK_GT(glm::dot(outside, glm::abs(hit.norm)), 0.0f);
+		}
+		CHECK_GT(hits, 0);
+
+		// Coarser LOD only stops earlier
+		auto lod_hit = renderer.RayMarch(*root, pool.GetConfig().GetLeafLevel(), 1.0f, 0, glm::vec3{0.5f, 0.5f, -1.0f},
+		                                 glm::vec3{0, 0, 1});
+		CHECK_GT(lod_hit.vox_size, 1);
+
+		auto null_hit = renderer.RayMarch(-1, pool.GetConfig().GetLeafLevel(), 1.0f, 0, glm::vec3{0.5f},
+		                                  glm::vec3{0, 0, 1});
+		CHECK_FALSE(null_hit.hit);
+		CHECK_EQ(null_hit.iter, 0);
+	}
+	TEST_CASE("Test ColorFetch()") {
+		MurmurNodePool pool(5);
+		uint32_t voxel_level = pool.GetConfig().GetVoxelLevel(), res = pool.GetConfig().GetResolution();
+		std::vector<uint32_t> color_nodes, color_leaves;
+		auto renderer = make_renderer(pool, color_nodes, color_leaves);
+
+		const auto check_color = [](glm::vec3 l, glm::vec3 r) {
+			CHECK(glm::all(glm::epsilonEqual(l, r, 1e-6f)));
+		};
+
+		// A single leaf spanning several macro blocks
+		uint32_t leaf_ptr = append_test_leaf(color_leaves, res * res * res, get_test_color);
+		for (uint32_t x = 0; x < res; ++x)
+			for (uint32_t y = 0; y < res; ++y)
+				for (uint32_t z = 0; z < res; ++z)
+					check_color(renderer.ColorFetch(leaf_ptr, voxel_level, 0, {x, y, z}),
+					            get_test_color(morton({x, y, z}, voxel_level)).Get());
+
+		// A node with leaf, color and null children
+		uint32_t half_res = res >> 1u;
+		const auto get_half_test_color = [&](uint32_t voxel_index) { return get_test_color(voxel_index / 1000u * 7000u); };
+		leaf_ptr = append_test_leaf(color_leaves, half_res * half_res * half_res, get_half_test_color);
+		uint32_t fill = (1u << 30u) | hashdag::RGB8Color{glm::u8vec3{12, 34, 56}}.GetData(), null = 3u << 30u;
+		// Then with the fill color shared by most children, so that it is stored once
+		for (const auto &children : {std::array{leaf_ptr, fill, null, leaf_ptr, leaf_ptr, leaf_ptr, leaf_ptr, leaf_ptr},
+		                             std::array{fill, leaf_ptr, null, fill, fill, null, leaf_ptr, fill}}) {
+			color_nodes.clear();
+			REQUIRE_EQ(append_test_node(color_nodes, children, hashdag::R5G6B5Color{glm::vec3{1, 0, 1}}.GetData()), 0);
+			CHECK_EQ(color_nodes.size(), std::ranges::count(children, fill) > 2 ? 6 : 8);
+			for (uint32_t x = 0; x < res; ++x)
+				for (uint32_t y = 0; y < res; ++y)
+					for (uint32_t z = 0; z < res; ++z) {
+						glm::u32vec3 p = {x, y, z}, o = p / half_res;
+						uint32_t child = children[o.x | (o.y << 1u) | (o.z << 2u)];
+						glm::vec3 color = renderer.ColorFetch(0, voxel_level, 1, p);
+						if (child == fill)
+							check_color(color, hashdag::RGB8Color{fill & 0xFFFFFFu}.Get());
+						else if (child == null)
+							check_color(color, glm::vec3{0});
+						else
+							check_color(color, get_half_test_color(morton(p % half_res, voxel_level - 1)).Get());
+					}
+			// A voxel covering the node takes its mip, voxels of the leaf level or smaller are fetched in full
+			check_color(renderer.ColorFetch(0, voxel_level, 1, {0, 0, 0}, res), glm::vec3{1, 0, 1});
+			for (uint32_t i = 0; i < 8; ++i) {
+				glm::u32vec3 p = glm::u32vec3{i & 1u, (i >> 1u) & 1u, (i >> 2u) & 1u} * half_res;
+				check_color(renderer.ColorFetch(0, voxel_level, 1, p, half_res), renderer.ColorFetch(0, voxel_level, 1, p));
+			}
+		}
+
+		// Palette leaves
+		uint32_t palette_leaf_ptr = append_test_palette_leaf(color_leaves, res * res * res, get_palette_test_color);
+		for (uint32_t x = 0; x < res; ++x)
+			for (uint32_t y = 0; y < res; ++y)
+				for (uint32_t z = 0; z < res; ++z) {
+					glm::vec3 color = renderer.ColorFetch(palette_leaf_ptr, voxel_level, 0, {x, y, z});
+					check_color(color, get_palette_test_color(morton({x, y, z}, voxel_level)).Get());
+				}
+		// Palette leaves under a node, with a VBR leaf and a null child
+		palette_leaf_ptr = append_test_palette_leaf(color_leaves, half_res * half_res * half_res, get_palette_test_color);
+		color_nodes.clear();
+		REQUIRE_EQ(append_test_node(color_nodes, {palette_leaf_ptr, leaf_ptr, 3u << 30u, palette_leaf_ptr, palette_leaf_ptr,
+		                                          palette_leaf_ptr, palette_leaf_ptr, palette_leaf_ptr}),
+		           0);
+		for (uint32_t x = 0; x < res; ++x)
+			for (uint32_t y = 0; y < res; ++y)
+				for (uint32_t z = 0; z < res; ++z) {
+					glm::u32vec3 p = {x, y, z}, o = p / half_res;
+					uint32_t child = o.x | (o.y << 1u) | (o.z << 2u);
+					glm::vec3 color = renderer.ColorFetch(0, voxel_level, 1, p);
+					if (child == 1)
+						check_color(color, get_half_test_color(morton(p % half_res, voxel_level - 1)).Get());
+					else if (child == 2)
+						check_color(color, glm::vec3{0});
+					else
+						check_color(color, get_palette_test_color(morton(p % half_res, voxel_level - 1)).Get());
+				}
+	}
+	TEST_CASE("Test ThreadedRender()") {
+		lf::busy_pool busy_pool(4);
+
+		MurmurNodePool pool(5);
+		auto root = edit_boxes(pool);
+		std::vector<uint32_t> color_nodes, color_leaves;
+		auto renderer = make_renderer(pool, color_nodes, color_leaves);
+		uint32_t res = pool.GetConfig().GetResolution();
+		uint32_t color_root = append_test_leaf(color_leaves, res * res * res, get_test_color);
+
+		decltype(renderer)::Params params = {
+		    .pos = {0.5f, 0.6f, -0.8f},
+		    .look = {0, 0, 1},
+		    .side = {0.6f, 0, 0},
+		    .up = {0, 0.5f, 0},
+		    .width = 67,
+		    .height = 45,
+		    .voxel_level = pool.GetConfig().GetVoxelLevel(),
+		    .dag_root = *root,
+		    .dag_leaf_level = pool.GetConfig().GetLeafLevel(),
+		    .color_root = color_root,
+		    .color_leaf_level = 0,
+		    .proj_factor = 45.0f,
+		    .type = 0,
+		};
+		for (uint32_t type = 0; type < 3; ++type) {
+			params.type = type;
+			std::vector<glm::u8vec3> image(params.width * params.height), threaded_image(image.size());
+			renderer.Render(params, image);
+			renderer.ThreadedRender(&busy_pool, params, threaded_image);
+			CHECK(image == threaded_image);
+			CHECK(std::ranges::any_of(image, [](glm::u8vec3 c) { return c != glm::u8vec3{0}; }));
+		}
+	}
+	TEST_CASE("Test VisiblePageFinder") {
+		lf::busy_pool busy_pool(4);
+
+		// Small pages so that a view covers only part of them
+		MurmurNodePool pool(hashdag::DefaultConfig<uint32_t>{.level_count = 6, .word_bits_per_page = 4}());
+		auto root = edit_boxes(pool);
+		uint32_t res = pool.GetConfig().GetResolution(), leaf_res = res >> 2u;
+
+		// Two levels of color nodes with leaf, color and null children
+		std::vector<uint32_t> color_nodes, color_leaves;
+		std::array<uint32_t, 3> leaf_ptrs{};
+		for (uint32_t i = 0; i < 3; ++i)
+			leaf_ptrs[i] = append_test_leaf(color_leaves, leaf_res * leaf_res * leaf_res,
+			                                [&](uint32_t voxel_index) { return get_test_color(voxel_index + i * 5000u); });
+		std::array<uint32_t, 8> root_children;
+		for (uint32_t i = 0; i < 8; ++i) {
+			std::array<uint32_t, 8> children;
+			for (uint32_t j = 0; j < 8; ++j) {
+				uint32_t k = (i * 8 + j) % 5;
+				children[j] = k < 3 ? leaf_ptrs[k] : (k == 3 ? (1u << 30u) | 0x123456u : 3u << 30u);
+			}
+			root_children[i] = append_test_node(color_nodes, children);
+		}
+		uint32_t color_root = append_test_node(color_nodes, root_children);
+
+		// Pages read by the renderer, only recorded in serial renders
+		std::array<std::set<uint32_t>, 3> touched;
+		bool record = false;
+		VisiblePageBits page_bits{};
+		const auto read_dag = [&](uint32_t i) {
+			if (record)
+				touched[0].insert(i >> page_bits.dag_words);
+			return pool.ReadPage(i >> pool.GetConfig().word_bits_per_page)[i & (pool.GetConfig().GetWordsPerPage() - 1u)];
+		};
+		const auto read_color_node = [&](uint32_t i) {
+			if (record)
+				touched[1].insert(i >> page_bits.color_node_words);
+			return color_nodes.at(i);
+		};
+		const auto read_color_leaf = [&](uint32_t i) {
+			if (record)
+				touched[2].insert(i >> page_bits.color_leaf_words);
+			return color_leaves.at(i);
+		};
+		CPURenderer renderer{read_dag, read_color_node, read_color_leaf};
+		VisiblePageFinder finder{read_dag, read_color_node, read_color_leaf};
+
+		decltype(renderer)::Params params = {
+		    .pos = {0.5f, 0.6f, -0.8f},
+		    .look = {0, 0, 1},
+		    .side = {0.6f, 0, 0},
+		    .up = {0, 0.5f, 0},
+		    .width = 67,
+		    .height = 45,
+		    .voxel_level = pool.GetConfig().GetVoxelLevel(),
+		    .dag_root = *root,
+		    .dag_leaf_level = pool.GetConfig().GetLeafLevel(),
+		    .color_root = color_root,
+		    .color_leaf_level = 2,
+		    .proj_factor = 45.0f,
+		    .type = 0,
+		};
+		const auto get_pages = [](const std::vector<VisiblePage> &visible_pages) {
+			std::set<uint32_t> pages;
+			for (const auto &p : visible_pages)
+				pages.insert(p.page);
+			return pages;
+		};
+		const auto is_sorted = [](const std::vector<VisiblePage> &visible_pages) {
+			return std::ranges::is_sorted(visible_pages, {}, &VisiblePage::distance);
+		};
+
+		std::size_t wide_dag_pages = 0;
+		for (uint32_t bits : {0u, 2u, 5u}) {
+			page_bits = {.dag_words = bits + 2u, .color_node_words = bits + 2u, .color_leaf_words = bits + 3u};
+			// Wide view, narrow view of a corner, and a coarse LOD
+			for (uint32_t view = 0; view < 3; ++view) {
+				params.pos = view == 1 ? glm::vec3{0.2f, 0.2f, -0.1f} : glm::vec3{0.5f, 0.6f, -0.8f};
+				params.side = view == 1 ? glm::vec3{0.05f, 0, 0} : glm::vec3{0.6f, 0, 0};
+				params.up = view == 1 ? glm::vec3{0, 0.05f, 0} : glm::vec3{0, 0.5f, 0};
+				params.proj_factor = view == 2 ? 4.0f : 45.0f;
+
+				for (auto &t : touched)
+					t.clear();
+				std::vector<glm::u8vec3> image(params.width * params.height);
+				record = true;
+				renderer.Render(params, image);
+				record = false;
+				const auto &touched_pages = touched;
+
+				VisiblePageSet page_set = finder.Find(params, page_bits);
+				std::array<std::set<uint32_t>, 3> visible = {get_pages(page_set.dag_node_pages),
+				                                             get_pages(page_set.color_node_pages),
+				                                             get_pages(page_set.color_leaf_pages)};
+				for (uint32_t type = 0; type < 3; ++type) {
+					CHECK(std::ranges::includes(visible[type], touched_pages[type]));
+					CHECK((view == 1 || !touched_pages[type].empty()));
+				}
+				CHECK(visible[0].size() == page_set.dag_node_pages.size());
+				CHECK(is_sorted(page_set.dag_node_pages));
+				CHECK(is_sorted(page_set.color_node_pages));
+				CHECK(is_sorted(page_set.color_leaf_pages));
+
+				VisiblePageSet threaded_page_set = finder.ThreadedFind(&busy_pool, params, page_bits);
+				const auto same = [](const std::vector<VisiblePage> &l, const std::vector<VisiblePage> &r) {
+					return std::ranges::equal(l, r, [](const VisiblePage &a, const VisiblePage &b) {
+						return a.page == b.page && a.distance == b.distance;
+					});
+				};
+				CHECK(same(page_set.dag_node_pages, threaded_page_set.dag_node_pages));
+				CHECK(same(page_set.color_node_pages, threaded_page_set.color_node_pages));
+				CHECK(same(page_set.color_leaf_pages, threaded_page_set.color_leaf_pages));
+
+				if (view == 0 && bits == 0)
+					wide_dag_pages = page_set.dag_node_pages.size();
+				if (view != 0 && bits == 0)
+					CHECK(page_set.dag_node_pages.size() < wide_dag_pages);
+			}
+		}
+	}
+}
+
+TEST_SUITE("VBREditor") {
+	TEST_CASE("Test VBREditorWrapper") {
+		using Wrapper = hashdag::VBREditorWrapper<uint32_t, ColorAABBEditor, TestColorOctree>;
+		lf::busy_pool busy_pool(4);
+
+		// Edit(), then ThreadedEdit() forking down to the octree leaf level and below it
+		for (auto [leaf_level, max_task_level] : std::initializer_list<std::pair<uint32_t, std::optional<uint32_t>>>{
+		         {3u, std::nullopt}, {3u, 3u}, {3u, -1u}, {1u, std::nullopt}, {1u, 1u}, {1u, -1u}, {0u, std::nullopt}}) {
+			MurmurNodePool pool(5);
+			uint32_t voxel_level = pool.GetConfig().GetVoxelLevel(), res = pool.GetConfig().GetResolution();
+			TestColorOctree octree(leaf_level, 1u << 16u);
+			std::size_t free_writer_count = Wrapper::WriterPool::GetFreeCount();
+			std::vector<uint8_t> ref_voxels(res * res * res);
+			std::vector<uint32_t> ref_colors(res * res * res);
+
+			hashdag::NodePointer<uint32_t> root{};
+			TestColorOctree::Pointer color_root{};
+			std::mt19937 gen{9};
+			std::uniform_int_distribution<uint32_t> dis{0, res - 1};
+			for (uint32_t i = 0; i < 24; ++i) {
+				glm::u32vec3 a = {dis(gen), dis(gen), dis(gen)}, b = {dis(gen), dis(gen), dis(gen)};
+				glm::u32vec3 aabb_min = glm::min(a, b), aabb_max = glm::max(a, b) + 1u;
+				hashdag::RGB8Color color{uint32_t(gen()) & 0xFFFFFFu};
+				bool paint = i >= 8 && (i & 1u);
+				Wrapper wrapper{
+				    .editor = {.aabb = {.level = voxel_level, .aabb_min = aabb_min, .aabb_max = aabb_max},
+				               .color = color,
+				               .paint = paint},
+				    .p_octree = &octree,
+				    .octree_root = color_root,
+				};
+				const auto on_edit_done = [&](hashdag::NodePointer<uint32_t> root_ptr, auto &&state) {
+					root = root_ptr;
+					color_root = state.octree_node;
+					return root_ptr;
+				};
+				if (max_task_level)
+					pool.ThreadedEdit(&busy_pool, root, wrapper, *max_task_level, on_edit_done);
+				else
+					pool.Edit(root, wrapper, on_edit_done);
+
+				for (uint32_t x = aabb_min.x; x < aabb_max.x; ++x)
+					for (uint32_t y = aabb_min.y; y < aabb_max.y; ++y)
+						for (uint32_t z = aabb_min.z; z < aabb_max.z; ++z) {
+							uint32_t idx = (x * res + y) * res + z;
+							if (paint && !ref_voxels[idx])
+								continue;
+							ref_voxels[idx] = 1;
+							ref_colors[idx] = color.GetData();
+						}
+			}
+
+			CHECK_GT(octree.leaf_count, 0);
+			// Small leaves of few colors are palette leaves, edited through their decoded VBR chunks
+			if (leaf_level > 0)
+				CHECK_GT(octree.palette_leaf_count, 0);
+			// Leaves above level 1 span several macro blocks, small edits leave some of them clean
+			if (leaf_level == 0)
+				CHECK_GT(octree.partial_dirty_count, 0);
+			auto voxels = pool.GetVoxels(root);
+			for (uint32_t x = 0; x < res; ++x)
+				for (uint32_t y = 0; y < res; ++y)
+					for (uint32_t z = 0; z < res; ++z) {
+						uint32_t idx = (x * res + y) * res + z;
+						CHECK_EQ(bool(voxels[idx]), bool(ref_voxels[idx]));
+						if (ref_voxels[idx])
+							CHECK_EQ(hashdag::RGB8Color{octree.GetColor(color_root, voxel_level, {x, y, z}).Get()}.GetData(),
+							         ref_colors[idx]);
+					}
+			// A serial edit holds the leaf writer and at most 8 segments for each level below, which are reused
+			if (!max_task_level)
+				CHECK_LE(Wrapper::WriterPool::GetFreeCount(),
+				         free_writer_count + 1 + 8 * (pool.GetConfig().GetNodeLevels() - 1 - leaf_level));
+		}
+	}
+	TEST_CASE("Test VBRRecompressor") {
+		using Wrapper = hashdag::VBREditorWrapper<uint32_t, ColorAABBEditor, TestColorOctree>;
+		constexpr float kMaxError = 3.0f / 255.0f;
+
+		for (uint32_t leaf_level : {2u, 1u, 0u}) {
+			MurmurNodePool pool(5);
+			uint32_t voxel_level = pool.GetConfig().GetVoxelLevel(), res = pool.GetConfig().GetResolution();
+			TestColorOctree octree(leaf_level, 1u << 16u);
+			hashdag::NodePointer<uint32_t> root{};
+			TestColorOctree::Pointer color_root{};
+			const auto edit = [&](glm::u32vec3 aabb_min, glm::u32vec3 aabb_max, hashdag::RGB8Color color) {
+				Wrapper wrapper{
+				    .editor = {.aabb = {.level = voxel_level, .aabb_min = aabb_min, .aabb_max = aabb_max},
+				               .color = color,
+				               .paint = false},
+				    .p_octree = &octree,
+				    .octree_root = color_root,
+				};
+				pool.Edit(root, wrapper, [&](hashdag::NodePointer<uint32_t> root_ptr, auto &&state) {
+					root = root_ptr;
+					color_root = state.octree_node;
+					return root_ptr;
+				});
+			};
+
+			// Boxes of near-equal colors, whose leaves are full of small blocks
+			std::mt19937 gen{11};
+			std::uniform_int_distribution<uint32_t> dis{0, res - 1}, jitter_dis{0, 2};
+			glm::u32vec3 base{};
+			for (uint32_t i = 0; i < 32; ++i) {
+				if (i % 8 == 0)
+					base = {gen() % 250, gen() % 250, gen() % 250};
+				glm::u32vec3 a = {dis(gen), dis(gen), dis(gen)}, b = {dis(gen), dis(gen), dis(gen)},
+				             c = base + glm::u32vec3{jitter_dis(gen), jitter_dis(gen), jitter_dis(gen)};
+				edit(glm::min(a, b), glm::max(a, b) + 1u, hashdag::RGB8Color{c.r | (c.g << 8u) | (c.b << 16u)});
+			}
+
+			auto voxels = pool.GetVoxels(root);
+			std::vector<glm::vec3> ref_colors(res * res * res);
+			for (uint32_t x = 0; x < res; ++x)
+				for (uint32_t y = 0; y < res; ++y)
+					for (uint32_t z = 0; z < res; ++z)
+						ref_colors[(x * res + y) * res + z] = octree.GetColor(color_root, voxel_level, {x, y, z}).Get();
+
+			// One fragmented macro block for each step, with an edit in between
+			hashdag::VBRRecompressor<uint32_t, TestColorOctree> recompressor(&octree, voxel_level, kMaxError);
+			uint32_t step_count = 0;
+			while (!recompressor.IsDone()) {
+				color_root = recompressor.Step(color_root, std::chrono::seconds(0));
+				if (++step_count == 2) {
+					glm::u32vec3 aabb_min{res / 4}, aabb_max{res / 2};
+					edit(aabb_min, aabb_max, hashdag::RGB8Color{0x123456u});
+					for (uint32_t x = aabb_min.x; x < aabb_max.x; ++x)
+						for (uint32_t y = aabb_min.y; y < aabb_max.y; ++y)
+							for (uint32_t z = aabb_min.z; z < aabb_max.z; ++z)
+								ref_colors[(x * res + y) * res + z] = hashdag::RGB8Color{0x123456u}.Get();
+				}
+			}
+			const auto &stats = recompressor.GetStats();
+			CHECK_LE(stats.leaf_count, step_count);
+			CHECK_LE(stats.recompressed_macro_block_count, step_count);
+			CHECK_GT(stats.recompressed_leaf_count, 0);
+			CHECK_GT(stats.GetSavedHeaderCount(), 0);
+			CHECK_GT(stats.GetSavedBytes(), 0);
+			if (leaf_level > 0)
+				CHECK_GT(step_count, 2);
+			else // The root leaf is split across steps at its macro blocks
+				CHECK_GT(step_count, stats.leaf_count);
+
+			voxels = pool.GetVoxels(root);
+			for (uint32_t x = 0; x < res; ++x)
+				for (uint32_t y = 0; y < res; ++y)
+					for (uint32_t z = 0; z < res; ++z) {
+						uint32_t idx = (x * res + y) * res + z;
+						if (!voxels[idx])
+							continue;
+						glm::vec3 d = glm::abs(octree.GetColor(color_root, voxel_level, {x, y, z}).Get() - ref_colors[idx]);
+						CHECK_LE(glm::max(glm::max(d.r, d.g), d.b), kMaxError + 1e-6f);
+					}
+
+			// Another pass finds less to merge
+			auto saved_header_count = stats.GetSavedHeaderCount();
+			std::size_t pass_leaf_count = stats.leaf_count;
+			recompressor.Restart();
+			while (!recompressor.IsDone())
+				color_root = recompressor.Step(color_root, std::chrono::seconds(1));
+			CHECK_LT(stats.GetSavedHeaderCount() - saved_header_count, saved_header_count);
+			pass_leaf_count = stats.leaf_count - pass_leaf_count;
+
+			// After an edit, only the leaves in the Morton range of its region are visited
+			glm::u32vec3 aabb_min{res / 8}, aabb_max{res / 8 + 8};
+			edit(aabb_min, aabb_max, hashdag::RGB8Color{0x123457u});
+			std::size_t leaf_count = stats.leaf_count;
+			recompressor.Restart(aabb_min, aabb_max - 1u);
+			while (!recompressor.IsDone())
+				color_root = recompressor.Step(color_root, std::chrono::seconds(1));
+			CHECK_GT(stats.leaf_count, leaf_count);
+			if (leaf_level > 0)
+				CHECK_LT(stats.leaf_count - leaf_count, pass_leaf_count);
+			glm::vec3 d = glm::abs(octree.GetColor(color_root, voxel_level, aabb_min).Get() -
+			                       hashdag::RGB8Color{0x123457u}.Get());
+			CHECK_LE(glm::max(glm::max(d.r, d.g), d.b), kMaxError + 1e-6f);
+		}
+	}
+}
+
+TEST_SUITE("ColorOctree") {
+	using LeafWriter = hashdag::VBRChunkWriter<uint32_t, ColorOctree::SafeLeafSpan>;
+	using WordRanges = std::map<uint32_t, std::pair<uint32_t, uint32_t>>;
+
+	// Page ranges that FlushWrites() reports for the written word intervals [first, last)
+	const auto get_page_ranges = [](std::initializer_list<std::pair<uint32_t, uint32_t>> intervals, uint32_t page_bits) {
+		WordRanges ranges;
+		for (auto [first, last] : intervals)
+			for (uint32_t idx = first; idx < last; idx = ((idx >> page_bits) + 1u) << page_bits) {
+				uint32_t page_id = idx >> page_bits, page_end = std::min(last, (page_id + 1u) << page_bits);
+				std::pair range{idx & ((1u << page_bits) - 1u), page_end - (page_id << page_bits)};
+				auto [it, inserted] = ranges.try_emplace(page_id, range);
+				if (!inserted)
+					it->second = {std::min(it->second.first, range.first), std::max(it->second.second, range.second)};
+			}
+		return ranges;
+	};
+	const auto flush_leaf_ranges = [](ColorOctree &octree) {
+		WordRanges ranges;
+		octree.FlushWrites([](auto &&...) {},
+		                   [&](uint32_t page_id, uint32_t page_offset, std::span<const uint32_t> words) {
+			                   CHECK(ranges.try_emplace(page_id, page_offset, page_offset + words.size()).second);
+		                   });
+		return ranges;
+	};
+
+	TEST_CASE("Test SetLeaf() with dirty macro blocks") {
+		// The root is a leaf of 16 macro blocks, runs of 1024 voxels of distinct weighted colors
+		constexpr uint32_t kPageBits = 8, kRunVoxels = 1024, kRunCount = 256;
+		ColorOctree octree({.voxel_level = 6,
+		                    .leaf_level = 0,
+		                    .word_bits_per_node_page = kPageBits,
+		                    .word_bits_per_leaf_page = kPageBits,
+		                    .keep_history = false},
+		                   1u << 12u, 1u << 12u);
+		const auto get_run_color = [](uint32_t run) {
+			return hashdag::VBRColor{hashdag::R5G6B5Color(uint16_t(run * 97u)),
+			                         hashdag::R5G6B5Color(uint16_t(run * 89u + 1u)), uint8_t(run & 3u), 2};
+		};
+		LeafWriter writer;
+		for (uint32_t run = 0; run < kRunCount; ++run)
+			writer.Push(get_run_color(run), kRunVoxels);
+		ColorOctree::Pointer ptr = octree.SetLeaf({}, writer.Flush());
+		REQUIRE(ptr.GetTag() == ColorOctree::Pointer::Tag::kLeaf);
+		flush_leaf_ranges(octree);
+
+		// Words of the leaf at ptr: [block size][sizes][macro blocks][block headers][weight words]
+		const auto get_layout = [&](ColorOctree::Pointer leaf_ptr) {
+			auto leaf = octree.GetLeaf(leaf_ptr);
+			uint32_t macro_idx = leaf_ptr.GetData() + 4u, block_idx = macro_idx + 2u * leaf.GetMacroBlocks().size(),
+			         weight_idx = block_idx + 2u * leaf.GetBlockHeaders().size(),
+			         end = weight_idx + leaf.GetWeightBits().GetWords().size();
+			return std::array{macro_idx, block_idx, weight_idx, end};
+		};
+		// Sets voxel_count voxels from first_voxel to color, returns the edited leaf
+		std::vector<hashdag::VBRColor> ref_colors(kRunCount);
+		for (uint32_t run = 0; run < kRunCount; ++run)
+			ref_colors[run] = get_run_color(run);
+		const auto edit = [&](uint32_t first_voxel, uint32_t voxel_count, hashdag::VBRColor color) {
+			LeafWriter edit_writer{octree.GetLeaf(ptr)};
+			edit_writer.Copy(first_voxel, {});
+			edit_writer.Push(color, voxel_count);
+			edit_writer.Copy(kRunCount * kRunVoxels - edit_writer.GetVoxelCount(), {});
+			auto dirty_macro_blocks = edit_writer.GetDirtyMacroBlocks();
+			CHECK_EQ(dirty_macro_blocks.size(), 1);
+			ptr = octree.SetLeaf(ptr, edit_writer.Flush(), dirty_macro_blocks);
+		};
+		const auto check_colors = [&] {
+			auto leaf = octree.GetLeaf(ptr);
+			for (uint32_t run = 0; run < kRunCount; ++run)
+				CHECK_EQ(leaf.GetColor(run * kRunVoxels + 7u), ref_colors[run]);
+		};
+
+		// Same block layout: only the block headers and the weight words of the dirty macro block are written
+		ColorOctree::Pointer src_ptr = ptr;
+		ref_colors[37] = get_run_color(1000);
+		edit(37 * kRunVoxels, kRunVoxels, ref_colors[37]);
+		CHECK_EQ(ptr, src_ptr);
+		{
+			auto [macro_idx, block_idx, weight_idx, end] = get_layout(ptr);
+			CHECK_EQ(flush_leaf_ranges(octree), get_page_ranges({{block_idx + 2u * 32u, block_idx + 2u * 48u},
+			                                                     {weight_idx + 2048u, weight_idx + 3072u}},
+			                                                    kPageBits));
+		}
+		check_colors();
+
+		// Runs 36 and 37 merge into one block: the macro blocks after the dirty one, the block headers from the dirty
+		// one and all the weight words move
+		ref_colors[37] = ref_colors[36];
+		edit(37 * kRunVoxels, kRunVoxels, ref_colors[37]);
+		CHECK_EQ(ptr, src_ptr);
+		{
+			auto [macro_idx, block_idx, weight_idx, end] = get_layout(ptr);
+			CHECK_EQ(octree.GetLeaf(ptr).GetBlockHeaders().size(), kRunCount - 1u);
+			CHECK_EQ(flush_leaf_ranges(octree), get_page_ranges({{ptr.GetData() + 1u, ptr.GetData() + 4u},
+			                                                     {macro_idx + 2u * 3u, block_idx},
+			                                                     {block_idx + 2u * 32u, end}},
+			                                                    kPageBits));
+		}
+		check_colors();
+		CHECK_EQ(octree.GetFreeLeafWordCount(), 0);
+
+		// Splitting a run in three grows the leaf out of its block, it moves to a new block of twice the size
+		edit(200 * kRunVoxels + 256u, 256u, get_run_color(2000));
+		CHECK_NE(ptr, src_ptr);
+		{
+			auto [macro_idx, block_idx, weight_idx, end] = get_layout(ptr);
+			CHECK_EQ(octree.ReadLeafWord(ptr.GetData()), 2u * octree.ReadLeafWord(src_ptr.GetData()));
+			CHECK_EQ(flush_leaf_ranges(octree), get_page_ranges({{ptr.GetData(), end}}, kPageBits));
+		}
+		CHECK_EQ(octree.GetFreeLeafWordCount(), octree.ReadLeafWord(src_ptr.GetData()));
+		CHECK_EQ(octree.GetLeaf(ptr).GetColor(200 * kRunVoxels + 300u), get_run_color(2000));
+		check_colors();
+	}
+	TEST_CASE("Test SetNode() and GetChild()") {
+		ColorOctree octree({.voxel_level = 3,
+		                    .leaf_level = 1,
+		                    .word_bits_per_node_page = 8,
+		                    .word_bits_per_leaf_page = 8,
+		                    .keep_history = false},
+		                   1u << 8u, 1u << 8u);
+		using Pointer = ColorOctree::Pointer;
+		const auto color_ptr = [&](uint32_t rgb) {
+			return octree.FillNode({}, hashdag::VBRColor{hashdag::RGB8Color{rgb}});
+		};
+		LeafWriter writer;
+		for (uint32_t run = 0; run < 8; ++run)
+			writer.Push(hashdag::VBRColor{hashdag::R5G6B5Color(uint16_t(run * 97u)),
+			                              hashdag::R5G6B5Color(uint16_t(run * 89u + 1u)), uint8_t(run & 3u), 2},
+			            8);
+		Pointer leaf = octree.SetLeaf({}, writer.Flush());
+		REQUIRE(leaf.GetTag() == Pointer::Tag::kLeaf);
+
+		// Sets a node of child_ptrs, checks its children and its words: the header, the fill and the stored children
+		const auto check_node = [&](std::array<Pointer, 8> child_ptrs) {
+			std::size_t word_count = octree.GetNodeWordCount();
+			Pointer node = octree.SetNode({}, child_ptrs);
+			REQUIRE(node.GetTag() == Pointer::Tag::kNode);
+			for (uint32_t i = 0; i < 8; ++i)
+				CHECK_EQ(octree.GetChild(node, i), child_ptrs[i]);
+			// The fill is a color of at least 2 children and more than the null ones
+			uint32_t null_count = std::ranges::count(child_ptrs, Pointer{}), fill_count = 0;
+			for (Pointer p : child_ptrs)
+				if (p.GetTag() == Pointer::Tag::kColor)
+					fill_count = std::max(fill_count, (uint32_t)std::ranges::count(child_ptrs, p));
+			bool has_fill = fill_count >= 2 && fill_count > null_count;
+			CHECK_EQ(octree.GetNodeWordCount() - word_count, 1u + has_fill + 8u - (has_fill ? fill_count : null_count));
+			return node;
+		};
+
+		// All null or all of one color are not nodes
+		std::array<Pointer, 8> child_ptrs{};
+		CHECK_EQ(octree.SetNode({}, child_ptrs), Pointer{});
+		std::ranges::fill(child_ptrs, color_ptr(0x123456u));
+		Pointer fill = octree.SetNode({}, child_ptrs);
+		CHECK_EQ(fill, color_ptr(0x123456u));
+		for (uint32_t i = 0; i < 8; ++i)
+			CHECK_EQ(octree.GetChild(fill, i), fill);
+		CHECK_EQ(octree.GetNodeWordCount(), 0);
+
+		// One null child, the other children are the fill
+		child_ptrs[5] = {};
+		check_node(child_ptrs);
+		// Nulls outnumber the color, no fill
+		check_node({color_ptr(1u), {}, {}, color_ptr(1u), {}, leaf, {}, color_ptr(2u)});
+		// A fill, with null children stored
+		Pointer mixed =
+		    check_node({color_ptr(1u), color_ptr(1u), {}, leaf, color_ptr(1u), {}, color_ptr(2u), color_ptr(1u)});
+		// A single leaf, and random children
+		check_node({Pointer{}, {}, {}, {}, {}, {}, leaf, {}});
+		std::array<Pointer, 6> choices = {Pointer{}, color_ptr(1u), color_ptr(2u), color_ptr(3u), leaf, mixed};
+		std::mt19937 gen{0};
+		for (uint32_t i = 0; i < 64; ++i) {
+			for (auto &p : child_ptrs)
+				p = choices[gen() % choices.size()];
+			if (std::ranges::count(child_ptrs, child_ptrs[0]) < 8)
+				check_node(child_ptrs);
+		}
+	}
+	TEST_CASE("Test node mips") {
+		// Four levels of nodes over leaves of 8 voxels, colors and nulls
+		constexpr uint32_t kVoxelLevel = 5, kLeafLevel = 4;
+		ColorOctree octree({.voxel_level = kVoxelLevel,
+		                    .leaf_level = kLeafLevel,
+		                    .word_bits_per_node_page = 10,
+		                    .word_bits_per_leaf_page = 12,
+		                    .keep_history = false},
+		                   1u << 8u, 1u << 8u);
+		using Pointer = ColorOctree::Pointer;
+		std::mt19937 gen{0};
+		// Returns the pointer and the mean color of a cell, checks the mips of the nodes
+		uint32_t node_count = 0;
+		const auto build = [&](auto &&self, uint32_t level) -> std::pair<Pointer, glm::dvec3> {
+			if (level == kLeafLevel) {
+				switch (gen() % 4u) {
+				case 0:
+					return {};
+				case 1: {
+					hashdag::RGB8Color color{uint32_t(gen()) & 0xFFFFFFu};
+					return {octree.FillNode({}, hashdag::VBRColor{color}), glm::dvec3{color.Get()}};
+				}
+				default: {
+					LeafWriter writer;
+					for (uint32_t i = 0; i < 8; ++i)
+						writer.Push(hashdag::VBRColor{hashdag::R5G6B5Color(uint16_t(gen())),
+						                              hashdag::R5G6B5Color(uint16_t(gen())), uint8_t(gen() & 3u), 2},
+						            1);
+					Pointer leaf = octree.SetLeaf({}, writer.Flush());
+					return {leaf, octree.GetLeaf(leaf).GetColorSum(8) / 8.0};
+				}
+				}
+			}
+			std::array<Pointer, 8> child_ptrs;
+			glm::dvec3 sum{0};
+			uint32_t count = 0;
+			for (uint32_t i = 0; i < 8; ++i) {
+				auto [child_ptr, mean] = self(self, level + 1);
+				child_ptrs[i] = child_ptr;
+				if (child_ptr.GetTag() != Pointer::Tag::kNull)
+					sum += mean, ++count;
+			}
+			Pointer node = octree.SetNode({}, child_ptrs);
+			REQUIRE(node.GetTag() == Pointer::Tag::kNode);
+			// The mip of the node, fetched as the root at the coarsest LOD, is the mean of its non-null children
+			// rounded to R5G6B5
+			octree.SetRoot(node);
+			glm::dvec3 mean = sum / double(count),
+			           d = glm::abs(glm::dvec3{octree.Fetch(glm::u32vec3{0}, 1u << kVoxelLevel)} - mean) *
+			               glm::dvec3{31, 63, 31};
+			CHECK_LE(glm::max(glm::max(d.r, d.g), d.b), 0.5 + 1e-5);
+			++node_count;
+			return {node, mean};
+		};
+		build(build, 0);
+		CHECK_EQ(node_count, 1 + 8 + 64 + 512);
+	}
+	TEST_CASE("Test Fetch()") {
+		// Three levels of nodes over leaves of 4x4x4 voxels (VBR and palette), colors and nulls
+		constexpr uint32_t kVoxelLevel = 5, kLeafLevel = 3, kLeafVoxels = 64;
+		ColorOctree octree({.voxel_level = kVoxelLevel,
+		                    .leaf_level = kLeafLevel,
+		                    .word_bits_per_node_page = 8,
+		                    .word_bits_per_leaf_page = 10,
+		                    .keep_history = false},
+		                   1u << 8u, 1u << 8u);
+		using Pointer = ColorOctree::Pointer;
+		using Chunk = hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer>;
+		std::mt19937 gen{0};
+		// Cells at the leaf level by Morton index, and the source chunks of the leaves
+		std::vector<Pointer> cells(1u << (3u * kLeafLevel));
+		std::unordered_map<uint32_t, Chunk> leaf_chunks;
+		const auto build = [&](auto &&self, uint32_t level, uint32_t cell_id) -> Pointer {
+			if (level == kLeafLevel) {
+				switch (gen() % 4u) {
+				case 0:
+					return cells[cell_id] = Pointer{};
+				case 1:
+					return cells[cell_id] =
+					           octree.FillNode({}, hashdag::VBRColor{hashdag::RGB8Color{uint32_t(gen()) & 0xFFFFFFu}});
+				default: {
+					bool flat = gen() & 1u;
+					LeafWriter writer;
+					for (uint32_t i = 0; i < kLeafVoxels; i += 4u)
+						writer.Push(flat ? hashdag::VBRColor{hashdag::RGB8Color{(gen() & 1u) ? 0xFF8000u : 0x0080FFu}}
+						                 : hashdag::VBRColor{hashdag::R5G6B5Color(uint16_t(gen())),
+						                                     hashdag::R5G6B5Color(uint16_t(gen())), uint8_t(gen() & 3u),
+						                                     2},
+						            4);
+					Chunk chunk = writer.Flush(), source_chunk = chunk;
+					Pointer leaf = octree.SetLeaf({}, std::move(chunk));
+					REQUIRE(leaf.GetTag() == Pointer::Tag::kLeaf);
+					leaf_chunks.emplace(leaf.GetData(), std::move(source_chunk));
+					return cells[cell_id] = leaf;
+				}
+				}
+			}
+			std::array<Pointer, 8> child_ptrs;
+			for (uint32_t i = 0; i < 8; ++i)
+				child_ptrs[i] = self(self, level + 1, cell_id << 3u | i);
+			return octree.SetNode({}, child_ptrs);
+		};
+		octree.SetRoot(build(build, 0, 0));
+		REQUIRE(octree.GetRoot().GetTag() == Pointer::Tag::kNode);
+		CHECK_GT(leaf_chunks.size(), 0);
+
+		CPURenderer renderer{[](uint32_t) { return 0u; }, [&](uint32_t idx) { return octree.ReadNodeWord(idx); },
+		                     [&](uint32_t idx) { return octree.ReadLeafWord(idx); }};
+		constexpr uint32_t kResolution = 1u << kVoxelLevel;
+		std::vector<uint64_t> morton_indices;
+		std::vector<glm::u32vec3> positions;
+		for (uint32_t z = 0; z < kResolution; ++z)
+			for (uint32_t y = 0; y < kResolution; ++y)
+				for (uint32_t x = 0; x < kResolution; ++x)
+					morton_indices.push_back(hashdag::GetMortonIndex({x, y, z}));
+		std::ranges::sort(morton_indices);
+		for (uint64_t morton_index : morton_indices) {
+			glm::u32vec3 pos{0};
+			for (uint32_t b = 0; b < kVoxelLevel; ++b)
+				pos |= glm::u32vec3{(morton_index >> (3u * b)) & 1u, (morton_index >> (3u * b + 1u)) & 1u,
+				                    (morton_index >> (3u * b + 2u)) & 1u}
+				       << b;
+			positions.push_back(pos);
+		}
+
+		// Voxels against the source chunks
+		for (std::size_t i = 0; i < morton_indices.size(); ++i) {
+			Pointer cell = cells[morton_indices[i] / kLeafVoxels];
+			hashdag::RGBColor ref_color{0};
+			if (cell.GetTag() == Pointer::Tag::kColor)
+				ref_color = hashdag::RGB8Color{cell.GetData()}.Get();
+			else if (cell.GetTag() == Pointer::Tag::kLeaf)
+				ref_color = leaf_chunks.at(cell.GetData()).GetColor(morton_indices[i] % kLeafVoxels).Get();
+			CHECK(glm::all(glm::epsilonEqual(octree.Fetch(positions[i]), ref_color, 1e-6f)));
+		}
+		// Every LOD against CPURenderer::ColorFetch() and the batch Fetch()
+		std::vector<hashdag::RGBColor> colors(morton_indices.size());
+		for (uint32_t voxel_size = 1; voxel_size <= kResolution; voxel_size <<= 1u) {
+			CAPTURE(voxel_size);
+			octree.Fetch(morton_indices, colors, voxel_size);
+			for (std::size_t i = 0; i < morton_indices.size(); ++i) {
+				hashdag::RGBColor color = octree.Fetch(positions[i], voxel_size);
+				CHECK_EQ(renderer.ColorFetch(octree.GetRoot().pointer, kVoxelLevel, kLeafLevel, positions[i], voxel_size),
+				         color);
+				CHECK(glm::all(glm::epsilonEqual(colors[i], color, 1e-6f)));
+			}
+		}
+	}
+	TEST_CASE("Test SetNode() and SetLeaf() with dedup") {
+		// Leaves of 64 voxels
+		ColorOctree octree({.voxel_level = 3,
+		                    .leaf_level = 1,
+		                    .word_bits_per_node_page = 8,
+		                    .word_bits_per_leaf_page = 8,
+		                    .keep_history = false,
+		                    .dedup = true},
+		                   1u << 8u, 1u << 8u);
+		using Tag = ColorOctree::Pointer::Tag;
+		// Runs of weighted colors are kept as a VBR leaf, runs of two flat colors become a palette leaf
+		const auto get_chunk = [](uint32_t seed, bool flat) {
+			LeafWriter writer;
+			for (uint32_t run = 0; run < 8; ++run)
+				writer.Push(flat ? hashdag::VBRColor{hashdag::RGB8Color{(run & 1u) ? seed : 0x00FF00u}}
+				                 : hashdag::VBRColor{hashdag::R5G6B5Color(uint16_t(seed + run * 97u)),
+				                                     hashdag::R5G6B5Color(uint16_t(run * 89u + 1u)), uint8_t(run & 3u), 2},
+				            8);
+			return writer.Flush();
+		};
+
+		// Equal leaves share one address
+		std::array<ColorOctree::Pointer, 2> leaves;
+		for (bool flat : {false, true}) {
+			CAPTURE(flat);
+			auto stats = octree.GetDedupStats();
+			std::size_t leaf_word_count = octree.GetLeafWordCount();
+			ColorOctree::Pointer a = octree.SetLeaf({}, get_chunk(0x123456u, flat)),
+			                     b = octree.SetLeaf({}, get_chunk(0x123456u, flat)),
+			                     c = octree.SetLeaf({}, get_chunk(0x654321u, flat));
+			REQUIRE(a.GetTag() == Tag::kLeaf);
+			REQUIRE(c.GetTag() == Tag::kLeaf);
+			// The first word after the block size tells palette leaves
+			CHECK_EQ(octree.ReadLeafWord(a.GetData() + 1u) >> 31u, flat);
+			CHECK_EQ(a, b);
+			CHECK_NE(a, c);
+			CHECK_EQ(octree.GetDedupStats().leaf_count, stats.leaf_count + 1);
+			CHECK_EQ(octree.GetLeafWordCount() - leaf_word_count,
+			         octree.ReadLeafWord(a.GetData()) + octree.ReadLeafWord(c.GetData()));
+			leaves[flat] = a;
+		}
+
+		// Equal nodes share one address, a node edited into the content of another one as well
+		std::array<ColorOctree::Pointer, 8> children{};
+		children[0] = leaves[0];
+		children[3] = octree.FillNode({}, hashdag::VBRColor{hashdag::RGB8Color{0x123456u}});
+		children[5] = leaves[1];
+		auto stats = octree.GetDedupStats();
+		ColorOctree::Pointer node = octree.SetNode({}, children);
+		REQUIRE(node.GetTag() == Tag::kNode);
+		std::size_t node_word_count = octree.GetNodeWordCount();
+		CHECK_EQ(octree.SetNode({}, children), node);
+		CHECK_EQ(octree.GetNodeWordCount(), node_word_count);
+		auto other_children = children;
+		other_children[5] = {};
+		ColorOctree::Pointer other_node = octree.SetNode({}, other_children);
+		CHECK_NE(other_node, node);
+		CHECK_EQ(octree.SetNode(other_node, children), node);
+		CHECK_EQ(octree.GetDedupStats().node_count, stats.node_count + 2);
+
+		// A shared leaf is not rewritten in place even if the edit fits in its block, nor freed when it is replaced,
+		// other parents still see its old colors
+		ColorOctree::Pointer src_ptr = leaves[0];
+		auto src_color = octree.GetLeaf(src_ptr).GetColor(12);
+		hashdag::VBRColor color{hashdag::RGB8Color{0xFF00FFu}};
+		LeafWriter edit_writer{octree.GetLeaf(src_ptr)};
+		edit_writer.Copy(8, {});
+		edit_writer.Push(color, 8);
+		edit_writer.Copy(64 - edit_writer.GetVoxelCount(), {});
+		auto dirty_macro_blocks = edit_writer.GetDirtyMacroBlocks();
+		REQUIRE_FALSE(dirty_macro_blocks.empty());
+		ColorOctree::Pointer ptr = octree.SetLeaf(src_ptr, edit_writer.Flush(), dirty_macro_blocks);
+		CHECK_NE(ptr, src_ptr);
+		CHECK_EQ(octree.GetLeaf(ptr).GetColor(12), color);
+		CHECK_EQ(octree.GetLeaf(src_ptr).GetColor(12), src_color);
+		CHECK_EQ(octree.GetChild(node, 0), src_ptr);
+
+		children[0] = ptr;
+		ColorOctree::Pointer new_node = octree.SetNode(node, children);
+		CHECK_NE(new_node, node);
+		CHECK_EQ(octree.GetChild(new_node, 0), ptr);
+		CHECK_EQ(octree.GetChild(node, 0), src_ptr);
+		octree.ClearNode(node);
+		octree.FillNode(leaves[1], color);
+		CHECK_EQ(octree.GetFreeLeafWordCount(), 0);
+		CHECK_EQ(octree.GetLeaf(src_ptr).GetColor(12), src_color);
+	}
+	TEST_CASE("Test leaf words over a long paint session") {
+		// Leaves of 4096 voxels grow, shrink and are cleared randomly, so that their blocks move, are freed and reused
+		constexpr uint32_t kLeafCount = 64, kEditCount = 20000, kLeafVoxels = 4096;
+		ColorOctree octree({.voxel_level = 6,
+		                    .leaf_level = 2,
+		                    .word_bits_per_node_page = 8,
+		                    .word_bits_per_leaf_page = 12,
+		                    .keep_history = false},
+		                   1u << 8u, 1u << 12u);
+		std::vector<ColorOctree::Pointer> leaves(kLeafCount);
+		std::mt19937 gen{0};
+		std::size_t half_leaf_word_count = 0;
+		for (uint32_t i = 0; i < kEditCount; ++i) {
+			auto &leaf = leaves[gen() % kLeafCount];
+			if (gen() % 8u == 0) {
+				leaf = octree.ClearNode(leaf);
+				continue;
+			}
+			// Runs of weighted colors, or of a few flat colors for palette leaves
+			uint32_t run_count = 1u << (gen() % 10u), run_voxels = kLeafVoxels / run_count;
+			bool flat = gen() % 4u == 0;
+			LeafWriter writer;
+			for (uint32_t run = 0; run < run_count; ++run)
+				writer.Push(flat ? hashdag::VBRColor{hashdag::RGB8Color{(gen() & 1u) ? 0xFF0000u : 0x0000FFu}}
+				                 : hashdag::VBRColor{hashdag::R5G6B5Color(uint16_t(gen())),
+				                                     hashdag::R5G6B5Color(uint16_t(gen())), uint8_t(gen() & 3u), 2},
+				            run_voxels);
+			leaf = octree.SetLeaf(leaf, writer.Flush());
+			REQUIRE(leaf.GetTag() == ColorOctree::Pointer::Tag::kLeaf);
+			if (i % 64u == 0)
+				octree.FlushWrites([](auto &&...) {}, [](auto &&...) {});
+			if (i == kEditCount / 2)
+				half_leaf_word_count = octree.GetLeafWordCount();
+		}
+		// Freed blocks are split and reused instead of appending
+		CHECK_LE(octree.GetLeafWordCount(), half_leaf_word_count + half_leaf_word_count / 8u);
+		// Blocks in use and free blocks make up all the leaf words
+		std::size_t used_word_count = 0;
+		for (auto leaf : leaves)
+			if (leaf.GetTag() == ColorOctree::Pointer::Tag::kLeaf)
+				used_word_count += octree.ReadLeafWord(leaf.GetData());
+		CHECK_EQ(used_word_count + octree.GetFreeLeafWordCount(), octree.GetLeafWordCount());
+	}
+}
+
+TEST_SUITE("FreeBlockList") {
+	TEST_CASE("Test Push() and Pop()") {
+		FreeBlockList<uint32_t> list(2);
+		CHECK_FALSE(list.Pop(2));
+
+		list.Push({.idx = 0, .size = 6});
+		list.Push({.idx = 10, .size = 4});
+		list.Push({.idx = 20, .size = 16});
+		CHECK_EQ(list.GetFreeSize(), 26);
+
+		CHECK_FALSE(list.Pop(32));
+		// Best fits, the rests of 1 are less than the minimum split size
+		auto block = list.Pop(5);
+		REQUIRE(block);
+		CHECK_EQ(block->idx, 0);
+		CHECK_EQ(block->size, 6);
+		block = list.Pop(3);
+		REQUIRE(block);
+		CHECK_EQ(block->idx, 10);
+		CHECK_EQ(block->size, 4);
+		// Split, [27, 36) stays free
+		block = list.Pop(7);
+		REQUIRE(block);
+		CHECK_EQ(block->idx, 20);
+		CHECK_EQ(block->size, 7);
+		CHECK_EQ(list.GetFreeSize(), 9);
+
+		// [20, 27) merges with [27, 36), [14, 20) with [10, 14) and [20, 36)
+		list.Push({.idx = 20, .size = 7});
+		list.Push({.idx = 10, .size = 4});
+		list.Push({.idx = 0, .size = 6});
+		list.Push({.idx = 14, .size = 6});
+		CHECK_EQ(list.GetFreeSize(), 32);
+		block = list.Pop(26);
+		REQUIRE(block);
+		CHECK_EQ(block->idx, 10);
+		CHECK_EQ(block->size, 26);
+		block = list.Pop(1);
+		REQUIRE(block);
+		CHECK_EQ(block->idx, 0);
+		CHECK_EQ(block->size, 1);
+		CHECK_EQ(list.GetFreeSize(), 5);
+		block = list.Pop(5);
+		REQUIRE(block);
+		CHECK_EQ(block->idx, 1);
+		CHECK_EQ(list.GetFreeSize(), 0);
+		CHECK_FALSE(list.Pop(1));
+	}
+	TEST_CASE("Test threaded Push() and Pop()") {
+		FreeBlockList<uint32_t> list;
+		std::atomic_uint32_t top{0};
+		std::mutex mutex;
+		std::vector<FreeBlockList<uint32_t>::Block> used_blocks;
+
+		// Leaves growing by doubling their blocks, the old blocks are freed to be reused by others
+		std::vector<std::thread> threads;
+		for (uint32_t t = 0; t < 4; ++t)
+			threads.emplace_back([&, t]() {
+				std::mt19937 gen{t};
+				for (uint32_t i = 0; i < 64; ++i) {
+					FreeBlockList<uint32_t>::Block block{.size = 2};
+					block.idx = top.fetch_add(block.size);
+					for (uint32_t j = gen() % 8; j--;) {
+						uint32_t size = 2u << (gen() % 8u);
+						if (size <= block.size)
+							continue;
+						auto opt_block = list.Pop(size);
+						FreeBlockList<uint32_t>::Block new_block =
+						    opt_block ? *opt_block : FreeBlockList<uint32_t>::Block{.idx = top.fetch_add(size), .size = size};
+						CHECK_GE(new_block.size, size);
+						list.Push(block);
+						block = new_block;
+					}
+					std::scoped_lock lock{mutex};
+					used_blocks.push_back(block);
+				}
+			});
+		for (auto &thread : threads)
+			thread.join();
+
+		// Blocks in use and free blocks do not overlap and cover everything allocated
+		for (auto opt_block = list.Pop(1); opt_block; opt_block = list.Pop(1))
+			used_blocks.push_back(*opt_block);
+		std::ranges::sort(used_blocks, {}, &FreeBlockList<uint32_t>::Block::idx);
+		uint32_t end = 0;
+		for (auto block : used_blocks) {
+			CHECK_EQ(block.idx, end);
+			end = block.idx + block.size;
+		}
+		CHECK_EQ(end, top.load());
+	}
+	TEST_CASE("Test long paint session") {
+		FreeBlockList<uint32_t> list;
+		uint32_t top = 0;
+		// Leaves grow and shrink randomly, a leaf moves to a doubled block when it does not fit, as DAGColorPool does
+		std::vector<FreeBlockList<uint32_t>::Block> leaves(256);
+		for (auto &leaf : leaves) {
+			leaf = {.idx = top, .size = 8};
+			top += leaf.size;
+		}
+		std::mt19937 gen{0};
+		uint32_t half_top = 0;
+		for (uint32_t i = 0; i < 100000; ++i) {
+			auto &leaf = leaves[gen() % leaves.size()];
+			uint32_t data_size = 2 + gen() % 512;
+			if (data_size > leaf.size) {
+				uint32_t size = std::max(leaf.size << 1, data_size + (data_size & 1));
+				auto opt_block = list.Pop(size);
+				list.Push(leaf);
+				if (opt_block)
+					leaf = *opt_block;
+				else {
+					leaf = {.idx = top, .size = size};
+					top += size;
+				}
+			}
+			if (i == 50000)
+				half_top = top;
+		}
+		CHECK_LE(top, half_top + half_top / 4);
+		CHECK_EQ(list.GetFreeSize() + std::transform_reduce(leaves.begin(), leaves.end(), 0u, std::plus{},
+		                                                   [](auto leaf) { return leaf.size; }),
+		         top);
 	}
 }
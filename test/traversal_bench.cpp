@@ -0,0 +1,216 @@
+// Rays per second of Traversal(), LODTraversal(), ThreadedTraversal() and CPURenderer
+// Microseconds per Overlap() and SweepAABB() query
+// Usage: TraversalBench [frame.ppm]
+
+#include <hashdag/NodePool.hpp>
+#include <hashdag/NodePoolThreadedEdit.hpp>
+#include <hashdag/NodePoolThreadedTraversal.hpp>
+#include <hashdag/NodePoolTraversal.hpp>
+
+#include <CPURenderer.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+struct SphereEditor {
+	glm::vec3 center;
+	float radius;
+	inline hashdag::EditType EditNode(const hashdag::Config<uint32_t> &config,
+	                                  const hashdag::NodeCoord<uint32_t> &coord, hashdag::NodePointer<uint32_t>) const {
+		auto lb = glm::vec3(coord.GetLowerBoundAtLevel(config.GetVoxelLevel())),
+		     ub = glm::vec3(coord.GetUpperBoundAtLevel(config.GetVoxelLevel()));
+		glm::vec3 d = glm::max(glm::max(lb - center, center - ub), glm::vec3{0});
+		if (glm::dot(d, d) > radius * radius)
+			return hashdag::EditType::kNotAffected;
+		glm::vec3 f = glm::max(glm::abs(lb - center), glm::abs(ub - center));
+		if (glm::dot(f, f) < radius * radius)
+			return hashdag::EditType::kFill;
+		return hashdag::EditType::kProceed;
+	}
+	inline bool EditVoxel(const hashdag::Config<uint32_t> &, const hashdag::NodeCoord<uint32_t> &coord,
+	                      bool voxel) const {
+		glm::vec3 d = glm::vec3(coord.pos) + 0.5f - center;
+		return voxel || glm::dot(d, d) < radius * radius;
+	}
+};
+
+struct BenchNodePool final : public hashdag::NodePoolBase<BenchNodePool, uint32_t>,
+                             public hashdag::NodePoolThreadedEdit<BenchNodePool, uint32_t>,
+                             public hashdag::NodePoolTraversal<BenchNodePool, uint32_t>,
+                             public hashdag::NodePoolThreadedTraversal<BenchNodePool, uint32_t> {
+	using WordSpanHasher = hashdag::MurmurHasher32;
+
+	std::vector<std::unique_ptr<uint32_t[]>> pages;
+	std::vector<uint32_t> bucket_words;
+	std::array<std::mutex, 1024> mutexes{};
+
+	inline explicit BenchNodePool(hashdag::Config<uint32_t> config)
+	    : hashdag::NodePoolBase<BenchNodePool, uint32_t>(std::move(config)) {
+		pages.resize(GetConfig().GetTotalPages());
+		bucket_words.resize(GetConfig().GetTotalBuckets());
+	}
+	inline std::mutex &GetBucketRefMutex(uint32_t bucket_id) { return mutexes[bucket_id % mutexes.size()]; }
+	inline uint32_t &GetBucketRefWords(uint32_t bucket_id) { return bucket_words[bucket_id]; }
+	inline const uint32_t *ReadPage(uint32_t page_id) const { return pages[page_id].get(); }
+	inline uint32_t *upsert_page(uint32_t page_id) {
+		if (!pages[page_id])
+			pages[page_id] = std::make_unique<uint32_t[]>(GetConfig().GetWordsPerPage());
+		return pages[page_id].get();
+	}
+	inline void ZeroPage(uint32_t page_id, uint32_t page_offset, uint32_t zero_words) {
+		std::fill(upsert_page(page_id) + page_offset, upsert_page(page_id) + page_offset + zero_words, 0);
+	}
+	inline void WritePage(uint32_t page_id, uint32_t page_offset, std::span<const uint32_t> word_span) {
+		std::copy(word_span.begin(), word_span.end(), upsert_page(page_id) + page_offset);
+	}
+};
+
+template <typename Func> inline double measure_mrays(uint32_t ray_count, Func &&func) {
+	auto begin = std::chrono::steady_clock::now();
+	func();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	return double(ray_count) / seconds * 1e-6;
+}
+
+int main(int argc, char **argv) {
+	constexpr uint32_t kWidth = 1024, kHeight = 1024, kRayCount = kWidth * kHeight;
+
+	uint32_t worker_count = std::max(std::thread::hardware_concurrency(), 1u);
+	lf::busy_pool busy_pool(worker_count);
+
+	BenchNodePool pool(hashdag::DefaultConfig<uint32_t>{.level_count = 11}());
+	hashdag::NodePointer<uint32_t> root{};
+	{
+		float res = float(pool.GetConfig().GetResolution());
+		std::mt19937 gen{0};
+		std::uniform_real_distribution<float> dis{0.0f, 1.0f};
+		for (uint32_t i = 0; i < 64; ++i)
+			root = pool.ThreadedEdit(
+			    &busy_pool, root,
+			    hashdag::StatelessEditorWrapper<uint32_t, SphereEditor>{
+			        .editor = {.center = glm::vec3{dis(gen), dis(gen), dis(gen)} * res, .radius = dis(gen) * res * 0.1f}});
+	}
+
+	// Pinhole camera inside the unit cube
+	std::vector<glm::vec3> origins(kRayCount, glm::vec3{0.5f, 0.5f, 0.02f}), dirs(kRayCount);
+	for (uint32_t y = 0; y < kHeight; ++y)
+		for (uint32_t x = 0; x < kWidth; ++x) {
+			glm::vec2 c = (glm::vec2{x, y} + 0.5f) / glm::vec2{kWidth, kHeight} * 2.0f - 1.0f;
+			dirs[y * kWidth + x] = glm::normalize(glm::vec3{c.x, c.y, 1.0f});
+		}
+
+	std::vector<uint32_t> hit_masks((kRayCount + 31) / 32);
+	std::vector<glm::vec3> positions(kRayCount);
+	std::vector<uint32_t> iterations(kRayCount);
+
+	uint32_t hits = 0;
+	double scalar_mrays = measure_mrays(kRayCount, [&] {
+		for (uint32_t i = 0; i < kRayCount; ++i)
+			hits += pool.Traversal(root, origins[i], dirs[i]).has_value();
+	});
+	printf("resolution %u^3, %u rays, %u hits\n", pool.GetConfig().GetResolution(), kRayCount, hits);
+	printf("Traversal (1 thread): %.2f Mrays/s\n", scalar_mrays);
+
+	uint64_t full_iterations = 0, lod_iterations = 0;
+	for (uint32_t i = 0; i < kRayCount; i += 16) {
+		const float kInf = std::numeric_limits<float>::infinity();
+		if (auto hit = pool.LODTraversal(root, origins[i], dirs[i], kInf))
+			full_iterations += hit->iterations;
+		if (auto hit = pool.LODTraversal(root, origins[i], dirs[i], float(kHeight) * 0.5f))
+			lod_iterations += hit->iterations;
+	}
+	uint32_t lod_hits = 0;
+	double lod_mrays = measure_mrays(kRayCount, [&] {
+		for (uint32_t i = 0; i < kRayCount; ++i)
+			lod_hits += pool.LODTraversal(root, origins[i], dirs[i], float(kHeight) * 0.5f).has_value();
+	});
+	printf("LODTraversal (1 thread): %.2f Mrays/s, %u hits, %.1f%% iterations of full resolution\n", lod_mrays,
+	       lod_hits, 100.0 * double(lod_iterations) / double(full_iterations));
+
+	// Character-sized collision queries (8 voxels) around the scene
+	{
+		constexpr uint32_t kQueryCount = 100000;
+		float query_size = 8.0f / float(pool.GetConfig().GetResolution());
+		std::mt19937 gen{1};
+		std::uniform_real_distribution<float> dis{0.0f, 1.0f - query_size}, delta_dis{-0.05f, 0.05f};
+		std::vector<hashdag::TraversalAABB<float>> boxes(kQueryCount);
+		std::vector<hashdag::TraversalSphere<float>> spheres(kQueryCount);
+		std::vector<glm::vec3> deltas(kQueryCount);
+		for (uint32_t i = 0; i < kQueryCount; ++i) {
+			glm::vec3 p = {dis(gen), dis(gen), dis(gen)};
+			boxes[i] = {.lower = p, .upper = p + query_size};
+			spheres[i] = {.center = p, .radius = query_size * 0.5f};
+			deltas[i] = {delta_dis(gen), delta_dis(gen), delta_dis(gen)};
+		}
+		const auto measure_us = [&](auto &&func) { return 1.0 / measure_mrays(kQueryCount, func); };
+
+		uint32_t box_hits = 0, sphere_hits = 0, sweep_hits = 0;
+		double box_us = measure_us([&] {
+			for (const auto &box : boxes)
+				box_hits += pool.Overlap(root, box);
+		});
+		double sphere_us = measure_us([&] {
+			for (const auto &sphere : spheres)
+				sphere_hits += pool.Overlap(root, sphere);
+		});
+		std::vector<uint32_t> query_masks((kQueryCount + 31) / 32);
+		double batch_us = measure_us(
+		    [&] { pool.Overlap(root, std::span<const hashdag::TraversalAABB<float>>{boxes}, query_masks); });
+		double sweep_us = measure_us([&] {
+			for (uint32_t i = 0; i < kQueryCount; ++i)
+				sweep_hits += pool.SweepAABB(root, boxes[i], deltas[i]).has_value();
+		});
+		printf("Overlap(aabb) (1 thread): %.3f us/query, %u hits\n", box_us, box_hits);
+		printf("Overlap(sphere) (1 thread): %.3f us/query, %u hits\n", sphere_us, sphere_hits);
+		printf("Overlap(aabbs) batch (1 thread): %.3f us/query\n", batch_us);
+		printf("SweepAABB (1 thread): %.3f us/query, %u hits\n", sweep_us, sweep_hits);
+	}
+
+	{
+		hashdag::TraversalBatch<uint32_t, float> batch = {.origins = origins,
+		                                                  .dirs = dirs,
+		                                                  .hit_masks = hit_masks,
+		                                                  .positions = positions,
+		                                                  .iterations = iterations};
+		double mrays = measure_mrays(kRayCount, [&] { pool.ThreadedTraversal(&busy_pool, root, batch); });
+		printf("ThreadedTraversal (%u threads): %.2f Mrays/s\n", worker_count, mrays);
+	}
+
+	// Same camera with the shading of trace.frag, colored by a single fill color
+	std::vector<uint32_t> color_nodes, color_leaves;
+	CPURenderer cpu_renderer{[&](uint32_t i) {
+		                         return pool.ReadPage(i >> pool.GetConfig().word_bits_per_page)
+		                             [i & (pool.GetConfig().GetWordsPerPage() - 1u)];
+	                         },
+	                         [&](uint32_t i) { return color_nodes[i]; }, [&](uint32_t i) { return color_leaves[i]; }};
+	decltype(cpu_renderer)::Params params = {
+	    .pos = {0.5f, 0.5f, 0.02f},
+	    .look = {0, 0, 1},
+	    .side = {-1, 0, 0},
+	    .up = {0, -1, 0},
+	    .width = kWidth,
+	    .height = kHeight,
+	    .voxel_level = pool.GetConfig().GetVoxelLevel(),
+	    .dag_root = *root,
+	    .dag_leaf_level = pool.GetConfig().GetLeafLevel(),
+	    .color_root = (1u << 30u) | 0xC0E0FFu,
+	    .color_leaf_level = 0,
+	    .proj_factor = float(kHeight) * 0.5f,
+	    .type = 0,
+	};
+	std::vector<glm::u8vec3> image(kRayCount);
+	for (const char *type_name : {"Diffuse", "Normal", "Iteration"}) {
+		double mrays = measure_mrays(kRayCount, [&] { cpu_renderer.ThreadedRender(&busy_pool, params, image); });
+		printf("CPURenderer %s (%u threads): %.2f Mrays/s\n", type_name, worker_count, mrays);
+		if (params.type == 0 && argc > 1 && !WritePPM(argv[1], kWidth, kHeight, image))
+			printf("failed to write %s\n", argv[1]);
+		++params.type;
+	}
+
+	return 0;
+}
@@ -0,0 +1,646 @@
+// GB/s of VBRBitsetWriter::Copy() (aligned and unaligned) and VBRBitsetWriter::Push(word, bits, count)
+// Bits per voxel of VBREncoder against its error budget
+// Bits per voxel and random access of palette leaves against VBR, on runs of a few flat colors
+// Allocations and latency of paint edits through VBREditorWrapper
+// Headers and bytes saved by VBRRecompressor after paint strokes of near-equal colors
+// Memory saved by sharing equal color nodes and leaves, on a scene tiled with a repeated material
+// Memory of ColorOctree nodes with 8 child pointers against a child mask, a shared fill and the other pointers only
+// Usage: VBRBench
+
+#include <hashdag/NodePool.hpp>
+#include <hashdag/NodePoolThreadedEdit.hpp>
+#include <hashdag/PaletteColor.hpp>
+#include <hashdag/VBRColor.hpp>
+#include <hashdag/VBREditor.hpp>
+#include <hashdag/VBREncoder.hpp>
+#include <hashdag/VBRRecompressor.hpp>
+
+#include <ColorOctree.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Counts heap allocations of the whole program
+// Every replaced new takes from malloc() and every replaced delete returns to free(), array forms included
+std::atomic_size_t alloc_count{0};
+inline void *counted_malloc(std::size_t size) {
+	++alloc_count;
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	std::abort();
+}
+void *operator new(std::size_t size) { return counted_malloc(size); }
+void *operator new[](std::size_t size) { return counted_malloc(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+template <typename Func> inline double bench_seconds(Func &&func) {
+	auto begin = std::chrono::steady_clock::now();
+	func();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+template <typename Word> inline void bench_copy(const char *word_name) {
+	// Writers of kWriterBits, about the weight bits of a large color leaf
+	constexpr std::size_t kSrcBits = std::size_t(1) << 26u, kWriterBits = std::size_t(1) << 21u,
+	                      kCopyBits = std::size_t(1) << 14u, kRounds = 512;
+	std::mt19937_64 gen{1};
+	std::vector<Word> src_words(kSrcBits / (sizeof(Word) * 8));
+	for (auto &w : src_words)
+		w = Word(gen());
+	hashdag::VBRBitset<Word, hashdag::VBRWriterContainer> src{std::move(src_words)};
+
+	// Copy runs of kCopyBits from random source positions, aligned: same bit offsets inside a word
+	const auto bench = [&](bool aligned) {
+		std::uniform_int_distribution<std::size_t> dis{0, kSrcBits - kCopyBits - 64};
+		std::size_t copied_bits = 0;
+		double seconds = 0;
+		for (std::size_t r = 0; r < kRounds; ++r) {
+			hashdag::VBRBitsetWriter<Word> writer;
+			writer.Push(1, 1, 5);
+			seconds += bench_seconds([&] {
+				for (std::size_t c = 0; c < kWriterBits / kCopyBits; ++c) {
+					std::size_t src_begin = dis(gen);
+					if (aligned)
+						src_begin = src_begin - (src_begin % (sizeof(Word) * 8)) + writer.GetBitCount() % (sizeof(Word) * 8);
+					std::size_t bits = kCopyBits - (aligned ? 0 : c % 61);
+					writer.Copy(src, src_begin, bits);
+					copied_bits += bits;
+				}
+			});
+			if (writer.Flush().GetWords().empty())
+				printf("empty\n");
+		}
+		return double(copied_bits) / 8.0 / seconds * 1e-9;
+	};
+	printf("Copy<%s> aligned: %.2f GB/s\n", word_name, bench(true));
+	printf("Copy<%s> unaligned: %.2f GB/s\n", word_name, bench(false));
+}
+
+template <typename Word> inline void bench_push(const char *word_name) {
+	constexpr std::size_t kWriterBits = std::size_t(1) << 21u, kRunLength = 4096, kRounds = 512;
+	for (Word bits = 1; bits <= 3; ++bits) {
+		std::size_t pushed_bits = 0;
+		double seconds = 0;
+		for (std::size_t r = 0; r < kRounds; ++r) {
+			hashdag::VBRBitsetWriter<Word> writer;
+			seconds += bench_seconds([&] {
+				for (std::size_t i = 0; writer.GetBitCount() < kWriterBits; ++i)
+					writer.Push(Word(i % (1u << bits)), bits, kRunLength + i % 7);
+			});
+			pushed_bits += writer.GetBitCount();
+		}
+		printf("Push<%s>(%u bits): %.2f GB/s\n", word_name, uint32_t(bits), double(pushed_bits) / 8.0 / seconds * 1e-9);
+	}
+}
+
+// Leaves of 32^3 voxels in Morton order, sampling smooth color fields with noise and hard edges, like a texture
+inline std::vector<std::vector<hashdag::RGBColor>> make_leaf_colors(uint32_t leaf_count) {
+	constexpr uint32_t kLeafBits = 5;
+	std::mt19937 gen{7};
+	std::normal_distribution<float> noise_dis{0.0f, 1.5f / 255.0f};
+	std::vector<std::vector<hashdag::RGBColor>> leaves(leaf_count);
+	for (uint32_t l = 0; l < leaf_count; ++l) {
+		glm::vec3 freq = glm::vec3{gen() % 7 + 1, gen() % 5 + 1, gen() % 3 + 1} / float(1u << kLeafBits);
+		for (uint32_t m = 0; m < (1u << (3 * kLeafBits)); ++m) {
+			glm::u32vec3 p{};
+			for (uint32_t b = 0; b < kLeafBits; ++b)
+				p |= glm::u32vec3{(m >> (3 * b)) & 1u, (m >> (3 * b + 1)) & 1u, (m >> (3 * b + 2)) & 1u} << b;
+			glm::vec3 f = glm::vec3(p) * freq;
+			hashdag::RGBColor c = glm::vec3{0.5f + 0.4f * glm::sin(f.x + f.y), 0.5f + 0.4f * glm::cos(f.y - f.z),
+			                                (p.x + p.z) % 23 < 11 ? 0.2f : 0.7f} +
+			                      noise_dis(gen);
+			leaves[l].push_back(glm::clamp(c, 0.0f, 1.0f));
+		}
+	}
+	return leaves;
+}
+
+inline void bench_encode() {
+	auto leaves = make_leaf_colors(64);
+	std::vector<std::span<const hashdag::RGBColor>> leaf_spans(leaves.begin(), leaves.end());
+	std::size_t voxel_count = leaves.size() * leaves[0].size();
+
+	uint32_t worker_count = std::thread::hardware_concurrency();
+	lf::busy_pool busy_pool(worker_count);
+	for (float max_error : {0.0f, 1.0f / 255.0f, 2.0f / 255.0f, 4.0f / 255.0f, 8.0f / 255.0f, 16.0f / 255.0f}) {
+		hashdag::VBREncoder<uint32_t> encoder{max_error};
+		std::vector<hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer>> chunks(leaves.size());
+		double seconds = bench_seconds([&] { encoder.ThreadedEncode(&busy_pool, leaf_spans, chunks); });
+
+		std::size_t bits = 0, blocks = 0;
+		float error = 0.0f;
+		for (std::size_t l = 0; l < leaves.size(); ++l) {
+			bits += hashdag::GetVBRChunkBits(chunks[l]);
+			blocks += chunks[l].GetBlockHeaders().size();
+			for (uint32_t i = 0; i < leaves[l].size(); ++i) {
+				glm::vec3 d = glm::abs(chunks[l].GetColor(i).Get() - leaves[l][i]);
+				error = glm::max(error, glm::max(glm::max(d.r, d.g), d.b));
+			}
+		}
+		printf("VBREncoder max_error %4.1f/255: %.2f bits/voxel, %.1f voxels/block, measured error %.2f/255, %.2f "
+		       "Mvoxels/s (%u threads)\n",
+		       max_error * 255.0f, double(bits) / double(voxel_count), double(voxel_count) / double(blocks),
+		       error * 255.0f, double(voxel_count) / seconds * 1e-6, worker_count);
+	}
+}
+
+inline void bench_palette() {
+	constexpr uint32_t kVoxelCount = 4u * hashdag::VBRInfo::kVoxelsPerMacroBlock, kLookups = 1u << 22u;
+	std::mt19937 gen{11};
+	for (uint32_t color_count : {2u, 4u, 16u})
+		for (uint32_t max_run : {1u, 8u, 32u}) {
+			std::uniform_int_distribution<uint32_t> run_dis{1, max_run}, color_dis{0, color_count - 1};
+			hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> writer;
+			while (writer.GetVoxelCount() < kVoxelCount)
+				writer.Push(hashdag::RGB8Color{color_dis(gen) * 0x10305u},
+				            std::min(run_dis(gen), kVoxelCount - writer.GetVoxelCount()));
+			auto chunk = writer.Flush();
+			auto opt_palette_chunk = hashdag::EncodePaletteChunk(chunk);
+
+			std::vector<uint32_t> indices(kLookups);
+			std::uniform_int_distribution<uint32_t> voxel_dis{0, kVoxelCount - 1};
+			for (auto &index : indices)
+				index = voxel_dis(gen);
+			uint32_t checksum = 0;
+			const auto bench_lookups = [&](const auto &leaf) {
+				return bench_seconds([&] {
+					       for (uint32_t index : indices)
+						       checksum += leaf.GetColor(index).GetColors();
+				       }) *
+				       1e9 / kLookups;
+			};
+			double vbr_ns = bench_lookups(chunk);
+			std::size_t vbr_bits = (chunk.GetMacroBlocks().size() * sizeof(hashdag::VBRMacroBlock) +
+			                        chunk.GetBlockHeaders().size() * sizeof(hashdag::VBRBlockHeader) +
+			                        chunk.GetWeightBits().GetWords().size() * sizeof(uint32_t)) *
+			                       8u;
+			printf("Palette %2u colors, runs of 1-%2u: VBR %.2f bits/voxel %.1f ns/lookup", color_count, max_run,
+			       double(vbr_bits) / kVoxelCount, vbr_ns);
+			if (opt_palette_chunk) {
+				std::size_t palette_bits =
+				    (opt_palette_chunk->GetColors().size() + opt_palette_chunk->GetIndexBits().GetWords().size()) * 32u;
+				double palette_ns = bench_lookups(*opt_palette_chunk);
+				printf(", palette %.2f bits/voxel %.1f ns/lookup", double(palette_bits) / kVoxelCount, palette_ns);
+			} else
+				printf(", VBR kept");
+			printf(" (checksum %u)\n", checksum);
+		}
+}
+
+struct BenchNodePool final : public hashdag::NodePoolBase<BenchNodePool, uint32_t>,
+                             public hashdag::NodePoolThreadedEdit<BenchNodePool, uint32_t> {
+	using WordSpanHasher = hashdag::MurmurHasher32;
+
+	std::vector<std::unique_ptr<uint32_t[]>> pages;
+	std::vector<uint32_t> bucket_words;
+	std::array<std::mutex, 1024> mutexes{};
+
+	inline explicit BenchNodePool(hashdag::Config<uint32_t> config)
+	    : hashdag::NodePoolBase<BenchNodePool, uint32_t>(std::move(config)) {
+		pages.resize(GetConfig().GetTotalPages());
+		bucket_words.resize(GetConfig().GetTotalBuckets());
+	}
+	inline std::mutex &GetBucketRefMutex(uint32_t bucket_id) { return mutexes[bucket_id % mutexes.size()]; }
+	inline uint32_t &GetBucketRefWords(uint32_t bucket_id) { return bucket_words[bucket_id]; }
+	inline const uint32_t *ReadPage(uint32_t page_id) const { return pages[page_id].get(); }
+	inline uint32_t *upsert_page(uint32_t page_id) {
+		if (!pages[page_id])
+			pages[page_id] = std::make_unique<uint32_t[]>(GetConfig().GetWordsPerPage());
+		return pages[page_id].get();
+	}
+	inline void ZeroPage(uint32_t page_id, uint32_t page_offset, uint32_t zero_words) {
+		std::fill(upsert_page(page_id) + page_offset, upsert_page(page_id) + page_offset + zero_words, 0);
+	}
+	inline void WritePage(uint32_t page_id, uint32_t page_offset, std::span<const uint32_t> word_span) {
+		std::copy(word_span.begin(), word_span.end(), upsert_page(page_id) + page_offset);
+	}
+};
+
+// Color octree writing leaves into one preallocated word array like DAGColorPool, so that it allocates nothing itself
+struct BenchColorOctree {
+	struct Pointer {
+		uint32_t pointer = 3u << 30u;
+		inline uint32_t GetTag() const { return pointer >> 30u; }
+		inline uint32_t GetData() const { return pointer & ((1u << 30u) - 1u); }
+		inline bool operator==(const Pointer &) const = default;
+	};
+	template <typename T> using LeafSpan = std::span<const T>;
+
+	uint32_t leaf_level;
+	std::vector<std::array<Pointer, 8>> nodes;
+	std::vector<uint32_t> leaf_words;
+	std::atomic_uint32_t node_count{0}, leaf_word_count{0}, patch_word_count{0};
+
+	inline BenchColorOctree(uint32_t leaf_level, uint32_t node_capacity, uint32_t leaf_word_capacity)
+	    : leaf_level{leaf_level}, nodes(node_capacity), leaf_words(leaf_word_capacity) {}
+
+	inline Pointer GetChild(Pointer ptr, auto idx) const {
+		return ptr.GetTag() == 0 ? nodes[ptr.GetData()][idx] : (ptr.GetTag() == 1 ? ptr : Pointer{});
+	}
+	inline static hashdag::VBRColor GetFill(Pointer ptr) {
+		return ptr.GetTag() == 1 ? hashdag::VBRColor{ptr.GetData()} : hashdag::VBRColor{};
+	}
+	inline Pointer SetNode(Pointer, std::span<const Pointer, 8> child_ptrs) {
+		uint32_t idx = node_count++;
+		std::ranges::copy(child_ptrs, nodes.at(idx).begin());
+		return Pointer{idx};
+	}
+	inline static Pointer ClearNode(Pointer) { return Pointer{}; }
+	inline static Pointer FillNode(Pointer, hashdag::VBRColor color) {
+		return Pointer{(1u << 30u) | hashdag::RGB8Color{color.Get()}.GetData()};
+	}
+	inline hashdag::VBRChunk<uint32_t, LeafSpan> GetLeaf(Pointer ptr) const {
+		if (ptr.GetTag() != 2)
+			return {};
+		const uint32_t *p = leaf_words.data() + ptr.GetData();
+		const auto *p_macro_blocks = reinterpret_cast<const hashdag::VBRMacroBlock *>(p + 3);
+		const auto *p_block_headers = reinterpret_cast<const hashdag::VBRBlockHeader *>(p_macro_blocks + p[0]);
+		const auto *p_weight_words = reinterpret_cast<const uint32_t *>(p_block_headers + p[1]);
+		return {LeafSpan<hashdag::VBRMacroBlock>{p_macro_blocks, p[0]},
+		        LeafSpan<hashdag::VBRBlockHeader>{p_block_headers, p[1]},
+		        hashdag::VBRBitset<uint32_t, LeafSpan>{LeafSpan<uint32_t>{p_weight_words, p[2]}}};
+	}
+	inline Pointer SetLeaf(Pointer, hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer> &&chunk) {
+		const auto &macro_blocks = chunk.GetMacroBlocks();
+		const auto &block_headers = chunk.GetBlockHeaders();
+		const auto &weight_words = chunk.GetWeightBits().GetWords();
+		uint32_t size = 3 + 2 * (macro_blocks.size() + block_headers.size()) + weight_words.size();
+		uint32_t idx = leaf_word_count.fetch_add(size);
+		if (idx + size > leaf_words.size())
+			std::abort();
+		uint32_t *p = leaf_words.data() + idx;
+		*p++ = macro_blocks.size(), *p++ = block_headers.size(), *p++ = weight_words.size();
+		p = reinterpret_cast<uint32_t *>(std::ranges::copy(macro_blocks, (hashdag::VBRMacroBlock *)p).out);
+		p = reinterpret_cast<uint32_t *>(std::ranges::copy(block_headers, (hashdag::VBRBlockHeader *)p).out);
+		std::ranges::copy(weight_words, p);
+		return Pointer{(2u << 30u) | idx};
+	}
+	// Counts the words DAGColorPool would upload by patching the leaf in place
+	inline Pointer SetLeaf(Pointer ptr, hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer> &&chunk,
+	                       std::span<const uint32_t> dirty_macro_blocks) {
+		const auto &macro_blocks = chunk.GetMacroBlocks();
+		const auto &block_headers = chunk.GetBlockHeaders();
+		const auto &weight_words = chunk.GetWeightBits().GetWords();
+		uint32_t words = 3 + 2 * (macro_blocks.size() + block_headers.size()) + weight_words.size();
+		auto src = GetLeaf(ptr);
+		if (src.GetMacroBlocks().size() == macro_blocks.size() && !dirty_macro_blocks.empty()) {
+			bool same_macro_blocks = std::ranges::equal(src.GetMacroBlocks(), macro_blocks),
+			     same_header_count = src.GetBlockHeaders().size() == block_headers.size();
+			const auto &first_dirty = macro_blocks[dirty_macro_blocks.front()];
+			words = 3 + (same_macro_blocks ? 0 : 2 * (macro_blocks.size() - dirty_macro_blocks.front() - 1));
+			if (same_macro_blocks) {
+				for (uint32_t macro_id : dirty_macro_blocks) {
+					bool is_last = macro_id + 1 == macro_blocks.size();
+					uint32_t last_block = is_last ? block_headers.size() : macro_blocks[macro_id + 1].first_block;
+					uint32_t last_word =
+					    is_last ? weight_words.size() : (macro_blocks[macro_id + 1].weight_start + 31u) / 32u;
+					words += 2 * (last_block - macro_blocks[macro_id].first_block);
+					if (same_header_count)
+						words += last_word - macro_blocks[macro_id].weight_start / 32u;
+				}
+			} else {
+				words += 2 * (block_headers.size() - first_dirty.first_block);
+				if (same_header_count)
+					words += weight_words.size() - first_dirty.weight_start / 32u;
+			}
+			if (!same_header_count)
+				words += weight_words.size();
+		}
+		patch_word_count += words;
+		return SetLeaf(ptr, std::move(chunk));
+	}
+	inline uint32_t GetLeafLevel() const { return leaf_level; }
+};
+
+// Fills a sphere with a color, or paints the existing voxels inside it
+struct PaintSphereEditor {
+	glm::vec3 center;
+	float radius;
+	hashdag::VBRColor color;
+	bool paint;
+	inline hashdag::EditType EditNode(const hashdag::Config<uint32_t> &config,
+	                                  const hashdag::NodeCoord<uint32_t> &coord, hashdag::NodePointer<uint32_t> ptr,
+	                                  hashdag::VBRColor &final_color) const {
+		auto lb = glm::vec3(coord.GetLowerBoundAtLevel(config.GetVoxelLevel())),
+		     ub = glm::vec3(coord.GetUpperBoundAtLevel(config.GetVoxelLevel()));
+		glm::vec3 d = glm::max(glm::max(lb - center, center - ub), glm::vec3{0});
+		glm::vec3 f = glm::max(glm::abs(lb - center), glm::abs(ub - center));
+		auto edit_type = glm::dot(d, d) > radius * radius ? hashdag::EditType::kNotAffected
+		                 : glm::dot(f, f) < radius * radius ? hashdag::EditType::kFill
+		                                                    : hashdag::EditType::kProceed;
+		if (edit_type == hashdag::EditType::kFill) {
+			final_color = color;
+			if (paint)
+				edit_type = hashdag::EditType::kNotAffected;
+		} else if (!ptr || final_color == color)
+			final_color = color;
+		else
+			final_color = {};
+		if (paint && !ptr)
+			edit_type = hashdag::EditType::kNotAffected;
+		return edit_type;
+	}
+	inline bool EditVoxel(const hashdag::Config<uint32_t> &, const hashdag::NodeCoord<uint32_t> &coord, bool voxel,
+	                      hashdag::VBRColor &voxel_color) const {
+		glm::vec3 d = glm::vec3(coord.pos) + 0.5f - center;
+		bool in_range = glm::dot(d, d) < radius * radius;
+		voxel_color = in_range || !voxel ? color : voxel_color;
+		return paint ? voxel : voxel || in_range;
+	}
+};
+
+// Paint edits of the size of a brush, on a scene painted with many smaller spheres
+inline void bench_paint_edit(uint32_t leaf_level) {
+	constexpr uint32_t kNodeLevels = 8, kSceneEdits = 256, kPaintEdits = 256;
+	BenchNodePool pool(hashdag::DefaultConfig<uint32_t>{.level_count = kNodeLevels + 1, .top_level_count = 4}());
+	BenchColorOctree octree(leaf_level, 1u << 22u, 1u << 28u);
+	float res = float(pool.GetConfig().GetResolution());
+
+	uint32_t worker_count = std::thread::hardware_concurrency();
+	lf::busy_pool busy_pool(worker_count);
+	hashdag::NodePointer<uint32_t> root{};
+	BenchColorOctree::Pointer color_root{};
+	std::mt19937 gen{3};
+	std::uniform_real_distribution<float> dis{0.0f, 1.0f};
+
+	// Edit() if max_task_level is std::nullopt
+	const auto edit = [&](const PaintSphereEditor &editor, std::optional<uint32_t> max_task_level) {
+		hashdag::VBREditorWrapper<uint32_t, PaintSphereEditor, BenchColorOctree> wrapper{
+		    .editor = editor, .p_octree = &octree, .octree_root = color_root};
+		const auto on_edit_done = [&](hashdag::NodePointer<uint32_t> root_ptr, auto &&state) {
+			root = root_ptr;
+			color_root = state.octree_node;
+			return root_ptr;
+		};
+		if (max_task_level)
+			pool.ThreadedEdit(&busy_pool, root, wrapper, *max_task_level, on_edit_done);
+		else
+			pool.Edit(root, wrapper, on_edit_done);
+	};
+	const auto random_color = [&] { return hashdag::VBRColor{hashdag::RGB8Color{uint32_t(gen()) & 0xFFFFFFu}}; };
+
+	edit({.center = glm::vec3{res * 0.5f}, .radius = res * 0.45f, .color = random_color(), .paint = false}, -1u);
+	for (uint32_t i = 0; i < kSceneEdits; ++i)
+		edit({.center = glm::vec3{dis(gen), dis(gen), dis(gen)} * res,
+		      .radius = res * 0.02f,
+		      .color = random_color(),
+		      .paint = true},
+		     -1u);
+
+	for (auto [name, max_task_level] : std::initializer_list<std::pair<const char *, std::optional<uint32_t>>>{
+	         {"Edit", std::nullopt}, {"ThreadedEdit to the leaf level", leaf_level}, {"ThreadedEdit", -1u}}) {
+		std::size_t allocs = 0, leaf_words = octree.leaf_word_count, patch_words = octree.patch_word_count;
+		double seconds = 0;
+		for (uint32_t i = 0; i < kPaintEdits; ++i) {
+			PaintSphereEditor editor{.center = glm::vec3{dis(gen), dis(gen), dis(gen)} * res,
+			                         .radius = res * 0.06f,
+			                         .color = random_color(),
+			                         .paint = true};
+			std::size_t begin_allocs = alloc_count;
+			seconds += bench_seconds([&] { edit(editor, max_task_level); });
+			allocs += alloc_count - begin_allocs;
+		}
+		printf("Paint edit (%s, leaf level %u): %.3f ms/edit, %.1f allocations/edit, %.1f KB leaves/edit, "
+		       "%.1f KB patched/edit (%u threads)\n",
+		       name, leaf_level, seconds * 1e3 / kPaintEdits, double(allocs) / kPaintEdits,
+		       double(octree.leaf_word_count - leaf_words) * 4.0 / 1024.0 / kPaintEdits,
+		       double(octree.patch_word_count - patch_words) * 4.0 / 1024.0 / kPaintEdits, worker_count);
+	}
+}
+
+// Paint strokes of a few colors with a jitter of 2/255, then a pass of VBRRecompressor in 1 ms slices
+inline void bench_recompress(uint32_t leaf_level) {
+	constexpr uint32_t kNodeLevels = 8, kPaintEdits = 512;
+	BenchNodePool pool(hashdag::DefaultConfig<uint32_t>{.level_count = kNodeLevels + 1, .top_level_count = 4}());
+	BenchColorOctree octree(leaf_level, 1u << 22u, 1u << 28u);
+	float res = float(pool.GetConfig().GetResolution());
+
+	lf::busy_pool busy_pool(std::thread::hardware_concurrency());
+	hashdag::NodePointer<uint32_t> root{};
+	BenchColorOctree::Pointer color_root{};
+	std::mt19937 gen{5};
+	std::uniform_real_distribution<float> dis{0.0f, 1.0f};
+	std::uniform_int_distribution<uint32_t> jitter_dis{0, 2};
+	const auto edit = [&](const PaintSphereEditor &editor) {
+		hashdag::VBREditorWrapper<uint32_t, PaintSphereEditor, BenchColorOctree> wrapper{
+		    .editor = editor, .p_octree = &octree, .octree_root = color_root};
+		pool.ThreadedEdit(&busy_pool, root, wrapper, -1u, [&](hashdag::NodePointer<uint32_t> root_ptr, auto &&state) {
+			root = root_ptr;
+			color_root = state.octree_node;
+			return root_ptr;
+		});
+	};
+	std::array<uint32_t, 4> bases;
+	for (auto &base : bases)
+		base = uint32_t(gen()) & 0xFCFCFCu;
+	const auto jittered_color = [&] {
+		return hashdag::VBRColor{hashdag::RGB8Color{bases[gen() % bases.size()] + jitter_dis(gen) +
+		                                            (jitter_dis(gen) << 8u) + (jitter_dis(gen) << 16u)}};
+	};
+
+	edit({.center = glm::vec3{res * 0.5f}, .radius = res * 0.45f, .color = jittered_color(), .paint = false});
+	for (uint32_t i = 0; i < kPaintEdits; ++i)
+		edit({.center = glm::vec3{dis(gen), dis(gen), dis(gen)} * res,
+		      .radius = res * 0.04f,
+		      .color = jittered_color(),
+		      .paint = true});
+
+	hashdag::VBRRecompressor<uint32_t, BenchColorOctree> recompressor(&octree, pool.GetConfig().GetVoxelLevel(),
+	                                                                  2.0f / 255.0f);
+	uint32_t step_count = 0;
+	double seconds = 0, max_step_seconds = 0;
+	while (!recompressor.IsDone()) {
+		double step_seconds =
+		    bench_seconds([&] { color_root = recompressor.Step(color_root, std::chrono::milliseconds(1)); });
+		seconds += step_seconds, max_step_seconds = std::max(max_step_seconds, step_seconds);
+		++step_count;
+	}
+	const auto &stats = recompressor.GetStats();
+	printf("Recompress (leaf level %u): %zu of %zu leaves, %zu -> %zu headers, %.1f -> %.1f KB (%.1f KB saved), %.1f "
+	       "ms in %u steps of at most %.2f ms\n",
+	       leaf_level, stats.recompressed_leaf_count, stats.leaf_count, stats.src_header_count, stats.header_count,
+	       double(stats.src_bytes) / 1024.0, double(stats.bytes) / 1024.0, double(stats.GetSavedBytes()) / 1024.0,
+	       seconds * 1e3, step_count, max_step_seconds * 1e3);
+
+	// One more stroke, the pass only goes over the leaves in the Morton range of its region
+	std::size_t pass_leaf_count = stats.leaf_count;
+	PaintSphereEditor stroke{.center = glm::vec3{res * 0.3f}, .radius = res * 0.04f, .color = jittered_color(),
+	                         .paint = true};
+	edit(stroke);
+	recompressor.Restart(glm::u32vec3(glm::max(stroke.center - stroke.radius, 0.0f)),
+	                     glm::u32vec3(glm::min(stroke.center + stroke.radius, res - 1.0f)));
+	step_count = 0, seconds = 0;
+	while (!recompressor.IsDone()) {
+		seconds += bench_seconds([&] { color_root = recompressor.Step(color_root, std::chrono::milliseconds(1)); });
+		++step_count;
+	}
+	printf("Recompress after a stroke (leaf level %u): %zu of %zu leaves visited, %.1f ms in %u steps\n", leaf_level,
+	       stats.leaf_count - pass_leaf_count, pass_leaf_count, seconds * 1e3, step_count);
+}
+
+// Fills a box with a material repeated every 16 voxels, so that leaves and nodes inside the box are equal
+struct TileBoxEditor {
+	glm::u32vec3 aabb_min, aabb_max;
+	std::array<hashdag::VBRColor, 4> colors;
+	inline hashdag::EditType EditNode(const hashdag::Config<uint32_t> &config,
+	                                  const hashdag::NodeCoord<uint32_t> &coord, hashdag::NodePointer<uint32_t>,
+	                                  hashdag::VBRColor &final_color) const {
+		auto lb = coord.GetLowerBoundAtLevel(config.GetVoxelLevel()),
+		     ub = coord.GetUpperBoundAtLevel(config.GetVoxelLevel());
+		final_color = {};
+		if (glm::any(glm::lessThanEqual(ub, aabb_min)) || glm::any(glm::greaterThanEqual(lb, aabb_max)))
+			return hashdag::EditType::kNotAffected;
+		return hashdag::EditType::kProceed;
+	}
+	inline bool EditVoxel(const hashdag::Config<uint32_t> &, const hashdag::NodeCoord<uint32_t> &coord, bool voxel,
+	                      hashdag::VBRColor &voxel_color) const {
+		if (glm::any(glm::lessThan(coord.pos, aabb_min)) || glm::any(glm::greaterThanEqual(coord.pos, aabb_max)))
+			return voxel;
+		glm::u32vec3 p = coord.pos & 15u;
+		voxel_color = colors[(p.x < 2 || p.y < 2) + 2 * (p.z < 4)];
+		return true;
+	}
+};
+
+// A tiled box with a few paint strokes on it, in ColorOctree without and with sharing
+inline void bench_dedup(uint32_t leaf_level) {
+	constexpr uint32_t kNodeLevels = 8, kPaintEdits = 16, kWordBitsPerPage = 16;
+	std::size_t node_bytes[2], leaf_bytes[2];
+	for (bool dedup : {false, true}) {
+		BenchNodePool pool(hashdag::DefaultConfig<uint32_t>{.level_count = kNodeLevels + 1, .top_level_count = 4}());
+		ColorOctree octree({.voxel_level = pool.GetConfig().GetVoxelLevel(),
+		                    .leaf_level = leaf_level,
+		                    .word_bits_per_node_page = kWordBitsPerPage,
+		                    .word_bits_per_leaf_page = kWordBitsPerPage,
+		                    .keep_history = false,
+		                    .dedup = dedup},
+		                   1u << 10u, 1u << 10u);
+		uint32_t res = pool.GetConfig().GetResolution();
+
+		lf::busy_pool busy_pool(std::thread::hardware_concurrency());
+		hashdag::NodePointer<uint32_t> root{};
+		const auto edit = [&]<typename Editor_T>(const Editor_T &editor) {
+			hashdag::VBREditorWrapper<uint32_t, Editor_T, ColorOctree> wrapper{
+			    .editor = editor, .p_octree = &octree, .octree_root = octree.GetRoot()};
+			pool.ThreadedEdit(&busy_pool, root, wrapper, -1u, [&](hashdag::NodePointer<uint32_t> root_ptr, auto &&state) {
+				root = root_ptr;
+				octree.SetRoot(state.octree_node);
+				return root_ptr;
+			});
+			octree.FlushWrites([](auto &&...) {}, [](auto &&...) {});
+		};
+		std::mt19937 gen{9};
+		std::uniform_real_distribution<float> dis{0.0f, 1.0f};
+		const auto random_color = [&] { return hashdag::VBRColor{hashdag::RGB8Color{uint32_t(gen()) & 0xFFFFFFu}}; };
+
+		edit(TileBoxEditor{.aabb_min = glm::u32vec3{res / 8},
+		                   .aabb_max = glm::u32vec3{res - res / 8},
+		                   .colors = {random_color(), random_color(), random_color(), random_color()}});
+		for (uint32_t i = 0; i < kPaintEdits; ++i)
+			edit(PaintSphereEditor{.center = glm::vec3{dis(gen), dis(gen), dis(gen)} * float(res),
+			                       .radius = float(res) * 0.05f,
+			                       .color = random_color(),
+			                       .paint = true});
+		// Free leaf blocks are reused by later edits, they are not counted
+		node_bytes[dedup] = octree.GetNodeWordCount() * sizeof(uint32_t);
+		leaf_bytes[dedup] = (octree.GetLeafWordCount() - octree.GetFreeLeafWordCount()) * sizeof(uint32_t);
+		if (dedup) {
+			auto stats = octree.GetDedupStats();
+			printf("Dedup (leaf level %u): nodes %.1f -> %.1f KB, leaves %.1f -> %.1f KB, %.1f KB saved (%zu nodes and "
+			       "%zu leaves of %.1f KB shared)\n",
+			       leaf_level, double(node_bytes[0]) / 1024.0, double(node_bytes[1]) / 1024.0,
+			       double(leaf_bytes[0]) / 1024.0, double(leaf_bytes[1]) / 1024.0,
+			       (double(node_bytes[0] + leaf_bytes[0]) - double(node_bytes[1] + leaf_bytes[1])) / 1024.0,
+			       stats.node_count, stats.leaf_count, double(stats.leaf_word_count) * 4.0 / 1024.0);
+		}
+	}
+}
+
+// Color nodes of a painted sphere and of scattered small spheres in ColorOctree, where most children are null
+inline void bench_sparse_nodes(uint32_t leaf_level) {
+	constexpr uint32_t kNodeLevels = 8, kEdits = 256, kWordBitsPerPage = 16;
+	for (bool scattered : {false, true}) {
+		BenchNodePool pool(hashdag::DefaultConfig<uint32_t>{.level_count = kNodeLevels + 1, .top_level_count = 4}());
+		ColorOctree octree({.voxel_level = pool.GetConfig().GetVoxelLevel(),
+		                    .leaf_level = leaf_level,
+		                    .word_bits_per_node_page = kWordBitsPerPage,
+		                    .word_bits_per_leaf_page = kWordBitsPerPage,
+		                    .keep_history = false},
+		                   1u << 10u, 1u << 12u);
+		float res = float(pool.GetConfig().GetResolution());
+
+		lf::busy_pool busy_pool(std::thread::hardware_concurrency());
+		hashdag::NodePointer<uint32_t> root{};
+		std::mt19937 gen{11};
+		std::uniform_real_distribution<float> dis{0.0f, 1.0f};
+		const auto edit = [&](const PaintSphereEditor &editor) {
+			hashdag::VBREditorWrapper<uint32_t, PaintSphereEditor, ColorOctree> wrapper{
+			    .editor = editor, .p_octree = &octree, .octree_root = octree.GetRoot()};
+			pool.ThreadedEdit(&busy_pool, root, wrapper, -1u, [&](hashdag::NodePointer<uint32_t> root_ptr, auto &&state) {
+				root = root_ptr;
+				octree.SetRoot(state.octree_node);
+				return root_ptr;
+			});
+			octree.FlushWrites([](auto &&...) {}, [](auto &&...) {});
+		};
+		const auto random_color = [&] { return hashdag::VBRColor{hashdag::RGB8Color{uint32_t(gen()) & 0xFFFFFFu}}; };
+
+		if (!scattered)
+			edit({.center = glm::vec3{res * 0.5f}, .radius = res * 0.45f, .color = random_color(), .paint = false});
+		for (uint32_t i = 0; i < kEdits; ++i)
+			edit({.center = glm::vec3{dis(gen), dis(gen), dis(gen)} * res,
+			      .radius = res * (scattered ? 0.01f : 0.03f),
+			      .color = random_color(),
+			      .paint = !scattered});
+
+		// Nodes are appended one after another as [child mask | fill bit << 8 | mip << 16][fill][stored children],
+		// the dense layout is the mip and 8 child pointers
+		uint32_t node_count = 0;
+		for (uint32_t idx = 0; idx < octree.GetNodeWordCount(); ++node_count) {
+			uint32_t header = octree.ReadNodeWord(idx);
+			idx += 1u + ((header >> 8u) & 1u) + std::popcount(header & 0xFFu);
+		}
+		std::size_t dense_bytes = node_count * 9u * sizeof(uint32_t),
+		            sparse_bytes = octree.GetNodeWordCount() * sizeof(uint32_t),
+		            leaf_bytes = (octree.GetLeafWordCount() - octree.GetFreeLeafWordCount()) * sizeof(uint32_t);
+		printf("Sparse nodes (%s, leaf level %u): %u nodes, %.1f -> %.1f KB (%.1f%%), leaves %.1f KB\n",
+		       scattered ? "scattered spheres" : "painted sphere", leaf_level, node_count, double(dense_bytes) / 1024.0,
+		       double(sparse_bytes) / 1024.0, 100.0 * double(sparse_bytes) / dense_bytes, double(leaf_bytes) / 1024.0);
+	}
+}
+
+int main() {
+	{
+		// Freeing a large block raises the mmap threshold of glibc, so that writers reuse heap pages
+		std::vector<uint64_t> warm_up(std::size_t(1) << 20u, 1);
+	}
+	bench_copy<uint32_t>("uint32_t");
+	bench_copy<uint64_t>("uint64_t");
+	bench_push<uint32_t>("uint32_t");
+	bench_push<uint64_t>("uint64_t");
+	bench_encode();
+	bench_palette();
+	bench_paint_edit(5);
+	bench_paint_edit(3);
+	bench_recompress(5);
+	bench_recompress(3);
+	bench_dedup(5);
+	bench_dedup(3);
+	bench_sparse_nodes(5);
+	bench_sparse_nodes(3);
+	return 0;
+}
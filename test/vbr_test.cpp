@@ -1,7 +1,13 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
+#include <hashdag/PaletteColor.hpp>
 #include <hashdag/VBRColor.hpp>
+#include <hashdag/VBREncoder.hpp>
+#include <hashdag/VBRMip.hpp>
+
+#include <glm/gtc/epsilon.hpp>
+#include <random>
 #include <span>
 
 template <typename T> void vector_cmp(const std::vector<T> &l, const std::vector<T> &r) {
@@ -28,7 +34,7 @@ template <typename Word> void test_push_get() {
 				bitset2_w.Push(word2, bits2);
 			auto bitset2 = bitset2_w.Flush();
 
-			vector_cmp(bitset.GetBits(), bitset2.GetBits());
+			vector_cmp(bitset.GetWords(), bitset2.GetWords());
 
 			for (std::size_t i = 0; i < 100; ++i)
 				CHECK_EQ(bitset.Get(i * bits, bits), word);
@@ -49,7 +55,7 @@ template <typename Word> void test_push_get() {
 
 				auto bitset3 = bitset3_w.Flush();
 
-				vector_cmp(bitset.GetBits(), bitset3.GetBits());
+				vector_cmp(bitset.GetWords(), bitset3.GetWords());
 				for (std::size_t i = 0; i < 100; ++i)
 					CHECK_EQ(bitset3.Get(i * bits, bits), word);
 				for (std::size_t i = 0; i < 100000; ++i)
@@ -75,8 +81,8 @@ template <typename Word> void test_push_get() {
 				auto bitset5 = bitset5_w.Flush();
 				auto bitset6 = bitset6_w.Flush();
 
-				vector_cmp(bitset4.GetBits(), bitset5.GetBits());
-				vector_cmp(bitset4.GetBits(), bitset6.GetBits());
+				vector_cmp(bitset4.GetWords(), bitset5.GetWords());
+				vector_cmp(bitset4.GetWords(), bitset6.GetWords());
 
 				for (std::size_t i = 0; i < 50; ++i)
 					CHECK_EQ(bitset4.Get(i * bits, bits), word);
@@ -93,7 +99,344 @@ TEST_CASE("Test VBRBitset") {
 	test_push_get<uint32_t>();
 	test_push_get<uint64_t>();
 }
+
+template <typename Word> void test_sum() {
+	std::mt19937 gen{7};
+	hashdag::VBRBitsetWriter<Word> bitset_w;
+	for (uint32_t i = 0; i < 1000; ++i)
+		bitset_w.Push(Word(gen()), Word(sizeof(Word) * 8));
+	auto bitset = bitset_w.Flush();
+	// Unaligned ranges, within a word and across many
+	for (Word bits = 1; bits < 4; ++bits)
+		for (std::size_t index : {0, 5, 31, 64, 999})
+			for (std::size_t count : {0, 1, 7, 100, 1000}) {
+				std::size_t sum = 0;
+				for (std::size_t i = 0; i < count; ++i)
+					sum += bitset.Get(index + i * bits, bits);
+				CHECK_EQ(bitset.GetSum(index, bits, count), sum);
+			}
+}
+
+TEST_CASE("Test VBRBitset::GetSum()") {
+	test_sum<uint8_t>();
+	test_sum<uint32_t>();
+	test_sum<uint64_t>();
+}
+// Runs of RGB8 and 1 to 3 bits-per-weight colors
+inline hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer> make_test_chunk(std::mt19937 &gen,
+                                                                                 uint32_t min_voxel_count) {
+	std::uniform_int_distribution<uint32_t> run_dis{1, 3000}, color_dis{};
+	hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> writer;
+	while (writer.GetVoxelCount() < min_voxel_count) {
+		uint32_t c = color_dis(gen), bits_per_weight = c % 4u, run = run_dis(gen);
+		if (bits_per_weight == 0)
+			writer.Push(hashdag::VBRColor{hashdag::RGB8Color{c >> 8u}}, run);
+		else if (c & 4u) // Varying weights
+			for (uint32_t i = 0; i < run; ++i)
+				writer.Push(hashdag::VBRColor{hashdag::R5G6B5Color{uint16_t(c >> 16u)}, hashdag::R5G6B5Color{uint16_t(c)},
+				                              uint8_t((c + i) % (1u << bits_per_weight)), uint8_t(bits_per_weight)},
+				            1);
+		else
+			writer.Push(hashdag::VBRColor{hashdag::R5G6B5Color{uint16_t(c >> 16u)}, hashdag::R5G6B5Color{uint16_t(c)},
+			                              uint8_t(c % (1u << bits_per_weight)), uint8_t(bits_per_weight)},
+			            run);
+	}
+	return writer.Flush();
+}
+
+TEST_CASE("Test VBRChunk::GetColor()") {
+	// Spanning several macro blocks
+	std::mt19937 gen{3};
+	uint32_t voxel_count = 5 * hashdag::VBRInfo::kVoxelsPerMacroBlock + 123;
+	auto chunk = make_test_chunk(gen, voxel_count);
+
+	std::vector<hashdag::VBRColor> iterator_colors;
+	hashdag::VBRChunkIterator<uint32_t, hashdag::VBRWriterContainer> iterator{chunk};
+	for (uint32_t i = 0; i < voxel_count; ++i)
+		iterator_colors.push_back(iterator.Next([](const auto &it) { return it.GetColor(); }));
+
+	for (uint32_t i = 0; i < voxel_count; ++i)
+		CHECK(chunk.GetColor(i) == iterator_colors[i]);
+	CHECK(!chunk.GetColor(6 * hashdag::VBRInfo::kVoxelsPerMacroBlock).HasValue());
+
+	// Sorted batches with duplicates, sparse and dense
+	for (uint32_t max_gap : {1u, 7u, 5000u}) {
+		std::vector<uint32_t> indices;
+		std::uniform_int_distribution<uint32_t> gap_dis{0, max_gap};
+		for (uint32_t i = gap_dis(gen); i < voxel_count; i += gap_dis(gen))
+			indices.push_back(i);
+		indices.push_back(voxel_count + 7 * hashdag::VBRInfo::kVoxelsPerMacroBlock);
+		std::vector<hashdag::VBRColor> colors(indices.size());
+		chunk.GetColors(indices, colors);
+		for (std::size_t i = 0; i + 1 < indices.size(); ++i)
+			CHECK(colors[i] == iterator_colors[indices[i]]);
+		CHECK(!colors.back().HasValue());
+	}
+}
+
+TEST_CASE("Test VBRChunk::GetColorSum()") {
+	std::mt19937 gen{4};
+	for (uint32_t voxel_count : {123u, 3 * hashdag::VBRInfo::kVoxelsPerMacroBlock + 4567}) {
+		auto chunk = make_test_chunk(gen, voxel_count);
+		glm::dvec3 sum{0};
+		for (uint32_t i = 0; i < voxel_count; ++i)
+			sum += glm::dvec3{chunk.GetColor(i).Get()};
+		glm::dvec3 color_sum = chunk.GetColorSum(voxel_count);
+		CHECK(glm::all(glm::epsilonEqual(color_sum, sum, 1e-6 * voxel_count)));
+
+		// The sum of an edited chunk only differs in the dirty macro blocks
+		hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> writer{chunk};
+		uint32_t begin = voxel_count / 3, count = voxel_count / 5;
+		writer.Copy(begin, {});
+		writer.Push(hashdag::VBRColor{hashdag::RGBColor{0.25f, 0.5f, 1.0f}}, count);
+		writer.Copy(voxel_count - begin - count, {});
+		auto edited = writer.Flush();
+		REQUIRE_EQ(edited.GetMacroBlocks().size(), chunk.GetMacroBlocks().size());
+		glm::dvec3 edited_sum = color_sum;
+		for (uint32_t macro_id : writer.GetDirtyMacroBlocks())
+			edited_sum += edited.GetMacroBlockColorSum(macro_id, voxel_count) -
+			              chunk.GetMacroBlockColorSum(macro_id, voxel_count);
+		CHECK(glm::all(glm::epsilonEqual(edited_sum, edited.GetColorSum(voxel_count), 1e-9 * voxel_count)));
+	}
+}
+
+TEST_CASE("Test VBRMip") {
+	hashdag::VBRMip mip;
+	CHECK_EQ(mip.GetCount(), 0);
+	CHECK_EQ(mip.GetMean(), glm::dvec3{0});
+	// Null children are not added, a leaf is added as the mean of its voxels
+	mip.AddColor(hashdag::RGB8Color{0x0000FFu}.Get());
+	mip.AddColorSum(glm::dvec3{0, 32, 0}, 64);
+	mip.AddMean(glm::dvec3{0, 0, 0.25});
+	CHECK_EQ(mip.GetCount(), 3);
+	CHECK(glm::all(glm::epsilonEqual(mip.GetMean(), glm::dvec3{1.0, 0.5, 0.25} / 3.0, 1e-9)));
+
+	// The R5G6B5 mip is the nearest to the mean
+	std::mt19937 gen{0};
+	std::uniform_real_distribution<double> dis{0.0, 1.0};
+	for (uint32_t i = 0; i < 1000; ++i) {
+		hashdag::VBRMip color_mip;
+		glm::dvec3 mean{dis(gen), dis(gen), dis(gen)};
+		color_mip.AddMean(mean);
+		glm::dvec3 d = glm::abs(glm::dvec3{color_mip.GetR5G6B5().Get()} - mean) * glm::dvec3{31, 63, 31};
+		CHECK_LE(glm::max(glm::max(d.r, d.g), d.b), 0.5 + 1e-5);
+	}
+}
+
+TEST_CASE("Test VBRChunkWriter::Append()") {
+	std::mt19937 gen{4};
+	constexpr uint32_t kVoxelCount = 4 * hashdag::VBRInfo::kVoxelsPerMacroBlock;
+	auto src = make_test_chunk(gen, kVoxelCount);
+
+	// Copies, pushes and per-voxel edits of each 64 voxels, the same for every writer
+	const auto write_range = [](auto &writer, uint32_t begin, uint32_t count) {
+		for (uint32_t part = begin; part < begin + count; part += 64u) {
+			uint32_t op = (part * 2654435761u) >> 29u;
+			hashdag::VBRColor color{hashdag::RGB8Color{part * 0x9E3779u & 0xFFFFFFu}};
+			if (op < 3)
+				writer.Copy(64u, color);
+			else if (op < 5)
+				writer.Push(color, 64u);
+			else
+				for (uint32_t i = 0; i < 64u; ++i)
+					writer.Edit([&](hashdag::VBRColor &c) { return c = i % 3u ? c : color; }, color);
+		}
+	};
+
+	hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> serial_writer{src};
+	write_range(serial_writer, 0, kVoxelCount);
+	auto serial_chunk = serial_writer.Flush();
+
+	// Segments within and across macro blocks, written out of order
+	for (uint32_t segment_size : {512u, 4096u, 32768u}) {
+		std::vector<hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer>> segments(kVoxelCount / segment_size);
+		for (uint32_t s = segments.size(); s--;) {
+			segments[s].Reset(src, s * segment_size);
+			write_range(segments[s], s * segment_size, segment_size);
+		}
+		hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> writer{src};
+		for (const auto &segment : segments)
+			writer.Append(segment);
+		CHECK_EQ(writer.GetVoxelCount(), kVoxelCount);
+		auto chunk = writer.Flush();
+		vector_cmp(chunk.GetMacroBlocks(), serial_chunk.GetMacroBlocks());
+		vector_cmp(chunk.GetBlockHeaders(), serial_chunk.GetBlockHeaders());
+		vector_cmp(chunk.GetWeightBits().GetWords(), serial_chunk.GetWeightBits().GetWords());
+	}
+}
+
+TEST_CASE("Test VBREncoder") {
+	// Smooth gradients with noise and flat runs, RGB8 representable so that a zero error budget is lossless
+	const auto make_colors = [](uint32_t seed, uint32_t count) {
+		std::mt19937 gen{seed};
+		std::uniform_int_distribution<uint32_t> noise_dis{0, 4}, run_dis{1, 2000};
+		std::vector<hashdag::RGBColor> colors;
+		while (colors.size() < count) {
+			uint32_t run = run_dis(gen);
+			glm::vec3 c0 = glm::vec3{gen() & 0xFFu, gen() & 0xFFu, gen() & 0xFFu},
+			          c1 = glm::vec3{gen() & 0xFFu, gen() & 0xFFu, gen() & 0xFFu};
+			bool flat = gen() & 1u;
+			for (uint32_t i = 0; i < run && colors.size() < count; ++i) {
+				glm::vec3 c = flat ? c0 : glm::mix(c0, c1, float(i) / float(run)) + float(noise_dis(gen));
+				colors.push_back(glm::round(glm::clamp(c, 0.0f, 255.0f)) / 255.0f);
+			}
+		}
+		return colors;
+	};
+	const auto max_channel_error = [](const auto &chunk, std::span<const hashdag::RGBColor> colors) {
+		float error = 0;
+		for (uint32_t i = 0; i < colors.size(); ++i) {
+			glm::vec3 d = glm::abs(chunk.GetColor(i).Get() - colors[i]);
+			error = glm::max(error, glm::max(glm::max(d.r, d.g), d.b));
+		}
+		return error;
+	};
+
+	auto colors = make_colors(1, 3 * hashdag::VBRInfo::kVoxelsPerMacroBlock + 77);
+	std::size_t prev_bits = -1;
+	for (float max_error : {0.0f, 2.0f / 255.0f, 8.0f / 255.0f, 32.0f / 255.0f}) {
+		hashdag::VBREncoder<uint32_t> encoder{max_error};
+		auto chunk = encoder.Encode(colors);
+		CHECK(max_channel_error(chunk, colors) <= max_error + 1e-6f);
+		std::size_t bits = hashdag::GetVBRChunkBits(chunk);
+		CHECK(bits < prev_bits);
+		prev_bits = bits;
+	}
+
+	// Threaded encoding of leaves matches the serial one
+	lf::busy_pool busy_pool(4);
+	std::vector<std::vector<hashdag::RGBColor>> leaves;
+	std::vector<std::span<const hashdag::RGBColor>> leaf_spans;
+	for (uint32_t i = 0; i < 13; ++i)
+		leaves.push_back(make_colors(i + 2, 1000u * i + 1u));
+	for (const auto &leaf : leaves)
+		leaf_spans.emplace_back(leaf);
+	hashdag::VBREncoder<uint32_t> encoder{4.0f / 255.0f};
+	std::vector<hashdag::VBRChunk<uint32_t, hashdag::VBRWriterContainer>> chunks(leaves.size());
+	encoder.ThreadedEncode(&busy_pool, leaf_spans, chunks);
+	for (uint32_t i = 0; i < leaves.size(); ++i) {
+		auto chunk = encoder.Encode(leaves[i]);
+		vector_cmp(chunk.GetMacroBlocks(), chunks[i].GetMacroBlocks());
+		vector_cmp(chunk.GetBlockHeaders(), chunks[i].GetBlockHeaders());
+		vector_cmp(chunk.GetWeightBits().GetWords(), chunks[i].GetWeightBits().GetWords());
+		CHECK(max_channel_error(chunks[i], leaves[i]) <= 4.0f / 255.0f + 1e-6f);
+	}
+}
+
+TEST_CASE("Test VBREncoder::Recompress()") {
+	constexpr uint32_t kVoxelsPerMacroBlock = hashdag::VBRInfo::kVoxelsPerMacroBlock,
+	                   kVoxelCount = 2 * kVoxelsPerMacroBlock + 500;
+	std::mt19937 gen{5};
+	std::uniform_int_distribution<uint32_t> run_dis{1, 40}, jitter_dis{0, 2};
+	// Short runs of near-equal colors like repeated paint strokes leave, except random colors in the second macro block
+	hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> src_writer;
+	glm::u32vec3 base{};
+	while (src_writer.GetVoxelCount() < kVoxelCount) {
+		uint32_t voxel_index = src_writer.GetVoxelCount();
+		if (voxel_index % 3000 < 40)
+			base = glm::u32vec3{gen() % 250, gen() % 250, gen() % 250};
+		glm::u32vec3 c = voxel_index >> 14u == 1 ? glm::u32vec3{gen() & 0xFFu, gen() & 0xFFu, gen() & 0xFFu}
+		                                         : base + glm::u32vec3{jitter_dis(gen), jitter_dis(gen), jitter_dis(gen)};
+		uint32_t macro_end = ((voxel_index >> 14u) + 1u) << 14u;
+		src_writer.Push(hashdag::RGB8Color{c.r | (c.g << 8u) | (c.b << 16u)},
+		                std::min({run_dis(gen), kVoxelCount - voxel_index, macro_end - voxel_index}));
+	}
+	auto chunk = src_writer.Flush();
+
+	hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> writer, segment;
+	// Nothing merges without an error budget, the chunk is copied
+	CHECK_EQ(hashdag::VBREncoder<uint32_t>{0.0f}.Recompress(chunk, kVoxelCount, writer, segment), 0);
+	CHECK(writer.GetDirtyMacroBlocks().empty());
+	auto copied = writer.Flush();
+	vector_cmp(copied.GetMacroBlocks(), chunk.GetMacroBlocks());
+	vector_cmp(copied.GetBlockHeaders(), chunk.GetBlockHeaders());
+
+	constexpr float kMaxError = 2.0f / 255.0f;
+	CHECK_EQ(hashdag::VBREncoder<uint32_t>{kMaxError}.Recompress(chunk, kVoxelCount, writer, segment), 2);
+	CHECK_EQ(writer.GetDirtyMacroBlocks().size(), 2);
+	CHECK_EQ(writer.GetDirtyMacroBlocks()[0], 0);
+	CHECK_EQ(writer.GetDirtyMacroBlocks()[1], 2);
+	auto recompressed = writer.Flush();
+	// The second macro block is kept, the others shrink to a few blocks
+	const auto get_block_count = [](const auto &chunk, uint32_t macro_id) {
+		return chunk.GetMacroBlocks()[macro_id + 1].first_block - chunk.GetMacroBlocks()[macro_id].first_block;
+	};
+	CHECK_EQ(get_block_count(recompressed, 1), get_block_count(chunk, 1));
+	CHECK_LT(get_block_count(recompressed, 0) * 8, get_block_count(chunk, 0));
+	CHECK_LT(hashdag::GetVBRChunkBits(recompressed), hashdag::GetVBRChunkBits(chunk));
+	for (uint32_t i = 0; i < kVoxelCount; ++i) {
+		glm::vec3 d = glm::abs(recompressed.GetColor(i).Get() - chunk.GetColor(i).Get());
+		CHECK(glm::max(glm::max(d.r, d.g), d.b) <= kMaxError + 1e-6f);
+		if (i >> 14u == 1)
+			CHECK(recompressed.GetColor(i) == chunk.GetColor(i));
+	}
+
+	// Split after every macro block that is re-encoded, the steps end up with the same chunk
+	// The second macro block has no mergeable blocks, it is copied in the step of the third
+	auto step_chunk = chunk;
+	std::vector<uint32_t> step_counts, next_macro_ids;
+	for (uint32_t macro_id = 0; macro_id < step_chunk.GetMacroBlocks().size();) {
+		step_counts.push_back(hashdag::VBREncoder<uint32_t>{kMaxError}.Recompress(
+		    step_chunk, kVoxelCount, writer, segment, macro_id, &macro_id, [] { return true; }));
+		next_macro_ids.push_back(macro_id);
+		CHECK_LE(writer.GetDirtyMacroBlocks().size(), 1);
+		step_chunk = writer.Flush();
+	}
+	CHECK_EQ(step_counts, std::vector<uint32_t>{1, 1});
+	CHECK_EQ(next_macro_ids, std::vector<uint32_t>{1, 3});
+	vector_cmp(step_chunk.GetMacroBlocks(), recompressed.GetMacroBlocks());
+	vector_cmp(step_chunk.GetBlockHeaders(), recompressed.GetBlockHeaders());
+	vector_cmp(step_chunk.GetWeightBits().GetWords(), recompressed.GetWeightBits().GetWords());
+}
+
 template <typename T> using const_span = std::span<const T>;
+TEST_CASE("Test PaletteChunk") {
+	constexpr uint32_t kVoxelsPerMacroBlock = hashdag::VBRInfo::kVoxelsPerMacroBlock;
+	std::mt19937 gen{7};
+	// Short runs of a few RGB8 colors, in a leaf smaller than a macro block and one spanning several
+	for (uint32_t color_count : {1u, 2u, 3u, 5u, 16u})
+		for (uint32_t voxel_count : {512u, 3 * kVoxelsPerMacroBlock + 77}) {
+			std::vector<uint32_t> palette(color_count);
+			for (auto &color : palette)
+				color = uint32_t(gen()) & 0xFFFFFFu;
+			std::uniform_int_distribution<uint32_t> run_dis{1, 8}, index_dis{0, color_count - 1};
+			hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> writer;
+			while (writer.GetVoxelCount() < voxel_count)
+				writer.Push(hashdag::RGB8Color{palette[index_dis(gen)]},
+				            std::min(run_dis(gen), voxel_count - writer.GetVoxelCount()));
+			auto chunk = writer.Flush();
+
+			auto opt_palette_chunk = hashdag::EncodePaletteChunk(chunk);
+			REQUIRE(opt_palette_chunk);
+			CHECK_LE(opt_palette_chunk->GetColors().size(), color_count);
+			CHECK_EQ(opt_palette_chunk->GetMacroBlockCount(), chunk.GetMacroBlocks().size());
+			uint32_t macro_voxel_count = chunk.GetMacroBlocks().size() * kVoxelsPerMacroBlock;
+			for (uint32_t i = 0; i < macro_voxel_count; ++i)
+				CHECK(opt_palette_chunk->GetColor(i) == chunk.GetColor(i));
+			CHECK(!opt_palette_chunk->GetColor(macro_voxel_count).HasValue());
+
+			// Decoded back to VBR for editing
+			auto vbr_chunk = opt_palette_chunk->ToVBR();
+			for (uint32_t i = 0; i < macro_voxel_count; ++i)
+				CHECK(vbr_chunk.GetColor(i) == chunk.GetColor(i));
+		}
+
+	// Not encoded: weighted blocks, more than 16 colors, or not fewer bits than VBR
+	CHECK_FALSE(hashdag::EncodePaletteChunk(make_test_chunk(gen, 3 * kVoxelsPerMacroBlock)));
+	{
+		hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> writer;
+		for (uint32_t i = 0; i <= hashdag::PaletteInfo::kMaxColorCount; ++i)
+			writer.Push(hashdag::RGB8Color{i}, 1);
+		CHECK_FALSE(hashdag::EncodePaletteChunk(writer.Flush()));
+	}
+	{
+		hashdag::VBRChunkWriter<uint32_t, hashdag::VBRWriterContainer> writer;
+		for (uint32_t i = 0; i < 12; ++i)
+			writer.Push(hashdag::RGB8Color{i & 1u}, 4096);
+		CHECK_FALSE(hashdag::EncodePaletteChunk(writer.Flush()));
+	}
+}
+
 TEST_CASE("Test VBRChunk") {
 	/*constexpr uint32_t kR2 = 10007, kR3 = 21753;
 	hashdag::VBRChunk<uint32_t, std::vector> blk;
@@ -131,7 +474,7 @@ TEST_CASE("Test VBRChunk") {
 		auto blk2 = writer.Flush();
 		vector_cmp(blk2.m_block_headers, blk.m_block_headers);
 		vector_cmp(blk2.m_macro_blocks, blk.m_macro_blocks);
-		vector_cmp(blk2.m_weight_bits.GetBits(), blk.m_weight_bits.GetBits());
+		vector_cmp(blk2.m_weight_bits.GetWords(), blk.m_weight_bits.GetWords());
 	}
 
 	// Check Complex Copy
@@ -143,6 +486,6 @@ TEST_CASE("Test VBRChunk") {
 		auto blk3 = writer.Flush();
 		vector_cmp(blk3.m_block_headers, blk.m_block_headers);
 		vector_cmp(blk3.m_macro_blocks, blk.m_macro_blocks);
-		vector_cmp(blk3.m_weight_bits.GetBits(), blk.m_weight_bits.GetBits());
+		vector_cmp(blk3.m_weight_bits.GetWords(), blk.m_weight_bits.GetWords());
 	} */
 }